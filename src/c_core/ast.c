@@ -0,0 +1,293 @@
+// ast.c
+#include "ast.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define GROW(array, count, capacity, initial)                                       \
+    do {                                                                            \
+        if ((count) == (capacity)) {                                                \
+            (capacity) = (capacity) ? (capacity) * 2 : (initial);                   \
+            (array) = realloc((array), sizeof(*(array)) * (capacity));              \
+        }                                                                           \
+    } while (0)
+
+void initAST(AST* ast) {
+    memset(ast, 0, sizeof(*ast));
+    // Slot 0 of every array is the "none" entry.
+    GROW(ast->nodes, ast->nodeCount, ast->nodeCapacity, 256);
+    memset(&ast->nodes[0], 0, sizeof(ASTNode));
+    ast->nodeCount = 1;
+    GROW(ast->tokens, ast->tokenCount, ast->tokenCapacity, 256);
+    memset(&ast->tokens[0], 0, sizeof(Token));
+    ast->tokens[0].type = TOKEN_EOF;
+    ast->tokenCount = 1;
+    GROW(ast->lists, ast->listCount, ast->listCapacity, 256);
+    ast->lists[0] = 0;
+    ast->listCount = 1;
+}
+
+void freeAST(AST* ast) {
+    free(ast->nodes);
+    free(ast->tokens);
+    free(ast->lists);
+    free(ast->scratch);
+    memset(ast, 0, sizeof(*ast));
+}
+
+ASTMark markAST(const AST* ast) {
+    ASTMark mark = { ast->nodeCount, ast->tokenCount, ast->listCount };
+    return mark;
+}
+
+void releaseAST(AST* ast, ASTMark mark) {
+    ast->nodeCount  = mark.nodes;
+    ast->tokenCount = mark.tokens;
+    ast->listCount  = mark.lists;
+    ast->scratchCount = 0;
+}
+
+NodeIndex newNode(AST* ast, ASTNodeType nodeType, const Token* token) {
+    GROW(ast->tokens, ast->tokenCount, ast->tokenCapacity, 256);
+    ast->tokens[ast->tokenCount] = *token;
+
+    GROW(ast->nodes, ast->nodeCount, ast->nodeCapacity, 256);
+    ASTNode* node = &ast->nodes[ast->nodeCount];
+    node->nodeType = (uint8_t)nodeType;
+    node->token    = ast->tokenCount++;
+    node->left     = AST_NONE;
+    node->right    = AST_NONE;
+    node->body     = AST_NONE;
+    node->slot     = -1;
+    return ast->nodeCount++;
+}
+
+void pushStatement(AST* ast, NodeIndex stmt) {
+    GROW(ast->scratch, ast->scratchCount, ast->scratchCapacity, 64);
+    ast->scratch[ast->scratchCount++] = stmt;
+}
+
+/*
+    Nested blocks are parsed while their parent is still open, so statements
+    collect on the scratch stack and each block is copied out contiguously
+    once its closing brace is seen.
+*/
+BlockIndex closeBlock(AST* ast, uint32_t scratchMark) {
+    uint32_t count = ast->scratchCount - scratchMark;
+    if (count == 0) return AST_NONE;
+
+    while (ast->listCount + count + 1 > ast->listCapacity) {
+        ast->listCapacity *= 2;
+        ast->lists = realloc(ast->lists, sizeof(NodeIndex) * ast->listCapacity);
+    }
+    BlockIndex b = ast->listCount;
+    ast->lists[b] = count;
+    memcpy(&ast->lists[b + 1], &ast->scratch[scratchMark], sizeof(NodeIndex) * count);
+    ast->listCount += count + 1;
+    ast->scratchCount = scratchMark;
+    return b;
+}
+
+static void reserve(void** array, uint32_t* capacity, uint32_t needed, size_t size) {
+    if (needed <= *capacity) return;
+    while (*capacity < needed) *capacity = *capacity ? *capacity * 2 : 256;
+    *array = realloc(*array, size * *capacity);
+}
+
+NodeIndex appendAST(AST* ast, const AST* from, NodeIndex root) {
+    // Entry 0 of 'from' is "none" and is not copied, so index i lands at base + i.
+    uint32_t nodeBase  = ast->nodeCount - 1;
+    uint32_t tokenBase = ast->tokenCount - 1;
+    uint32_t listBase  = ast->listCount - 1;
+    reserve((void**)&ast->nodes, &ast->nodeCapacity, ast->nodeCount + from->nodeCount, sizeof(ASTNode));
+    reserve((void**)&ast->tokens, &ast->tokenCapacity, ast->tokenCount + from->tokenCount, sizeof(Token));
+    reserve((void**)&ast->lists, &ast->listCapacity, ast->listCount + from->listCount, sizeof(NodeIndex));
+
+    memcpy(&ast->tokens[ast->tokenCount], &from->tokens[1], sizeof(Token) * (from->tokenCount - 1));
+    ast->tokenCount += from->tokenCount - 1;
+
+    for (uint32_t i = 1; i < from->nodeCount; i++) {
+        ASTNode node = from->nodes[i];
+        node.token += tokenBase;
+        if (node.left) node.left += nodeBase;
+        if (node.right) node.right += rightIsBlock(&node) ? listBase : nodeBase;
+        if (node.body) node.body += listBase;
+        ast->nodes[ast->nodeCount++] = node;
+    }
+
+    // Blocks are laid out back to back: a count, then that many statements.
+    for (uint32_t b = 1; b < from->listCount; ) {
+        uint32_t count = from->lists[b];
+        ast->lists[ast->listCount++] = count;
+        for (uint32_t i = 1; i <= count; i++) {
+            ast->lists[ast->listCount++] = from->lists[b + i] + nodeBase;
+        }
+        b += count + 1;
+    }
+    return root + nodeBase;
+}
+
+/* -------------------------------------------------------------- walks ---- */
+
+void walkInit(ASTWalk* walk) {
+    walk->frames   = walk->inlineFrames;
+    walk->depth    = 0;
+    walk->capacity = AST_WALK_INLINE;
+}
+
+void walkFree(ASTWalk* walk) {
+    if (walk->frames != walk->inlineFrames) free(walk->frames);
+    walkInit(walk);
+}
+
+void walkGrow(ASTWalk* walk) {
+    uint32_t capacity = walk->capacity * 2;
+    if (walk->frames == walk->inlineFrames) {
+        walk->frames = malloc(sizeof(WalkFrame) * capacity);
+        memcpy(walk->frames, walk->inlineFrames, sizeof(walk->inlineFrames));
+    } else {
+        walk->frames = realloc(walk->frames, sizeof(WalkFrame) * capacity);
+    }
+    walk->capacity = capacity;
+}
+
+void walkStart(ASTWalk* walk, NodeIndex root) {
+    walk->depth = 0;
+    if (root) walkPush(walk, root);
+}
+
+// Child k of 'node' in walk order; AST_NONE for a missing one, and *done past the last.
+static NodeIndex childAt(const AST* ast, const ASTNode* node, uint32_t k, int* done) {
+    if (k == 0) return node->left;
+    k--;
+    BlockIndex blocks[2] = { node->body, AST_NONE };
+    if (!rightIsBlock(node)) {
+        if (k == 0) return node->right;
+        k--;
+    } else if (node->nodeType == AST_FUNC_DEF) {
+        blocks[0] = node->right;
+        blocks[1] = node->body;
+    } else {
+        blocks[1] = node->right;
+    }
+    for (int i = 0; i < 2; i++) {
+        uint32_t count = blockCount(ast, blocks[i]);
+        if (k < count) return blockNodes(ast, blocks[i])[k];
+        k -= count;
+    }
+    *done = 1;
+    return AST_NONE;
+}
+
+NodeIndex walkNext(ASTWalk* walk, const AST* ast, int* leaving) {
+    while (walk->depth) {
+        WalkFrame* top = walkTop(walk);
+        if (top->step == 0) {
+            top->step = 1;
+            *leaving = 0;
+            return top->node;
+        }
+        if (top->step != WALK_SKIP) {
+            int done = 0;
+            NodeIndex child = childAt(ast, astNode(ast, top->node), top->step - 1, &done);
+            if (!done) {
+                top->step++;
+                if (child) walkPush(walk, child);
+                continue;
+            }
+        }
+        NodeIndex node = top->node;
+        walkPop(walk);
+        *leaving = 1;
+        return node;
+    }
+    return AST_NONE;
+}
+
+/*
+    Nodes are copied on the way up, children first.  The copies wait on the
+    scratch stack in walk order, so a node's blocks are the last entries
+    there when it is left: they are laid out from the end, then the right
+    and left operands are popped.
+*/
+NodeIndex copyTree(AST* ast, const AST* from, NodeIndex root) {
+    if (!root) return AST_NONE;
+    ASTWalk walk;
+    walkInit(&walk);
+    walkStart(&walk, root);
+    int leaving;
+    NodeIndex index;
+    while ((index = walkNext(&walk, from, &leaving))) {
+        if (!leaving) continue;
+        ASTNode node = from->nodes[index];
+        BlockIndex first = node.body, second = AST_NONE;
+        if (node.nodeType == AST_FUNC_DEF) {
+            first  = node.right;
+            second = node.body;
+        } else if (rightIsBlock(&node)) {
+            second = node.right;
+        }
+        BlockIndex secondCopy = closeBlock(ast, ast->scratchCount - blockCount(from, second));
+        BlockIndex firstCopy  = closeBlock(ast, ast->scratchCount - blockCount(from, first));
+        if (node.nodeType == AST_FUNC_DEF) {
+            node.right = firstCopy;
+            node.body  = secondCopy;
+        } else if (rightIsBlock(&node)) {
+            node.body  = firstCopy;
+            node.right = secondCopy;
+        } else {
+            node.body  = firstCopy;
+            node.right = node.right ? ast->scratch[--ast->scratchCount] : AST_NONE;
+        }
+        node.left = node.left ? ast->scratch[--ast->scratchCount] : AST_NONE;
+
+        NodeIndex copy = newNode(ast, (ASTNodeType)node.nodeType, &from->tokens[node.token]);
+        node.token = ast->nodes[copy].token;
+        ast->nodes[copy] = node;
+        pushStatement(ast, copy);
+    }
+    walkFree(&walk);
+    return ast->scratch[--ast->scratchCount];
+}
+
+int containsCall(const AST* ast, NodeIndex index) {
+    ASTWalk walk;
+    walkInit(&walk);
+    walkStart(&walk, index);
+    int leaving, found = 0;
+    NodeIndex i;
+    while (!found && (i = walkNext(&walk, ast, &leaving))) {
+        found = hasEffects(astNode(ast, i));
+    }
+    walkFree(&walk);
+    return found;
+}
+
+int findReductions(const AST* ast, NodeIndex loop, Reduction** out) {
+    Reduction* list = NULL;
+    int count = 0, capacity = 0;
+    ASTWalk walk;
+    walkInit(&walk);
+    walkStart(&walk, loop);
+    int leaving;
+    NodeIndex i;
+    while ((i = walkNext(&walk, ast, &leaving))) {
+        const ASTNode* node = astNode(ast, i);
+        if (leaving) continue;
+        if (node->nodeType == AST_FUNC_DEF) {
+            walkSkip(&walk);
+            continue;
+        }
+        if (node->nodeType != AST_REDUCE) continue;
+        int32_t slot = astNode(ast, astNode(ast, node->left)->left)->slot;
+        int seen = 0;
+        for (int r = 0; r < count && !seen; r++) seen = list[r].slot == slot;
+        if (seen) continue;
+        GROW(list, count, capacity, 4);
+        list[count].slot = slot;
+        list[count].op   = nodeToken(ast, node)->id;
+        count++;
+    }
+    walkFree(&walk);
+    *out = list;
+    return count;
+}
@@ -0,0 +1,195 @@
+#ifndef AST_H
+#define AST_H
+
+#include "token.h"
+#include <stdint.h>
+
+typedef enum {
+    AST_UNKNOWN,
+    AST_VAR_ASSIGN,
+    AST_FUNC_DEF,
+    AST_RETURN,
+    AST_WHILE_LOOP,
+    AST_IF_STATEMENT,
+    AST_EXPRESSION,
+    AST_PRINT,
+    AST_INPUT,
+    AST_LOOP,     // <-- added
+    AST_BREAK,     // <-- added
+    AST_CALL,      // name(args) — kept apart from plain identifiers for the resolver
+    AST_SPAWN,     // spawn call: left = the call, run as a task of its own (task.h)
+    AST_SEND,      // send channel, value: left = the channel, right = the value
+    AST_RECV,      // recv channel: left = the channel
+    AST_CHAN,      // chan(capacity): left = the capacity, none for 0
+    AST_FOR_LOOP,  // for i = a .. b step s: left = the AST_VAR_ASSIGN i = a, right = the
+                   // AST_RANGE, body = the loop body; slot = its counter, end and step (resolver.c)
+    AST_RANGE,     // '..' of a for: left = the end, right = the step, none for 1
+    AST_PARALLEL_FOR, // parallel [unordered] for: laid out as AST_FOR_LOOP; its token is
+                      // 'unordered' when prints need not keep their order
+    AST_REDUCE,    // reduce x op= e: left = the AST_VAR_ASSIGN x = x op e; token = op
+} ASTNodeType;
+
+/*
+    The AST lives in one arena per parse.  Nodes, the tokens they refer to
+    and block statement lists are kept in three growable arrays and linked
+    by 32-bit indices, so the whole tree is freed at once and is position
+    independent.  Index 0 means "none" in every array.
+*/
+typedef uint32_t NodeIndex;
+typedef uint32_t BlockIndex;   // lists[b] = count, lists[b+1 .. b+count] = statements
+
+#define AST_NONE 0
+
+typedef struct {
+    uint8_t   nodeType;  // ASTNodeType
+    uint32_t  token;     // index into AST.tokens of the “main” token (operator, keyword, etc.)
+    NodeIndex left;      // operand, condition or printed expression
+    NodeIndex right;     // operand or assigned value; a BlockIndex for nodes with rightIsBlock()
+    BlockIndex body;     // statements of a func, then-branch or loop; arguments of a call
+    int32_t   slot;      // frame slot for identifiers, frame size for AST_FUNC_DEF,
+                         // function index for AST_CALL (see resolver.c)
+} ASTNode;
+
+typedef struct {
+    ASTNode*   nodes;
+    uint32_t   nodeCount, nodeCapacity;
+    Token*     tokens;
+    uint32_t   tokenCount, tokenCapacity;
+    NodeIndex* lists;
+    uint32_t   listCount, listCapacity;
+    NodeIndex* scratch;   // statements of the blocks being parsed, before they are laid out
+    uint32_t   scratchCount, scratchCapacity;
+} AST;
+
+// Arena sizes at some point in time; releasing to a mark frees everything added since.
+typedef struct {
+    uint32_t nodes, tokens, lists;
+} ASTMark;
+
+void      initAST(AST* ast);
+void      freeAST(AST* ast);
+ASTMark   markAST(const AST* ast);
+void      releaseAST(AST* ast, ASTMark mark);
+
+NodeIndex  newNode(AST* ast, ASTNodeType nodeType, const Token* token);
+void       pushStatement(AST* ast, NodeIndex stmt);
+BlockIndex closeBlock(AST* ast, uint32_t scratchMark);   // lays out scratch[scratchMark..] as a block
+
+// Copy everything in 'from' to the end of 'ast', relocating its indices;
+// returns the index 'root' (a node of 'from') has in 'ast'.
+NodeIndex  appendAST(AST* ast, const AST* from, NodeIndex root);
+// Copy only the tree under 'root' (a node of 'from'); returns its new index.
+NodeIndex  copyTree(AST* ast, const AST* from, NodeIndex root);
+
+static inline ASTNode* astNode(const AST* ast, NodeIndex i) {
+    return i ? &ast->nodes[i] : NULL;
+}
+
+static inline const Token* nodeToken(const AST* ast, const ASTNode* node) {
+    return &ast->tokens[node->token];
+}
+
+// Source line of a node: the line of its main token.
+static inline uint32_t nodeLine(const AST* ast, const ASTNode* node) {
+    return ast->tokens[node->token].line;
+}
+
+// 'right' is a block: the else-branch of an if, the parameters of a func.
+static inline int rightIsBlock(const ASTNode* node) {
+    return node->nodeType == AST_IF_STATEMENT || node->nodeType == AST_FUNC_DEF;
+}
+
+// A call, recv or chan(): worth a value only once it has run, and it does something.
+static inline int hasEffects(const ASTNode* node) {
+    return node->nodeType == AST_CALL || node->nodeType == AST_RECV || node->nodeType == AST_CHAN;
+}
+
+// The expression contains a call (or recv, chan()), so it has side effects and must be evaluated.
+int containsCall(const AST* ast, NodeIndex index);
+
+static inline int isForLoop(const ASTNode* node) {
+    return node->nodeType == AST_FOR_LOOP || node->nodeType == AST_PARALLEL_FOR;
+}
+
+// A variable a parallel for reduces, and how: STR_PLUS, STR_MINUS or STR_STAR.
+typedef struct {
+    int32_t  slot;
+    uint32_t op;
+} Reduction;
+
+/*
+    The variables reduced anywhere in a parallel for's body, nested loops
+    included but not funcs, in order of first use; a variable reduced with
+    two operators keeps the first.  *out is malloc'd (NULL when there are
+    none); returns the count.
+*/
+int findReductions(const AST* ast, NodeIndex loop, Reduction** out);
+
+/*
+    Every pass over a tree keeps the nodes it is in the middle of on an
+    ASTWalk instead of the C stack: a + b + c + ... is as deep as it is
+    long, so neither deep nesting nor long expressions may recurse.  The
+    first AST_WALK_INLINE frames live in the walk itself and only deeper
+    trees move them to the heap, so a walk normally does not allocate.
+    A pushed frame may move when the stack grows: re-read walkTop() after
+    every walkPush().
+*/
+#define AST_WALK_INLINE 48
+#define WALK_SKIP       UINT32_MAX
+
+typedef struct {
+    NodeIndex node;
+    uint32_t  step;         // how far the walker got with the node, 0 = not started
+    int32_t   data[3];      // the walker's own state for it
+} WalkFrame;
+
+typedef struct {
+    WalkFrame* frames;
+    uint32_t   depth, capacity;
+    WalkFrame  inlineFrames[AST_WALK_INLINE];
+} ASTWalk;
+
+void walkInit(ASTWalk* walk);
+void walkFree(ASTWalk* walk);
+void walkGrow(ASTWalk* walk);
+
+static inline WalkFrame* walkPush(ASTWalk* walk, NodeIndex node) {
+    if (walk->depth == walk->capacity) walkGrow(walk);
+    WalkFrame* frame = &walk->frames[walk->depth++];
+    frame->node = node;
+    frame->step = 0;
+    return frame;
+}
+
+static inline WalkFrame* walkTop(ASTWalk* walk) {
+    return &walk->frames[walk->depth - 1];
+}
+
+static inline void walkPop(ASTWalk* walk) {
+    walk->depth--;
+}
+
+/*
+    The generic walk, for passes that treat most nodes alike: every node
+    under 'root' comes out of walkNext() once on the way down (*leaving = 0)
+    and once more after all of its children (*leaving = 1).  Children come
+    as left, right, then the statements of body, except that a func's
+    parameters come before its body and an if's else-branch after its
+    then-branch.  walkSkip() right after a node came down skips its children.
+*/
+void      walkStart(ASTWalk* walk, NodeIndex root);
+NodeIndex walkNext(ASTWalk* walk, const AST* ast, int* leaving);
+
+static inline void walkSkip(ASTWalk* walk) {
+    walkTop(walk)->step = WALK_SKIP;
+}
+
+static inline uint32_t blockCount(const AST* ast, BlockIndex b) {
+    return b ? ast->lists[b] : 0;
+}
+
+static inline const NodeIndex* blockNodes(const AST* ast, BlockIndex b) {
+    return &ast->lists[b + 1];
+}
+
+#endif // AST_H
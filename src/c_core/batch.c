@@ -0,0 +1,113 @@
+// batch.c
+#include "batch.h"
+#include "interpreter.h"
+#include "io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct {
+    const char* script;
+    char*       out;            // captured stdout and stderr, once 'done'
+    size_t      outSize;
+    char*       err;
+    size_t      errSize;
+    int         status;
+    int         done;
+} BatchJob;
+
+typedef struct {
+    BatchJob*       jobs;
+    int             count;
+    int             next;       // next job for a thread
+    BatchRun        run;
+    void*           arg;
+    pthread_mutex_t lock;
+    pthread_cond_t  finished;   // a job is done
+} Batch;
+
+static void runJob(Batch* batch, BatchJob* job) {
+    FILE* out = open_memstream(&job->out, &job->outSize);
+    FILE* err = open_memstream(&job->err, &job->errSize);
+    if (!out || !err) {
+        if (out) fclose(out);
+        if (err) fclose(err);
+        job->status = 1;
+        return;
+    }
+    Interpreter* interpreter = interpreterNew();
+    interpreterEnter(interpreter);
+    ioRedirect(out, err, -1);
+    job->status = batch->run(job->script, batch->arg);
+    ioFlush();
+    interpreterFree(interpreter);
+    fclose(out);
+    fclose(err);
+}
+
+static void* batchWorker(void* arg) {
+    Batch* batch = (Batch*)arg;
+    pthread_mutex_lock(&batch->lock);
+    while (batch->next < batch->count) {
+        BatchJob* job = &batch->jobs[batch->next++];
+        pthread_mutex_unlock(&batch->lock);
+
+        runJob(batch, job);
+
+        pthread_mutex_lock(&batch->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&batch->finished);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+int runBatch(const char** scripts, int count, int threads, BatchRun run, void* arg) {
+    Batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.jobs  = (BatchJob*)calloc(count > 0 ? count : 1, sizeof(BatchJob));
+    batch.count = count;
+    batch.run   = run;
+    batch.arg   = arg;
+    for (int i = 0; i < count; i++) batch.jobs[i].script = scripts[i];
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.finished, NULL);
+
+    if (threads > count) threads = count;
+    pthread_t* pool = (pthread_t*)malloc(sizeof(pthread_t) * (threads > 0 ? threads : 1));
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool[started], NULL, batchWorker, &batch) != 0) break;
+        started++;
+    }
+    // Without a single thread the scripts run here, one after another.
+    if (started == 0) batchWorker(&batch);
+
+    // Output goes out in script order, each script's as soon as it and those before it are done.
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        BatchJob* job = &batch.jobs[i];
+        pthread_mutex_lock(&batch.lock);
+        while (!job->done) pthread_cond_wait(&batch.finished, &batch.lock);
+        pthread_mutex_unlock(&batch.lock);
+
+        fwrite(job->out, 1, job->outSize, stdout);
+        fflush(stdout);
+        fwrite(job->err, 1, job->errSize, stderr);
+        if (job->status != 0) {
+            fprintf(stderr, "[JOBS] %s: exit status %d\n", job->script, job->status);
+            failed++;
+        }
+        free(job->out);
+        free(job->err);
+    }
+
+    for (int i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.finished);
+    free(pool);
+    free(batch.jobs);
+    if (failed) fprintf(stderr, "[JOBS] %d of %d scripts failed\n", failed, count);
+    return failed ? 1 : 0;
+}
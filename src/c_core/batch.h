@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/*
+    Batch runs (--jobs): many scripts in one process, on a pool of threads.
+
+    Every script runs in an interpreter of its own (interpreter.h), so runs
+    share nothing but the process, and has no input.  What it prints and
+    its messages are collected in memory while it runs and written to
+    stdout and stderr once it is done, script after script in the order
+    given, so the output is the same however the scripts were scheduled.
+*/
+
+// Runs one script in the current interpreter; returns its exit status.
+typedef int (*BatchRun)(const char* script, void* arg);
+
+// Runs every script with 'run' on 'threads' threads.  Returns 0 if they all
+// succeeded, 1 otherwise (each failure is named on stderr after its output).
+int runBatch(const char** scripts, int count, int threads, BatchRun run, void* arg);
+
+#endif // BATCH_H
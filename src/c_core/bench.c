@@ -0,0 +1,312 @@
+// bench.c — `make bench`: throughput of the lexer, parser and executor
+#include "lexer.h"
+#include "parser.h"
+#include "executor.h"
+#include "io.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+/*
+    Every workload is generated in memory at a size proportional to
+    --scale, then lexed, parsed and executed separately, each phase timed
+    REPEATS times and the fastest run kept.  Results go to a JSON file with
+    one workload per line; with --baseline, a phase whose throughput drops
+    more than --threshold percent below the baseline fails the run.
+*/
+
+#define REPEATS 5
+
+typedef struct {
+    char*  text;
+    size_t length;
+    size_t capacity;
+} Source;
+
+static void appendf(Source* src, const char* format, ...) {
+    va_list args;
+    for (;;) {
+        va_start(args, format);
+        int n = vsnprintf(src->text + src->length, src->capacity - src->length, format, args);
+        va_end(args);
+        if ((size_t)n < src->capacity - src->length) {
+            src->length += (size_t)n;
+            return;
+        }
+        src->capacity = src->capacity ? src->capacity * 2 : 1 << 16;
+        src->text = (char*)realloc(src->text, src->capacity);
+    }
+}
+
+typedef struct {
+    const char* name;
+    // Writes the program; returns how many statements executing it runs.
+    double (*generate)(Source* src, int scale);
+} Workload;
+
+static double deepNesting(Source* src, int scale) {
+    int statements = 2000 * scale;
+    for (int i = 0; i < statements; i++) {
+        appendf(src, "x = ");
+        for (int d = 0; d < 100; d++) appendf(src, "(");
+        appendf(src, "x");
+        for (int d = 0; d < 100; d++) appendf(src, " %c %d)", "+-*"[d % 3], d % 5 + 1);
+        appendf(src, ";\n");
+    }
+    return statements;
+}
+
+static double longStatements(Source* src, int scale) {
+    int statements = 200000 * scale;
+    appendf(src, "x = 0;\n");
+    for (int i = 0; i < statements; i++) {
+        appendf(src, "x = x + %d; // statement %d\n", i % 1000, i);
+    }
+    return statements + 1;
+}
+
+static double tightLoop(Source* src, int scale) {
+    int iterations = 5000000 * scale;
+    appendf(src,
+            "func main() {\n"
+            "    i = 0;\n"
+            "    s = 0;\n"
+            "    while i < %d {\n"
+            "        s = s + i * 2 %% 7 - i / 3;\n"
+            "        i = i + 1;\n"
+            "    }\n"
+            "    print s;\n"
+            "}\n", iterations);
+    return 2.0 * iterations;
+}
+
+static double printHeavy(Source* src, int scale) {
+    int lines = 1000000 * scale;
+    appendf(src,
+            "i = 0;\n"
+            "while i < %d {\n"
+            "    print i * 7;\n"
+            "    print \"row\";\n"
+            "    i = i + 1;\n"
+            "}\n", lines / 2);
+    return 1.5 * lines;
+}
+
+static double manyFunctions(Source* src, int scale) {
+    int functions = 20000 * scale;
+    for (int i = 0; i < functions; i++) {
+        appendf(src, "func f%d() {\n    a = %d;\n    b = a * 2 + %d;\n    print b;\n}\n", i, i, i % 9);
+    }
+    appendf(src, "func main() {\n    n = %d;\n    print n;\n}\n", functions);
+    // Only main runs; the other bodies are resolved and skipped.
+    return 3.0 * functions + 2;
+}
+
+static const Workload WORKLOADS[] = {
+    { "deep_nesting",    deepNesting },
+    { "long_statements", longStatements },
+    { "tight_loop",      tightLoop },
+    { "print_heavy",     printHeavy },
+    { "many_functions",  manyFunctions },
+};
+#define WORKLOAD_COUNT (int)(sizeof(WORKLOADS) / sizeof(WORKLOADS[0]))
+
+typedef struct {
+    const char* name;
+    size_t bytes;
+    long   tokens, nodes;
+    double statements;
+    double lexSeconds, parseSeconds, executeSeconds;
+    double tokensPerSec, nodesPerSec, statementsPerSec;
+} Result;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double best(double current, double sample) {
+    return current < 0 || sample < current ? sample : current;
+}
+
+static Result run(const Workload* w, int scale) {
+    Source src = { NULL, 0, 0 };
+    Result r;
+    memset(&r, 0, sizeof(r));
+    r.name = w->name;
+    r.statements = w->generate(&src, scale);
+    r.bytes = src.length;
+    r.lexSeconds = r.parseSeconds = r.executeSeconds = -1;
+
+    for (int rep = 0; rep < REPEATS; rep++) {
+        Lexer lexer;
+        initLexerString(&lexer, src.text);
+        long tokens = 0;
+        double start = now();
+        while (nextToken(&lexer).type != TOKEN_EOF) tokens++;
+        r.lexSeconds = best(r.lexSeconds, now() - start);
+        r.tokens = tokens;
+        freeLexer(&lexer);
+
+        // execute_program() optimizes the tree in place, so parse afresh every time.
+        AST ast;
+        initAST(&ast);
+        initLexerString(&lexer, src.text);
+        start = now();
+        BlockIndex root = parse(&lexer, &ast);
+        r.parseSeconds = best(r.parseSeconds, now() - start);
+        r.nodes = (long)ast.nodeCount - 1;
+        freeLexer(&lexer);
+
+        start = now();
+        execute_program(&ast, root);
+        ioFlush();
+        r.executeSeconds = best(r.executeSeconds, now() - start);
+        freeAST(&ast);
+    }
+    free(src.text);
+
+    r.tokensPerSec     = r.tokens / r.lexSeconds;
+    r.nodesPerSec      = r.nodes / r.parseSeconds;
+    r.statementsPerSec = r.statements / r.executeSeconds;
+    return r;
+}
+
+static void writeJSON(FILE* out, const Result* results, int count, int scale) {
+    fprintf(out, "{\n  \"version\": 1,\n  \"scale\": %d,\n  \"workloads\": [\n", scale);
+    for (int i = 0; i < count; i++) {
+        const Result* r = &results[i];
+        fprintf(out,
+                "    {\"name\": \"%s\", \"bytes\": %zu, \"tokens\": %ld, \"nodes\": %ld, "
+                "\"statements\": %.0f, \"lex_seconds\": %.6f, \"parse_seconds\": %.6f, "
+                "\"execute_seconds\": %.6f, \"tokens_per_sec\": %.0f, \"nodes_per_sec\": %.0f, "
+                "\"statements_per_sec\": %.0f}%s\n",
+                r->name, r->bytes, r->tokens, r->nodes, r->statements,
+                r->lexSeconds, r->parseSeconds, r->executeSeconds,
+                r->tokensPerSec, r->nodesPerSec, r->statementsPerSec,
+                i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Reads "key": number from the workload's line of a file written by writeJSON().
+static int baselineValue(const char* json, const char* name, const char* key, double* value) {
+    char pattern[96];
+    snprintf(pattern, sizeof(pattern), "\"name\": \"%s\"", name);
+    const char* line = strstr(json, pattern);
+    if (!line) return 0;
+    const char* end = strchr(line, '\n');
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    const char* field = strstr(line, pattern);
+    if (!field || (end && field > end)) return 0;
+    *value = strtod(field + strlen(pattern), NULL);
+    return 1;
+}
+
+static char* readFile(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char* text = (char*)malloc(size + 1);
+    size_t got = fread(text, 1, size, file);
+    text[got] = '\0';
+    fclose(file);
+    return text;
+}
+
+// Phases shorter than this are mostly timer noise and are not compared.
+#define MIN_COMPARED_SECONDS 0.005
+
+// Returns the number of regressions.
+static int compare(const char* json, const Result* results, int count, double threshold) {
+    static const char* keys[] = { "tokens_per_sec", "nodes_per_sec", "statements_per_sec" };
+    int regressions = 0;
+    fprintf(stderr, "\n%-16s %-20s %14s %14s %8s\n", "workload", "metric", "baseline", "current", "change");
+    for (int i = 0; i < count; i++) {
+        const Result* r = &results[i];
+        double current[] = { r->tokensPerSec, r->nodesPerSec, r->statementsPerSec };
+        double seconds[] = { r->lexSeconds, r->parseSeconds, r->executeSeconds };
+        for (int k = 0; k < 3; k++) {
+            double old;
+            if (seconds[k] < MIN_COMPARED_SECONDS) continue;
+            if (!baselineValue(json, r->name, keys[k], &old) || old <= 0) continue;
+            double change = (current[k] - old) / old * 100.0;
+            int regressed = change < -threshold;
+            regressions += regressed;
+            fprintf(stderr, "%-16s %-20s %14.0f %14.0f %+7.1f%%%s\n", r->name, keys[k],
+                    old, current[k], change, regressed ? "  REGRESSION" : "");
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[]) {
+    const char* output = "bench.json";
+    const char* baseline = NULL;
+    double threshold = 15.0;
+    int scale = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atoi(argv[++i]);
+            if (scale < 1) scale = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--out file.json] [--baseline file.json] [--threshold percent] [--scale n]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    interpreterEnter(interpreterNew());
+
+    // Program output is part of the measured work, but nobody needs to see it.
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("/dev/null");
+        return 2;
+    }
+
+    Result results[WORKLOAD_COUNT];
+    fprintf(stderr, "%-16s %10s %12s %12s %12s %14s %14s %16s\n", "workload", "bytes", "lex s",
+            "parse s", "execute s", "tokens/s", "nodes/s", "statements/s");
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        results[i] = run(&WORKLOADS[i], scale);
+        const Result* r = &results[i];
+        fprintf(stderr, "%-16s %10zu %12.4f %12.4f %12.4f %14.0f %14.0f %16.0f\n", r->name, r->bytes,
+                r->lexSeconds, r->parseSeconds, r->executeSeconds,
+                r->tokensPerSec, r->nodesPerSec, r->statementsPerSec);
+    }
+
+    FILE* out = fopen(output, "w");
+    if (!out) {
+        perror(output);
+        return 2;
+    }
+    writeJSON(out, results, WORKLOAD_COUNT, scale);
+    fclose(out);
+    fprintf(stderr, "results written to %s\n", output);
+
+    if (!baseline) return 0;
+    char* json = readFile(baseline);
+    if (!json) {
+        fprintf(stderr, "no baseline at %s (make bench-baseline creates one)\n", baseline);
+        return 0;
+    }
+    int regressions = compare(json, results, WORKLOAD_COUNT, threshold);
+    free(json);
+    if (regressions) {
+        fprintf(stderr, "%d metric(s) regressed by more than %.1f%%\n", regressions, threshold);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,510 @@
+// cache.c
+#include "cache.h"
+#include "token.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+typedef struct {
+    char     magic[4];          // "SPLC"
+    uint32_t version;
+    uint32_t flags;
+    uint32_t statements;
+    uint64_t sourceSize;
+    int64_t  sourceMtimeSec, sourceMtimeNsec;
+    uint64_t sourceHash;
+    uint64_t stringsOffset;
+    uint32_t firstString;
+    uint32_t stringCount;
+    uint64_t payloadHash;       // of everything after the header
+} CacheHeader;
+
+/*
+    A statement record, in bytes and variable-length integers (7 bits a
+    byte, low bits first; signed ones zigzag-encoded):
+
+        nodes tokens lists root     the counts include entry 0
+        per token from 1:   type | TOKEN_NEW_LINE; the number, the float's
+                            8 bytes or the string id; the offset as the
+                            difference from the token before; with
+                            TOKEN_NEW_LINE, how many lines further it is
+        per node from 1:    type | NODE_* for the fields that are set;
+                            its token, then left and right (unless right
+                            is a block) as differences from the node
+                            itself; a block right and body as they are
+        per list entry from 1
+
+    Nodes are made right after their children and tokens with their nodes,
+    so most fields take a single byte.  A token's length is not kept: once
+    it is parsed, nothing reads it.
+*/
+#define TOKEN_NEW_LINE 0x10u
+#define NODE_LEFT      0x20u
+#define NODE_RIGHT     0x40u
+#define NODE_BODY      0x80u
+
+#define RECORD_SLACK 4096       // small programs are cached whatever their growth
+#define TOKEN_MAX    41         // bytes a token or a node can take at most
+#define VARINT_MAX   10
+
+#define HASH_START 14695981039346656037ull
+
+// FNV-1a over 64-bit words; split input must be split at multiples of 8 but the last part.
+static uint64_t hashBytes(uint64_t h, const unsigned char* p, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        h = (h ^ word) * 1099511628211ull;
+        h ^= h >> 29;
+    }
+    for (; i < n; i++) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+// Hash of the rest of 'file' from the current position.
+static uint64_t hashRest(FILE* file, uint64_t* size) {
+    enum { BLOCK = 64 * 1024 };
+    unsigned char* buffer = (unsigned char*)malloc(BLOCK);
+    uint64_t h = HASH_START;
+    uint64_t total = 0;
+    size_t got;
+    while ((got = fread(buffer, 1, BLOCK, file)) > 0) {
+        h = hashBytes(h, buffer, got);
+        total += got;
+    }
+    free(buffer);
+    *size = total;
+    return h ^ total;
+}
+
+// Hash and size of all of 'file'; leaves its position at the start.
+static uint64_t hashFile(FILE* file, uint64_t* size) {
+    rewind(file);
+    uint64_t h = hashRest(file, size);
+    rewind(file);
+    return h;
+}
+
+char* cachePathFor(const char* source) {
+    const char* dir = getenv("FREESPL_CACHE_DIR");
+    char* path;
+    if (dir && *dir) {
+        // Named after the source's full path, so a/x.spl and b/x.spl get a file each.
+        char* full = realpath(source, NULL);
+        const char* key = full ? full : source;
+        uint64_t h = hashBytes(HASH_START, (const unsigned char*)key, strlen(key));
+        const char* name = strrchr(source, '/');
+        name = name ? name + 1 : source;
+        path = (char*)malloc(strlen(dir) + strlen(name) + 24);
+        sprintf(path, "%s/%s.%016llxc", dir, name, (unsigned long long)h);
+        free(full);
+    } else {
+        path = (char*)malloc(strlen(source) + 2);
+        sprintf(path, "%sc", source);
+    }
+    return path;
+}
+
+static CacheHeader newHeader(const struct stat* source, uint32_t flags) {
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SPLC", 4);
+    header.version         = CACHE_VERSION;
+    header.flags           = flags;
+    header.sourceSize      = (uint64_t)source->st_size;
+    header.sourceMtimeSec  = (int64_t)source->st_mtim.tv_sec;
+    header.sourceMtimeNsec = (int64_t)source->st_mtim.tv_nsec;
+    return header;
+}
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* ----------------------------------------------------------- writing ---- */
+
+static uint8_t* putVarint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// A node reference relative to node 'i'.
+static uint8_t* putNode(uint8_t* p, NodeIndex i, NodeIndex node) {
+    return putVarint(p, zigzag((int64_t)i - node));
+}
+
+int cacheOpenWriter(CacheWriter* writer, const char* path, FILE* source, uint32_t flags) {
+    memset(writer, 0, sizeof(*writer));
+    struct stat st;
+    if (fstat(fileno(source), &st) != 0) return 0;
+    writer->path = strdup(path);
+    // Unique per writer: the threads of --jobs may write the same cache at once.
+    static unsigned writers = 0;
+    unsigned serial = __atomic_fetch_add(&writers, 1, __ATOMIC_RELAXED);
+    writer->tempPath = (char*)malloc(strlen(path) + 48);
+    sprintf(writer->tempPath, "%s.tmp%ld.%u", path, (long)getpid(), serial);
+    writer->file = fopen(writer->tempPath, "w+b");
+    if (!writer->file) {
+        free(writer->path);
+        free(writer->tempPath);
+        memset(writer, 0, sizeof(*writer));
+        return 0;
+    }
+    writer->source    = source;
+    writer->size      = (uint64_t)st.st_size;
+    writer->mtimeSec  = (int64_t)st.st_mtim.tv_sec;
+    writer->mtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+    writer->flags     = flags;
+    writer->firstString = stringCount();
+    // Counts, the source's hash and the string table offset are filled in by cacheCloseWriter().
+    CacheHeader header = newHeader(&st, flags);
+    fwrite(&header, sizeof(header), 1, writer->file);
+    return 1;
+}
+
+void cacheAppend(CacheWriter* writer, const AST* ast, NodeIndex root) {
+    if (!writer->file) return;
+    size_t bound = 4 * VARINT_MAX + (size_t)ast->tokenCount * TOKEN_MAX +
+                   (size_t)ast->nodeCount * TOKEN_MAX + (size_t)ast->listCount * VARINT_MAX;
+    if (bound > writer->recordCapacity) {
+        writer->recordCapacity = bound * 2;
+        writer->record = (uint8_t*)realloc(writer->record, writer->recordCapacity);
+    }
+
+    uint8_t* p = writer->record;
+    p = putVarint(p, ast->nodeCount);
+    p = putVarint(p, ast->tokenCount);
+    p = putVarint(p, ast->listCount);
+    p = putVarint(p, root);
+    int64_t offset = 0, line = 0;
+    for (uint32_t i = 1; i < ast->tokenCount; i++) {
+        const Token* tok = &ast->tokens[i];
+        *p++ = (uint8_t)(tok->type | (tok->line != line ? TOKEN_NEW_LINE : 0));
+        if (tok->type == TOKEN_NUMBER) {
+            p = putVarint(p, zigzag(tok->number));
+        } else if (tok->type == TOKEN_FLOAT) {
+            memcpy(p, &tok->real, 8);
+            p += 8;
+        } else {
+            p = putVarint(p, tok->id);
+        }
+        p = putVarint(p, zigzag((int64_t)tok->offset - offset));
+        if (tok->line != line) p = putVarint(p, zigzag((int64_t)tok->line - line));
+        offset = tok->offset;
+        line = tok->line;
+    }
+    for (uint32_t i = 1; i < ast->nodeCount; i++) {
+        const ASTNode* node = &ast->nodes[i];
+        *p++ = (uint8_t)(node->nodeType | (node->left ? NODE_LEFT : 0) |
+                         (node->right ? NODE_RIGHT : 0) | (node->body ? NODE_BODY : 0));
+        p = putVarint(p, zigzag((int64_t)i - node->token));
+        if (node->left) p = putNode(p, i, node->left);
+        if (node->right) p = rightIsBlock(node) ? putVarint(p, node->right) : putNode(p, i, node->right);
+        if (node->body) p = putVarint(p, node->body);
+    }
+    for (uint32_t i = 1; i < ast->listCount; i++) {
+        p = putVarint(p, ast->lists[i]);
+    }
+
+    // A program that would take more room cached than as source is run without a cache.
+    size_t length = (size_t)(p - writer->record);
+    writer->written += length;
+    if (writer->written > CACHE_MAX_GROWTH * writer->size + RECORD_SLACK) {
+        cacheCloseWriter(writer, 0);
+        return;
+    }
+    fwrite(writer->record, 1, length, writer->file);
+    writer->statements++;
+}
+
+void cacheCloseWriter(CacheWriter* writer, int keep) {
+    if (writer->file) {
+        // The source is hashed now rather than before the first statement ran; if it
+        // changed in the meantime, the hash would not be of what was parsed.
+        struct stat st;
+        uint64_t size = 0, hash = 0;
+        if (keep) {
+            keep = fstat(fileno(writer->source), &st) == 0 &&
+                   (uint64_t)st.st_size == writer->size &&
+                   (int64_t)st.st_mtim.tv_sec == writer->mtimeSec &&
+                   (int64_t)st.st_mtim.tv_nsec == writer->mtimeNsec;
+        }
+        if (keep) {
+            hash = hashFile(writer->source, &size);
+            keep = size == writer->size;
+        }
+
+        if (keep) {
+            long stringsOffset = ftell(writer->file);
+            uint32_t count = stringCount();
+            for (uint32_t id = writer->firstString; id < count; id++) {
+                uint32_t length = stringLength(id);
+                fwrite(&length, sizeof(length), 1, writer->file);
+                fwrite(stringOf(id), 1, length, writer->file);
+            }
+
+            // Read back for the checksum; it is in the page cache anyway.
+            uint64_t payload;
+            CacheHeader header = newHeader(&st, writer->flags);
+            if (fseek(writer->file, sizeof(CacheHeader), SEEK_SET) != 0) keep = 0;
+            header.payloadHash   = hashRest(writer->file, &payload);
+            header.sourceHash    = hash;
+            header.statements    = writer->statements;
+            header.stringsOffset = (uint64_t)stringsOffset;
+            header.firstString   = writer->firstString;
+            header.stringCount   = count - writer->firstString;
+            rewind(writer->file);
+            if (fwrite(&header, sizeof(header), 1, writer->file) != 1) keep = 0;
+        }
+
+        if (fclose(writer->file) != 0) keep = 0;
+        if (!keep || rename(writer->tempPath, writer->path) != 0) {
+            remove(writer->tempPath);
+        }
+    }
+    free(writer->path);
+    free(writer->tempPath);
+    free(writer->record);
+    memset(writer, 0, sizeof(*writer));
+}
+
+/* ----------------------------------------------------------- reading ---- */
+
+static int getVarint(const uint8_t** p, const uint8_t* limit, uint64_t* value) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p == limit) return 0;
+        uint8_t byte = *(*p)++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A count or index that has to fit in 32 bits.
+static int getIndex(const uint8_t** p, const uint8_t* limit, uint32_t* value) {
+    uint64_t v;
+    if (!getVarint(p, limit, &v) || v > UINT32_MAX) return 0;
+    *value = (uint32_t)v;
+    return 1;
+}
+
+// The other end of putNode(); anything outside the arena is an error.
+static int getNode(const uint8_t** p, const uint8_t* limit, NodeIndex i, uint32_t nodes, NodeIndex* node) {
+    uint64_t v;
+    if (!getVarint(p, limit, &v)) return 0;
+    int64_t index = (int64_t)i - unzigzag(v);
+    if (index <= 0 || index >= nodes) return 0;
+    *node = (NodeIndex)index;
+    return 1;
+}
+
+static void* reserve(void* array, uint32_t* capacity, uint32_t count, size_t size) {
+    if (count <= *capacity) return array;
+    while (*capacity < count) *capacity = *capacity ? *capacity * 2 : 256;
+    return realloc(array, size * *capacity);
+}
+
+static int validBlock(const AST* ast, BlockIndex b) {
+    if (b == 0) return 1;
+    const NodeIndex* lists = ast->lists;
+    if (b >= ast->listCount || lists[b] > ast->listCount - 1 - b) return 0;
+    for (uint32_t i = 1; i <= lists[b]; i++) {
+        if (lists[b + i] == 0 || lists[b + i] >= ast->nodeCount) return 0;
+    }
+    return 1;
+}
+
+/*
+    Decodes the record at '*p' into 'ast'.  Every index is checked to point
+    inside the arena, and every string id inside the table (below
+    'strings'), so nothing read from a damaged or foreign file can reach
+    outside them.
+*/
+static int decodeRecord(const uint8_t** p, const uint8_t* limit, uint32_t strings, AST* ast, NodeIndex* root) {
+    uint32_t nodes, tokens, lists;
+    if (!getIndex(p, limit, &nodes) || !getIndex(p, limit, &tokens) ||
+        !getIndex(p, limit, &lists) || !getIndex(p, limit, root) ||
+        nodes < 2 || tokens < 1 || lists < 1 || *root == 0 || *root >= nodes) return 0;
+    // Each entry takes a byte at least: counts larger than the rest of the file are lies.
+    if ((uint64_t)nodes + tokens + lists > (uint64_t)(limit - *p) + 3) return 0;
+
+    ast->nodes  = (ASTNode*)reserve(ast->nodes, &ast->nodeCapacity, nodes, sizeof(ASTNode));
+    ast->tokens = (Token*)reserve(ast->tokens, &ast->tokenCapacity, tokens, sizeof(Token));
+    ast->lists  = (NodeIndex*)reserve(ast->lists, &ast->listCapacity, lists, sizeof(NodeIndex));
+    ast->nodeCount = nodes;
+    ast->tokenCount = tokens;
+    ast->listCount = lists;
+    ast->scratchCount = 0;
+
+    int64_t offset = 0, line = 0;
+    for (uint32_t i = 1; i < tokens; i++) {
+        Token* tok = &ast->tokens[i];
+        uint64_t v;
+        if (*p == limit || (**p & ~TOKEN_NEW_LINE) > TOKEN_EOF) return 0;
+        unsigned type = *(*p)++;
+        tok->type = (TokenType)(type & ~TOKEN_NEW_LINE);
+        if (tok->type == TOKEN_NUMBER) {
+            if (!getVarint(p, limit, &v)) return 0;
+            tok->number = unzigzag(v);
+        } else if (tok->type == TOKEN_FLOAT) {
+            if (limit - *p < 8) return 0;
+            memcpy(&tok->real, *p, 8);
+            *p += 8;
+        } else {
+            if (!getIndex(p, limit, &tok->id)) return 0;
+            if (tok->type != TOKEN_EOF && tok->id >= strings) return 0;
+        }
+        if (!getVarint(p, limit, &v)) return 0;
+        offset += unzigzag(v);
+        if (type & TOKEN_NEW_LINE) {
+            if (!getVarint(p, limit, &v)) return 0;
+            line += unzigzag(v);
+        }
+        if (offset < 0 || offset > UINT32_MAX || line < 0 || line > UINT32_MAX) return 0;
+        tok->offset = (uint32_t)offset;
+        tok->line   = (uint32_t)line;
+        tok->length = 0;
+    }
+    for (uint32_t i = 1; i < nodes; i++) {
+        ASTNode* node = &ast->nodes[i];
+        uint64_t v;
+        if (*p == limit || (**p & 0x1fu) > AST_REDUCE) return 0;
+        unsigned fields = *(*p)++;
+        node->nodeType = (uint8_t)(fields & 0x1fu);
+        if (!getVarint(p, limit, &v)) return 0;
+        int64_t token = (int64_t)i - unzigzag(v);
+        if (token < 0 || token >= tokens) return 0;
+        node->token = (uint32_t)token;
+        node->left = node->right = node->body = AST_NONE;
+        if ((fields & NODE_LEFT) && !getNode(p, limit, i, nodes, &node->left)) return 0;
+        if ((fields & NODE_RIGHT) &&
+            (rightIsBlock(node) ? !getIndex(p, limit, &node->right) : !getNode(p, limit, i, nodes, &node->right))) return 0;
+        if ((fields & NODE_BODY) && !getIndex(p, limit, &node->body)) return 0;
+        // As parsed: the resolver gives it its slot.
+        node->slot = -1;
+    }
+    for (uint32_t i = 1; i < lists; i++) {
+        if (!getIndex(p, limit, &ast->lists[i])) return 0;
+    }
+    for (uint32_t i = 1; i < nodes; i++) {
+        const ASTNode* node = &ast->nodes[i];
+        if (!validBlock(ast, node->body) || (rightIsBlock(node) && !validBlock(ast, node->right))) return 0;
+    }
+    return 1;
+}
+
+// Re-intern the program's strings; they must come back with the same ids.
+static int loadStrings(const CacheHeader* header, const uint8_t* p, const uint8_t* end) {
+    if (stringCount() != header->firstString) return 0;
+    for (uint32_t i = 0; i < header->stringCount; i++) {
+        uint32_t length;
+        if (end - p < (ptrdiff_t)sizeof(length)) return 0;
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if ((uint64_t)(end - p) < length) return 0;
+        if (intern((const char*)p, length) != header->firstString + i) return 0;
+        p += length;
+    }
+    return 1;
+}
+
+/*
+    Every record is decoded once up front to check it, as one bad record
+    would leave the program half run; decoding is cheap next to lexing and
+    parsing.
+*/
+static int validRecords(const CacheHeader* header, const uint8_t* p, const uint8_t* limit) {
+    AST scratch;
+    initAST(&scratch);
+    uint32_t strings = header->firstString + header->stringCount;
+    int valid = strings >= header->firstString;
+    for (uint32_t n = 0; valid && n < header->statements; n++) {
+        NodeIndex root;
+        valid = decodeRecord(&p, limit, strings, &scratch, &root);
+    }
+    freeAST(&scratch);
+    return valid && p == limit;
+}
+
+int cacheOpenReader(CacheReader* reader, const char* path, FILE* source, uint32_t flags) {
+    memset(reader, 0, sizeof(*reader));
+    struct stat sourceStat;
+    if (fstat(fileno(source), &sourceStat) != 0) return 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return 0;
+    }
+    // The whole file is used, so fault it in up front rather than page by page.
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    // Size and time first: only a cache that may be of this source is worth hashing it for.
+    const CacheHeader* header = (const CacheHeader*)map;
+    const uint8_t* base = (const uint8_t*)map;
+    const uint8_t* end  = base + st.st_size;
+    size_t payload = (size_t)st.st_size - sizeof(CacheHeader);
+    CacheHeader expected = newHeader(&sourceStat, flags);
+    uint64_t size;
+    if (memcmp(header->magic, expected.magic, 4) != 0 ||
+        header->version         != expected.version ||
+        header->flags           != expected.flags ||
+        header->sourceSize      != expected.sourceSize ||
+        header->sourceMtimeSec  != expected.sourceMtimeSec ||
+        header->sourceMtimeNsec != expected.sourceMtimeNsec ||
+        header->stringsOffset < sizeof(CacheHeader) ||
+        header->stringsOffset > (uint64_t)st.st_size ||
+        header->sourceHash != hashFile(source, &size) ||
+        (hashBytes(HASH_START, base + sizeof(CacheHeader), payload) ^ payload) != header->payloadHash ||
+        !validRecords(header, base + sizeof(CacheHeader), base + header->stringsOffset) ||
+        !loadStrings(header, base + header->stringsOffset, end)) {
+        munmap(map, (size_t)st.st_size);
+        return 0;
+    }
+
+    reader->map   = map;
+    reader->size  = (size_t)st.st_size;
+    reader->next  = base + sizeof(CacheHeader);
+    reader->limit = base + header->stringsOffset;
+    reader->remaining = header->statements;
+    return 1;
+}
+
+int cacheNext(CacheReader* reader, AST* ast, NodeIndex* root) {
+    if (!reader->remaining) return 0;
+    // validRecords() has checked them all.
+    const CacheHeader* header = (const CacheHeader*)reader->map;
+    if (!decodeRecord(&reader->next, reader->limit, header->firstString + header->stringCount, ast, root)) return 0;
+    reader->remaining--;
+    return 1;
+}
+
+void cacheCloseReader(CacheReader* reader) {
+    if (reader->map) munmap(reader->map, reader->size);
+    memset(reader, 0, sizeof(*reader));
+}
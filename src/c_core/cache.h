@@ -0,0 +1,69 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "ast.h"
+#include <stdio.h>
+
+/*
+    Precompiled program cache (.splc).  As a program runs, every top-level
+    statement's arena (nodes, tokens and block lists, already optimized) is
+    appended to the cache file in a compact form: variable-length integers,
+    node references relative to the node, token offsets and lines relative
+    to the token before.  Indices are arena-relative, so loading only
+    decodes.  The strings the tokens refer to are written at the end and
+    re-interned, in id order, before anything else on load, so they get the
+    same ids as when the file was written.
+
+    A cache is looked up by the source's size and modification time; only
+    when those match is the source hashed and compared with the hash in the
+    header, so a miss costs nothing before the first statement runs.  The
+    hash of a new cache is taken when it is closed, after the program ran.
+    A cache is only used if the magic, version, flags, size, time and hash
+    all match, the rest of the file matches the checksum in the header and
+    every index and string id in it is in range; anything else is a miss
+    and the source is parsed again (and the cache rewritten).  A program
+    whose records outgrow CACHE_MAX_GROWTH times its source is not cached.
+*/
+#define CACHE_VERSION    10
+#define CACHE_OPTIMIZED  1u     // header flag: statements went through optimizer.c
+#define CACHE_MAX_GROWTH 4      // records may take this many times the source's size
+
+typedef struct {
+    FILE*    file;
+    char*    path;
+    char*    tempPath;          // written here, renamed over 'path' when complete
+    FILE*    source;            // hashed when the writer is closed
+    uint64_t size;              // of the source, and its modification time
+    int64_t  mtimeSec, mtimeNsec;
+    uint64_t written;           // bytes of records so far
+    uint32_t flags;
+    uint32_t statements;
+    uint32_t firstString;       // strings from this id on belong to the program
+    uint8_t* record;            // a record being encoded
+    size_t   recordCapacity;
+} CacheWriter;
+
+typedef struct {
+    void*          map;
+    size_t         size;
+    const uint8_t* next;        // next statement record
+    const uint8_t* limit;       // end of the records
+    uint32_t       remaining;
+} CacheReader;
+
+// "prog.spl" -> "prog.splc", or $FREESPL_CACHE_DIR/prog.spl.<hash of the full path>c when that is set.
+char*    cachePathFor(const char* source);
+
+// 'source' is the open source file; it is only read when the writer is closed.
+int  cacheOpenWriter(CacheWriter* writer, const char* path, FILE* source, uint32_t flags);
+void cacheAppend(CacheWriter* writer, const AST* ast, NodeIndex root);
+// keep = 0 discards the file (e.g. after a parse error).
+void cacheCloseWriter(CacheWriter* writer, int keep);
+
+// Returns 0 if there is no usable cache for 'source'; leaves its position at the start.
+int  cacheOpenReader(CacheReader* reader, const char* path, FILE* source, uint32_t flags);
+// Decodes the next statement into 'ast' (from initAST()), replacing what it held.
+int  cacheNext(CacheReader* reader, AST* ast, NodeIndex* root);
+void cacheCloseReader(CacheReader* reader);
+
+#endif // CACHE_H
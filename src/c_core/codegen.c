@@ -0,0 +1,1209 @@
+// codegen.c
+#include "codegen.h"
+#include "resolver.h"
+#include "token.h"
+#include "value.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Both backends follow executor.c statement for statement: x/0 and x%0
+    are 0, unknown operators evaluate to 0, and print writes
+    string literals and names verbatim.  Only calls have side effects, so
+    expressions without one are not evaluated unless their value is used,
+    and operands with calls are evaluated left to right.  Calls nest on the
+    machine stack here; only a func's tail calls to itself become jumps.
+    Calling a func that is not defined yet gives 0, without the warning.
+
+    The C backend works on boxed values (value.h) with a copy of the VM's
+    int fast paths and of the string runtime in the generated file.  The
+    asm backend only knows the 32-bit ints; a float or string operand stops
+    the assembler with an .error.  Tasks and channels (task.h) need the
+    interpreter's scheduler, so both stop the C compiler or the assembler.
+*/
+
+static int isBinary(const AST* ast, const ASTNode* node) {
+    return node && node->left && node->right && nodeToken(ast, node)->type == TOKEN_OPERATOR;
+}
+
+// Same test as AST_PRINT in the executor: print a value, or print the token's text.
+static int printsValue(const AST* ast, const ASTNode* expr) {
+    return isBinary(ast, expr) || isVariableNode(ast, expr) ||
+           isNumberToken(nodeToken(ast, expr)) || hasEffects(expr);
+}
+
+// spawn, send, recv, chan and parallel for, which need the interpreter's workers:
+// an #error or .error line of its own.
+static void unsupported(Codegen* gen, const Token* tok, const char* what) {
+    fprintf(gen->out, gen->target == TARGET_C ? "\n#error \"line %u: %s not supported by --emit-c\"\n"
+                                              : "    .error \"line %u: %s not supported by --emit-asm\"\n",
+            tok->line, what);
+}
+
+static void noTasks(Codegen* gen, const Token* tok) {
+    unsupported(gen, tok, "tasks and channels are");
+}
+
+// Quoted string literal, valid for both C and GNU as.
+static void writeString(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') fprintf(out, "\\%c", ch);
+        else if (ch < 32 || ch >= 127) fprintf(out, "\\%03o", ch);
+        else fputc(ch, out);
+    }
+    fputc('"', out);
+}
+
+static void indent(Codegen* gen, int level) {
+    for (int i = 0; i < level; i++) fputs("    ", gen->out);
+}
+
+/* ---------------------------------------------------------------- C ---- */
+
+static void frameName(Codegen* gen) {
+    if (gen->depth == 0) fputs("G", gen->out);
+    else fprintf(gen->out, "L%d", gen->depth);
+}
+
+// Runtime function for a binary operator (see the prologue in codegenBegin()).
+static const char* cOperator(uint32_t op) {
+    switch (op) {
+        case STR_PLUS:    return "spl_add";
+        case STR_MINUS:   return "spl_sub";
+        case STR_STAR:    return "spl_mul";
+        case STR_SLASH:   return "spl_div";
+        case STR_PERCENT: return "spl_mod";
+        case STR_ASSIGN:
+        case STR_EQ:      return "spl_eq";
+        case STR_NE:      return "spl_ne";
+        case STR_LT:      return "spl_lt";
+        case STR_LE:      return "spl_le";
+        case STR_GT:      return "spl_gt";
+        case STR_GE:      return "spl_ge";
+    }
+    return NULL;
+}
+
+static int newTemp(Codegen* gen) {
+    if (gen->temps == gen->maxTemps) gen->maxTemps++;
+    return gen->temps++;
+}
+
+/*
+    Which nodes under 'root' contain a call, in one pass before an
+    expression is written: asking containsCall() at every operator would
+    make a long a + b + c + ... quadratic.
+*/
+static void markCalls(Codegen* gen, const AST* ast, NodeIndex root) {
+    if (ast->nodeCount > gen->callCapacity) {
+        gen->callCapacity = ast->nodeCount;
+        gen->calls = (uint8_t*)realloc(gen->calls, gen->callCapacity);
+    }
+    ASTWalk walk;
+    walkInit(&walk);
+    walkStart(&walk, root);
+    int leaving;
+    NodeIndex i;
+    while ((i = walkNext(&walk, ast, &leaving))) {
+        if (!leaving) continue;
+        const ASTNode* node = astNode(ast, i);
+        gen->calls[i] = hasEffects(node) ||
+                        (node->left && gen->calls[node->left]) ||
+                        (node->right && !rightIsBlock(node) && gen->calls[node->right]);
+    }
+    walkFree(&walk);
+}
+
+static int hasCall(const Codegen* gen, NodeIndex index) {
+    return index && gen->calls[index];
+}
+
+/*
+    Expressions are written from an ASTWalk, not by recursion.  A node
+    whose text surrounds its operands gets a frame that remembers which
+    of these forms it took (data[0]) and its temporary (data[1]).
+*/
+enum {
+    C_PLAIN,        // spl_add(l, r)
+    C_TEMP,         // (T[t] = l, spl_add(T[t], r))
+    C_LOGIC,        // spl_int(spl_true(l) && spl_true(r))
+    C_ARGS,         // spl_call(f, (V[]){a, b}, 2)
+    C_ARGS_TEMP     // (T[t] = a, T[t+1] = b, spl_call(f, &T[t], 2))
+};
+
+// A leaf is written whole; anything else writes up to its first operand and is pushed.
+static void cOpen(Codegen* gen, ASTWalk* walk, const AST* ast, NodeIndex index) {
+    const ASTNode* node = astNode(ast, index);
+    FILE* out = gen->out;
+    if (!node) { fputs("0", out); return; }
+
+    const Token* tok = nodeToken(ast, node);
+    if (tok->type == TOKEN_NUMBER) {
+        fprintf(out, "spl_int(%d)", (int)tok->number);
+        return;
+    }
+    if (tok->type == TOKEN_FLOAT) {
+        // The boxed bits, so that every double (inf too) comes out exact.
+        fprintf(out, "(V)0x%016llxull", (unsigned long long)valueDouble(tok->real));
+        return;
+    }
+    if (tok->type == TOKEN_STRING) {
+        // Made on first use and kept, like textLiteral().
+        fprintf(out, "spl_lit(%d, ", gen->literals++);
+        writeString(out, stringOf(tok->id));
+        fprintf(out, ", %u)", stringLength(tok->id));
+        return;
+    }
+    if (isVariableNode(ast, node)) {
+        frameName(gen);
+        fprintf(out, "[%d]", node->slot);
+        return;
+    }
+    if (node->nodeType == AST_RECV || node->nodeType == AST_CHAN) {
+        fputs("0", out);
+        noTasks(gen, tok);
+        return;
+    }
+
+    int form, temp = 0;
+    if (node->nodeType == AST_CALL) {
+        // When more than one argument makes calls, they are evaluated into temporaries first, in order.
+        uint32_t count = blockCount(ast, node->body);
+        const NodeIndex* args = blockNodes(ast, node->body);
+        if (count == 0) {
+            fprintf(out, "spl_call(%d, 0, 0)", node->slot);
+            return;
+        }
+        uint32_t calls = 0;
+        for (uint32_t i = 0; i < count; i++) calls += hasCall(gen, args[i]);
+        if (calls < 2) {
+            form = C_ARGS;
+            fprintf(out, "spl_call(%d, (V[]){", node->slot);
+        } else {
+            form = C_ARGS_TEMP;
+            temp = gen->temps;
+            for (uint32_t i = 0; i < count; i++) newTemp(gen);
+            fputs("(", out);
+        }
+    } else if (!isBinary(ast, node) ||
+               (tok->id != STR_AND && tok->id != STR_OR && !cOperator(tok->id))) {
+        fputs("0", out);
+        return;
+    } else if (tok->id == STR_AND || tok->id == STR_OR) {
+        form = C_LOGIC;
+        fputs("spl_int(spl_true(", out);
+    } else if (hasCall(gen, node->left) && hasCall(gen, node->right)) {
+        // C leaves the order of arguments open: settle the left one first.
+        form = C_TEMP;
+        temp = newTemp(gen);
+        fprintf(out, "(T[%d] = ", temp);
+    } else {
+        form = C_PLAIN;
+        fprintf(out, "%s(", cOperator(tok->id));
+    }
+    WalkFrame* frame = walkPush(walk, index);
+    frame->data[0] = form;
+    frame->data[1] = temp;
+}
+
+// The next operand of the frame on top, or its closing text.
+static void cStep(Codegen* gen, ASTWalk* walk, const AST* ast) {
+    WalkFrame* frame = walkTop(walk);
+    const ASTNode* node = astNode(ast, frame->node);
+    int form = frame->data[0], temp = frame->data[1];
+    uint32_t step = frame->step++;
+    FILE* out = gen->out;
+
+    if (form == C_ARGS || form == C_ARGS_TEMP) {
+        uint32_t count = blockCount(ast, node->body);
+        if (step < count) {
+            if (form == C_ARGS_TEMP) {
+                fprintf(out, "%sT[%u] = ", step ? ", " : "", temp + step);
+            } else if (step) {
+                fputs(", ", out);
+            }
+            cOpen(gen, walk, ast, blockNodes(ast, node->body)[step]);
+            return;
+        }
+        walkPop(walk);
+        if (form == C_ARGS) {
+            fprintf(out, "}, %u)", count);
+        } else {
+            fprintf(out, ", spl_call(%d, &T[%d], %u))", node->slot, temp, count);
+            gen->temps = temp;
+        }
+        return;
+    }
+
+    uint32_t op = nodeToken(ast, node)->id;
+    if (step == 0) {
+        cOpen(gen, walk, ast, node->left);
+        return;
+    }
+    if (step == 1) {
+        if (form == C_LOGIC) {
+            fputs(op == STR_AND ? ") && spl_true(" : ") || spl_true(", out);
+        } else if (form == C_TEMP) {
+            fprintf(out, ", %s(T[%d], ", cOperator(op), temp);
+        } else {
+            fputs(", ", out);
+        }
+        cOpen(gen, walk, ast, node->right);
+        return;
+    }
+    walkPop(walk);
+    fputs(form == C_PLAIN ? ")" : "))", out);
+    if (form == C_TEMP) gen->temps = temp;
+}
+
+static void cExpression(Codegen* gen, const AST* ast, NodeIndex index) {
+    markCalls(gen, ast, index);
+    ASTWalk walk;
+    walkInit(&walk);
+    cOpen(gen, &walk, ast, index);
+    while (walk.depth) cStep(gen, &walk, ast);
+    walkFree(&walk);
+}
+
+static void cBlock(Codegen* gen, const AST* ast, BlockIndex block, int level);
+
+// 'return f(...)' inside f itself.
+static int isSelfCall(const Codegen* gen, const AST* ast, NodeIndex expr) {
+    const ASTNode* node = astNode(ast, expr);
+    return gen->self >= 0 && node && node->nodeType == AST_CALL && (int)node->slot == gen->self;
+}
+
+// The arguments go to N[] one statement at a time (so in order), then
+// make a fresh frame like the call would.
+static void cSelfCall(Codegen* gen, const AST* ast, const ASTNode* call, int level) {
+    FILE* out = gen->out;
+    uint32_t count = blockCount(ast, call->body);
+    indent(gen, level);
+    fputs("{\n", out);
+    if (count) {
+        indent(gen, level + 1);
+        fprintf(out, "V N[%u];\n", count);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        indent(gen, level + 1);
+        fprintf(out, "N[%u] = ", i);
+        cExpression(gen, ast, blockNodes(ast, call->body)[i]);
+        fputs(";\n", out);
+    }
+    indent(gen, level + 1);
+    fputs("memset(L1, 0, sizeof(L1));\n", out);
+    for (uint32_t i = 0; i < count && i < gen->selfParams; i++) {
+        indent(gen, level + 1);
+        fprintf(out, "L1[%u] = N[%u];\n", i, i);
+    }
+    indent(gen, level + 1);
+    fputs("goto top;\n", out);
+    indent(gen, level);
+    fputs("}\n", out);
+    gen->selfCalls++;
+}
+
+static void cStatement(Codegen* gen, const AST* ast, NodeIndex index, int level) {
+    const ASTNode* node = astNode(ast, index);
+    FILE* out = gen->out;
+    if (!node) return;
+
+    switch (node->nodeType) {
+        case AST_FUNC_DEF:
+            // Top-level funcs go through codegenFunction(); nested ones define nothing.
+            break;
+
+        case AST_VAR_ASSIGN: {
+            const ASTNode* target = astNode(ast, node->left);
+            if (isVariableNode(ast, target)) {
+                indent(gen, level);
+                frameName(gen);
+                fprintf(out, "[%d] = ", target->slot);
+                cExpression(gen, ast, node->right);
+                fputs(";\n", out);
+            }
+            break;
+        }
+
+        case AST_PRINT:
+            if (node->left) {
+                const ASTNode* expr = astNode(ast, node->left);
+                indent(gen, level);
+                if (printsValue(ast, expr)) {
+                    fputs("spl_print(", out);
+                    cExpression(gen, ast, node->left);
+                    fputs(", \"\\n\");\n", out);
+                } else {
+                    fputs("puts(", out);
+                    writeString(out, stringOf(nodeToken(ast, expr)->id));
+                    fputs(");\n", out);
+                }
+            }
+            break;
+
+        case AST_INPUT: {
+            const ASTNode* expr = astNode(ast, node->left);
+            indent(gen, level);
+            if (isVariableNode(ast, expr)) {
+                frameName(gen);
+                fprintf(out, "[%d] = spl_int(spl_input());\n", expr->slot);
+                break;
+            }
+            if (expr && printsValue(ast, expr)) {
+                fputs("spl_print(", out);
+                cExpression(gen, ast, node->left);
+                fputs(", \"\");\n", out);
+                indent(gen, level);
+            } else if (expr) {
+                fputs("fputs(", out);
+                writeString(out, stringOf(nodeToken(ast, expr)->id));
+                fputs(", stdout);\n", out);
+                indent(gen, level);
+            }
+            fputs("(void)spl_input();\n", out);
+            break;
+        }
+
+        case AST_IF_STATEMENT:
+            indent(gen, level);
+            fputs("if (spl_true(", out);
+            cExpression(gen, ast, node->left);
+            fputs(")) {\n", out);
+            cBlock(gen, ast, node->body, level + 1);
+            if (node->right) {
+                indent(gen, level);
+                fputs("} else {\n", out);
+                cBlock(gen, ast, node->right, level + 1);
+            }
+            indent(gen, level);
+            fputs("}\n", out);
+            break;
+
+        case AST_WHILE_LOOP:
+            indent(gen, level);
+            fputs("while (spl_true(", out);
+            cExpression(gen, ast, node->left);
+            fputs(")) {\n", out);
+            cBlock(gen, ast, node->body, level + 1);
+            indent(gen, level);
+            fputs("}\n", out);
+            break;
+
+        case AST_FOR_LOOP: {
+            // The start, end and step go to the hidden slots at node->slot once (spl_for()).
+            const ASTNode* init = astNode(ast, node->left);
+            const ASTNode* range = astNode(ast, node->right);
+            NodeIndex bounds[3] = { init->right, range->left, range->right };
+            for (int i = 0; i < 3; i++) {
+                indent(gen, level);
+                frameName(gen);
+                fprintf(out, "[%d] = ", node->slot + i);
+                if (bounds[i]) cExpression(gen, ast, bounds[i]);
+                else fputs("spl_int(1)", out);
+                fputs(";\n", out);
+            }
+            indent(gen, level);
+            fputs("if (spl_for(&", out);
+            frameName(gen);
+            fprintf(out, "[%d])) do {\n", node->slot);
+            indent(gen, level + 1);
+            frameName(gen);
+            fprintf(out, "[%d] = ", astNode(ast, init->left)->slot);
+            frameName(gen);
+            fprintf(out, "[%d];\n", node->slot);
+            cBlock(gen, ast, node->body, level + 1);
+            indent(gen, level);
+            fputs("} while (spl_next(&", out);
+            frameName(gen);
+            fprintf(out, "[%d]));\n", node->slot);
+            break;
+        }
+
+        case AST_RETURN:
+            if (isSelfCall(gen, ast, node->left)) {
+                cSelfCall(gen, ast, astNode(ast, node->left), level);
+            } else if (gen->depth > 0) {
+                indent(gen, level);
+                fputs("return ", out);
+                cExpression(gen, ast, node->left);
+                fputs(";\n", out);
+            } else if (containsCall(ast, node->left)) {
+                indent(gen, level);
+                fputs("(void)", out);
+                cExpression(gen, ast, node->left);
+                fputs(";\n", out);
+            }
+            break;
+
+        case AST_SPAWN:
+        case AST_SEND:
+            noTasks(gen, nodeToken(ast, node));
+            break;
+
+        case AST_PARALLEL_FOR:
+            unsupported(gen, nodeToken(ast, node), "parallel for is");
+            break;
+
+        case AST_EXPRESSION:
+        case AST_CALL:
+        case AST_RECV:
+        case AST_CHAN:
+            if (containsCall(ast, index)) {
+                indent(gen, level);
+                fputs("(void)", out);
+                cExpression(gen, ast, index);
+                fputs(";\n", out);
+            }
+            break;
+
+        default:
+            // loop and break do nothing
+            break;
+    }
+}
+
+static void cBlock(Codegen* gen, const AST* ast, BlockIndex block, int level) {
+    uint32_t count = blockCount(ast, block);
+    for (uint32_t i = 0; i < count; i++) {
+        cStatement(gen, ast, blockNodes(ast, block)[i], level);
+    }
+}
+
+static void copyOut(FILE* from, FILE* to) {
+    char buf[4096];
+    size_t n;
+    rewind(from);
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0) fwrite(buf, 1, n, to);
+}
+
+/*
+    A func becomes a C function taking its arguments as an array, written
+    at file scope ahead of run(); its body goes through a temporary file
+    first, since the temporaries it needs are only known at the end.
+*/
+static void cFunction(Codegen* gen, const AST* ast, NodeIndex func, int index) {
+    const ASTNode* node = astNode(ast, func);
+    uint32_t params = blockCount(ast, node->right);
+    int id = gen->functions++;
+    FILE* body = tmpfile();
+    if (!body) {
+        perror("tmpfile");
+        return;
+    }
+
+    gen->runTemps = gen->maxTemps;
+    gen->out = body;
+    gen->temps = gen->maxTemps = 0;
+    gen->depth = 1;
+    gen->self = index;
+    gen->selfParams = params;
+    gen->selfCalls = 0;
+    cBlock(gen, ast, node->body, 1);
+    gen->self = -1;
+
+    FILE* out = gen->file;
+    fprintf(out, "/* func %s */\n", stringOf(nodeToken(ast, node)->id));
+    fprintf(out, "static V spl_func%d(const V* A, int n) {\n", id);
+    fprintf(out, "    V L1[%d] = {0};\n    (void)L1;\n", node->slot > 0 ? node->slot : 1);
+    if (gen->maxTemps) fprintf(out, "    V T[%d];\n", gen->maxTemps);
+    if (params) {
+        fprintf(out, "    for (int i = 0; i < n && i < %u; i++) L1[i] = A[i];\n", params);
+    } else {
+        fputs("    (void)A;\n    (void)n;\n", out);
+    }
+    if (gen->selfCalls) fputs("top:\n", out);
+    copyOut(body, out);
+    fputs("    return 0;\n}\n\n", out);
+    fclose(body);
+
+    gen->out = gen->run;
+    gen->temps = 0;
+    gen->maxTemps = gen->runTemps;
+    gen->depth = 0;
+    fprintf(gen->out, "    spl_fn[%d] = spl_func%d;\n", index, id);
+    if (nodeToken(ast, node)->id == STR_MAIN) {
+        fprintf(gen->out, "    (void)spl_call(%d, 0, 0);\n", index);
+    }
+}
+
+/* ------------------------------------------------------------ x86-64 ---- */
+
+/*
+    A simple accumulator scheme: every expression leaves its value in eax,
+    left operands wait on the stack.  r12 points at the current frame
+    (top-level globals or the running function's frame).
+*/
+
+// setcc for a comparison, "" for arithmetic, NULL for anything else.
+static const char* asmCompare(uint32_t op) {
+    switch (op) {
+        case STR_PLUS: case STR_MINUS: case STR_STAR:
+        case STR_SLASH: case STR_PERCENT:
+            return "";
+        case STR_ASSIGN:
+        case STR_EQ: return "sete";
+        case STR_NE: return "setne";
+        case STR_LT: return "setl";
+        case STR_LE: return "setle";
+        case STR_GT: return "setg";
+        case STR_GE: return "setge";
+    }
+    return NULL;
+}
+
+// As cOpen(): a leaf is written whole, a call or operator is pushed (data[0]: its end label).
+static void asmOpen(Codegen* gen, ASTWalk* walk, const AST* ast, NodeIndex index) {
+    const ASTNode* node = astNode(ast, index);
+    FILE* out = gen->out;
+    if (!node) { fputs("    xor eax, eax\n", out); return; }
+
+    const Token* tok = nodeToken(ast, node);
+    if (tok->type == TOKEN_NUMBER) {
+        fprintf(out, "    mov eax, %d\n", (int)tok->number);
+        return;
+    }
+    if (tok->type == TOKEN_FLOAT || tok->type == TOKEN_STRING) {
+        fprintf(out, "    .error \"line %u: %s are not supported by --emit-asm\"\n", tok->line,
+                tok->type == TOKEN_FLOAT ? "floats" : "string values");
+        return;
+    }
+    if (isVariableNode(ast, node)) {
+        fprintf(out, "    mov eax, DWORD PTR [r12+%d]\n", node->slot * 4);
+        return;
+    }
+    if (node->nodeType == AST_RECV || node->nodeType == AST_CHAN) {
+        noTasks(gen, tok);
+        fputs("    xor eax, eax\n", out);
+        return;
+    }
+    if (node->nodeType != AST_CALL) {
+        if (!isBinary(ast, node) ||
+            (tok->id != STR_AND && tok->id != STR_OR && !asmCompare(tok->id))) {
+            fputs("    xor eax, eax\n", out);
+            return;
+        }
+    }
+    WalkFrame* frame = walkPush(walk, index);
+    if (node->nodeType != AST_CALL && (tok->id == STR_AND || tok->id == STR_OR)) {
+        frame->data[0] = gen->labels++;
+    }
+}
+
+static void asmStep(Codegen* gen, ASTWalk* walk, const AST* ast) {
+    WalkFrame* frame = walkTop(walk);
+    const ASTNode* node = astNode(ast, frame->node);
+    uint32_t step = frame->step++;
+    FILE* out = gen->out;
+
+    if (node->nodeType == AST_CALL) {
+        // Arguments are pushed in order; rsi points at the last one.
+        uint32_t count = blockCount(ast, node->body);
+        if (step > 0) fputs("    push rax\n", out);
+        if (step < count) {
+            asmOpen(gen, walk, ast, blockNodes(ast, node->body)[step]);
+            return;
+        }
+        walkPop(walk);
+        int missing = gen->labels++, done = gen->labels++;
+        fprintf(out, "    mov rax, QWORD PTR [rip+.Lfunctions+%d]\n"
+                     "    test rax, rax\n    jz .L%d\n", node->slot * 8, missing);
+        fprintf(out, "    mov edi, %u\n    mov rsi, rsp\n    call rax\n"
+                     "    jmp .L%d\n.L%d:\n    xor eax, eax\n.L%d:\n", count, done, missing, done);
+        if (count) fprintf(out, "    add rsp, %u\n", count * 8);
+        return;
+    }
+
+    uint32_t op = nodeToken(ast, node)->id;
+    if (op == STR_AND || op == STR_OR) {
+        int end = frame->data[0];
+        if (step == 0) {
+            asmOpen(gen, walk, ast, node->left);
+            return;
+        }
+        fputs("    test eax, eax\n    setne al\n    movzx eax, al\n", out);
+        if (step == 1) {
+            fprintf(out, "    %s .L%d\n", op == STR_AND ? "jz" : "jnz", end);
+            asmOpen(gen, walk, ast, node->right);
+            return;
+        }
+        walkPop(walk);
+        fprintf(out, ".L%d:\n", end);
+        return;
+    }
+
+    if (step == 0) {
+        asmOpen(gen, walk, ast, node->left);
+        return;
+    }
+    if (step == 1) {
+        fputs("    push rax\n", out);
+        asmOpen(gen, walk, ast, node->right);
+        return;
+    }
+    walkPop(walk);
+    fputs("    mov ecx, eax\n    pop rax\n", out);
+
+    const char* setcc = asmCompare(op);
+    if (*setcc) {
+        fprintf(out, "    cmp eax, ecx\n    %s al\n    movzx eax, al\n", setcc);
+        return;
+    }
+    switch (op) {
+        case STR_PLUS:  fputs("    add eax, ecx\n", out); break;
+        case STR_MINUS: fputs("    sub eax, ecx\n", out); break;
+        case STR_STAR:  fputs("    imul eax, ecx\n", out); break;
+        default: {
+            // x / 0 and x % -1 are 0, x / -1 is neg (idiv traps on INT_MIN / -1)
+            int zero = gen->labels++, done = gen->labels++, divide = gen->labels++;
+            fprintf(out, "    test ecx, ecx\n    jz .L%d\n    cmp ecx, -1\n    jne .L%d\n", zero, divide);
+            if (op == STR_PERCENT) fprintf(out, "    jmp .L%d\n", zero);
+            else fprintf(out, "    neg eax\n    jmp .L%d\n", done);
+            fprintf(out, ".L%d:\n    cdq\n    idiv ecx\n", divide);
+            if (op == STR_PERCENT) fputs("    mov eax, edx\n", out);
+            fprintf(out, "    jmp .L%d\n.L%d:\n    xor eax, eax\n.L%d:\n", done, zero, done);
+            break;
+        }
+    }
+}
+
+static void asmExpression(Codegen* gen, const AST* ast, NodeIndex index) {
+    ASTWalk walk;
+    walkInit(&walk);
+    asmOpen(gen, &walk, ast, index);
+    while (walk.depth) asmStep(gen, &walk, ast);
+    walkFree(&walk);
+}
+
+static void asmBlock(Codegen* gen, const AST* ast, BlockIndex block);
+
+// The arguments are pushed as for a call, then copied into the zeroed frame.
+static void asmSelfCall(Codegen* gen, const AST* ast, const ASTNode* call) {
+    FILE* out = gen->out;
+    uint32_t count = blockCount(ast, call->body);
+    for (uint32_t i = 0; i < count; i++) {
+        asmExpression(gen, ast, blockNodes(ast, call->body)[i]);
+        fputs("    push rax\n", out);
+    }
+    fprintf(out, "    mov rdi, r12\n    xor eax, eax\n    mov ecx, %d\n    rep stosd\n", gen->frameSize);
+    for (uint32_t i = 0; i < count && i < gen->selfParams; i++) {
+        fprintf(out, "    mov eax, DWORD PTR [rsp+%u]\n    mov DWORD PTR [r12+%u], eax\n",
+                (count - 1 - i) * 8, i * 4);
+    }
+    if (count) fprintf(out, "    add rsp, %u\n", count * 8);
+    fprintf(out, "    jmp .L%d\n", gen->topLabel);
+}
+
+static void asmStatement(Codegen* gen, const AST* ast, NodeIndex index) {
+    const ASTNode* node = astNode(ast, index);
+    FILE* out = gen->out;
+    if (!node) return;
+
+    switch (node->nodeType) {
+        case AST_FUNC_DEF:
+            // Top-level funcs go through codegenFunction(); nested ones define nothing.
+            break;
+
+        case AST_VAR_ASSIGN: {
+            const ASTNode* target = astNode(ast, node->left);
+            if (isVariableNode(ast, target)) {
+                asmExpression(gen, ast, node->right);
+                fprintf(out, "    mov DWORD PTR [r12+%d], eax\n", target->slot * 4);
+            }
+            break;
+        }
+
+        case AST_PRINT:
+            if (node->left) {
+                const ASTNode* expr = astNode(ast, node->left);
+                if (printsValue(ast, expr)) {
+                    asmExpression(gen, ast, node->left);
+                    fputs("    mov esi, eax\n    lea rdi, [rip+.Lint]\n"
+                          "    xor eax, eax\n    call printf@PLT\n", out);
+                } else {
+                    int str = gen->labels++;
+                    fprintf(out, "    .section .rodata\n.L%d:\n    .string ", str);
+                    writeString(out, stringOf(nodeToken(ast, expr)->id));
+                    fprintf(out, "\n    .text\n    lea rdi, [rip+.L%d]\n    call puts@PLT\n", str);
+                }
+            }
+            break;
+
+        case AST_INPUT: {
+            const ASTNode* expr = astNode(ast, node->left);
+            if (expr && !isVariableNode(ast, expr)) {
+                if (printsValue(ast, expr)) {
+                    asmExpression(gen, ast, node->left);
+                    fputs("    mov esi, eax\n    lea rdi, [rip+.Lnum]\n", out);
+                } else {
+                    int str = gen->labels++;
+                    fprintf(out, "    .section .rodata\n.L%d:\n    .string ", str);
+                    writeString(out, stringOf(nodeToken(ast, expr)->id));
+                    fprintf(out, "\n    .text\n    lea rsi, [rip+.L%d]\n    lea rdi, [rip+.Lstr]\n", str);
+                }
+                fputs("    xor eax, eax\n    call printf@PLT\n", out);
+            }
+            fputs("    call spl_input\n", out);
+            if (isVariableNode(ast, expr)) {
+                fprintf(out, "    mov DWORD PTR [r12+%d], eax\n", expr->slot * 4);
+            }
+            break;
+        }
+
+        case AST_IF_STATEMENT: {
+            int orElse = gen->labels++, end = gen->labels++;
+            asmExpression(gen, ast, node->left);
+            fprintf(out, "    test eax, eax\n    jz .L%d\n", orElse);
+            asmBlock(gen, ast, node->body);
+            fprintf(out, "    jmp .L%d\n.L%d:\n", end, orElse);
+            asmBlock(gen, ast, node->right);
+            fprintf(out, ".L%d:\n", end);
+            break;
+        }
+
+        case AST_WHILE_LOOP: {
+            int top = gen->labels++, end = gen->labels++;
+            fprintf(out, ".L%d:\n", top);
+            asmExpression(gen, ast, node->left);
+            fprintf(out, "    test eax, eax\n    jz .L%d\n", end);
+            asmBlock(gen, ast, node->body);
+            fprintf(out, "    jmp .L%d\n.L%d:\n", top, end);
+            break;
+        }
+
+        case AST_FOR_LOOP: {
+            // Counter, end and step in the slots at h; the next counter is worked out in
+            // 64 bits, the first time it is the start itself (forStart()/forNext() in value.h).
+            const ASTNode* init = astNode(ast, node->left);
+            const ASTNode* range = astNode(ast, node->right);
+            NodeIndex bounds[3] = { init->right, range->left, range->right };
+            int h = node->slot * 4;
+            int top = gen->labels++, check = gen->labels++, down = gen->labels++;
+            int store = gen->labels++, end = gen->labels++;
+            for (int i = 0; i < 3; i++) {
+                if (bounds[i]) asmExpression(gen, ast, bounds[i]);
+                else fputs("    mov eax, 1\n", out);
+                fprintf(out, "    mov DWORD PTR [r12+%d], eax\n", h + i * 4);
+            }
+            fprintf(out, "    movsxd rax, DWORD PTR [r12+%d]\n    jmp .L%d\n", h, check);
+            fprintf(out, ".L%d:\n    mov eax, DWORD PTR [r12+%d]\n    mov DWORD PTR [r12+%d], eax\n",
+                    top, h, astNode(ast, init->left)->slot * 4);
+            asmBlock(gen, ast, node->body);
+            fprintf(out, "    movsxd rax, DWORD PTR [r12+%d]\n    movsxd rcx, DWORD PTR [r12+%d]\n"
+                         "    add rax, rcx\n", h, h + 8);
+            fprintf(out, ".L%d:\n    movsxd rcx, DWORD PTR [r12+%d]\n    movsxd rdx, DWORD PTR [r12+%d]\n"
+                         "    test ecx, ecx\n    jz .L%d\n    js .L%d\n"
+                         "    cmp rax, rdx\n    jge .L%d\n    jmp .L%d\n"
+                         ".L%d:\n    cmp rax, rdx\n    jle .L%d\n"
+                         ".L%d:\n    mov DWORD PTR [r12+%d], eax\n    jmp .L%d\n.L%d:\n",
+                    check, h + 8, h + 4, end, down, end, store, down, end, store, h, top, end);
+            break;
+        }
+
+        case AST_RETURN:
+            if (isSelfCall(gen, ast, node->left)) {
+                asmSelfCall(gen, ast, astNode(ast, node->left));
+            } else if (gen->returnLabel >= 0) {
+                asmExpression(gen, ast, node->left);
+                fprintf(out, "    jmp .L%d\n", gen->returnLabel);
+            } else if (containsCall(ast, node->left)) {
+                asmExpression(gen, ast, node->left);
+            }
+            break;
+
+        case AST_SPAWN:
+        case AST_SEND:
+            noTasks(gen, nodeToken(ast, node));
+            break;
+
+        case AST_PARALLEL_FOR:
+            unsupported(gen, nodeToken(ast, node), "parallel for is");
+            break;
+
+        case AST_EXPRESSION:
+        case AST_CALL:
+        case AST_RECV:
+        case AST_CHAN:
+            if (containsCall(ast, index)) asmExpression(gen, ast, index);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void asmBlock(Codegen* gen, const AST* ast, BlockIndex block) {
+    uint32_t count = blockCount(ast, block);
+    for (uint32_t i = 0; i < count; i++) {
+        asmStatement(gen, ast, blockNodes(ast, block)[i]);
+    }
+}
+
+/*
+    A func is assembled where it is defined, with a jump around it.  It
+    gets a zeroed frame on the machine stack (aligned afresh, as calls may
+    come from the middle of an expression), copies its arguments in and
+    returns its value in eax.
+*/
+static void asmFunction(Codegen* gen, const AST* ast, NodeIndex func, int index) {
+    const ASTNode* node = astNode(ast, func);
+    FILE* out = gen->out;
+    uint32_t params = blockCount(ast, node->right);
+    int size = node->slot > 0 ? node->slot : 1;
+    int skip = gen->labels++, entry = gen->labels++, ret = gen->labels++, args = gen->labels++;
+
+    fprintf(out, "    jmp .L%d\n", skip);
+    fprintf(out, "# func %s: edi = argument count, rsi = the last argument\n.L%d:\n",
+            stringOf(nodeToken(ast, node)->id), entry);
+    fprintf(out, "    push rbp\n    mov rbp, rsp\n    push r12\n    and rsp, -16\n"
+                 "    sub rsp, %d\n    mov r12, rsp\n", (size * 4 + 15) & ~15);
+    fprintf(out, "    mov r8d, edi\n    mov r9, rsi\n    mov rdi, r12\n"
+                 "    xor eax, eax\n    mov ecx, %d\n    rep stosd\n", size);
+    for (uint32_t i = 0; i < params; i++) {
+        // Argument i is at [r9 + 8 * (count - 1 - i)]; missing ones stay 0.
+        fprintf(out, "    cmp r8d, %u\n    jle .L%d\n    mov eax, r8d\n    sub eax, %u\n"
+                     "    mov eax, DWORD PTR [r9+rax*8]\n    mov DWORD PTR [r12+%u], eax\n",
+                i, args, i + 1, i * 4);
+    }
+    fprintf(out, ".L%d:\n", args);
+
+    int outer = gen->returnLabel;
+    gen->returnLabel = ret;
+    gen->self = index;
+    gen->selfParams = params;
+    gen->topLabel = args;
+    gen->frameSize = size;
+    gen->depth++;
+    asmBlock(gen, ast, node->body);
+    gen->depth--;
+    gen->self = -1;
+    gen->returnLabel = outer;
+
+    fprintf(out, "    xor eax, eax\n.L%d:\n    mov r12, QWORD PTR [rbp-8]\n    leave\n    ret\n", ret);
+    fprintf(out, ".L%d:\n    lea rax, [rip+.L%d]\n    mov QWORD PTR [rip+.Lfunctions+%d], rax\n",
+            skip, entry, index * 8);
+    if (nodeToken(ast, node)->id == STR_MAIN) {
+        fprintf(out, "    xor edi, edi\n    call .L%d\n", entry);
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+// value.h, text.h and valueArith()/valueFormat() for the generated C file.
+static const char C_RUNTIME[] =
+    "typedef uint64_t V;    /* see value.h: ints, 0x0001 strings, doubles + 2^49 */\n"
+    "#define SPL_OFFSET (1ull << 49)\n"
+    "static inline V spl_int(int32_t i) { return (uint32_t)i; }\n"
+    "static inline int spl_both_int(V a, V b) { return ((a | b) >> 32) == 0; }\n"
+    "static inline int spl_is_str(V v) { return (v >> 48) == 1; }\n"
+    "static inline V spl_box(double d) {\n"
+    "    uint64_t bits;\n"
+    "    memcpy(&bits, &d, 8);\n"
+    "    if (d != d) bits = 0x7FF8000000000000ull;\n"
+    "    return bits + SPL_OFFSET;\n"
+    "}\n"
+    "static inline double spl_double(V v) {\n"
+    "    if ((v >> 32) == 0) return (int32_t)(uint32_t)v;\n"
+    "    uint64_t bits = v - SPL_OFFSET;\n"
+    "    double d;\n"
+    "    memcpy(&d, &bits, 8);\n"
+    "    return d;\n"
+    "}\n"
+    "\n"
+    "/* Strings (text.h): up to 5 bytes inline, else a flat text or a rope.\n"
+    "   Nothing is freed, the program ends soon enough. */\n"
+    "typedef struct { uint32_t length; V left, right; const char* chars; } SplText;\n"
+    "static inline SplText* spl_text(V v) { return (SplText*)(uintptr_t)(v & 0x7FFFFFFFFFFFull); }\n"
+    "static inline int spl_inline(V v) { return (v >> 47) == 3; }\n"
+    "static uint32_t spl_len(V v) { return spl_inline(v) ? (uint32_t)(v >> 40) & 7 : spl_text(v)->length; }\n"
+    "static V spl_new(const char* chars, uint32_t n, V left, V right) {\n"
+    "    SplText* t = (SplText*)malloc(sizeof(SplText));\n"
+    "    t->length = n; t->left = left; t->right = right; t->chars = chars;\n"
+    "    return (1ull << 48) | (uint64_t)(uintptr_t)t;\n"
+    "}\n"
+    "static V spl_str(const char* s, uint32_t n) {\n"
+    "    if (n > 5) return spl_new(s, n, 0, 0);\n"
+    "    V v = (3ull << 47) | ((uint64_t)n << 40);\n"
+    "    for (uint32_t i = 0; i < n; i++) v |= (uint64_t)(unsigned char)s[i] << (8 * i);\n"
+    "    return v;\n"
+    "}\n"
+    "static const char* spl_chars(V v, char* buf) {\n"
+    "    if (spl_inline(v)) {\n"
+    "        uint32_t n = spl_len(v);\n"
+    "        for (uint32_t i = 0; i < n; i++) buf[i] = (char)(v >> (8 * i));\n"
+    "        return buf;\n"
+    "    }\n"
+    "    SplText* t = spl_text(v);\n"
+    "    if (!t->chars) {\n"
+    "        char* out = (char*)malloc(t->length + 1);\n"
+    "        char* p = out;\n"
+    "        size_t depth = 0, capacity = 64;\n"
+    "        V* stack = (V*)malloc(sizeof(V) * capacity);\n"
+    "        stack[depth++] = v;\n"
+    "        while (depth) {\n"
+    "            V x = stack[--depth];\n"
+    "            if (!spl_inline(x) && !spl_text(x)->chars) {\n"
+    "                if (depth + 2 > capacity) stack = (V*)realloc(stack, sizeof(V) * (capacity *= 2));\n"
+    "                stack[depth++] = spl_text(x)->right;\n"
+    "                stack[depth++] = spl_text(x)->left;\n"
+    "                continue;\n"
+    "            }\n"
+    "            char small[8];\n"
+    "            uint32_t n = spl_len(x);\n"
+    "            memcpy(p, spl_chars(x, small), n);\n"
+    "            p += n;\n"
+    "        }\n"
+    "        free(stack);\n"
+    "        *p = '\\0';\n"
+    "        t->chars = out;\n"
+    "    }\n"
+    "    return t->chars;\n"
+    "}\n"
+    "static void spl_format(V v, char* text) {\n"
+    "    double d = spl_double(v);\n"
+    "    if ((v >> 32) == 0) sprintf(text, \"%d\", (int32_t)v);\n"
+    "    else if (isnan(d)) strcpy(text, \"nan\");\n"
+    "    else if (isinf(d)) strcpy(text, d < 0 ? \"-inf\" : \"inf\");\n"
+    "    else {\n"
+    "        sprintf(text, \"%.15g\", d);\n"
+    "        if (strtod(text, NULL) != d) sprintf(text, \"%.17g\", d);\n"
+    "        if (!strpbrk(text, \".e\")) strcat(text, \".0\");\n"
+    "    }\n"
+    "}\n"
+    "static V spl_number(V v) {\n"
+    "    char buf[32];\n"
+    "    spl_format(v, buf);\n"
+    "    size_t n = strlen(buf);\n"
+    "    return spl_str((const char*)memcpy(malloc(n + 1), buf, n + 1), (uint32_t)n);\n"
+    "}\n"
+    "static V spl_concat(V a, V b) {\n"
+    "    char small[8];\n"
+    "    if (!spl_is_str(a)) a = spl_number(a);\n"
+    "    if (!spl_is_str(b)) b = spl_number(b);\n"
+    "    uint32_t la = spl_len(a), lb = spl_len(b);\n"
+    "    if (la == 0) return b;\n"
+    "    if (lb == 0) return a;\n"
+    "    if (la + lb > 32) return spl_new(NULL, la + lb, a, b);\n"
+    "    char* s = (char*)malloc(la + lb + 1);\n"
+    "    memcpy(s, spl_chars(a, small), la);\n"
+    "    memcpy(s + la, spl_chars(b, small), lb);\n"
+    "    s[la + lb] = '\\0';\n"
+    "    return spl_str(s, la + lb);\n"
+    "}\n"
+    "static int spl_compare(V a, V b) {\n"
+    "    char sa[8], sb[8];\n"
+    "    uint32_t la = spl_len(a), lb = spl_len(b);\n"
+    "    int order = memcmp(spl_chars(a, sa), spl_chars(b, sb), la < lb ? la : lb);\n"
+    "    return order ? order : (la < lb ? -1 : la > lb);\n"
+    "}\n"
+    "static V spl_lit(int k, const char* s, uint32_t n) {\n"
+    "    static V* cache;\n"
+    "    static int capacity;\n"
+    "    if (k >= capacity) {\n"
+    "        int grown = capacity ? capacity : 16;\n"
+    "        while (grown <= k) grown *= 2;\n"
+    "        cache = (V*)realloc(cache, sizeof(V) * grown);\n"
+    "        memset(cache + capacity, 0, sizeof(V) * (grown - capacity));\n"
+    "        capacity = grown;\n"
+    "    }\n"
+    "    if (!cache[k]) cache[k] = spl_str(s, n);\n"
+    "    return cache[k];\n"
+    "}\n"
+    "static inline int spl_true(V v) {\n"
+    "    if ((v >> 32) == 0) return v != 0;\n"
+    "    if (spl_is_str(v)) return spl_len(v) != 0;\n"
+    "    return spl_double(v) != 0.0;\n"
+    "}\n"
+    "\n"
+    "/* valueArith(): a string is 0 to anything but +, and to comparisons with another string */\n"
+    "#define SPL_ARITH(name, i, d) \\\n"
+    "    static inline V name(V a, V b) { \\\n"
+    "        if (spl_both_int(a, b)) { int32_t x = (int32_t)a, y = (int32_t)b; return spl_int(i); } \\\n"
+    "        if (spl_is_str(a) || spl_is_str(b)) return name(spl_is_str(a) ? 0 : a, spl_is_str(b) ? 0 : b); \\\n"
+    "        double x = spl_double(a), y = spl_double(b); return d; \\\n"
+    "    }\n"
+    "#define SPL_COMPARE(name, cmp) \\\n"
+    "    SPL_ARITH(name##_n, x cmp y, spl_int(x cmp y)) \\\n"
+    "    static inline V name(V a, V b) { \\\n"
+    "        if (spl_is_str(a) && spl_is_str(b)) return spl_int(spl_compare(a, b) cmp 0); \\\n"
+    "        return name##_n(a, b); \\\n"
+    "    }\n"
+    "SPL_ARITH(spl_sub, x - y, spl_box(x - y))\n"
+    "SPL_ARITH(spl_mul, x * y, spl_box(x * y))\n"
+    "SPL_ARITH(spl_div, y == 0 ? 0 : y == -1 ? (int32_t)(0u - (uint32_t)x) : x / y, y != 0.0 ? spl_box(x / y) : 0)\n"
+    "SPL_ARITH(spl_mod, y != 0 && y != -1 ? x % y : 0, y != 0.0 ? spl_box(fmod(x, y)) : 0)\n"
+    "SPL_COMPARE(spl_eq, ==)\n"
+    "SPL_COMPARE(spl_ne, !=)\n"
+    "SPL_COMPARE(spl_lt, <)\n"
+    "SPL_COMPARE(spl_le, <=)\n"
+    "SPL_COMPARE(spl_gt, >)\n"
+    "SPL_COMPARE(spl_ge, >=)\n"
+    "static inline V spl_add(V a, V b) {\n"
+    "    if (spl_both_int(a, b)) return spl_int((int32_t)((uint32_t)a + (uint32_t)b));\n"
+    "    if (spl_is_str(a) || spl_is_str(b)) return spl_concat(a, b);\n"
+    "    return spl_box(spl_double(a) + spl_double(b));\n"
+    "}\n"
+    "/* forStart()/forNext() (value.h): a for's counter, end and step, made ints once */\n"
+    "static int32_t spl_loop_int(V v) {\n"
+    "    if ((v >> 32) == 0) return (int32_t)v;\n"
+    "    if (spl_is_str(v)) return 0;\n"
+    "    double d = spl_double(v);\n"
+    "    if (d != d) return 0;\n"
+    "    return d <= -2147483648.0 ? INT32_MIN : d >= 2147483647.0 ? INT32_MAX : (int32_t)d;\n"
+    "}\n"
+    "static int spl_for(V* loop) {\n"
+    "    for (int i = 0; i < 3; i++) loop[i] = spl_int(spl_loop_int(loop[i]));\n"
+    "    int32_t counter = (int32_t)loop[0], end = (int32_t)loop[1], step = (int32_t)loop[2];\n"
+    "    return step > 0 ? counter < end : step < 0 && counter > end;\n"
+    "}\n"
+    "static inline int spl_next(V* loop) {\n"
+    "    int32_t step = (int32_t)loop[2];\n"
+    "    int64_t next = (int64_t)(int32_t)loop[0] + step;\n"
+    "    if (step > 0 ? next >= (int32_t)loop[1] : next <= (int32_t)loop[1]) return 0;\n"
+    "    loop[0] = spl_int((int32_t)next);\n"
+    "    return 1;\n"
+    "}\n"
+    "static void spl_print(V v, const char* end) {\n"
+    "    char text[32];\n"
+    "    if (spl_is_str(v)) {\n"
+    "        fwrite(spl_chars(v, text), 1, spl_len(v), stdout);\n"
+    "        fputs(end, stdout);\n"
+    "        return;\n"
+    "    }\n"
+    "    spl_format(v, text);\n"
+    "    printf(\"%s%s\", text, end);\n"
+    "}\n\n";
+
+void codegenBegin(Codegen* gen, FILE* out, CodegenTarget target) {
+    gen->out      = out;
+    gen->file     = out;
+    gen->run      = NULL;
+    gen->target   = target;
+    gen->labels   = 0;
+    gen->depth    = 0;
+    gen->literals = 0;
+    gen->runTemps = 0;
+    gen->temps    = 0;
+    gen->maxTemps = 0;
+    gen->functions   = 0;
+    gen->returnLabel = -1;
+    gen->self        = -1;
+    gen->calls       = NULL;
+    gen->callCapacity = 0;
+
+    if (target == TARGET_C) {
+        fputs("/* Generated by freespl --emit-c */\n"
+              "#include <stdio.h>\n"
+              "#include <stdlib.h>\n"
+              "#include <stdint.h>\n"
+              "#include <string.h>\n"
+              "#include <math.h>\n\n", out);
+        fputs(C_RUNTIME, out);
+        fputs("static int spl_input(void) {\n"
+              "    char line[4096];\n"
+              "    fflush(stdout);\n"
+              "    if (!fgets(line, sizeof(line), stdin)) return 0;\n"
+              "    return atoi(line);\n"
+              "}\n\n"
+              "typedef V (*SplFn)(const V* args, int count);\n"
+              "extern SplFn spl_fn[];   /* by function index, set where each func is defined */\n"
+              "static V spl_call(int f, const V* args, int count) {\n"
+              "    return spl_fn[f] ? spl_fn[f](args, count) : 0;\n"
+              "}\n\n", out);
+        // run() comes last, after the functions defined along the way.
+        gen->run = gen->out = tmpfile();
+        if (!gen->run) {
+            perror("tmpfile");
+            gen->run = gen->out = out;
+        }
+    } else {
+        fputs("# Generated by freespl --emit-asm\n"
+              "    .intel_syntax noprefix\n"
+              "    .section .rodata\n"
+              ".Lint:\n"
+              "    .string \"%d\\n\"\n"
+              ".Lnum:\n"
+              "    .string \"%d\"\n"
+              ".Lstr:\n"
+              "    .string \"%s\"\n"
+              "    .text\n"
+              "# eax = the integer the next line of stdin starts with (0 at EOF)\n"
+              "spl_input:\n"
+              "    sub rsp, 8\n"
+              "    mov rdi, QWORD PTR stdout@GOTPCREL[rip]\n"
+              "    mov rdi, QWORD PTR [rdi]\n"
+              "    call fflush@PLT\n"
+              "    lea rdi, [rip+.Lline]\n"
+              "    mov BYTE PTR [rdi], 0\n"
+              "    mov esi, 4096\n"
+              "    mov rdx, QWORD PTR stdin@GOTPCREL[rip]\n"
+              "    mov rdx, QWORD PTR [rdx]\n"
+              "    call fgets@PLT\n"
+              "    lea rdi, [rip+.Lline]\n"
+              "    call atoi@PLT\n"
+              "    add rsp, 8\n"
+              "    ret\n"
+              "    .lcomm .Lline, 4096\n"
+              "    .globl main\n"
+              "    .type main, @function\n"
+              "main:\n"
+              "    push rbp\n"
+              "    mov rbp, rsp\n"
+              "    push r12\n"
+              "    sub rsp, 8\n"
+              "    lea r12, [rip+.G]\n", out);
+    }
+}
+
+void codegenStatement(Codegen* gen, const AST* ast, NodeIndex stmt) {
+    if (gen->target == TARGET_C) {
+        cStatement(gen, ast, stmt, 1);
+    } else {
+        asmStatement(gen, ast, stmt);
+    }
+}
+
+void codegenFunction(Codegen* gen, const AST* ast, NodeIndex func, int index) {
+    if (gen->target == TARGET_C) {
+        cFunction(gen, ast, func, index);
+    } else {
+        asmFunction(gen, ast, func, index);
+    }
+}
+
+void codegenEnd(Codegen* gen, int globals, int functions) {
+    if (globals < 1) globals = 1;
+    if (functions < 1) functions = 1;
+    if (gen->target == TARGET_C) {
+        FILE* out = gen->file;
+        fputs("static void run(V* G) {\n    (void)G;\n", out);
+        if (gen->maxTemps) fprintf(out, "    V T[%d];\n", gen->maxTemps);
+        if (gen->run != out) {
+            copyOut(gen->run, out);
+            fclose(gen->run);
+        }
+        gen->out = out;
+        fprintf(out,
+                "}\n\n"
+                "SplFn spl_fn[%d];\n\n"
+                "int main(void) {\n"
+                "    static V G[%d];\n"
+                "    run(G);\n"
+                "    return 0;\n"
+                "}\n", functions, globals);
+    } else {
+        fprintf(gen->out,
+                "    xor eax, eax\n"
+                "    add rsp, 8\n"
+                "    pop r12\n"
+                "    pop rbp\n"
+                "    ret\n"
+                "    .size main, .-main\n"
+                "    .lcomm .G, %d\n"
+                "    .lcomm .Lfunctions, %d\n"
+                "    .section .note.GNU-stack,\"\",@progbits\n", globals * 4, functions * 8);
+    }
+    free(gen->calls);
+    gen->calls = NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "parser.h"
+#include <stdio.h>
+
+/*
+    Ahead-of-time backends.  Resolved top-level statements (see resolver.h)
+    are translated one at a time, as they are parsed, into a standalone C
+    or x86-64 (GNU as, Intel syntax) translation unit that behaves exactly
+    like the interpreter.  Top-level variables live in one static array
+    whose size is only known at the end, which codegenEnd() writes out.
+    Functions are reached through a table indexed like the interpreter's
+    (resolver.h), filled in where each definition runs, so calling one
+    before its definition gives 0 here too.
+*/
+typedef enum {
+    TARGET_C,
+    TARGET_ASM
+} CodegenTarget;
+
+typedef struct {
+    FILE*         out;
+    CodegenTarget target;
+    int           labels;   // next free local label
+    int           depth;    // function nesting, 0 = top level
+    int           literals; // next string literal cache slot (C)
+    FILE*         file;     // the output; 'out' is where the current code goes
+    FILE*         run;      // body of the top-level code, copied out at the end (C)
+    int           runTemps; // its temporaries (C)
+    int           temps;    // next free temporary T[i] of the code being written (C)
+    int           maxTemps;
+    int           functions; // C functions written so far
+    int           returnLabel; // epilogue of the function being written, -1 outside (asm)
+    int           self;     // function index of the func being written, -1 outside
+    uint32_t      selfParams; // its parameter count
+    int           topLabel; // its body, where a tail call to itself jumps (asm)
+    int           frameSize; // its frame, in slots (asm)
+    int           selfCalls; // tail calls to itself written so far (C)
+    uint8_t*      calls;    // by node: contains a call, for the expression being written (C)
+    uint32_t      callCapacity;
+} Codegen;
+
+void codegenBegin(Codegen* gen, FILE* out, CodegenTarget target);
+void codegenStatement(Codegen* gen, const AST* ast, NodeIndex stmt);
+// A top-level func with function index 'index'; main is also called.
+void codegenFunction(Codegen* gen, const AST* ast, NodeIndex func, int index);
+void codegenEnd(Codegen* gen, int globals, int functions);
+
+#endif // CODEGEN_H
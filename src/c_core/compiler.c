@@ -0,0 +1,675 @@
+// compiler.c
+#include "compiler.h"
+#include "token.h"
+#include "resolver.h"
+#include "profile.h"
+#include "text.h"
+#include "jit.h"
+#include "io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_REGISTERS 65535
+
+/*
+    The compiler mirrors the semantics of the tree walker in executor.c
+    exactly (so the two can be diffed against each other), but resolves
+    every operator string and literal once, at compile time.
+*/
+
+typedef struct {
+    const AST*     ast;
+    Chunk*         chunk;
+    CompilerError* error;
+    int            base;    // register holding slot 0 of the current frame
+    int            temps;   // first register free for temporaries
+    int            profile; // bracket statements with OP_ENTER/OP_LEAVE
+    uint32_t       function; // enclosing func's name id, for the profiler
+    uint32_t       line;    // of the statement being compiled, for errors
+    int            inFunction; // compiling a function body: return returns
+    int            entered; // OP_ENTERs not yet left, closed by a return
+} Compiler;
+
+static int emit(Compiler* c, uint8_t op, int a, int32_t sx) {
+    Chunk* chunk = c->chunk;
+    if (chunk->count == chunk->capacity) {
+        chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 64;
+        chunk->code = (Instr*)realloc(chunk->code, sizeof(Instr) * chunk->capacity);
+    }
+    Instr* in = &chunk->code[chunk->count];
+    in->op = op;
+    in->a  = (uint16_t)a;
+    in->sx = sx;
+    return chunk->count++;
+}
+
+static int addConstant(Compiler* c, Value value) {
+    Chunk* chunk = c->chunk;
+    for (int i = 0; i < chunk->constantCount; i++) {
+        if (chunk->constants[i] == value) return i;
+    }
+    if (chunk->constantCount == chunk->constantCapacity) {
+        chunk->constantCapacity = chunk->constantCapacity ? chunk->constantCapacity * 2 : 8;
+        chunk->constants = (Value*)realloc(chunk->constants, sizeof(Value) * chunk->constantCapacity);
+    }
+    chunk->constants[chunk->constantCount] = value;
+    return chunk->constantCount++;
+}
+
+static int emitABC(Compiler* c, uint8_t op, int a, int b, int rc) {
+    int at = emit(c, op, a, 0);
+    c->chunk->code[at].b = (uint16_t)b;
+    c->chunk->code[at].c = (uint16_t)rc;
+    return at;
+}
+
+// Point the jump at 'at' to the next instruction to be emitted.
+static void patchJump(Compiler* c, int at) {
+    c->chunk->code[at].sx = c->chunk->count - (at + 1);
+}
+
+static void emitLoop(Compiler* c, int target) {
+    emit(c, OP_JMP, 0, target - (c->chunk->count + 1));
+}
+
+static int useRegister(Compiler* c, int reg) {
+    if (reg >= MAX_REGISTERS) {
+        c->error->line = (int)c->line;
+        snprintf(c->error->message, sizeof(c->error->message),
+                 "Expression too deeply nested (register limit %d)", MAX_REGISTERS);
+        return 0;
+    }
+    if (reg + 1 > c->chunk->nregs) c->chunk->nregs = reg + 1;
+    return 1;
+}
+
+static uint8_t binaryOpcode(uint32_t op) {
+    switch (op) {
+        case STR_PLUS:    return OP_ADD;
+        case STR_MINUS:   return OP_SUB;
+        case STR_STAR:    return OP_MUL;
+        case STR_SLASH:   return OP_DIV;
+        case STR_PERCENT: return OP_MOD;
+        case STR_ASSIGN:
+        case STR_EQ:      return OP_EQ;
+        case STR_NE:      return OP_NE;
+        case STR_LT:      return OP_LT;
+        case STR_LE:      return OP_LE;
+        case STR_GT:      return OP_GT;
+        case STR_GE:      return OP_GE;
+    }
+    return OP_HALT;
+}
+
+static int isBinary(const Compiler* c, const ASTNode* node) {
+    return node->left && node->right && nodeToken(c->ast, node)->type == TOKEN_OPERATOR;
+}
+
+static int compileInto(Compiler* c, NodeIndex index, int dst, int temp);
+
+/*
+    exprToReg: return the register holding the value of 'node'.  Variables
+    are read in place; anything else is computed into 'temp' (registers from
+    'temp' up are scratch).  Returns -1 on error.
+*/
+static int exprToReg(Compiler* c, NodeIndex index, int temp) {
+    const ASTNode* node = astNode(c->ast, index);
+    if (isVariableNode(c->ast, node)) return c->base + node->slot;
+    return compileInto(c, index, temp, temp) ? temp : -1;
+}
+
+static int checkFunction(Compiler* c, const ASTNode* call) {
+    if (call->slot <= UINT16_MAX) return 1;
+    c->error->line = (int)c->line;
+    snprintf(c->error->message, sizeof(c->error->message),
+             "Too many functions (limit %d)", UINT16_MAX + 1);
+    return 0;
+}
+
+/*
+    The arguments of a call, left to right, into consecutive registers from
+    'first': the callee's frame starts there, so they become its parameters
+    without being copied.
+*/
+static int compileArguments(Compiler* c, const ASTNode* call, int first) {
+    uint32_t count = blockCount(c->ast, call->body);
+    if (!checkFunction(c, call)) return 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!compileInto(c, blockNodes(c->ast, call->body)[i], first + i, first + i)) return 0;
+    }
+    return useRegister(c, first + count);
+}
+
+// An operand: a variable is read where it is, anything else goes on the walk
+// to be computed into 'temp' first.
+static void pushOperand(Compiler* c, ASTWalk* walk, NodeIndex index, int temp) {
+    if (isVariableNode(c->ast, astNode(c->ast, index))) return;
+    WalkFrame* frame = walkPush(walk, index);
+    frame->data[0] = frame->data[1] = temp;
+}
+
+static int operandRegister(Compiler* c, NodeIndex index, int temp) {
+    const ASTNode* node = astNode(c->ast, index);
+    return isVariableNode(c->ast, node) ? c->base + node->slot : temp;
+}
+
+/*
+    compileInto: evaluate 'node' into register 'dst'.  Operands are evaluated
+    into scratch registers first, so 'dst' may be a variable the expression
+    itself reads (x = x + 1).
+
+    Operands are compiled on a walk: a frame holds the node, its 'dst' and
+    'temp', and the jump of a short-circuit operator, and its step counts
+    the operands done.
+*/
+static int compileInto(Compiler* c, NodeIndex index, int dst, int temp) {
+    ASTWalk walk;
+    walkInit(&walk);
+    WalkFrame* root = walkPush(&walk, index);
+    root->data[0] = dst;
+    root->data[1] = temp;
+    int ok = 1;
+
+    while (ok && walk.depth) {
+        WalkFrame* frame = walkTop(&walk);
+        const ASTNode* node = astNode(c->ast, frame->node);
+        dst  = frame->data[0];
+        temp = frame->data[1];
+        uint32_t step = frame->step++;
+        if (step == 0 && (!useRegister(c, dst) || !useRegister(c, temp + 1))) {
+            ok = 0;
+            break;
+        }
+
+        if (!node) {
+            emit(c, OP_LOADI, dst, 0);
+            walkPop(&walk);
+            continue;
+        }
+        const Token* tok = nodeToken(c->ast, node);
+        if (tok->type == TOKEN_NUMBER) {
+            emit(c, OP_LOADI, dst, (int32_t)tok->number);
+        } else if (tok->type == TOKEN_FLOAT) {
+            emit(c, OP_LOADK, dst, addConstant(c, valueDouble(tok->real)));
+        } else if (tok->type == TOKEN_STRING) {
+            // Literals stay alive for the whole run, so the chunk only borrows them.
+            emit(c, OP_LOADK, dst, addConstant(c, textLiteral(tok->id)));
+        } else if (isVariableNode(c->ast, node)) {
+            int src = c->base + node->slot;
+            if (src != dst) emitABC(c, OP_MOV, dst, src, 0);
+
+        } else if (node->nodeType == AST_CALL) {
+            // Argument i goes into temp + i, where the callee's frame will start.
+            uint32_t count = blockCount(c->ast, node->body);
+            if (step == 0 && !checkFunction(c, node)) {
+                ok = 0;
+                break;
+            }
+            if (step < count) {
+                WalkFrame* arg = walkPush(&walk, blockNodes(c->ast, node->body)[step]);
+                arg->data[0] = arg->data[1] = temp + (int)step;
+                continue;
+            }
+            if (!useRegister(c, temp + (int)count)) {
+                ok = 0;
+                break;
+            }
+            emitABC(c, OP_CALL, temp, node->slot, count);
+            if (dst != temp) emitABC(c, OP_MOV, dst, temp, 0);
+
+        } else if (node->nodeType == AST_RECV || node->nodeType == AST_CHAN) {
+            // chan() has no capacity: 0.
+            if (step == 0 && node->left) {
+                pushOperand(c, &walk, node->left, temp);
+                continue;
+            }
+            int operand = temp;
+            if (node->left) operand = operandRegister(c, node->left, temp);
+            else emit(c, OP_LOADI, temp, 0);
+            emitABC(c, node->nodeType == AST_RECV ? OP_RECV : OP_CHAN, dst, operand, 0);
+
+        } else if (isBinary(c, node) && (tok->id == STR_AND || tok->id == STR_OR)) {
+            // Short-circuit: the result is built in 'temp' so 'dst' may be an operand.
+            if (step == 0) {
+                pushOperand(c, &walk, node->left, temp);
+                continue;
+            }
+            if (step == 1) {
+                emitABC(c, OP_TEST, temp, operandRegister(c, node->left, temp), 0);
+                frame->data[2] = emit(c, tok->id == STR_AND ? OP_JMPF : OP_JMPT, temp, 0);
+                pushOperand(c, &walk, node->right, temp);
+                continue;
+            }
+            emitABC(c, OP_TEST, temp, operandRegister(c, node->right, temp), 0);
+            patchJump(c, frame->data[2]);
+            if (dst != temp) emitABC(c, OP_MOV, dst, temp, 0);
+
+        } else if (isBinary(c, node) && binaryOpcode(tok->id) != OP_HALT) {
+            if (step == 0) {
+                pushOperand(c, &walk, node->left, temp);
+                continue;
+            }
+            if (step == 1) {
+                pushOperand(c, &walk, node->right, temp + 1);
+                continue;
+            }
+            emitABC(c, binaryOpcode(tok->id), dst, operandRegister(c, node->left, temp),
+                    operandRegister(c, node->right, temp + 1));
+        } else {
+            // Unknown operators evaluate to 0 in the walker; operands are side-effect free.
+            emit(c, OP_LOADI, dst, 0);
+        }
+        walkPop(&walk);
+    }
+    walkFree(&walk);
+    return ok;
+}
+
+// A statement without blocks of its own: its code in one go.
+static int compileSimple(Compiler* c, NodeIndex index) {
+    const ASTNode* node = astNode(c->ast, index);
+    switch (node->nodeType) {
+        case AST_FUNC_DEF:
+            // Top-level functions are compiled on their own (compileFunction);
+            // a func nested in a block defines nothing.
+            return 1;
+
+        case AST_VAR_ASSIGN: {
+            const ASTNode* target = astNode(c->ast, node->left);
+            if (isVariableNode(c->ast, target)) {
+                return compileInto(c, node->right, c->base + target->slot, c->temps);
+            }
+            return compileInto(c, node->right, c->temps, c->temps);
+        }
+
+        case AST_PRINT: {
+            const ASTNode* expr = astNode(c->ast, node->left);
+            if (!expr) return 1;
+            const Token* tok = nodeToken(c->ast, expr);
+            if (isBinary(c, expr) || isVariableNode(c->ast, expr) || isNumberToken(tok) ||
+                hasEffects(expr)) {
+                int reg = exprToReg(c, node->left, c->temps);
+                if (reg < 0) return 0;
+                emit(c, OP_PRINT, reg, 0);
+            } else {
+                // Strings and names are printed verbatim, as the walker does.
+                emit(c, OP_PRINTS, 0, tok->id);
+            }
+            return 1;
+        }
+
+        case AST_INPUT: {
+            const ASTNode* expr = astNode(c->ast, node->left);
+            if (isVariableNode(c->ast, expr)) {
+                emit(c, OP_INPUT, c->base + expr->slot, 0);
+                return 1;
+            }
+            if (expr) {
+                const Token* tok = nodeToken(c->ast, expr);
+                if (isBinary(c, expr) || isNumberToken(tok) || hasEffects(expr)) {
+                    int reg = exprToReg(c, node->left, c->temps);
+                    if (reg < 0) return 0;
+                    emit(c, OP_PROMPT, reg, 0);
+                } else {
+                    emit(c, OP_PROMPTS, 0, tok->id);
+                }
+            }
+            // The line is read and thrown away.
+            if (!useRegister(c, c->temps)) return 0;
+            emit(c, OP_INPUT, c->temps, 0);
+            return 1;
+        }
+
+        case AST_RETURN: {
+            const ASTNode* expr = astNode(c->ast, node->left);
+            if (!c->inFunction) {
+                // Outside a function there is nothing to return from.
+                if (!containsCall(c->ast, node->left)) return 1;
+                return compileInto(c, node->left, c->temps, c->temps);
+            }
+            if (expr && expr->nodeType == AST_CALL) {
+                // A call in tail position replaces this call instead of nesting in it.
+                if (!compileArguments(c, expr, c->temps)) return 0;
+                for (int i = 0; i < c->entered; i++) emit(c, OP_LEAVE, 0, 0);
+                emitABC(c, OP_TAILCALL, c->temps, expr->slot, blockCount(c->ast, expr->body));
+                return 1;
+            }
+            int reg = exprToReg(c, node->left, c->temps);
+            if (reg < 0) return 0;
+            for (int i = 0; i < c->entered; i++) emit(c, OP_LEAVE, 0, 0);
+            emit(c, OP_RET, reg, 0);
+            return 1;
+        }
+
+        case AST_SPAWN: {
+            // The arguments are evaluated here, where the task's frame is copied from.
+            const ASTNode* call = astNode(c->ast, node->left);
+            if (!compileArguments(c, call, c->temps)) return 0;
+            emitABC(c, OP_SPAWN, c->temps, call->slot, blockCount(c->ast, call->body));
+            return 1;
+        }
+
+        case AST_SEND: {
+            if (!useRegister(c, c->temps + 1)) return 0;
+            int channel = exprToReg(c, node->left, c->temps);
+            if (channel < 0) return 0;
+            int value = exprToReg(c, node->right, c->temps + 1);
+            if (value < 0) return 0;
+            emitABC(c, OP_SEND, channel, value, 0);
+            return 1;
+        }
+
+        case AST_EXPRESSION:
+        case AST_CALL:
+        case AST_RECV:
+        case AST_CHAN:
+            // Only calls and channels have side effects; anything else is not worth evaluating.
+            if (!containsCall(c->ast, index)) return 1;
+            return compileInto(c, index, c->temps, c->temps);
+
+        case AST_REDUCE:
+            return compileSimple(c, node->left);
+
+        case AST_LOOP:
+        case AST_BREAK:
+            return 1;
+
+        default: {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "[UNSUPPORTED NODE TYPE: %d]", node->nodeType);
+            emit(c, OP_PRINTS, 0, intern(msg, strlen(msg)));
+            return 1;
+        }
+    }
+}
+
+// A parallel for's entry in the chunk, for OP_PARFOR; -1 past the limit.
+static int addParallel(Compiler* c, NodeIndex index) {
+    Chunk* chunk = c->chunk;
+    if (chunk->parallelCount > UINT16_MAX) {
+        c->error->line = (int)c->line;
+        snprintf(c->error->message, sizeof(c->error->message),
+                 "Too many parallel for loops (limit %d)", UINT16_MAX + 1);
+        return -1;
+    }
+    chunk->parallels = (ParallelLoop*)realloc(chunk->parallels, sizeof(ParallelLoop) * (chunk->parallelCount + 1));
+    ParallelLoop* loop = &chunk->parallels[chunk->parallelCount];
+    loop->next      = 0;
+    loop->unordered = nodeToken(c->ast, astNode(c->ast, index))->id == STR_UNORDERED;
+    loop->reductionCount = findReductions(c->ast, index, &loop->reductions);
+    for (int i = 0; i < loop->reductionCount; i++) loop->reductions[i].slot += c->base;
+    return chunk->parallelCount++;
+}
+
+// --profile: a statement's code goes between OP_ENTER and OP_LEAVE.
+static int isProfiled(const Compiler* c, NodeIndex index) {
+    return c->profile && astNode(c->ast, index)->nodeType != AST_FUNC_DEF;   // defines, never runs
+}
+
+static void enterStatement(Compiler* c, NodeIndex index) {
+    emit(c, OP_ENTER, 0, (int32_t)profileSite(c->ast, index, c->function));
+    c->entered++;
+}
+
+static void leaveStatement(Compiler* c) {
+    c->entered--;
+    emit(c, OP_LEAVE, 0, 0);
+}
+
+/*
+    Put the next statement of 'block' on the walk, data[2] of the frame on
+    top counting those done.  Returns 0 when the block is finished.
+*/
+static int nextStatement(Compiler* c, ASTWalk* walk, BlockIndex block) {
+    WalkFrame* frame = walkTop(walk);
+    uint32_t i = (uint32_t)frame->data[2];
+    const NodeIndex* stmts = blockNodes(c->ast, block);
+    if (i > 0 && isProfiled(c, stmts[i - 1])) leaveStatement(c);
+    if (i == blockCount(c->ast, block)) return 0;
+    frame->data[2] = (int32_t)i + 1;
+    if (isProfiled(c, stmts[i])) enterStatement(c, stmts[i]);
+    walkPush(walk, stmts[i]);
+    return 1;
+}
+
+/*
+    Ifs and loops stay on the walk while their blocks are compiled: step
+    is 1 in the then-branch or loop body, 2 in the else-branch, data[0] is
+    the jump past the branch, data[1] the jump over the else-branch or the
+    loop's top.
+
+    A for keeps its counter, end and step in the registers of its own
+    slots: the loop is OP_FORPREP, then the body, which starts by copying
+    the counter into the variable, and OP_FORLOOP back to it.  Nothing in
+    the loop's test is evaluated as an expression.  A parallel for is laid
+    out the same way with OP_PARFOR and OP_PARNEXT; the body is only ever
+    run by its chunks.
+*/
+static int compileStatement(Compiler* c, NodeIndex index) {
+    ASTWalk walk;
+    walkInit(&walk);
+    walkPush(&walk, index);
+    int ok = 1;
+
+    while (ok && walk.depth) {
+        WalkFrame* frame = walkTop(&walk);
+        const ASTNode* node = astNode(c->ast, frame->node);
+        if (frame->step == 0) c->line = nodeLine(c->ast, node);
+
+        if (node->nodeType == AST_IF_STATEMENT) {
+            if (frame->step == 0) {
+                int cond = exprToReg(c, node->left, c->temps);
+                if (cond < 0) { ok = 0; break; }
+                frame->data[0] = emit(c, OP_JMPF, cond, 0);
+                frame->data[2] = 0;
+                frame->step = 1;
+            }
+            if (frame->step == 1) {
+                if (nextStatement(c, &walk, node->body)) continue;
+                if (node->right) {
+                    frame->data[1] = emit(c, OP_JMP, 0, 0);
+                    patchJump(c, frame->data[0]);
+                    frame->data[2] = 0;
+                    frame->step = 2;
+                    continue;
+                }
+                patchJump(c, frame->data[0]);
+            } else {
+                if (nextStatement(c, &walk, node->right)) continue;
+                patchJump(c, frame->data[1]);
+            }
+
+        } else if (node->nodeType == AST_WHILE_LOOP) {
+            if (frame->step == 0) {
+                frame->data[1] = c->chunk->count;
+                int cond = exprToReg(c, node->left, c->temps);
+                if (cond < 0) { ok = 0; break; }
+                frame->data[0] = emit(c, OP_JMPF, cond, 0);
+                frame->data[2] = 0;
+                frame->step = 1;
+            }
+            if (nextStatement(c, &walk, node->body)) continue;
+            emitLoop(c, frame->data[1]);
+            patchJump(c, frame->data[0]);
+
+        } else if (isForLoop(node)) {
+            const ASTNode* init  = astNode(c->ast, node->left);
+            const ASTNode* range = astNode(c->ast, node->right);
+            int loop = c->base + node->slot;
+            int parallel = node->nodeType == AST_PARALLEL_FOR;
+            if (frame->step == 0) {
+                if (!compileInto(c, init->right, loop, c->temps) ||
+                    !compileInto(c, range->left, loop + 1, c->temps)) { ok = 0; break; }
+                if (!range->right) emit(c, OP_LOADI, loop + 2, 1);
+                else if (!compileInto(c, range->right, loop + 2, c->temps)) { ok = 0; break; }
+                if (parallel) {
+                    int at = addParallel(c, frame->node);
+                    if (at < 0) { ok = 0; break; }
+                    frame->data[0] = emitABC(c, OP_PARFOR, loop, at, 0);
+                } else {
+                    frame->data[0] = emit(c, OP_FORPREP, loop, 0);
+                }
+                frame->data[1] = emitABC(c, OP_MOV, c->base + astNode(c->ast, init->left)->slot, loop, 0);
+                frame->data[2] = 0;
+                frame->step = 1;
+            }
+            if (nextStatement(c, &walk, node->body)) continue;
+            if (parallel) {
+                emit(c, OP_PARNEXT, loop, frame->data[1] - (c->chunk->count + 1));
+                c->chunk->parallels[c->chunk->code[frame->data[0]].b].next = c->chunk->count;
+            } else {
+                emit(c, OP_FORLOOP, loop, frame->data[1] - (c->chunk->count + 1));
+                patchJump(c, frame->data[0]);
+            }
+
+        } else if (!compileSimple(c, frame->node)) {
+            ok = 0;
+            break;
+        }
+        walkPop(&walk);
+    }
+    walkFree(&walk);
+    return ok;
+}
+
+static int compileProfiled(Compiler* c, NodeIndex index) {
+    if (!isProfiled(c, index)) return 1;
+    enterStatement(c, index);
+    if (!compileStatement(c, index)) return 0;
+    leaveStatement(c);
+    return 1;
+}
+
+static int compileBlock(Compiler* c, BlockIndex block) {
+    uint32_t count = blockCount(c->ast, block);
+    const NodeIndex* stmts = blockNodes(c->ast, block);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!(c->profile ? compileProfiled(c, stmts[i]) : compileStatement(c, stmts[i]))) return 0;
+    }
+    return 1;
+}
+
+Chunk* compile(const AST* ast, NodeIndex stmt, int globals, int profile, CompilerError* error) {
+    Chunk* chunk = (Chunk*)calloc(1, sizeof(Chunk));
+    Compiler c = { ast, chunk, error, 0, globals, profile, PROFILE_TOP_LEVEL, 0, 0, 0 };
+    chunk->nregs = globals;
+    error->line = error->column = 0;
+    error->message[0] = '\0';
+
+    if (stmt && !(profile ? compileProfiled(&c, stmt) : compileStatement(&c, stmt))) {
+        freeChunk(chunk);
+        return NULL;
+    }
+    emit(&c, OP_HALT, 0, 0);
+    if (chunk->nregs == 0) chunk->nregs = 1;
+    return chunk;
+}
+
+Chunk* compileFunction(const AST* ast, NodeIndex func, int profile, CompilerError* error) {
+    const ASTNode* node = astNode(ast, func);
+    Chunk* chunk = (Chunk*)calloc(1, sizeof(Chunk));
+    Compiler c = { ast, chunk, error, 0, node->slot, profile, nodeToken(ast, node)->id,
+                   nodeLine(ast, node), 1, 0 };
+    chunk->params = (int)blockCount(ast, node->right);
+    chunk->frame  = node->slot;
+    chunk->nregs  = node->slot;
+    error->line = error->column = 0;
+    error->message[0] = '\0';
+
+    // Every call enters the definition's site: its count is the call count.
+    if (profile) {
+        emit(&c, OP_ENTER, 0, (int32_t)profileSite(ast, func, c.function));
+        c.entered = 1;
+    }
+    if (!compileBlock(&c, node->body) || !useRegister(&c, c.temps)) {
+        freeChunk(chunk);
+        return NULL;
+    }
+    if (profile) emit(&c, OP_LEAVE, 0, 0);
+    emit(&c, OP_LOADI, c.temps, 0);
+    emit(&c, OP_RET, c.temps, 0);
+    return chunk;
+}
+
+Chunk* compileCall(int function, int globals) {
+    Chunk* chunk = (Chunk*)calloc(1, sizeof(Chunk));
+    CompilerError error;
+    Compiler c = { NULL, chunk, &error, 0, globals, 0, PROFILE_TOP_LEVEL, 0, 0, 0 };
+    chunk->nregs = globals + 1;
+    emitABC(&c, OP_CALL, globals, function, 0);
+    emit(&c, OP_HALT, 0, 0);
+    return chunk;
+}
+
+void freeChunk(Chunk* chunk) {
+    if (!chunk) return;
+    if (chunk->loops) {
+        for (int i = 0; i < chunk->count; i++) jitFree(chunk->loops[i]);
+    }
+    for (int i = 0; i < chunk->parallelCount; i++) free(chunk->parallels[i].reductions);
+    free(chunk->parallels);
+    free(chunk->hits);
+    free(chunk->loops);
+    free(chunk->code);
+    free(chunk->constants);
+    free(chunk);
+}
+
+void functionUndefined(Function* function) {
+    if (function->warned) return;
+    function->warned = 1;
+    ioFlush();
+    fprintf(ioErr(), "[WARNING] Call to undefined function '%s' gives 0\n", stringOf(function->name));
+}
+
+static const char* opcodeNames[OP_COUNT] = {
+    "HALT", "LOADI", "LOADK", "MOV", "ADD", "SUB", "MUL", "DIV", "MOD",
+    "EQ", "NE", "LT", "LE", "GT", "GE", "TEST",
+    "JMP", "JMPF", "JMPT", "PRINT", "PRINTS", "INPUT", "PROMPT", "PROMPTS",
+    "ENTER", "LEAVE", "CALL", "TAILCALL", "RET", "SPAWN", "CHAN", "SEND", "RECV",
+    "FORPREP", "FORLOOP", "PARFOR", "PARNEXT"
+};
+
+void disassembleChunk(const Chunk* chunk) {
+    printf("[BYTECODE] %d instructions, %d registers\n", chunk->count, chunk->nregs);
+    for (int i = 0; i < chunk->count; i++) {
+        const Instr* in = &chunk->code[i];
+        printf("%04d  %-7s", i, opcodeNames[in->op]);
+        switch (in->op) {
+            case OP_LOADI:  printf("r%d, %d\n", in->a, in->sx); break;
+            case OP_LOADK: {
+                char text[32];
+                valueFormat(chunk->constants[in->sx], text, sizeof(text));
+                printf("r%d, k%d (%s)\n", in->a, in->sx, text);
+                break;
+            }
+            case OP_MOV:    printf("r%d, r%d\n", in->a, in->b); break;
+            case OP_TEST:   printf("r%d, r%d\n", in->a, in->b); break;
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            case OP_EQ:  case OP_NE:  case OP_LT:  case OP_LE:  case OP_GT: case OP_GE:
+                printf("r%d, r%d, r%d\n", in->a, in->b, in->c); break;
+            case OP_JMP:    printf("-> %04d\n", i + 1 + in->sx); break;
+            case OP_JMPF:
+            case OP_JMPT:
+            case OP_FORPREP:
+            case OP_FORLOOP:
+            case OP_PARNEXT: printf("r%d -> %04d\n", in->a, i + 1 + in->sx); break;
+            case OP_PARFOR: printf("r%d, p%d -> %04d\n", in->a, in->b, chunk->parallels[in->b].next); break;
+            case OP_PRINT:
+            case OP_INPUT:
+            case OP_PROMPT: printf("r%d\n", in->a); break;
+            case OP_PRINTS:
+            case OP_PROMPTS: printf("\"%s\"\n", stringOf(in->sx)); break;
+            case OP_ENTER:  printf("site %d\n", in->sx); break;
+            case OP_CHAN:
+            case OP_SEND:
+            case OP_RECV:   printf("r%d, r%d\n", in->a, in->b); break;
+            case OP_CALL:
+            case OP_SPAWN:
+            case OP_TAILCALL: printf("r%d, f%d, %d\n", in->a, in->b, in->c); break;
+            case OP_RET:    printf("r%d\n", in->a); break;
+            default:        printf("\n"); break;
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "parser.h"
+#include "value.h"
+#include <stdint.h>
+
+/*
+    Linear bytecode for the register VM.
+    Every instruction is a fixed 8 bytes: opcode, destination register and
+    either two source registers or one signed 32-bit immediate (literal,
+    string-table id or jump offset relative to the next instruction).
+    Registers hold Values (see value.h); arithmetic and comparisons take an
+    int fast path when both operands are ints and valueArith() otherwise.
+*/
+typedef enum {
+    OP_HALT,
+    OP_LOADI,   // R[a] = sx
+    OP_LOADK,   // R[a] = K[sx], the chunk's constants (float and string literals)
+    OP_MOV,     // R[a] = R[b]
+    OP_ADD,     // R[a] = R[b] + R[c]
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,     // R[a] = R[c] ? R[b] / R[c] : 0
+    OP_MOD,     // R[a] = R[c] ? R[b] % R[c] : 0
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_TEST,    // R[a] = R[b] is true (not 0, 0.0 or -0.0)
+    OP_JMP,     // pc += sx
+    OP_JMPF,    // if (!R[a]) pc += sx
+    OP_JMPT,    // if (R[a]) pc += sx
+    OP_PRINT,   // print R[a] as a number
+    OP_PRINTS,  // print the interned string sx
+    OP_INPUT,   // R[a] = integer read from the next input line
+    OP_PROMPT,  // write R[a] with no newline
+    OP_PROMPTS, // write the interned string sx with no newline
+    OP_ENTER,   // --profile: statement with profiler site sx starts
+    OP_LEAVE,   // --profile: the innermost statement entered ends
+    OP_CALL,    // R[a] = function b (R[a], .. R[a+c-1]); its frame starts at R[a]
+    OP_TAILCALL,// return function b (R[a], .. R[a+c-1]), reusing this frame
+    OP_RET,     // return R[a] to the caller
+    OP_SPAWN,   // run function b (R[a], .. R[a+c-1]) as a task of its own (task.h)
+    OP_CHAN,    // R[a] = a new channel of capacity R[b]
+    OP_SEND,    // send R[b] on channel R[a], waiting for room
+    OP_RECV,    // R[a] = the next value on channel R[b], waiting for one
+    OP_FORPREP, // R[a..a+2] = a for's start, end and step as ints; pc += sx if it runs no times
+    OP_FORLOOP, // R[a] += R[a+2]; pc += sx while it has not reached R[a+1] (value.h)
+    OP_PARFOR,  // parallel for b over R[a..a+2] (as OP_FORPREP); its chunks run from the next
+                // instruction on, then pc = parallels[b].next
+    OP_PARNEXT, // OP_FORLOOP of a chunk, which is done when the loop is
+    OP_COUNT
+} OpCode;
+
+typedef struct {
+    uint8_t  op;
+    uint16_t a;
+    union {
+        struct { uint16_t b, c; };
+        int32_t sx;
+    };
+} Instr;
+
+typedef struct JitCode JitCode;
+
+/*
+    A parallel for in a chunk.  Its chunks start out with a copy of the
+    frame and run the body on it; the variables in 'reductions' (by
+    register here, not slot) are then combined back into the frame.
+*/
+typedef struct {
+    int        next;            // the instruction after the loop
+    int        unordered;       // prints need not come out in chunk order
+    int        reductionCount;
+    Reduction* reductions;
+} ParallelLoop;
+
+typedef struct {
+    Instr* code;
+    int    count;
+    int    capacity;
+    int    nregs;
+    int    params;      // a function's parameters: its first registers
+    int    frame;       // a function's variables, parameters included
+    Value* constants;
+    int    constantCount;
+    int    constantCapacity;
+    uint32_t* hits;     // --jit: times each backward jump was taken (vm.c)
+    JitCode** loops;    // and the loops compiled from them, kept with the chunk
+    ParallelLoop* parallels;    // OP_PARFOR's b
+    int    parallelCount;
+} Chunk;
+
+/*
+    A user-defined function, by the index the resolver gave its name
+    (resolver.h); calls refer to it by that index only.  A function that
+    has not been defined (yet) has no chunk and no node, and calling it
+    gives 0.
+*/
+typedef struct {
+    uint32_t  name;
+    Chunk*    chunk;    // for the VM
+    NodeIndex node;     // its AST_FUNC_DEF in the executor's program arena
+    int       warned;   // the call-to-undefined warning was printed
+} Function;
+
+typedef struct {
+    int line;
+    int column;
+    char message[128];
+} CompilerError;
+
+/*
+    Lower one resolved top-level statement (see resolver.h) to bytecode.
+    Variable slots map straight onto registers: the top-level frame takes the
+    first 'globals' registers, temporaries follow.
+    With 'profile' set, every statement is bracketed by OP_ENTER/OP_LEAVE
+    (see profile.h).  Returns NULL and fills 'error' on failure.
+*/
+Chunk* compile(const AST* ast, NodeIndex stmt, int globals, int profile, CompilerError* error);
+// A function's body, with its frame at register 0 (OP_CALL moves the VM's
+// register window there), ending in an implicit 'return 0'.  Profiled,
+// the whole call is also bracketed by the definition's site.
+Chunk* compileFunction(const AST* ast, NodeIndex func, int profile, CompilerError* error);
+// Where main is defined: call function 'function' with no arguments.
+Chunk* compileCall(int function, int globals);
+void   freeChunk(Chunk* chunk);
+
+// Warn (once per function) that an undefined function was called.
+void   functionUndefined(Function* function);
+void   disassembleChunk(const Chunk* chunk);
+
+#endif // COMPILER_H
@@ -1,39 +1,54 @@
 #include "debugger.h"
 #include "token.h"
+#include "io.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-int isImportUsed(ASTNode* node, const char* importName) {
-    if (node == NULL) return 0;
-
-    if (node->token.type == TOKEN_IDENTIFIER || node->token.type == TOKEN_KEYWORD) {
-        if (strcmp(node->token.value, importName) == 0) {
-            return 1;
+/*
+    One pass over the tokens marks every name an identifier refers to, then
+    each import is looked up.  Names are interned, so the set is a bitmap
+    indexed by string id rather than a hash table.
+*/
+int debuggerCheck(const Token* tokens, int token_count, ImportPolicy policy) {
+    uint32_t names = stringCount();
+    unsigned char* used = (unsigned char*)calloc((names + 7) / 8, 1);
+    for (int i = 0; i < token_count; i++) {
+        if (tokens[i].type == TOKEN_IDENTIFIER) {
+            used[tokens[i].id / 8] |= (unsigned char)(1u << (tokens[i].id % 8));
         }
     }
 
-    return isImportUsed(node->left, importName) ||
-           isImportUsed(node->right, importName) ||
-           isImportUsed(node->body, importName) ||
-           isImportUsed(node->next, importName);
-}
-
-void debuggerCheck(Token* tokens, int token_count, ASTNode* root) {
+    const char* label = policy == IMPORTS_ERROR ? "DebuggerError" : "DebuggerWarning";
+    int unused = 0;
     for (int i = 0; i < token_count; i++) {
-        if (tokens[i].type == TOKEN_IMPORT || tokens[i].type == TOKEN_IMPORT_FROM_C) {
-            if (!isImportUsed(root, tokens[i].value)) {
-                printf("[DebuggerWarning] Unused import: %s\n", tokens[i].value);
-                printf("Continue compilation? [Y/n]: ");
+        const Token* tok = &tokens[i];
+        if (tok->type != TOKEN_IMPORT && tok->type != TOKEN_IMPORT_FROM_C) continue;
+        uint32_t id = tok->id;
+        if (used[id / 8] & (1u << (id % 8))) continue;
+        // Mark it, so an import repeated further down is reported once.
+        used[id / 8] |= (unsigned char)(1u << (id % 8));
+        fprintf(ioOut(), "[%s] Line %u: unused import%s: %s\n", label, tok->line,
+                tok->type == TOKEN_IMPORT_FROM_C ? " from C" : "", stringOf(id));
+        unused++;
+    }
+    free(used);
 
-                char response[10];
-                fgets(response, sizeof(response), stdin);
+    if (unused == 0) return 0;
+    if (policy == IMPORTS_ERROR) return -1;
+    // The question goes to the program's own input and output, which are
+    // not this process's stdin and stdout in a server's run (server.h).
+    if (policy == IMPORTS_PROMPT && isatty(ioInputFd())) {
+        fputs("Continue compilation? [Y/n]: ", ioOut());
+        fflush(ioOut());
 
-                if (response[0] == 'n' || response[0] == 'N') {
-                    printf("Compilation aborted due to unused import.\n");
-                    exit(1);
-                }
-            }
+        size_t length;
+        const char* response = ioReadLine(&length);
+        if (response && length > 0 && (response[0] == 'n' || response[0] == 'N')) {
+            fputs("Compilation aborted due to unused imports.\n", ioOut());
+            return -1;
         }
     }
+    return unused;
 }
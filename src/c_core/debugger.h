@@ -4,6 +4,19 @@
 #include "token.h"
 #include "parser.h"
 
-void debuggerCheck(Token* tokens, int token_count, ASTNode* root);
+// What debuggerCheck() does about unused imports.
+typedef enum {
+    IMPORTS_PROMPT,     // ask once whether to go on; just warn when stdin is not a terminal
+    IMPORTS_WARN,       // --no-prompt
+    IMPORTS_ERROR,      // --werror
+} ImportPolicy;
+
+/*
+    Reports every import in 'tokens' (a program's imports and the names it
+    uses, as collected by parseImports()) whose name no identifier in the
+    program refers to.  Returns how many there were, or -1 if the program
+    must not run.
+*/
+int debuggerCheck(const Token* tokens, int token_count, ImportPolicy policy);
 
 #endif // DEBUGGER_H
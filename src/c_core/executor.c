@@ -1,126 +1,1189 @@
 #include "parser.h"
 #include "token.h"
+#include "compiler.h"
+#include "vm.h"
+#include "resolver.h"
+#include "optimizer.h"
+#include "codegen.h"
+#include "executor.h"
+#include "io.h"
+#include "profile.h"
+#include "value.h"
+#include "text.h"
+#include "interpreter.h"
+#include "task.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Symulacja zmiennych — uproszczona
-const char* get_variable_value(const char* name) {
-    return NULL; // Zmiennych nie obsługujemy jeszcze
+// Store an owned value in a slot, releasing what was there.
+static void storeSlot(Value* slot, Value value) {
+    Value old = *slot;
+    *slot = value;
+    valueRelease(old);
 }
 
-int evalExpression(ASTNode* node) {
-    if (!node) return 0;
+/*
+    Interpreter drzewa nie schodzi rekurencyjnie: instrukcje, wyrażenia i
+    wywołania w toku leżą jako ramki na ASTWalk, a wartości pośrednie i
+    ramki funkcji jedna nad drugą na jednym stosie wartości (nie w mallocu
+    na każde wywołanie).  Oba stosy rosną w miarę potrzeby, więc głębokość
+    wywołań i zagnieżdżeń ogranicza tylko pamięć, jak w VM.
+*/
+#define TREE_STACK_INITIAL (1u << 12)  // wartości
 
-    if (node->token.type == TOKEN_NUMBER) {
-        return atoi(node->token.value);
+// Wywołanie w toku: ramka funkcji na stosie wartości i ramka f(...) na ASTWalk, która czeka na wynik
+typedef struct {
+    size_t   base;
+    uint32_t depth;
+    int      function;
+} TreeCall;
+
+// Rodzaj ramki (data[1]): to samo przypisanie w wyrażeniu jest porównaniem
+enum { FRAME_STATEMENT, FRAME_EXPRESSION };
+
+// Stos wartości i wywołań jednego wątku programu: głównego albo zadania
+typedef struct {
+    Value*    stack;
+    size_t    top;
+    size_t    capacity;
+    TreeCall* calls;
+    uint32_t  callCount;
+    uint32_t  callCapacity;
+    uint32_t  profileFunction;
+} TreeStacks;
+
+/*
+    Zadanie (spawn f(...)) w interpreterze drzewa.  Zadania idą na zmianę
+    na wątku programu, bez wywłaszczania: zadanie działa, aż skończy albo
+    stanie na kanale (task.h), a ruszają, kiedy program główny czeka na
+    kanał, i do końca przed każdym złączeniem (definicja funkcji, koniec
+    programu).  Czekające leży tylko w kolejce kanału; budzik wstawia je
+    z powrotem do kolejki gotowych.
+*/
+typedef struct TreeTask {
+    ASTWalk          walk;
+    TreeStacks       stacks;
+    Waiter           wait;
+    int              sending;       // czeka z wartością w wait.value
+    struct TreeTask* queued;        // następne gotowe
+    struct TreeTask* prev;          // wszystkie żywe
+    struct TreeTask* next;
+} TreeTask;
+
+/*
+    Stan wykonania jednego programu, w bieżącym interpreterze (interpreter.h).
+
+    Funkcje użytkownika, po indeksie nadanym przez resolver.  Arena
+    instrukcji jest zwalniana po każdej z nich, więc definicje są kopiowane
+    do 'program'; VM dostaje od razu skompilowany chunk.  Zmienne globalne
+    (poza funkcjami) żyją między kolejnymi instrukcjami najwyższego poziomu.
+*/
+struct ExecutorState {
+    Scope     functionScope;
+    Function* functions;
+    int       functionCount;
+    int       functionCapacity;
+    AST       program;
+
+    Scope     globalScope;
+    Value*    globals;
+    int       globalCount;
+    int       started;
+
+    Value*    treeStack;
+    size_t    treeTop;              // nad nim same zera
+    size_t    treeCapacity;
+    TreeCall* treeCalls;
+    uint32_t  treeCallCount;        // 0 = poza funkcją
+    uint32_t  treeCallCapacity;
+
+    int       debugMode;
+    int       treeWalkMode;         // stary interpreter drzewa AST, do testów porównawczych z VM
+    int       optimizeMode;         // optymalizator AST (stałe, martwe gałęzie), domyślnie włączony
+    int       jitMode;              // kompilacja gorących pętli do kodu maszynowego (x86-64)
+    int       profileMode;          // --profile: VM dostaje OP_ENTER/OP_LEAVE, interpreter drzewa mierzy sam
+    uint32_t  profileFunction;
+
+    TreeTask* treeTasks;            // żywe zadania interpretera drzewa
+    TreeTask* readyFirst;           // gotowe do biegu, od najstarszego
+    TreeTask* readyLast;
+    TreeTask* treeCurrent;          // NULL: biegnie program główny
+    Waiter    mainWaiter;
+    int       mainReady;            // program główny obudzony na kanale
+    int       treeParked;           // bieżący wątek stanął na kanale
+};
+
+#define EXECUTOR (INTERPRETER->executor)
+
+// Budzik programu głównego: kanał, na którym czekał, już zrobił swoje
+static void wakeMain(Waiter* waiter) {
+    (void)waiter;
+    EXECUTOR->mainReady = 1;
+}
+
+ExecutorState* executor_new(void) {
+    ExecutorState* state = (ExecutorState*)calloc(1, sizeof(ExecutorState));
+    initScope(&state->functionScope);
+    initScope(&state->globalScope);
+    initAST(&state->program);
+    state->optimizeMode    = 1;
+    state->profileFunction = PROFILE_TOP_LEVEL;
+    state->mainWaiter.wake = wakeMain;
+    return state;
+}
+
+static void freeTreeTask(TreeTask* task) {
+    for (size_t i = 0; i < task->stacks.capacity; i++) valueRelease(task->stacks.stack[i]);
+    if (task->sending) valueRelease(task->wait.value);
+    free(task->stacks.stack);
+    free(task->stacks.calls);
+    walkFree(&task->walk);
+    free(task);
+}
+
+void executor_free(ExecutorState* state) {
+    if (!state) return;
+    // Zostają tylko po przerwanym programie; kanałów już nie ma
+    while (state->treeTasks) {
+        TreeTask* task = state->treeTasks;
+        state->treeTasks = task->next;
+        freeTreeTask(task);
     }
+    for (int i = 0; i < state->globalCount; i++) valueRelease(state->globals[i]);
+    for (size_t i = 0; i < state->treeCapacity; i++) valueRelease(state->treeStack[i]);
+    for (int i = 0; i < state->functionCount; i++) freeChunk(state->functions[i].chunk);
+    free(state->globals);
+    free(state->treeStack);
+    free(state->treeCalls);
+    free(state->functions);
+    freeScope(&state->functionScope);
+    freeScope(&state->globalScope);
+    freeAST(&state->program);
+    free(state);
+}
 
-    if (node->left && node->right && node->token.type == TOKEN_OPERATOR) {
-        int left = evalExpression(node->left);
-        int right = evalExpression(node->right);
-        if (strcmp(node->token.value, "+") == 0) return left + right;
-        if (strcmp(node->token.value, "-") == 0) return left - right;
-        if (strcmp(node->token.value, "*") == 0) return left * right;
-        if (strcmp(node->token.value, "/") == 0) return right != 0 ? left / right : 0;
-        if (strcmp(node->token.value, "=") == 0) return left == right;
-        if (strcmp(node->token.value, "<") == 0) return left < right;
-        if (strcmp(node->token.value, ">") == 0) return left > right;
+// Na nim staje bieżący wątek, gdy kanał każe mu czekać
+static Waiter* currentWaiter(void) {
+    ExecutorState* state = EXECUTOR;
+    return state->treeCurrent ? &state->treeCurrent->wait : &state->mainWaiter;
+}
+
+static void reserveTree(size_t size) {
+    ExecutorState* state = EXECUTOR;
+    if (size <= state->treeCapacity) return;
+    size_t capacity = state->treeCapacity ? state->treeCapacity : TREE_STACK_INITIAL;
+    while (capacity < size) capacity *= 2;
+    state->treeStack = (Value*)realloc(state->treeStack, sizeof(Value) * capacity);
+    memset(state->treeStack + state->treeCapacity, 0, sizeof(Value) * (capacity - state->treeCapacity));
+    state->treeCapacity = capacity;
+}
+
+static void pushValue(Value value) {
+    ExecutorState* state = EXECUTOR;
+    reserveTree(state->treeTop + 1);
+    state->treeStack[state->treeTop++] = value;
+}
+
+// Zdejmuje wartość ze szczytu (teraz należy do wołającego), zostawiając zero
+static Value popValue(void) {
+    ExecutorState* state = EXECUTOR;
+    Value value = state->treeStack[--state->treeTop];
+    state->treeStack[state->treeTop] = 0;
+    return value;
+}
+
+static int popCondition(void) {
+    Value value = popValue();
+    int result = valueTruthy(value);
+    valueRelease(value);
+    return result;
+}
+
+static void beginStatement(ASTWalk* walk, NodeIndex index) {
+    walkPush(walk, index)->data[1] = FRAME_STATEMENT;
+}
+
+// Stała albo zmienna: wartość (własna) od razu, bez ramki.  Zwraca 0 dla reszty.
+static int leafValue(const AST* ast, NodeIndex index, const Value* frame, Value* out) {
+    const ASTNode* node = astNode(ast, index);
+    if (!node) {
+        *out = valueInt(0);
+        return 1;
     }
+    if (hasEffects(node)) return 0;
+    const Token* tok = nodeToken(ast, node);
+    switch (tok->type) {
+        case TOKEN_NUMBER:
+            *out = valueInt((int32_t)tok->number);
+            return 1;
+        case TOKEN_FLOAT:
+            *out = valueDouble(tok->real);
+            return 1;
+        case TOKEN_STRING:
+            *out = textLiteral(tok->id);
+            break;
+        case TOKEN_IDENTIFIER:
+            if (node->nodeType != AST_EXPRESSION) {
+                *out = valueInt(0);
+                return 1;
+            }
+            *out = frame[node->slot];
+            break;
+        case TOKEN_OPERATOR:
+            if (node->left && node->right) return 0;
+            *out = valueInt(0);
+            return 1;
+        default:
+            *out = valueInt(0);
+            return 1;
+    }
+    valueRetain(*out);
+    return 1;
+}
 
+/*
+    Wartość wyrażenia na szczyt stosu wartości.  Liście i działania na dwóch
+    liściach (i < n, x + 1) są liczone od razu; reszta idzie jako ramka,
+    którą policzy evaluate().  Stos może się przy tym przenieść, więc
+    'frame' jest czytana wcześniej.  Zwraca 1, gdy wartość już leży na stosie.
+*/
+static int pushExpression(ASTWalk* walk, const AST* ast, NodeIndex index, const Value* frame) {
+    Value value;
+    if (leafValue(ast, index, frame, &value)) {
+        pushValue(value);
+        return 1;
+    }
+    const ASTNode* node = astNode(ast, index);
+    uint32_t op = nodeToken(ast, node)->id;
+    Value left, right;
+    if (!hasEffects(node) && op != STR_AND && op != STR_OR &&
+        leafValue(ast, node->left, frame, &left)) {
+        if (leafValue(ast, node->right, frame, &right)) {
+            pushValue(valueArith(op, left, right));
+            valueRelease(left);
+            valueRelease(right);
+            return 1;
+        }
+        valueRelease(left);
+    }
+    walkPush(walk, index)->data[1] = FRAME_EXPRESSION;
     return 0;
 }
 
-void execute(ASTNode* node);
+static void spawnTree(int index, uint32_t nargs);
+
+static int isTimed(const AST* ast, NodeIndex index) {
+    const ASTNode* node = astNode(ast, index);
+    return node && node->nodeType != AST_FUNC_DEF;
+}
+
+/*
+    Następna instrukcja bloku ramki na szczycie (pozycja w data[2]); 0, gdy
+    blok się skończył.  Przy profilowaniu instrukcja jest mierzona od
+    wejścia jej ramki do zejścia, definicje funkcji wcale.
+*/
+static int nextStatement(ASTWalk* walk, const AST* ast, BlockIndex block) {
+    ExecutorState* state = EXECUTOR;
+    WalkFrame* at = walkTop(walk);
+    uint32_t i = (uint32_t)at->data[2];
+    uint32_t count = blockCount(ast, block);
+    const NodeIndex* stmts = blockNodes(ast, block);
+    if (state->profileMode && i > 0 && isTimed(ast, stmts[i - 1])) profileLeave();
+    if (i == count) return 0;
+
+    at->data[2] = (int32_t)(i + 1);
+    if (!isTimed(ast, stmts[i])) return 1;
+    if (state->profileMode) profileEnter(profileSite(ast, stmts[i], state->profileFunction));
+    beginStatement(walk, stmts[i]);
+    return 1;
+}
+
+// Ramka funkcji wywołania 'call': 'nargs' argumentów od call->base to już jej pierwsze sloty.
+static void enterFunction(ASTWalk* walk, TreeCall* call, uint32_t nargs) {
+    ExecutorState* state = EXECUTOR;
+    Function* function = &state->functions[call->function];
+    const ASTNode* def = astNode(&state->program, function->node);
+    uint32_t params = blockCount(&state->program, def->right);
+    uint32_t size = def->slot > 0 ? (uint32_t)def->slot : 0;
+    reserveTree(call->base + (size > nargs ? size : nargs));
+    Value* frame = state->treeStack + call->base;
+    // Nadmiarowe argumenty przepadają, reszta zmiennych już jest zerem
+    for (uint32_t i = params; i < nargs; i++) storeSlot(&frame[i], valueInt(0));
+    state->treeTop = call->base + size;
+
+    walkTop(walk)->data[2] = 0;
+    state->profileFunction = function->name;
+    if (state->profileMode) profileEnter(profileSite(&state->program, function->node, function->name));
+}
+
+// Wynik wywołania trafia w miejsce jego ramki; ramka f(...) schodzi z ASTWalk.
+static void returnFromCall(ASTWalk* walk, Value result) {
+    ExecutorState* state = EXECUTOR;
+    TreeCall* call = &state->treeCalls[--state->treeCallCount];
+    while (state->treeTop > call->base) valueRelease(popValue());
+    walkPop(walk);
+    pushValue(result);
+    state->profileFunction = state->treeCallCount
+                           ? state->functions[state->treeCalls[state->treeCallCount - 1].function].name
+                           : PROFILE_TOP_LEVEL;
+}
+
+/*
+    Wywołanie funkcji 'index' z 'nargs' argumentami na szczycie stosu
+    wartości, dla ramki na szczycie ASTWalk.  Nieznana funkcja od razu
+    daje 0.
+*/
+static void startCall(ASTWalk* walk, int index, uint32_t nargs) {
+    ExecutorState* state = EXECUTOR;
+    size_t base = state->treeTop - nargs;
+    if (!state->functions[index].node) {
+        functionUndefined(&state->functions[index]);
+        while (state->treeTop > base) valueRelease(popValue());
+        walkPop(walk);
+        pushValue(valueInt(0));
+        return;
+    }
+    if (state->treeCallCount == state->treeCallCapacity) {
+        state->treeCallCapacity = state->treeCallCapacity ? state->treeCallCapacity * 2 : 64;
+        state->treeCalls = (TreeCall*)realloc(state->treeCalls, sizeof(TreeCall) * state->treeCallCapacity);
+    }
+    TreeCall* call = &state->treeCalls[state->treeCallCount++];
+    call->base = base;
+    call->depth = walk->depth - 1;
+    call->function = index;
+    enterFunction(walk, call, nargs);
+}
 
-void executeBlock(ASTNode* node) {
-    while (node != NULL) {
-        execute(node);
-        node = node->next;
+// return: zdejmuje instrukcje funkcji w toku, aż na szczycie zostanie ramka jej wywołania.
+static void leaveFunction(ASTWalk* walk) {
+    ExecutorState* state = EXECUTOR;
+    uint32_t depth = state->treeCalls[state->treeCallCount - 1].depth;
+    while (walk->depth - 1 > depth) {
+        walkPop(walk);
+        if (state->profileMode) profileLeave();
     }
+    if (state->profileMode) profileLeave();
 }
 
-void execute(ASTNode* node) {
-    if (!node) return;
+// return f(...): argumenty leżą na szczycie stosu; podmieniają ramkę zamiast zagnieżdżać wywołanie.
+static void tailCall(ASTWalk* walk, int index, uint32_t nargs) {
+    ExecutorState* state = EXECUTOR;
+    leaveFunction(walk);
+    TreeCall* call = &state->treeCalls[state->treeCallCount - 1];
+    size_t args = state->treeTop - nargs;
+    for (size_t i = call->base; i < args; i++) storeSlot(&state->treeStack[i], valueInt(0));
+    memmove(state->treeStack + call->base, state->treeStack + args, sizeof(Value) * nargs);
+    memset(state->treeStack + call->base + nargs, 0, sizeof(Value) * (state->treeTop - call->base - nargs));
+    state->treeTop = call->base + nargs;
 
-    switch (node->nodeType) {
-        case AST_FUNC_DEF:
-            if (strcmp(node->token.value, "main") == 0) {
-                executeBlock(node->body);
+    call->function = index;
+    if (!state->functions[index].node) {
+        functionUndefined(&state->functions[index]);
+        returnFromCall(walk, valueInt(0));
+        return;
+    }
+    enterFunction(walk, call, nargs);
+}
+
+/*
+    Liczy ramki wyrażeń ze szczytu ASTWalk.  Skończone wyrażenie zostawia
+    wynik na stosie wartości i od razu wraca do rodzica, dopóki to też
+    wyrażenie; koniec, gdy na szczycie jest instrukcja albo zaczęło się
+    wywołanie.
+*/
+static void evaluate(ASTWalk* walk, const AST* ast, const Value* globals) {
+    ExecutorState* state = EXECUTOR;
+    for (;;) {
+        WalkFrame* at = walkTop(walk);
+        const ASTNode* node = astNode(ast, at->node);
+        // Stos wartości mógł się przenieść przy ostatnim pushValue()
+        const Value* frame = state->treeCallCount ? state->treeStack + state->treeCalls[state->treeCallCount - 1].base : globals;
+        uint32_t step = at->step++;
+
+        if (node->nodeType == AST_CALL) {
+            // Argumenty od lewej na szczyt stosu; każdy zajmuje swoje miejsce, zanim liczy się następny
+            uint32_t count = blockCount(ast, node->body);
+            if (step < count) {
+                pushExpression(walk, ast, blockNodes(ast, node->body)[step], frame);
+                continue;
             }
-            break;
+            startCall(walk, node->slot, count);
+            return;
+        }
 
-        case AST_VAR_ASSIGN:
-            // Na razie nie implementujemy zmiennych
-            evalExpression(node->right);
-            break;
+        if (node->nodeType == AST_RECV || node->nodeType == AST_CHAN) {
+            if (step == 0) {
+                pushExpression(walk, ast, node->left, frame);
+                continue;
+            }
+            Value result = valueInt(0);
+            if (step == 2) {
+                // Obudzony recv: wartość zostawił budzik
+                result = currentWaiter()->value;
+            } else {
+                Value operand = popValue();
+                if (node->nodeType == AST_CHAN) {
+                    result = channelNew(operand);
+                } else {
+                    Channel* channel = channelFind(operand);
+                    if (channel && !channelRecv(channel, &result, currentWaiter())) {
+                        valueRelease(operand);
+                        state->treeParked = 1;
+                        return;
+                    }
+                }
+                valueRelease(operand);
+            }
+            walkPop(walk);
+            pushValue(result);
+            if (!walk->depth || walkTop(walk)->data[1] != FRAME_EXPRESSION) return;
+            continue;
+        }
+
+        uint32_t op = nodeToken(ast, node)->id;
+        int logical = op == STR_AND || op == STR_OR;
+        if (step == 0 || (step == 1 && !logical)) {
+            pushExpression(walk, ast, step == 0 ? node->left : node->right, frame);
+            continue;
+        }
+        Value result;
+        if (logical) {
+            // && i || liczą prawy argument tylko wtedy, gdy to on rozstrzyga
+            int truth = popCondition();
+            if (step == 1 && truth == (op == STR_AND)) {
+                pushExpression(walk, ast, node->right, frame);
+                continue;
+            }
+            result = valueInt(truth);
+        } else {
+            Value right = popValue();
+            Value left = popValue();
+            result = valueArith(op, left, right);
+            valueRelease(left);
+            valueRelease(right);
+        }
+        walkPop(walk);
+        pushValue(result);
+        if (!walk->depth || walkTop(walk)->data[1] != FRAME_EXPRESSION) return;
+    }
+}
+
+/*
+    parallel for w interpreterze drzewa: kawałki zakresu (value.h) biegną po
+    kolei na tym samym wątku, jak zadania, ale z tym samym wynikiem co w VM.
+    Nad ramką pętli leży na stosie wartości jej obszar (od data[0]): kopia
+    ramki sprzed pętli, numer bieżącego kawałka i dla każdej redukcji slot,
+    operator i wynik dotąd.  Każdy kawałek zaczyna od kopii ramki, z
+    redukowanymi zmiennymi na wartości początkowej; na koniec ramka wraca
+    do kopii, a redukowane zmienne dostają wyniki.
+*/
+static Value* currentFrame(Value* globals) {
+    ExecutorState* state = EXECUTOR;
+    return state->treeCallCount ? state->treeStack + state->treeCalls[state->treeCallCount - 1].base : globals;
+}
+
+static uint32_t frameSize(void) {
+    ExecutorState* state = EXECUTOR;
+    if (!state->treeCallCount) return (uint32_t)state->globalCount;
+    const Function* function = &state->functions[state->treeCalls[state->treeCallCount - 1].function];
+    return (uint32_t)astNode(&state->program, function->node)->slot;
+}
+
+// Kawałek 'k': ramka z kopii, redukcje od początku, licznik, koniec i krok kawałka
+static void beginChunk(const ASTNode* node, Value* globals, size_t region, int32_t k) {
+    ExecutorState* state = EXECUTOR;
+    Value* frame = currentFrame(globals);
+    uint32_t size = frameSize();
+    Value* saved = state->treeStack + region;
+    for (uint32_t i = 0; i < size; i++) {
+        valueRetain(saved[i]);
+        storeSlot(&frame[i], saved[i]);
+    }
+    for (size_t r = region + size + 1; r < state->treeTop; r += 3) {
+        Value* reduction = state->treeStack + r;
+        storeSlot(&frame[asInt(reduction[0])], reduceStart((uint32_t)asInt(reduction[1])));
+    }
+    saved[size] = valueInt(k);
+    parallelChunk(saved + node->slot, k, parallelChunks(saved + node->slot), frame + node->slot);
+}
 
-        case AST_PRINT:
-            if (node->left) {
-                ASTNode* expr = node->left;
-
-                if (expr->left && expr->right && expr->token.type == TOKEN_OPERATOR) {
-                    int val = evalExpression(expr);
-                    printf("%d\n", val);
-                } else if (expr->token.type == TOKEN_NUMBER) {
-                    printf("%s\n", expr->token.value);
-                } else if (expr->token.type == TOKEN_IDENTIFIER) {
-                    const char* val = get_variable_value(expr->token.value);
-                    printf("%s\n", val ? val : expr->token.value);
-                } else if (expr->nodeType == AST_EXPRESSION) {
-                    printf("%s\n", expr->token.value);
+static size_t startParallel(const AST* ast, NodeIndex index, Value* globals) {
+    ExecutorState* state = EXECUTOR;
+    uint32_t size = frameSize();
+    Reduction* reductions;
+    int count = findReductions(ast, index, &reductions);
+    size_t region = state->treeTop;
+    reserveTree(region + size + 1 + 3 * (size_t)count);
+    const Value* frame = currentFrame(globals);
+    for (uint32_t i = 0; i < size; i++) {
+        valueRetain(frame[i]);
+        pushValue(frame[i]);
+    }
+    pushValue(valueInt(0));
+    for (int r = 0; r < count; r++) {
+        pushValue(valueInt(reductions[r].slot));
+        pushValue(valueInt((int32_t)reductions[r].op));
+        valueRetain(frame[reductions[r].slot]);
+        pushValue(frame[reductions[r].slot]);
+    }
+    free(reductions);
+    beginChunk(astNode(ast, index), globals, region, 0);
+    return region;
+}
+
+// Koniec kawałka: wyniki redukcji dochodzą, po kolei.  Zwraca 0 po ostatnim, z ramką już odtworzoną.
+static int nextChunk(const ASTNode* node, Value* globals, size_t region) {
+    ExecutorState* state = EXECUTOR;
+    Value* frame = currentFrame(globals);
+    uint32_t size = frameSize();
+    Value* saved = state->treeStack + region;
+    for (size_t r = region + size + 1; r < state->treeTop; r += 3) {
+        Value* reduction = state->treeStack + r;
+        uint32_t op = reduceCombine((uint32_t)asInt(reduction[1]));
+        storeSlot(&reduction[2], valueArith(op, reduction[2], frame[asInt(reduction[0])]));
+    }
+    int32_t k = asInt(saved[size]) + 1;
+    if (k < parallelChunks(saved + node->slot)) {
+        beginChunk(node, globals, region, k);
+        return 1;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        valueRetain(saved[i]);
+        storeSlot(&frame[i], saved[i]);
+    }
+    for (size_t r = region + size + 1; r < state->treeTop; r += 3) {
+        Value* reduction = state->treeStack + r;
+        valueRetain(reduction[2]);
+        storeSlot(&frame[asInt(reduction[0])], reduction[2]);
+    }
+    while (state->treeTop > region) valueRelease(popValue());
+    return 0;
+}
+
+// Wypisywane jako wartość, a nie jako tekst tokenu
+static int printsValue(const AST* ast, const ASTNode* expr) {
+    const Token* tok = nodeToken(ast, expr);
+    return (expr->left && expr->right && tok->type == TOKEN_OPERATOR) ||
+           isNumberToken(tok) || hasEffects(expr);
+}
+
+/*
+    Wykonuje ramki instrukcji ze szczytu ASTWalk, dopóki na szczycie jest
+    instrukcja: skończona zdejmuje swoją ramkę i oddaje krok rodzicowi.
+    Wraca do runTree() przy wyrażeniu do policzenia i przy wywołaniu.
+*/
+static void executeStatements(ASTWalk* walk, const AST* ast, Value* globals) {
+    ExecutorState* state = EXECUTOR;
+    for (;;) {
+        WalkFrame* at = walkTop(walk);
+        NodeIndex index = at->node;
+        const ASTNode* node = astNode(ast, index);
+        // Stos wartości mógł się przenieść przy ostatnim pushValue()
+        Value* frame = state->treeCallCount ? state->treeStack + state->treeCalls[state->treeCallCount - 1].base : globals;
+        uint32_t step = at->step++;
+
+        switch (node->nodeType) {
+            case AST_FUNC_DEF:
+                // Funkcje z najwyższego poziomu definiuje execute_statement(); zagnieżdżone nic nie robią
+                break;
+
+            case AST_VAR_ASSIGN: {
+                if (step == 0) {
+                    if (pushExpression(walk, ast, node->right, frame)) continue;
+                    return;
+                }
+                Value value = popValue();
+                const ASTNode* target = astNode(ast, node->left);
+                if (isVariableNode(ast, target)) {
+                    storeSlot(&frame[target->slot], value);
                 } else {
-                    printf("%s\n", expr->token.value);
+                    valueRelease(value);
                 }
+                break;
             }
-            break;
 
-        case AST_INPUT:
-            // Pomijamy obsługę input na razie
-            break;
+            case AST_PRINT:
+                if (step == 1) {
+                    Value value = popValue();
+                    ioPrintValue(value);
+                    valueRelease(value);
+                } else if (node->left) {
+                    const ASTNode* expr = astNode(ast, node->left);
+                    if (printsValue(ast, expr) || isVariableNode(ast, expr)) {
+                        if (pushExpression(walk, ast, node->left, frame)) continue;
+                        return;
+                    }
+                    const Token* tok = nodeToken(ast, expr);
+                    ioPrintString(stringOf(tok->id), stringLength(tok->id));
+                }
+                break;
 
-        case AST_IF_STATEMENT: {
-            int cond = evalExpression(node->left);
-            if (cond) {
-                executeBlock(node->body);
-            } else if (node->right) {
-                executeBlock(node->right);
+            case AST_INPUT: {
+                // input x: wczytuje liczbę z całej linii do zmiennej;
+                // input "tekst": wypisuje zachętę (bez nowej linii) i pomija linię
+                const ASTNode* expr = astNode(ast, node->left);
+                if (step == 1) {
+                    Value value = popValue();
+                    ioWriteValue(value);
+                    valueRelease(value);
+                } else if (isVariableNode(ast, expr)) {
+                    storeSlot(&frame[expr->slot], valueInt(ioReadInt()));
+                    break;
+                } else if (expr) {
+                    if (printsValue(ast, expr)) {
+                        if (pushExpression(walk, ast, node->left, frame)) continue;
+                        return;
+                    }
+                    const Token* tok = nodeToken(ast, expr);
+                    ioWrite(stringOf(tok->id), stringLength(tok->id));
+                }
+                size_t length;
+                ioReadLine(&length);
+                break;
             }
-            break;
+
+            case AST_IF_STATEMENT:
+                if (step == 0) {
+                    if (pushExpression(walk, ast, node->left, frame)) continue;
+                    return;
+                }
+                if (step == 1) {
+                    at->data[0] = (int32_t)(popCondition() ? node->body : node->right);
+                    at->data[2] = 0;
+                }
+                if (nextStatement(walk, ast, (BlockIndex)at->data[0])) continue;
+                break;
+
+            case AST_WHILE_LOOP:
+                if (step == 0) {
+                    if (pushExpression(walk, ast, node->left, frame)) continue;
+                    return;
+                }
+                if (step == 1) {
+                    if (!popCondition()) break;
+                    at->data[2] = 0;
+                }
+                if (nextStatement(walk, ast, node->body)) continue;
+                at->step = 0;
+                // Przerwany program (interpreter.h) staje przy skoku wstecz; resztę robi runTree()
+                if (interpreterCancelled()) return;
+                continue;
+
+            case AST_FOR_LOOP:
+            case AST_PARALLEL_FOR: {
+                // Początek, koniec i krok liczone raz, po kolei, do ukrytych slotów od node->slot (value.h)
+                const ASTNode* init = astNode(ast, node->left);
+                const ASTNode* range = astNode(ast, node->right);
+                int parallel = node->nodeType == AST_PARALLEL_FOR;
+                Value* loop = &frame[node->slot];
+                if (step < 3) {
+                    if (step > 0) storeSlot(&loop[step - 1], popValue());
+                    NodeIndex expr = step == 0 ? init->right : step == 1 ? range->left : range->right;
+                    if (expr) {
+                        if (pushExpression(walk, ast, expr, frame)) continue;
+                        return;
+                    }
+                    storeSlot(&loop[2], valueInt(1));   // bez 'step' krok to 1
+                } else if (step == 3) {
+                    storeSlot(&loop[2], popValue());
+                }
+                if (step <= 3) {
+                    if (!forStart(loop)) break;
+                    if (parallel) at->data[0] = (int32_t)startParallel(ast, index, globals);
+                } else {
+                    if (nextStatement(walk, ast, node->body)) continue;
+                    if (!forNext(loop) && (!parallel || !nextChunk(node, globals, (size_t)at->data[0]))) break;
+                }
+                // Zmienna dostaje licznik na początku każdego obrotu
+                frame = currentFrame(globals);
+                loop = &frame[node->slot];
+                storeSlot(&frame[astNode(ast, init->left)->slot], loop[0]);
+                at->data[2] = 0;
+                at->step = 4;
+                if (interpreterCancelled()) return;
+                continue;
+            }
+
+            case AST_RETURN: {
+                const ASTNode* expr = astNode(ast, node->left);
+                if (state->treeCallCount == 0) {
+                    // Poza funkcją nie ma skąd wracać; liczy się tylko dla wywołań w wyrażeniu
+                    if (step == 1) {
+                        valueRelease(popValue());
+                    } else if (containsCall(ast, node->left)) {
+                        if (pushExpression(walk, ast, node->left, frame)) continue;
+                        return;
+                    }
+                    break;
+                }
+                if (expr && expr->nodeType == AST_CALL) {
+                    uint32_t count = blockCount(ast, expr->body);
+                    if (step == count) {
+                        tailCall(walk, expr->slot, count);
+                        return;
+                    }
+                    if (pushExpression(walk, ast, blockNodes(ast, expr->body)[step], frame)) continue;
+                    return;
+                }
+                if (step == 0) {
+                    if (pushExpression(walk, ast, node->left, frame)) continue;
+                    return;
+                }
+                Value result = popValue();
+                leaveFunction(walk);
+                returnFromCall(walk, result);
+                return;
+            }
+
+            case AST_SPAWN: {
+                // Argumenty liczy ten, kto woła spawn; zadanie dostaje je na swój stos
+                const ASTNode* call = astNode(ast, node->left);
+                uint32_t count = blockCount(ast, call->body);
+                if (step < count) {
+                    if (pushExpression(walk, ast, blockNodes(ast, call->body)[step], frame)) continue;
+                    return;
+                }
+                spawnTree(call->slot, count);
+                break;
+            }
+
+            case AST_SEND: {
+                if (step < 2) {
+                    if (pushExpression(walk, ast, step == 0 ? node->left : node->right, frame)) continue;
+                    return;
+                }
+                if (step == 3) break;   // obudzony send: wartość już odebrana
+                Value value = popValue();
+                Value handle = popValue();
+                Channel* channel = channelFind(handle);
+                valueRelease(handle);
+                if (!channel) {
+                    valueRelease(value);
+                } else if (!channelSend(channel, value, currentWaiter())) {
+                    if (state->treeCurrent) state->treeCurrent->sending = 1;
+                    state->treeParked = 1;
+                    return;
+                }
+                break;
+            }
+
+            case AST_EXPRESSION:
+            case AST_CALL:
+            case AST_RECV:
+            case AST_CHAN:
+                // Tylko wywołania i kanały mają skutki uboczne
+                if (step == 1) {
+                    valueRelease(popValue());
+                } else if (containsCall(ast, index)) {
+                    if (pushExpression(walk, ast, index, frame)) continue;
+                    return;
+                }
+                break;
+
+            case AST_REDUCE:
+                // x op= e to zwykłe x = x op e; wynik łączy pętla
+                if (step == 0) {
+                    beginStatement(walk, node->left);
+                    continue;
+                }
+                break;
+
+            case AST_LOOP:
+            case AST_BREAK:
+                // Skipping
+                break;
+
+            default:
+                ioFlush();
+                fprintf(ioOut(), "[UNSUPPORTED NODE TYPE: %d]\n", node->nodeType);
+                break;
         }
+        walkPop(walk);
+        if (!walk->depth || walkTop(walk)->data[1] != FRAME_STATEMENT) return;
+    }
+}
 
-        case AST_WHILE_LOOP: {
-            while (evalExpression(node->left)) {
-                executeBlock(node->body);
+/*
+    Wykonuje ramki z 'walk', aż zejdą wszystkie albo wątek stanie na kanale.  Poza funkcją zmienne to
+    'globals', a węzły pochodzą z 'top'; w funkcji ramka leży na stosie
+    wartości (jej adres czytany co krok, bo stos rośnie), a węzły w 'program'.
+    Przerwany program (interpreter.h) kończy tu, przy wywołaniu albo po
+    obrocie pętli: ramki zostają, zwalnia je walkFree() i interpreterFree(),
+    a zadanie liczy się jako skończone.
+*/
+static void runTree(ASTWalk* walk, const AST* top, Value* globals) {
+    ExecutorState* state = EXECUTOR;
+    while (walk->depth && !state->treeParked && !interpreterCancelled()) {
+        const AST* ast = top;
+        if (state->treeCallCount) {
+            const TreeCall* call = &state->treeCalls[state->treeCallCount - 1];
+            if (call->depth == walk->depth - 1) {
+                // Ciało funkcji w toku, instrukcja po instrukcji; koniec bez return daje 0
+                const ASTNode* def = astNode(&state->program, state->functions[call->function].node);
+                if (!nextStatement(walk, &state->program, def->body)) {
+                    leaveFunction(walk);
+                    returnFromCall(walk, valueInt(0));
+                }
+                continue;
             }
-            break;
+            ast = &state->program;
         }
+        if (walkTop(walk)->data[1] == FRAME_EXPRESSION) {
+            evaluate(walk, ast, globals);
+        } else {
+            executeStatements(walk, ast, globals);
+        }
+    }
+}
 
-        case AST_RETURN:
-        case AST_LOOP:
-        case AST_BREAK:
-        case AST_EXPRESSION:
-            // Skipping
-            break;
+/* ---- zadania ---- */
 
-        default:
-            printf("[UNSUPPORTED NODE TYPE: %d]\n", node->nodeType);
-            break;
+// Bieżący wątek zamienia się stosami z 'other'
+static void swapStacks(TreeStacks* other) {
+    ExecutorState* state = EXECUTOR;
+    TreeStacks mine = { state->treeStack, state->treeTop, state->treeCapacity, state->treeCalls,
+                        state->treeCallCount, state->treeCallCapacity, state->profileFunction };
+    state->treeStack        = other->stack;
+    state->treeTop          = other->top;
+    state->treeCapacity     = other->capacity;
+    state->treeCalls        = other->calls;
+    state->treeCallCount    = other->callCount;
+    state->treeCallCapacity = other->callCapacity;
+    state->profileFunction  = other->profileFunction;
+    *other = mine;
+}
+
+// Budzik zadania: z powrotem do kolejki gotowych
+static void taskReady(Waiter* waiter) {
+    ExecutorState* state = EXECUTOR;
+    TreeTask* task = (TreeTask*)waiter->owner;
+    task->sending = 0;
+    task->queued = NULL;
+    if (state->readyLast) state->readyLast->queued = task;
+    else state->readyFirst = task;
+    state->readyLast = task;
+}
+
+/*
+    spawn f(...): 'nargs' argumentów ze szczytu stosu przechodzi na stos
+    nowego zadania, które zaczyna od wywołania jak callTree().  Rusza
+    dopiero, gdy przyjdzie jego kolej.
+*/
+static void spawnTree(int index, uint32_t nargs) {
+    ExecutorState* state = EXECUTOR;
+    if (!state->functions[index].node) {
+        functionUndefined(&state->functions[index]);
+        while (nargs--) valueRelease(popValue());
+        return;
+    }
+    TreeTask* task = (TreeTask*)calloc(1, sizeof(TreeTask));
+    task->stacks.capacity = nargs + 64;
+    task->stacks.stack = (Value*)calloc(task->stacks.capacity, sizeof(Value));
+    task->stacks.top = nargs;
+    task->stacks.profileFunction = PROFILE_TOP_LEVEL;
+    state->treeTop -= nargs;
+    memcpy(task->stacks.stack, state->treeStack + state->treeTop, sizeof(Value) * nargs);
+    memset(state->treeStack + state->treeTop, 0, sizeof(Value) * nargs);
+    task->wait.wake  = taskReady;
+    task->wait.owner = task;
+    walkInit(&task->walk);
+
+    int profileMode = state->profileMode;
+    state->profileMode = 0;
+    swapStacks(&task->stacks);
+    walkPush(&task->walk, AST_NONE)->data[1] = FRAME_EXPRESSION;    // czeka na wynik
+    startCall(&task->walk, index, nargs);
+    swapStacks(&task->stacks);
+    state->profileMode = profileMode;
+
+    task->next = state->treeTasks;
+    if (state->treeTasks) state->treeTasks->prev = task;
+    state->treeTasks = task;
+    taskReady(&task->wait);
+}
+
+// Zadanie biegnie, aż skończy (i znika) albo stanie na kanale
+static void runTreeTask(TreeTask* task) {
+    ExecutorState* state = EXECUTOR;
+    // Czas zadań liczy się instrukcji, która na nie czeka
+    int profileMode = state->profileMode;
+    state->profileMode = 0;
+    state->treeCurrent = task;
+    swapStacks(&task->stacks);
+    runTree(&task->walk, &state->program, NULL);
+    swapStacks(&task->stacks);
+    state->treeCurrent = NULL;
+    state->profileMode = profileMode;
+    if (state->treeParked) {
+        state->treeParked = 0;
+        return;
+    }
+    if (task->prev) task->prev->next = task->next;
+    else state->treeTasks = task->next;
+    if (task->next) task->next->prev = task->prev;
+    freeTreeTask(task);
+}
+
+static TreeTask* nextReady(void) {
+    ExecutorState* state = EXECUTOR;
+    TreeTask* task = state->readyFirst;
+    if (task) {
+        state->readyFirst = task->queued;
+        if (!state->readyFirst) state->readyLast = NULL;
+    }
+    return task;
+}
+
+/*
+    Program główny na szczycie 'walk'.  Kiedy stanie na kanale, biegną
+    gotowe zadania, aż któreś go obudzi; jeśli żadne nie może, to
+    zakleszczenie i program idzie dalej bez czekania (taskGiveUp()).
+*/
+static void runWaiting(ASTWalk* walk, const AST* top, Value* globals) {
+    ExecutorState* state = EXECUTOR;
+    for (;;) {
+        runTree(walk, top, globals);
+        if (!state->treeParked) return;
+        state->treeParked = 0;
+        TreeTask* task;
+        while (!state->mainReady && (task = nextReady())) runTreeTask(task);
+        if (!state->mainReady) taskGiveUp(&state->mainWaiter);
+        state->mainReady = 0;
+    }
+}
+
+// Złączenie: gotowe zadania biegną do końca, a te, których nic już nie obudzi, przepadają
+static void finishTree(void) {
+    ExecutorState* state = EXECUTOR;
+    TreeTask* task;
+    while ((task = nextReady())) runTreeTask(task);
+    if (!state->treeTasks) return;
+    int count = 0;
+    for (task = state->treeTasks; task; task = task->next) count++;
+    taskWarnDropped(count);
+    while ((task = state->treeTasks)) {
+        state->treeTasks = task->next;
+        channelCancel(&task->wait);
+        freeTreeTask(task);
     }
 }
 
-// Globalna flaga debugowania
-static int DEBUG_MODE = 0;
+// Wszystkie zadania, VM i interpretera drzewa, przed zmianą funkcji, na których biegną
+static void joinTasks(void) {
+    taskJoin();
+    finishTree();
+}
+
+// Jedna instrukcja najwyższego poziomu, na zmiennych globalnych
+static void execute(const AST* ast, NodeIndex index, Value* globals) {
+    ExecutorState* state = EXECUTOR;
+    if (!isTimed(ast, index)) return;
+    // Zadania VM nie dzielą wyjścia z interpreterem drzewa
+    taskJoin();
+    ASTWalk walk;
+    walkInit(&walk);
+    if (state->profileMode) profileEnter(profileSite(ast, index, state->profileFunction));
+    beginStatement(&walk, index);
+    runWaiting(&walk, ast, globals);
+    if (state->profileMode) profileLeave();
+    walkFree(&walk);
+}
+
+// Wywołanie funkcji 'index' bez argumentów spoza wszelkich wyrażeń (main)
+static void callTree(int index, Value* globals) {
+    ExecutorState* state = EXECUTOR;
+    taskJoin();
+    ASTWalk walk;
+    walkInit(&walk);
+    walkPush(&walk, AST_NONE)->data[1] = FRAME_EXPRESSION;    // czeka na wynik
+    startCall(&walk, index, 0);
+    runWaiting(&walk, &state->program, globals);
+    valueRelease(popValue());
+    walkFree(&walk);
+}
 
 // Ustawianie trybu debugowania z main.c
 void set_debug_mode(int enabled) {
-    DEBUG_MODE = enabled;
+    EXECUTOR->debugMode = enabled;
+}
+
+void set_tree_walk_mode(int enabled) {
+    EXECUTOR->treeWalkMode = enabled;
+}
+
+void set_optimize_mode(int enabled) {
+    EXECUTOR->optimizeMode = enabled;
+}
+
+void set_jit_mode(int enabled) {
+    EXECUTOR->jitMode = enabled;
+}
+
+void set_profile_mode(int enabled) {
+    EXECUTOR->profileMode = enabled;
+}
+
+static void growGlobals(int count) {
+    ExecutorState* state = EXECUTOR;
+    if (count <= state->globalCount) return;
+    state->globals = (Value*)realloc(state->globals, sizeof(Value) * count);
+    memset(state->globals + state->globalCount, 0, sizeof(Value) * (count - state->globalCount));
+    state->globalCount = count;
+}
+
+// Nowe nazwy funkcji z resolvera dostają puste wpisy (bez definicji) w 'functions';
+// tablica rośnie dwukrotnie, inaczej tysiące definicji to kwadratowy koszt
+static void growFunctions(void) {
+    ExecutorState* state = EXECUTOR;
+    int count = state->functionScope.count;
+    if (count <= state->functionCount) return;
+    if (count > state->functionCapacity) {
+        int capacity = state->functionCapacity ? state->functionCapacity : 16;
+        while (capacity < count) capacity *= 2;
+        state->functions = (Function*)realloc(state->functions, sizeof(Function) * capacity);
+        state->functionCapacity = capacity;
+    }
+    memset(state->functions + state->functionCount, 0, sizeof(Function) * (count - state->functionCount));
+    for (int slot = state->functionCount; slot < count; slot++) {
+        state->functions[slot].name = state->functionScope.names[slot];
+    }
+    state->functionCount = count;
+}
+
+// Optymalizacja i nadanie slotów, wspólne dla interpretera i kompilatora AOT
+static void prepareStatement(AST* ast, NodeIndex stmt) {
+    ExecutorState* state = EXECUTOR;
+    if (!state->started) {
+        state->started = 1;
+        if (state->debugMode) {
+            printf("[RUNNING in DEBUG MODE]\n");
+        }
+    }
+
+    if (state->optimizeMode) {
+        optimizeStatement(ast, stmt);
+    }
+    growGlobals(resolveStatement(ast, stmt, &state->globalScope, &state->functionScope));
+    if (astNode(ast, stmt)->nodeType == AST_FUNC_DEF) {
+        resolveFunctionName(&state->functionScope, nodeToken(ast, astNode(ast, stmt))->id);
+    }
+    // Zadania VM trzymają tablicę funkcji, która zaraz się przeniesie
+    if (state->functionScope.count > state->functionCount) joinTasks();
+    growFunctions();
+}
+
+static void reportCompilerError(const CompilerError* error) {
+    fprintf(ioErr(), "Compiler Error [Line %d, Column %d]: %s\n",
+            error->line, error->column, error->message);
+}
+
+/*
+    Definicja funkcji z najwyższego poziomu: od tej chwili wywołania jej
+    indeksu trafiają tutaj (późniejsza definicja tej samej nazwy zastępuje
+    wcześniejszą).  Zwraca indeks.
+*/
+static int defineFunction(const AST* ast, NodeIndex stmt) {
+    ExecutorState* state = EXECUTOR;
+    const ASTNode* node = astNode(ast, stmt);
+    joinTasks();
+    int index = resolveFunctionName(&state->functionScope, nodeToken(ast, node)->id);
+    Function* function = &state->functions[index];
+    function->node = copyTree(&state->program, ast, stmt);
+    freeChunk(function->chunk);
+    function->chunk = NULL;
+    if (state->treeWalkMode) return index;
+
+    CompilerError error;
+    function->chunk = compileFunction(&state->program, function->node, state->profileMode, &error);
+    if (!function->chunk) {
+        reportCompilerError(&error);
+        fprintf(ioErr(), "[WARNING] Falling back to the tree-walking interpreter.\n");
+        state->treeWalkMode = 1;
+        return index;
+    }
+    if (state->debugMode) {
+        ioFlush();
+        printf("[FUNCTION %s]\n", stringOf(function->name));
+        disassembleChunk(function->chunk);
+    }
+    return index;
+}
+
+// Funkcja main rusza w miejscu swojej definicji
+static void runMain(int index) {
+    ExecutorState* state = EXECUTOR;
+    if (state->treeWalkMode) {
+        callTree(index, state->globals);
+        return;
+    }
+    Chunk* chunk = compileCall(index, state->globalCount);
+    vm_run(chunk, state->globals, state->globalCount, state->functions, state->jitMode);
+    freeChunk(chunk);
+}
+
+// Uruchamia jedną instrukcję najwyższego poziomu
+void execute_statement(AST* ast, NodeIndex stmt) {
+    ExecutorState* state = EXECUTOR;
+    prepareStatement(ast, stmt);
+
+    const ASTNode* node = astNode(ast, stmt);
+    if (node->nodeType == AST_FUNC_DEF) {
+        int index = defineFunction(ast, stmt);
+        if (nodeToken(ast, node)->id == STR_MAIN) runMain(index);
+        return;
+    }
+
+    if (state->treeWalkMode) {
+        execute(ast, stmt, state->globals);
+        return;
+    }
+
+    CompilerError error;
+    Chunk* chunk = compile(ast, stmt, state->globalCount, state->profileMode, &error);
+    if (!chunk) {
+        reportCompilerError(&error);
+        fprintf(ioErr(), "[WARNING] Falling back to the tree-walking interpreter.\n");
+        execute(ast, stmt, state->globals);
+        // Dalej biegnie VM: zadania tej instrukcji kończą się razem z nią
+        finishTree();
+        return;
+    }
+    if (state->debugMode) {
+        ioFlush();
+        disassembleChunk(chunk);
+    }
+    vm_run(chunk, state->globals, state->globalCount, state->functions, state->jitMode);
+    freeChunk(chunk);
 }
 
 // Główna funkcja uruchamiająca program (wołana z main.c)
-void execute_program(ASTNode* root) {
-    if (DEBUG_MODE) {
-        printf("[RUNNING in DEBUG MODE]\n");
+void execute_program(AST* ast, BlockIndex root) {
+    uint32_t count = blockCount(ast, root);
+    for (uint32_t i = 0; i < count; i++) {
+        execute_statement(ast, blockNodes(ast, root)[i]);
     }
-    execute(root);
+    execute_finish();
+}
+
+// Koniec programu: czeka na wszystkie zadania
+void execute_finish(void) {
+    joinTasks();
+}
+
+// Tłumaczy jedną instrukcję najwyższego poziomu na C/asm zamiast ją uruchamiać
+void emit_statement(Codegen* gen, AST* ast, NodeIndex stmt) {
+    ExecutorState* state = EXECUTOR;
+    prepareStatement(ast, stmt);
+    const ASTNode* node = astNode(ast, stmt);
+    if (node->nodeType == AST_FUNC_DEF) {
+        codegenFunction(gen, ast, stmt, resolveFunctionName(&state->functionScope, nodeToken(ast, node)->id));
+        return;
+    }
+    codegenStatement(gen, ast, stmt);
+}
+
+void emit_finish(Codegen* gen) {
+    ExecutorState* state = EXECUTOR;
+    codegenEnd(gen, state->globalCount, state->functionCount);
 }
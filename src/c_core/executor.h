@@ -2,8 +2,28 @@
 #define EXECUTOR_H
 
 #include "parser.h"
+#include "codegen.h"
+#include "interpreter.h"
 
-void execute_program(ASTNode* node);
+// The program state of an interpreter (interpreter.h): its globals, functions
+// and modes.  Everything below works on the current interpreter's.
+ExecutorState* executor_new(void);
+void executor_free(ExecutorState* state);
+
+void execute_program(AST* ast, BlockIndex root);
+// Run a single top-level statement; top-level variables persist between calls.
+void execute_statement(AST* ast, NodeIndex stmt);
+// The end of the program: waits for the tasks it spawned (task.h).
+void execute_finish(void);
+// Same, but translate the statement with 'gen' instead of running it;
+// emit_finish() closes the translation unit once every statement is in.
+void emit_statement(Codegen* gen, AST* ast, NodeIndex stmt);
+void emit_finish(Codegen* gen);
 void set_debug_mode(int enabled);
+void set_tree_walk_mode(int enabled);
+void set_optimize_mode(int enabled);
+void set_jit_mode(int enabled);
+// Count and time every statement (see profile.h); profileReport() prints the result.
+void set_profile_mode(int enabled);
 
 #endif // EXECUTOR_H
@@ -0,0 +1,45 @@
+// interpreter.c
+#include "interpreter.h"
+#include "token.h"
+#include "text.h"
+#include "io.h"
+#include "executor.h"
+#include "vm.h"
+#include "jit.h"
+#include "profile.h"
+#include "task.h"
+#include <stdlib.h>
+
+_Thread_local Interpreter* INTERPRETER = NULL;
+
+Interpreter* interpreterNew(void) {
+    Interpreter* interpreter = (Interpreter*)malloc(sizeof(Interpreter));
+    interpreter->strings  = stringTableNew();
+    interpreter->text     = textStateNew();
+    interpreter->io       = ioStateNew();
+    interpreter->executor = executor_new();
+    interpreter->vm       = vm_new();
+    interpreter->jit      = jitStateNew();
+    interpreter->profile  = profileStateNew();
+    interpreter->tasks    = taskStateNew();
+    interpreter->cancelled = 0;
+    return interpreter;
+}
+
+void interpreterFree(Interpreter* interpreter) {
+    if (!interpreter) return;
+    // Tasks stop first, as they run the executor's chunks; then values and
+    // chunks go, while the strings they name still exist.
+    Interpreter* previous = INTERPRETER;
+    interpreterEnter(interpreter);
+    taskStateFree(interpreter->tasks);
+    executor_free(interpreter->executor);
+    vm_free(interpreter->vm);
+    textStateFree(interpreter->text);
+    ioStateFree(interpreter->io);
+    jitStateFree(interpreter->jit);
+    profileStateFree(interpreter->profile);
+    stringTableFree(interpreter->strings);
+    interpreterEnter(previous == interpreter ? NULL : previous);
+    free(interpreter);
+}
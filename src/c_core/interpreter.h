@@ -0,0 +1,69 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+/*
+    Everything that lexing, parsing and running one program changes lives in
+    an Interpreter: the string table, the string literals, the program's
+    input and output, the executor's globals and functions, the VM's stacks,
+    the JIT's statistics, the profiler and the tasks and channels.  Any
+    number of interpreters can be at work in one process, each on its own
+    thread: one per script under --jobs (batch.h), one per request in the
+    server (server.h).
+
+    A thread works in one interpreter at a time, the one it entered last,
+    and every module reaches its part through INTERPRETER, a thread-local
+    pointer, instead of taking it as an argument in every call from
+    intern() down to ioWrite().  Threads a pipeline starts for itself (the
+    parallel parser's) enter the interpreter of the thread that started
+    them, and so do the workers that run its tasks (task.h).  Each
+    module's state is allocated by interpreterNew(), so nothing on the hot
+    paths checks whether it exists yet.
+*/
+
+typedef struct StringTable   StringTable;     // token.c
+typedef struct TextState     TextState;       // text.c
+typedef struct IoState       IoState;         // io.c
+typedef struct ExecutorState ExecutorState;   // executor.c
+typedef struct VmState       VmState;         // vm.c
+typedef struct JitState      JitState;        // jit.c
+typedef struct ProfileState  ProfileState;    // profile.c
+typedef struct TaskState     TaskState;       // task.c
+
+typedef struct {
+    StringTable*   strings;
+    TextState*     text;
+    IoState*       io;
+    ExecutorState* executor;
+    VmState*       vm;
+    JitState*      jit;
+    ProfileState*  profile;
+    TaskState*     tasks;
+    int            cancelled;   // interpreterCancel()
+} Interpreter;
+
+extern _Thread_local Interpreter* INTERPRETER;
+
+Interpreter* interpreterNew(void);
+// Frees the interpreter and every value and chunk its program left behind.
+void         interpreterFree(Interpreter* interpreter);
+
+static inline void interpreterEnter(Interpreter* interpreter) {
+    INTERPRETER = interpreter;
+}
+
+/*
+    Asks the program at work in 'interpreter' to stop; any thread may.  The
+    VM, the JIT's loops and the tree walker look at the flag at every
+    backward jump and call, and end the statement there, and so do tasks;
+    input waiting for a line gives end of input.  The program is left half
+    done: all that is still good for is interpreterFree().
+*/
+static inline void interpreterCancel(Interpreter* interpreter) {
+    __atomic_store_n(&interpreter->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+static inline int interpreterCancelled(void) {
+    return __atomic_load_n(&INTERPRETER->cancelled, __ATOMIC_RELAXED);
+}
+
+#endif // INTERPRETER_H
@@ -0,0 +1,261 @@
+// io.c
+#include "io.h"
+#include "text.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define OUTPUT_SIZE (1 << 16)
+#define INPUT_BLOCK (1 << 16)
+#define INPUT_WAIT  100         // ms between looks at the cancel flag while input waits
+
+struct IoState {
+    char*  output;                  // OUTPUT_SIZE bytes
+    size_t outputUsed;
+    int    lineFlush;               // 'out' is a terminal; decided on first print
+    FILE*  out;
+    FILE*  err;
+    int    inputFd;                 // < 0: no input at all
+
+    char*  input;
+    size_t inputCapacity;
+    size_t inputStart;              // first unread byte
+    size_t inputEnd;
+    int    inputEof;
+
+    pthread_mutex_t lock;           // ioLock()
+};
+
+#define IO (INTERPRETER->io)
+
+static _Thread_local IoCapture* CAPTURE = NULL;
+
+IoState* ioStateNew(void) {
+    IoState* io = (IoState*)calloc(1, sizeof(IoState));
+    io->output    = (char*)malloc(OUTPUT_SIZE);
+    io->lineFlush = -1;
+    io->out       = stdout;
+    io->err       = stderr;
+    io->inputFd   = STDIN_FILENO;
+    pthread_mutex_init(&io->lock, NULL);
+    return io;
+}
+
+void ioStateFree(IoState* io) {
+    if (!io) return;
+    pthread_mutex_destroy(&io->lock);
+    free(io->output);
+    free(io->input);
+    free(io);
+}
+
+void ioRedirect(FILE* out, FILE* err, int inputFd) {
+    IoState* io = IO;
+    io->out       = out;
+    io->err       = err;
+    io->inputFd   = inputFd;
+    io->lineFlush = -1;
+    io->inputEof  = inputFd < 0;
+}
+
+void ioLock(void) {
+    pthread_mutex_lock(&IO->lock);
+}
+
+void ioUnlock(void) {
+    pthread_mutex_unlock(&IO->lock);
+}
+
+FILE* ioOut(void) {
+    return IO->out;
+}
+
+FILE* ioErr(void) {
+    return IO->err;
+}
+
+int ioInputFd(void) {
+    return IO->inputFd;
+}
+
+void ioFlush(void) {
+    IoState* io = IO;
+    if (io->outputUsed) {
+        fwrite(io->output, 1, io->outputUsed, io->out);
+        io->outputUsed = 0;
+    }
+    fflush(io->out);
+}
+
+IoCapture* ioCapture(IoCapture* capture) {
+    IoCapture* previous = CAPTURE;
+    CAPTURE = capture;
+    return previous;
+}
+
+static void captureWrite(IoCapture* capture, const char* text, size_t length) {
+    if (capture->length + length > capture->capacity) {
+        size_t capacity = capture->capacity ? capture->capacity * 2 : 256;
+        while (capacity < capture->length + length) capacity *= 2;
+        capture->data = (char*)realloc(capture->data, capacity);
+        capture->capacity = capacity;
+    }
+    memcpy(capture->data + capture->length, text, length);
+    capture->length += length;
+}
+
+void ioCaptureWrite(IoCapture* capture) {
+    if (capture->length) {
+        ioWrite(capture->data, capture->length);
+        IoState* io = IO;
+        if (!CAPTURE && io->lineFlush > 0) ioFlush();
+    }
+    free(capture->data);
+    memset(capture, 0, sizeof(IoCapture));
+}
+
+void ioWrite(const char* text, size_t length) {
+    if (CAPTURE) {
+        captureWrite(CAPTURE, text, length);
+        return;
+    }
+    IoState* io = IO;
+    if (io->outputUsed + length > OUTPUT_SIZE) {
+        ioFlush();
+        if (length > OUTPUT_SIZE) {
+            fwrite(text, 1, length, io->out);
+            return;
+        }
+    }
+    memcpy(io->output + io->outputUsed, text, length);
+    io->outputUsed += length;
+}
+
+static void endLine(void) {
+    if (CAPTURE) {
+        captureWrite(CAPTURE, "\n", 1);
+        return;
+    }
+    IoState* io = IO;
+    if (io->outputUsed == OUTPUT_SIZE) ioFlush();
+    io->output[io->outputUsed++] = '\n';
+    if (io->lineFlush < 0) io->lineFlush = isatty(fileno(io->out));
+    if (io->lineFlush) ioFlush();
+}
+
+void ioWriteInt(int value) {
+    // Digits are produced backwards; unsigned so that INT_MIN negates cleanly.
+    char digits[12];
+    char* p = digits + sizeof(digits);
+    unsigned n = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    do {
+        *--p = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    if (value < 0) *--p = '-';
+    ioWrite(p, (size_t)(digits + sizeof(digits) - p));
+}
+
+void ioWriteValue(Value value) {
+    if (isInt(value)) {
+        ioWriteInt(asInt(value));
+        return;
+    }
+    if (isString(value)) {
+        char small[TEXT_INLINE_MAX + 1];
+        ioWrite(textChars(value, small), textLength(value));
+        return;
+    }
+    char text[32];
+    int length = valueFormat(value, text, sizeof(text));
+    ioWrite(text, (size_t)length);
+}
+
+void ioPrintValue(Value value) {
+    ioWriteValue(value);
+    endLine();
+}
+
+void ioPrintString(const char* text, size_t length) {
+    ioWrite(text, length);
+    endLine();
+}
+
+// Read more of the input after the unread bytes.  Returns 0 at end of input.
+static int fillInput(IoState* io) {
+    if (io->inputEof) return 0;
+    if (io->inputStart > 0) {
+        memmove(io->input, io->input + io->inputStart, io->inputEnd - io->inputStart);
+        io->inputEnd  -= io->inputStart;
+        io->inputStart = 0;
+    }
+    if (io->inputEnd == io->inputCapacity) {
+        io->inputCapacity = io->inputCapacity ? io->inputCapacity * 2 : INPUT_BLOCK;
+        io->input = (char*)realloc(io->input, io->inputCapacity);
+    }
+    // The prompt (and everything printed so far) has to be visible before we wait.
+    ioFlush();
+    // A cancelled run (interpreter.h) reads no more: neither the rest of a
+    // line that never ends nor one that nobody may ever type.
+    struct pollfd input = { io->inputFd, POLLIN, 0 };
+    for (;;) {
+        if (interpreterCancelled()) {
+            io->inputEof = 1;
+            return 0;
+        }
+        int ready = poll(&input, 1, INPUT_WAIT);
+        if (ready > 0 || (ready < 0 && errno != EINTR)) break;
+    }
+    ssize_t got = read(io->inputFd, io->input + io->inputEnd, io->inputCapacity - io->inputEnd);
+    if (got <= 0) {
+        io->inputEof = 1;
+        return 0;
+    }
+    io->inputEnd += (size_t)got;
+    return 1;
+}
+
+const char* ioReadLine(size_t* length) {
+    IoState* io = IO;
+    size_t scanned = io->inputStart;
+    for (;;) {
+        char* newline = io->inputEnd > scanned ? memchr(io->input + scanned, '\n', io->inputEnd - scanned) : NULL;
+        if (newline) {
+            const char* line = io->input + io->inputStart;
+            *length = (size_t)(newline - line);
+            io->inputStart = (size_t)(newline - io->input) + 1;
+            return line;
+        }
+        scanned = io->inputEnd - io->inputStart;
+        if (!fillInput(io)) break;
+        // fillInput() moved the unread bytes to the front of the buffer.
+        scanned += io->inputStart;
+    }
+    // Last line without a trailing newline.
+    if (io->inputStart == io->inputEnd) return NULL;
+    const char* line = io->input + io->inputStart;
+    *length = io->inputEnd - io->inputStart;
+    io->inputStart = io->inputEnd;
+    return line;
+}
+
+int ioReadInt(void) {
+    size_t length;
+    const char* line = ioReadLine(&length);
+    if (!line) return 0;
+
+    size_t i = 0;
+    while (i < length && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) i++;
+    int negative = 0;
+    if (i < length && (line[i] == '-' || line[i] == '+')) negative = line[i++] == '-';
+    unsigned value = 0;
+    while (i < length && line[i] >= '0' && line[i] <= '9') {
+        value = value * 10 + (unsigned)(line[i++] - '0');
+    }
+    return (int)(negative ? 0u - value : value);
+}
@@ -0,0 +1,61 @@
+#ifndef IO_H
+#define IO_H
+
+#include "value.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+    Program I/O for print and input.  Output collects in one large buffer
+    that is handed to stdout when it fills up, before input blocks, and by
+    ioFlush() at exit (or after every line when stdout is a terminal).
+    Input is read from stdin a block at a time and split into lines.
+    Anything else printed to stdout with stdio (debug output) must call
+    ioFlush() first to stay in order.  The buffers belong to the current
+    interpreter (interpreter.h).
+*/
+IoState* ioStateNew(void);
+void     ioStateFree(IoState* io);
+
+// Send the interpreter's program output to 'out', its messages (errors and
+// warnings) to 'err' and read input from 'inputFd'; a negative 'inputFd'
+// gives no input at all.  The defaults are stdout, stderr and stdin.
+void     ioRedirect(FILE* out, FILE* err, int inputFd);
+FILE*    ioOut(void);
+FILE*    ioErr(void);
+int      ioInputFd(void);     // where input is read from; < 0 for none
+// While tasks run on other threads (task.h), every print, input and message
+// of the program is made holding this lock.
+void     ioLock(void);
+void     ioUnlock(void);
+
+/*
+    Output of a thread can be captured instead: while 'capture' is set
+    with ioCapture(), whatever it writes collects there, and
+    ioCaptureWrite() later writes it out in one piece (through the
+    capture set then, if any) and frees it.  A parallel for keeps the
+    prints of its chunks in order that way (vm.c).  ioCapture() returns
+    the capture it replaces.
+*/
+typedef struct IoCapture {
+    char*  data;
+    size_t length, capacity;
+} IoCapture;
+
+IoCapture* ioCapture(IoCapture* capture);
+void       ioCaptureWrite(IoCapture* capture);
+
+void ioWrite(const char* text, size_t length);
+void ioWriteInt(int value);
+void ioWriteValue(Value value);
+void ioPrintValue(Value value);                       // value and a newline
+void ioPrintString(const char* text, size_t length);  // text and a newline
+void ioFlush(void);
+
+// Next line of input without its newline, valid until the next read; NULL at EOF.
+const char* ioReadLine(size_t* length);
+// Reads a whole line and returns the integer it starts with (0 if none or at EOF).
+int ioReadInt(void);
+
+#endif // IO_H
@@ -0,0 +1,570 @@
+// jit.c
+#include "jit.h"
+#include "token.h"
+#include "io.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+typedef int (*JitEntry)(Value* registers);
+
+struct JitCode {
+    JitEntry entry;
+    void*    memory;
+    size_t   size;
+};
+
+typedef struct {
+    int    statement;
+    int    start, end;
+    size_t bytes;        // 0 when the loop was rejected
+} JitStat;
+
+struct JitState {
+    JitStat* stats;
+    int      count;
+    int      capacity;
+};
+
+JitState* jitStateNew(void) {
+    return (JitState*)calloc(1, sizeof(JitState));
+}
+
+void jitStateFree(JitState* state) {
+    if (!state) return;
+    free(state->stats);
+    free(state);
+}
+
+static void recordStat(int statement, int start, int end, size_t bytes) {
+    JitState* state = INTERPRETER->jit;
+    if (state->count == state->capacity) {
+        state->capacity = state->capacity ? state->capacity * 2 : 16;
+        state->stats = (JitStat*)realloc(state->stats, sizeof(JitStat) * state->capacity);
+    }
+    JitStat stat = { statement, start, end, bytes };
+    state->stats[state->count++] = stat;
+}
+
+void jitReport(void) {
+    const JitState* state = INTERPRETER->jit;
+    int compiled = 0;
+    for (int i = 0; i < state->count; i++) compiled += state->stats[i].bytes > 0;
+    ioFlush();
+    fprintf(stderr, "[JIT] %d loop(s) compiled, %d rejected%s\n", compiled, state->count - compiled,
+            JIT_SUPPORTED ? "" : " (no JIT for this platform)");
+    for (int i = 0; i < state->count; i++) {
+        const JitStat* s = &state->stats[i];
+        if (s->bytes) {
+            fprintf(stderr, "[JIT]   statement %d, bytecode %04d-%04d: %d instructions -> %zu bytes\n",
+                    s->statement, s->start, s->end, s->end - s->start + 1, s->bytes);
+        } else {
+            fprintf(stderr, "[JIT]   statement %d, bytecode %04d-%04d: rejected\n",
+                    s->statement, s->start, s->end);
+        }
+    }
+}
+
+#if JIT_SUPPORTED
+
+/*
+    Code generation.  Every VM register stays in memory at [rbx + 8*r]; each
+    instruction loads its operands into rax/rcx, computes and stores back.
+    Arithmetic checks that both operands are ints and does the 32-bit
+    operation inline (its result, zero-extended, is the boxed int); any
+    other operands call valueArith(), like the interpreter.  Stores release
+    the object they overwrite and copies retain, as in vm.c; for ints and
+    doubles that is a compare and a branch not taken.  No register
+    allocation, but also no dispatch, no bounds on the loop and no function
+    call per int operation, which is where the interpreter spends its time.
+*/
+
+typedef struct {
+    uint8_t* code;
+    size_t   size;
+    size_t   capacity;
+} Emitter;
+
+typedef struct {
+    size_t at;       // offset of a rel32 field
+    int    target;   // bytecode index it jumps to
+} Fixup;
+
+static void byte(Emitter* e, uint8_t b) {
+    if (e->size == e->capacity) {
+        e->capacity = e->capacity ? e->capacity * 2 : 256;
+        e->code = (uint8_t*)realloc(e->code, e->capacity);
+    }
+    e->code[e->size++] = b;
+}
+
+static void bytes(Emitter* e, const uint8_t* b, int n) {
+    for (int i = 0; i < n; i++) byte(e, b[i]);
+}
+
+static void u32(Emitter* e, uint32_t v) {
+    for (int i = 0; i < 4; i++) byte(e, (uint8_t)(v >> (8 * i)));
+}
+
+static void u64(Emitter* e, uint64_t v) {
+    for (int i = 0; i < 8; i++) byte(e, (uint8_t)(v >> (8 * i)));
+}
+
+// REX.W op [rbx + disp32] with the ModRM reg field 'reg'
+static void memOperand(Emitter* e, uint8_t opcode, int reg, int vmReg) {
+    byte(e, 0x48);
+    byte(e, opcode);
+    byte(e, (uint8_t)(0x83 | (reg << 3)));
+    u32(e, (uint32_t)(vmReg * 8));
+}
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RDI 7
+
+static void load(Emitter* e, int reg, int vmReg)  { memOperand(e, 0x8B, reg, vmReg); }
+
+// mov rax, imm64
+static void loadConstant(Emitter* e, uint64_t value) {
+    byte(e, 0x48); byte(e, 0xB8);
+    u64(e, value);
+}
+
+// Short forward jump (jcc rel8 or jmp rel8); patchShort() points it here.
+static size_t jumpShort(Emitter* e, uint8_t opcode) {
+    byte(e, opcode);
+    byte(e, 0);
+    return e->size - 1;
+}
+
+static void patchShort(Emitter* e, size_t at) {
+    e->code[at] = (uint8_t)(e->size - (at + 1));
+}
+
+static void callHelper(Emitter* e, uintptr_t fn) {
+    loadConstant(e, (uint64_t)fn);
+    byte(e, 0xFF); byte(e, 0xD0);           // call rax
+}
+
+static void jitRetain(Value v)  { valueRetain(v); }
+static void jitRelease(Value v) { valueRelease(v); }
+static int  jitTruthy(Value v)  { return valueTruthy(v); }
+
+// Call 'fn' with the value in 'reg' when it is an object (isObject()).  Uses rdx, rdi.
+static void ifObject(Emitter* e, int reg, uintptr_t fn) {
+    byte(e, 0x48); byte(e, 0x89); byte(e, (uint8_t)(0xC2 | (reg << 3)));    // mov rdx, reg
+    static const uint8_t tag[] = { 0x48, 0xC1, 0xEA, 0x2F,                  // shr rdx, 47
+                                   0x83, 0xFA, 0x02 };                      // cmp edx, 2
+    bytes(e, tag, sizeof(tag));
+    size_t skip = jumpShort(e, 0x75);
+    byte(e, 0x48); byte(e, 0x89); byte(e, (uint8_t)(0xC7 | (reg << 3)));    // mov rdi, reg
+    callHelper(e, fn);
+    patchShort(e, skip);
+}
+
+// R[vmReg] = rax, releasing the old value.  Uses rcx, rdx, rdi.
+static void store(Emitter* e, int vmReg) {
+    load(e, RCX, vmReg);
+    memOperand(e, 0x89, RAX, vmReg);
+    ifObject(e, RCX, (uintptr_t)jitRelease);
+}
+
+// mov eax, pc; pop rbx; ret
+static void exitTo(Emitter* e, int pc) {
+    byte(e, 0xB8);
+    u32(e, (uint32_t)pc);
+    byte(e, 0x5B);
+    byte(e, 0xC3);
+}
+
+/*
+    Before a jump back: a cancelled run (interpreter.h) leaves native code
+    for 'target', where the interpreter's own check stops it.  The flag's
+    address is the interpreter's, which owns the chunk.  The exit is out
+    of line, after the loop (cancelExits()), so a trip only costs a load
+    and a branch not taken.
+*/
+static void cancelCheck(Emitter* e, Fixup* exits, int* nexits, int target) {
+    loadConstant(e, (uint64_t)(uintptr_t)&INTERPRETER->cancelled);
+    static const uint8_t test[] = { 0x83, 0x38, 0x00,                   // cmp dword [rax], 0
+                                    0x0F, 0x85 };                       // jne rel32
+    bytes(e, test, sizeof(test));
+    exits[*nexits].at = e->size;
+    exits[*nexits].target = target;
+    (*nexits)++;
+    u32(e, 0);
+}
+
+static void cancelExits(Emitter* e, const Fixup* exits, int nexits) {
+    for (int i = 0; i < nexits; i++) {
+        int32_t rel = (int32_t)(e->size - (exits[i].at + 4));
+        memcpy(&e->code[exits[i].at], &rel, 4);
+        exitTo(e, exits[i].target);
+    }
+}
+
+static void jitPrintString(int id) {
+    ioPrintString(stringOf((uint32_t)id), stringLength((uint32_t)id));
+}
+
+static void jitPromptString(int id) {
+    ioWrite(stringOf((uint32_t)id), stringLength((uint32_t)id));
+}
+
+// eax = 1 if the value in rax is true, else 0 (valueTruthy()).  Strings
+// call out for their length.  Uses rdx, and rdi for strings.
+static void truthy(Emitter* e) {
+    static const uint8_t testRax[]  = { 0x48, 0x85, 0xC0 };              // test rax, rax
+    static const uint8_t highHalf[] = { 0x48, 0x89, 0xC2,                // mov rdx, rax
+                                        0x48, 0xC1, 0xEA, 0x20 };        // shr rdx, 32
+    static const uint8_t string[]   = { 0x48, 0xC1, 0xEA, 0x10,          // shr rdx, 16
+                                        0x83, 0xFA, 0x01 };              // cmp edx, 1
+    static const uint8_t isZero[]   = { 0x48, 0x29, 0xD0,                // sub rax, rdx
+                                        0x48, 0x01, 0xC0 };              // add rax, rax: drops the sign
+    bytes(e, testRax, sizeof(testRax));
+    size_t zeroInt = jumpShort(e, 0x74);
+    bytes(e, highHalf, sizeof(highHalf));
+    size_t otherInt = jumpShort(e, 0x74);
+    bytes(e, string, sizeof(string));
+    size_t notString = jumpShort(e, 0x75);
+    byte(e, 0x48); byte(e, 0x89); byte(e, 0xC7);                         // mov rdi, rax
+    callHelper(e, (uintptr_t)jitTruthy);
+    size_t called = jumpShort(e, 0xEB);
+    patchShort(e, notString);
+    byte(e, 0x48); byte(e, 0xBA);                                        // mov rdx, offset
+    u64(e, VALUE_DOUBLE_OFFSET);
+    bytes(e, isZero, sizeof(isZero));
+    size_t zeroDouble = jumpShort(e, 0x74);
+    patchShort(e, otherInt);
+    byte(e, 0xB8); u32(e, 1);                                            // mov eax, 1
+    size_t done = jumpShort(e, 0xEB);
+    patchShort(e, zeroInt);
+    patchShort(e, zeroDouble);
+    byte(e, 0x31); byte(e, 0xC0);                                        // xor eax, eax
+    patchShort(e, done);
+    patchShort(e, called);
+}
+
+/*
+    'cond' is 0 for an unconditional jump, else the second byte of the
+    0F 8x jcc rel32 form.  Targets outside the loop leave native code.
+*/
+static void jump(Emitter* e, Fixup* fixups, int* nfixups, int cond, int target, int start, int end) {
+    if (target >= start && target <= end) {
+        if (cond) { byte(e, 0x0F); byte(e, (uint8_t)cond); }
+        else      { byte(e, 0xE9); }
+        fixups[*nfixups].at = e->size;
+        fixups[*nfixups].target = target;
+        (*nfixups)++;
+        u32(e, 0);
+        return;
+    }
+    if (cond) {
+        // Skip the 7-byte exit when the condition does not hold.
+        byte(e, (uint8_t)(cond == 0x84 ? 0x75 : 0x74));
+        byte(e, 7);
+    }
+    exitTo(e, target);
+}
+
+static uint8_t setccFor(uint8_t op) {
+    switch (op) {
+        case OP_EQ: return 0x94;
+        case OP_NE: return 0x95;
+        case OP_LT: return 0x9C;
+        case OP_LE: return 0x9E;
+        case OP_GT: return 0x9F;
+        case OP_GE: return 0x9D;
+    }
+    return 0;
+}
+
+static uint32_t operatorFor(uint8_t op) {
+    switch (op) {
+        case OP_ADD: return STR_PLUS;
+        case OP_SUB: return STR_MINUS;
+        case OP_MUL: return STR_STAR;
+        case OP_DIV: return STR_SLASH;
+        case OP_MOD: return STR_PERCENT;
+        case OP_EQ:  return STR_EQ;
+        case OP_NE:  return STR_NE;
+        case OP_LT:  return STR_LT;
+        case OP_LE:  return STR_LE;
+        case OP_GT:  return STR_GT;
+    }
+    return STR_GE;
+}
+
+// The int operation on eax and ecx, result in eax.
+static void intOperation(Emitter* e, uint8_t op) {
+    switch (op) {
+        case OP_ADD: byte(e, 0x01); byte(e, 0xC8); break;                // add eax, ecx
+        case OP_SUB: byte(e, 0x29); byte(e, 0xC8); break;                // sub eax, ecx
+        case OP_MUL: byte(e, 0x0F); byte(e, 0xAF); byte(e, 0xC1); break; // imul eax, ecx
+        case OP_DIV:
+        case OP_MOD: {
+            // R[c] == 0 gives 0, like the interpreter; -1 is not divided
+            // by, idiv traps on INT_MIN / -1: x / -1 = neg x, x % -1 = 0.
+            byte(e, 0x85); byte(e, 0xC9);                                // test ecx, ecx
+            size_t zero = jumpShort(e, 0x74);
+            byte(e, 0x83); byte(e, 0xF9); byte(e, 0xFF);                 // cmp ecx, -1
+            size_t divide = jumpShort(e, 0x75);
+            if (op == OP_DIV) { byte(e, 0xF7); byte(e, 0xD8); }          // neg eax
+            else { byte(e, 0x31); byte(e, 0xC0); }                       // xor eax, eax
+            size_t negated = jumpShort(e, 0xEB);
+            patchShort(e, divide);
+            byte(e, 0x99);                                               // cdq
+            byte(e, 0xF7); byte(e, 0xF9);                                // idiv ecx
+            if (op == OP_MOD) { byte(e, 0x89); byte(e, 0xD0); }          // mov eax, edx
+            size_t done = jumpShort(e, 0xEB);
+            patchShort(e, zero);
+            byte(e, 0x31); byte(e, 0xC0);                                // xor eax, eax
+            patchShort(e, done);
+            patchShort(e, negated);
+            break;
+        }
+        default:
+            byte(e, 0x39); byte(e, 0xC8);                                // cmp eax, ecx
+            byte(e, 0x0F); byte(e, setccFor(op)); byte(e, 0xC0);         // setcc al
+            byte(e, 0x0F); byte(e, 0xB6); byte(e, 0xC0);                 // movzx eax, al
+            break;
+    }
+}
+
+static void arithmetic(Emitter* e, const Instr* in) {
+    static const uint8_t bothInt[] = { 0x48, 0x89, 0xC2,                 // mov rdx, rax
+                                       0x48, 0x09, 0xCA,                 // or rdx, rcx
+                                       0x48, 0xC1, 0xEA, 0x20 };         // shr rdx, 32
+    static const uint8_t operands[] = { 0x48, 0x89, 0xC6,                // mov rsi, rax
+                                        0x48, 0x89, 0xCA };              // mov rdx, rcx
+    load(e, RAX, in->b);
+    load(e, RCX, in->c);
+    bytes(e, bothInt, sizeof(bothInt));
+    size_t slow = jumpShort(e, 0x75);
+    intOperation(e, in->op);
+    size_t done = jumpShort(e, 0xEB);
+    patchShort(e, slow);
+    byte(e, 0xBF); u32(e, operatorFor(in->op));                          // mov edi, operator
+    bytes(e, operands, sizeof(operands));
+    callHelper(e, (uintptr_t)valueArith);
+    patchShort(e, done);
+    store(e, in->a);
+}
+
+/*
+    OP_FORLOOP up to its jump back (forNext()): the counter, end and step
+    are ints by then, so the next counter is their sum in 64 bits, held
+    against the end the way the step points.  done[] are the jumps out of
+    the loop, for patchShort() after the jump back.
+*/
+static void forNextCode(Emitter* e, const Instr* in, size_t done[2]) {
+    static const uint8_t addStep[] = { 0x48, 0x01, 0xD0 };              // add rax, rdx
+    static const uint8_t testStep[] = { 0x85, 0xD2 };                   // test edx, edx
+    static const uint8_t compare[] = { 0x48, 0x39, 0xC8 };              // cmp rax, rcx
+    memOperand(e, 0x63, RAX, in->a);                                     // movsxd rax, counter
+    memOperand(e, 0x63, RDX, in->a + 2);                                 // movsxd rdx, step
+    bytes(e, addStep, sizeof(addStep));
+    memOperand(e, 0x63, RCX, in->a + 1);                                 // movsxd rcx, end
+    bytes(e, testStep, sizeof(testStep));
+    size_t down = jumpShort(e, 0x78);                                    // js
+    bytes(e, compare, sizeof(compare));
+    done[0] = jumpShort(e, 0x7D);                                        // jge
+    size_t counted = jumpShort(e, 0xEB);
+    patchShort(e, down);
+    bytes(e, compare, sizeof(compare));
+    done[1] = jumpShort(e, 0x7E);                                        // jle
+    patchShort(e, counted);
+    byte(e, 0x89); byte(e, 0xC0);                                        // mov eax, eax: box the int
+    memOperand(e, 0x89, RAX, in->a);                                     // mov counter, rax
+}
+
+static int emitLoop(Emitter* e, const Chunk* chunk, int start, int end) {
+    int n = end - start + 1;
+    size_t* offsets = (size_t*)malloc(sizeof(size_t) * n);
+    Fixup* fixups = (Fixup*)malloc(sizeof(Fixup) * n);
+    Fixup* exits = (Fixup*)malloc(sizeof(Fixup) * n);
+    int nfixups = 0, nexits = 0;
+
+    static const uint8_t prologue[] = { 0x53, 0x48, 0x89, 0xFB };   // push rbx; mov rbx, rdi
+    bytes(e, prologue, sizeof(prologue));
+
+    for (int pc = start; pc <= end; pc++) {
+        const Instr* in = &chunk->code[pc];
+        offsets[pc - start] = e->size;
+
+        switch (in->op) {
+            case OP_LOADI:
+                byte(e, 0xB8);                                   // mov eax, imm32 (zero-extends)
+                u32(e, (uint32_t)in->sx);
+                store(e, in->a);
+                break;
+
+            case OP_LOADK:
+                if (isObject(chunk->constants[in->sx])) {
+                    byte(e, 0x48); byte(e, 0xBF);                // mov rdi, imm64
+                    u64(e, chunk->constants[in->sx]);
+                    callHelper(e, (uintptr_t)jitRetain);
+                }
+                loadConstant(e, chunk->constants[in->sx]);
+                store(e, in->a);
+                break;
+
+            case OP_MOV:
+                load(e, RAX, in->b);
+                ifObject(e, RAX, (uintptr_t)jitRetain);
+                load(e, RAX, in->b);
+                store(e, in->a);
+                break;
+
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            case OP_EQ:  case OP_NE:  case OP_LT:  case OP_LE:  case OP_GT: case OP_GE:
+                arithmetic(e, in);
+                break;
+
+            case OP_TEST:
+                load(e, RAX, in->b);
+                truthy(e);
+                store(e, in->a);
+                break;
+
+            case OP_JMP:
+                if (in->sx < 0) cancelCheck(e, exits, &nexits, pc + 1 + in->sx);
+                jump(e, fixups, &nfixups, 0, pc + 1 + in->sx, start, end);
+                break;
+
+            case OP_JMPF:
+            case OP_JMPT:
+                load(e, RAX, in->a);
+                truthy(e);
+                byte(e, 0x85); byte(e, 0xC0);                    // test eax, eax
+                jump(e, fixups, &nfixups, in->op == OP_JMPF ? 0x84 : 0x85,
+                     pc + 1 + in->sx, start, end);
+                break;
+
+            case OP_PRINT:
+            case OP_PROMPT:
+                load(e, RDI, in->a);
+                callHelper(e, in->op == OP_PRINT ? (uintptr_t)ioPrintValue : (uintptr_t)ioWriteValue);
+                break;
+
+            case OP_PRINTS:
+            case OP_PROMPTS:
+                byte(e, 0xBF);                                   // mov edi, imm32
+                u32(e, (uint32_t)in->sx);
+                callHelper(e, in->op == OP_PRINTS ? (uintptr_t)jitPrintString : (uintptr_t)jitPromptString);
+                break;
+
+            case OP_INPUT:
+                callHelper(e, (uintptr_t)ioReadInt);
+                byte(e, 0x89); byte(e, 0xC0);                    // mov eax, eax: box the int
+                store(e, in->a);
+                break;
+
+            case OP_FORPREP:
+                byte(e, 0x48); byte(e, 0x8D); byte(e, 0xBB);     // lea rdi, [rbx + 8*a]
+                u32(e, (uint32_t)(in->a * 8));
+                callHelper(e, (uintptr_t)forStart);
+                byte(e, 0x85); byte(e, 0xC0);                    // test eax, eax
+                jump(e, fixups, &nfixups, 0x84, pc + 1 + in->sx, start, end);
+                break;
+
+            case OP_FORLOOP: {
+                size_t done[2];
+                forNextCode(e, in, done);
+                cancelCheck(e, exits, &nexits, pc + 1 + in->sx);
+                jump(e, fixups, &nfixups, 0, pc + 1 + in->sx, start, end);
+                patchShort(e, done[0]);
+                patchShort(e, done[1]);
+                break;
+            }
+
+            case OP_HALT:
+                exitTo(e, pc);
+                break;
+
+            default:
+                free(offsets);
+                free(fixups);
+                free(exits);
+                return 0;
+        }
+    }
+    exitTo(e, end + 1);
+    cancelExits(e, exits, nexits);
+
+    for (int i = 0; i < nfixups; i++) {
+        int32_t rel = (int32_t)(offsets[fixups[i].target - start] - (fixups[i].at + 4));
+        memcpy(&e->code[fixups[i].at], &rel, 4);
+    }
+    free(offsets);
+    free(fixups);
+    free(exits);
+    return 1;
+}
+
+JitCode* jitCompileLoop(const Chunk* chunk, int start, int end, int statement) {
+    Emitter e = { NULL, 0, 0 };
+    if (start < 0 || end >= chunk->count || start > end || !emitLoop(&e, chunk, start, end)) {
+        free(e.code);
+        recordStat(statement, start, end, 0);
+        return NULL;
+    }
+
+    // Written while writable, then flipped to executable (never both at once).
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (e.size + page - 1) / page * page;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        free(e.code);
+        recordStat(statement, start, end, 0);
+        return NULL;
+    }
+    memcpy(memory, e.code, e.size);
+    free(e.code);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        recordStat(statement, start, end, 0);
+        return NULL;
+    }
+
+    JitCode* code = (JitCode*)malloc(sizeof(JitCode));
+    code->entry  = (JitEntry)memory;
+    code->memory = memory;
+    code->size   = size;
+    recordStat(statement, start, end, e.size);
+    return code;
+}
+
+void jitFree(JitCode* code) {
+    if (!code) return;
+    munmap(code->memory, code->size);
+    free(code);
+}
+
+#else
+
+JitCode* jitCompileLoop(const Chunk* chunk, int start, int end, int statement) {
+    (void)chunk;
+    recordStat(statement, start, end, 0);
+    return NULL;
+}
+
+void jitFree(JitCode* code) {
+    (void)code;
+}
+
+#endif
+
+int jitRun(const JitCode* code, Value* registers) {
+    return code->entry(registers);
+}
@@ -0,0 +1,29 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "compiler.h"
+#include "interpreter.h"
+
+/*
+    Baseline x86-64 JIT for hot loops.  The VM counts backward jumps and,
+    once a loop has run JIT_THRESHOLD times, hands its bytecode range to
+    jitCompileLoop().  The native code works directly on the VM's register
+    array and returns the bytecode index to continue at when the loop exits.
+    On other platforms, or for code it can't handle, jitCompileLoop()
+    returns NULL and the loop stays in the interpreter.
+*/
+#define JIT_THRESHOLD 1000
+
+// Compile instructions start..end (end is the loop's backward jump).
+// 'statement' is only used for the --jit-stats report.
+JitCode* jitCompileLoop(const Chunk* chunk, int start, int end, int statement);
+int      jitRun(const JitCode* code, Value* registers);
+void     jitFree(JitCode* code);
+
+// Print the loops compiled so far to stderr (--jit-stats).
+void     jitReport(void);
+// The interpreter's list of compiled loops for jitReport().
+JitState* jitStateNew(void);
+void      jitStateFree(JitState* state);
+
+#endif // JIT_H
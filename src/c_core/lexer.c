@@ -2,85 +2,785 @@
 #include "error_handling.h"
 #include "token.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
 
-#define MAX_TOKEN_SIZE 100
-#define MAX_TOKENS 1024
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-const char* keywords[] = {
-    "if", "else", "while", "for", "return", "int", "float", "void",
-    "func", "print", "input", "break", "loop"
+#define LEXER_BUFFER_SIZE (64 * 1024)
+#define LEXER_LOOKAHEAD   64      // bytes kept available ahead of each token when reading a file
+
+/*
+    Character classes.  One table lookup replaces the isspace/isalpha/
+    isalnum/strchr calls per byte.
+*/
+enum {
+    CC_SPACE  = 1,
+    CC_ALPHA  = 2,
+    CC_DIGIT  = 4,
+    CC_OPER   = 8,
+    CC_SYMBOL = 16,
+    CC_QUOTE  = 32
+};
+
+#define S CC_SPACE
+#define A CC_ALPHA
+#define D CC_DIGIT
+#define O CC_OPER
+#define Y CC_SYMBOL
+#define Q CC_QUOTE
+static const unsigned char charClass[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, S, S, S, S, S, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    S, O, Q, 0, 0, O, O, 0, Y, Y, O, O, Y, O, Y, O,
+    D, D, D, D, D, D, D, D, D, D, 0, Y, O, O, O, 0,
+    0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, 0,
+    0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, Y, O, Y, 0, 0,
+    // bytes >= 0x80 are not part of any token
 };
+#undef S
+#undef A
+#undef D
+#undef O
+#undef Y
+#undef Q
+
+/*
+    Keywords are resolved with a perfect hash on (length, first byte, last
+    byte) and one memcmp, so they never reach the string table's hash.
+    Regenerate the table if the keyword list in token.c changes.  The text
+    comes from predefinedText(), which pool workers may read while the
+    parser's thread grows the string table.
+*/
+#define KEYWORD_HASH(s, n) ((7u * (n) + 5u * (unsigned char)(s)[0] + (unsigned char)(s)[(n) - 1]) & 31)
+
+static const signed char keywordTable[32] = {
+    -1, STR_IF, -1, -1, STR_INPUT, STR_FOR, -1, STR_PRINT,
+    STR_LOOP, STR_REDUCE, -1, -1, STR_RECV, -1, STR_VOID, -1,
+    STR_SPAWN, -1, STR_RETURN, -1, STR_PARALLEL, STR_FLOAT, STR_INT, -1,
+    STR_BREAK, STR_CHAN, STR_ELSE, STR_WHILE, -1, STR_FUNC, -1, STR_SEND
+};
+
+static int keywordId(const char* s, size_t n) {
+    if (n < 2 || n > 8) return -1;
+    int id = keywordTable[KEYWORD_HASH(s, n)];
+    if (id < 0) return -1;
+    const char* text = predefinedText((uint32_t)id);
+    if (strncmp(text, s, n) == 0 && text[n] == '\0') return id;
+    return -1;
+}
+
+/*
+    Bulk scanners.  Each returns the first byte in [p, end) that ends the
+    run; they never read past 'end'.  The vector loops handle whole 16/32
+    byte blocks and the scalar loop finishes the tail.
+*/
+#if defined(__AVX2__)
+#define VEC_WIDTH 32
+typedef __m256i vec;
+#define vload(p)        _mm256_loadu_si256((const __m256i*)(p))
+#define vset1(c)        _mm256_set1_epi8((char)(c))
+#define veq(a, b)       _mm256_cmpeq_epi8((a), (b))
+#define vgt(a, b)       _mm256_cmpgt_epi8((a), (b))
+#define vor(a, b)       _mm256_or_si256((a), (b))
+#define vand(a, b)      _mm256_and_si256((a), (b))
+#define vmask(a)        ((uint32_t)_mm256_movemask_epi8(a))
+#define VEC_ALL         0xFFFFFFFFu
+#elif defined(__SSE2__)
+#define VEC_WIDTH 16
+typedef __m128i vec;
+#define vload(p)        _mm_loadu_si128((const __m128i*)(p))
+#define vset1(c)        _mm_set1_epi8((char)(c))
+#define veq(a, b)       _mm_cmpeq_epi8((a), (b))
+#define vgt(a, b)       _mm_cmpgt_epi8((a), (b))
+#define vor(a, b)       _mm_or_si128((a), (b))
+#define vand(a, b)      _mm_and_si128((a), (b))
+#define vmask(a)        ((uint32_t)_mm_movemask_epi8(a))
+#define VEC_ALL         0xFFFFu
+#endif
 
-int isKeyword(const char* str) {
-    for (int i = 0; i < (int)(sizeof(keywords) / sizeof(keywords[0])); i++) {
-        if (strcmp(str, keywords[i]) == 0) return 1;
+static const char* skipSpaces(const char* p, const char* end) {
+#ifdef VEC_WIDTH
+    const vec sp = vset1(' '), nl = vset1('\n'), tab = vset1('\t'), cr = vset1('\r');
+    while (end - p >= VEC_WIDTH) {
+        vec v = vload(p);
+        uint32_t m = vmask(vor(vor(veq(v, sp), veq(v, nl)), vor(veq(v, tab), veq(v, cr))));
+        if (m != VEC_ALL) return p + __builtin_ctz(~m);
+        p += VEC_WIDTH;
     }
-    return 0;
+#endif
+    while (p < end && (charClass[(unsigned char)*p] & CC_SPACE)) p++;
+    return p;
 }
 
-Token* lex(const char* input, int* token_count) {
-    static Token tokens[MAX_TOKENS];
-    int count = 0;
-    const char* p = input;
+// Stops on the byte in 'stop' or on '\0' (which ends the input).
+static const char* findByte(const char* p, const char* end, char stop) {
+#ifdef VEC_WIDTH
+    const vec s = vset1(stop), zero = vset1(0);
+    while (end - p >= VEC_WIDTH) {
+        vec v = vload(p);
+        uint32_t m = vmask(vor(veq(v, s), veq(v, zero)));
+        if (m) return p + __builtin_ctz(m);
+        p += VEC_WIDTH;
+    }
+#endif
+    while (p < end && *p != stop && *p != '\0') p++;
+    return p;
+}
 
-    while (*p != '\0') {
-        if (*p == '/' && *(p+1) == '/') {
-            while (*p && *p != '\n') p++;
-            continue;
+static const char* skipAlnum(const char* p, const char* end) {
+#ifdef VEC_WIDTH
+    // Signed compares: bytes >= 0x80 are negative and fall outside both ranges.
+    const vec d0 = vset1('0' - 1), d9 = vset1('9' + 1);
+    const vec a0 = vset1('a' - 1), az = vset1('z' + 1), lower = vset1(0x20);
+    while (end - p >= VEC_WIDTH) {
+        vec v = vload(p);
+        vec digit = vand(vgt(v, d0), vgt(d9, v));
+        vec l = vor(v, lower);
+        vec alpha = vand(vgt(l, a0), vgt(az, l));
+        uint32_t m = vmask(vor(digit, alpha));
+        if (m != VEC_ALL) return p + __builtin_ctz(~m);
+        p += VEC_WIDTH;
+    }
+#endif
+    while (p < end && (charClass[(unsigned char)*p] & (CC_ALPHA | CC_DIGIT))) p++;
+    return p;
+}
+
+// Lex input[start, length) as if it began at a line start; offsets stay relative to 'input'.
+static void initLexerRange(Lexer* lexer, const char* input, size_t length, size_t start) {
+    lexer->file     = NULL;
+    lexer->buffer   = (char*)input;
+    lexer->capacity = length;
+    lexer->mark     = start;
+    lexer->pos      = start;
+    lexer->end      = length;
+    lexer->base     = 0;
+    lexer->owned    = 0;
+    lexer->eof      = 1;
+    lexer->line     = 1;
+    lexer->lineStart = start;
+    lexer->column   = 0;
+    lexer->hashOnly = 0;
+    lexer->readAt   = -1;
+    lexer->pool     = NULL;
+}
+
+void initLexerString(Lexer* lexer, const char* input) {
+    initLexerRange(lexer, input, strlen(input), 0);
+}
+
+void initLexerFile(Lexer* lexer, FILE* file) {
+    lexer->file     = file;
+    lexer->capacity = LEXER_BUFFER_SIZE;
+    lexer->buffer   = (char*)malloc(lexer->capacity);
+    lexer->mark     = 0;
+    lexer->pos      = 0;
+    lexer->end      = 0;
+    lexer->base     = 0;
+    lexer->owned    = 1;
+    lexer->eof      = 0;
+    lexer->line     = 1;
+    lexer->lineStart = 0;
+    lexer->column   = 0;
+    lexer->hashOnly = 0;
+    lexer->readAt   = -1;
+    lexer->pool     = NULL;
+}
+
+int initLexerRescan(Lexer* scan, const Lexer* lexer, uint64_t offset) {
+    if (!lexer->file) {
+        initLexerRange(scan, lexer->buffer, lexer->end, (size_t)offset);
+        return 1;
+    }
+    if (lseek(fileno(lexer->file), 0, SEEK_CUR) < 0) return 0;
+    initLexerFile(scan, lexer->file);
+    scan->base      = offset;
+    scan->lineStart = offset;
+    scan->readAt    = (int64_t)offset;
+    return 1;
+}
+
+static void freePool(LexerPool* pool);
+
+void freeLexer(Lexer* lexer) {
+    if (lexer->pool) freePool(lexer->pool);
+    if (lexer->owned) free(lexer->buffer);
+    lexer->buffer = NULL;
+    lexer->pool   = NULL;
+}
+
+uint32_t lexerColumn(const Lexer* lexer, const Token* tok) {
+    if (lexer->file) return lexer->column;
+    // The whole source is in memory; look back for the start of the line.
+    const char* line = lexer->buffer + tok->offset;
+    while (line > lexer->buffer && line[-1] != '\n') line--;
+    return (uint32_t)(lexer->buffer + tok->offset - line) + 1;
+}
+
+/*
+    fill: read more input.  Everything before 'mark' has been consumed and
+    is dropped; the buffer only grows when a single lexeme outgrows it.
+    Returns 0 at end of input.
+*/
+static int fill(Lexer* lexer) {
+    if (lexer->eof) return 0;
+
+    if (lexer->mark > 0) {
+        memmove(lexer->buffer, lexer->buffer + lexer->mark, lexer->end - lexer->mark);
+        lexer->base += lexer->mark;
+        lexer->pos  -= lexer->mark;
+        lexer->end  -= lexer->mark;
+        lexer->mark  = 0;
+    }
+    if (lexer->end == lexer->capacity) {
+        lexer->capacity *= 2;
+        lexer->buffer = (char*)realloc(lexer->buffer, lexer->capacity);
+    }
+
+    size_t n;
+    if (lexer->readAt >= 0) {
+        ssize_t got = pread(fileno(lexer->file), lexer->buffer + lexer->end, lexer->capacity - lexer->end,
+                            (off_t)lexer->readAt);
+        n = got > 0 ? (size_t)got : 0;
+        lexer->readAt += (int64_t)n;
+    } else {
+        n = fread(lexer->buffer + lexer->end, 1, lexer->capacity - lexer->end, lexer->file);
+    }
+    lexer->end += n;
+    if (n == 0) lexer->eof = 1;
+    return n > 0;
+}
+
+// Byte at pos + k, or '\0' past the end of input.
+static inline int peek(Lexer* lexer, size_t k) {
+    while (lexer->pos + k >= lexer->end) {
+        if (!fill(lexer)) return '\0';
+    }
+    return (unsigned char)lexer->buffer[lexer->pos + k];
+}
+
+typedef const char* (*Scanner)(const char* p, const char* end);
+
+static const char* findNewline(const char* p, const char* end) {
+    return findByte(p, end, '\n');
+}
+
+static const char* findQuote(const char* p, const char* end) {
+    return findByte(p, end, '"');
+}
+
+// Count the newlines in buffer[from, to); the line starts after the last one.
+static void countLines(Lexer* lexer, size_t from, size_t to) {
+    const char* p = lexer->buffer + from;
+    const char* end = lexer->buffer + to;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        p++;
+        lexer->line++;
+        lexer->lineStart = lexer->base + (uint64_t)(p - lexer->buffer);
+    }
+}
+
+/*
+    Run a bulk scanner from pos, refilling while the run reaches the end of
+    the buffer.  scanLexeme keeps the lexeme from 'mark' across refills;
+    skipRun (whitespace, comments) lets the skipped bytes be dropped.
+*/
+static void scanLexeme(Lexer* lexer, Scanner scan) {
+    do {
+        const char* p = scan(lexer->buffer + lexer->pos, lexer->buffer + lexer->end);
+        lexer->pos = (size_t)(p - lexer->buffer);
+    } while (lexer->pos == lexer->end && fill(lexer));
+}
+
+static void skipRun(Lexer* lexer, Scanner scan) {
+    do {
+        const char* p = scan(lexer->buffer + lexer->pos, lexer->buffer + lexer->end);
+        countLines(lexer, lexer->pos, (size_t)(p - lexer->buffer));
+        lexer->pos  = (size_t)(p - lexer->buffer);
+        lexer->mark = lexer->pos;
+    } while (lexer->pos == lexer->end && fill(lexer));
+}
+
+static uint32_t operatorId(int c, int next, int* length) {
+    *length = 2;
+    switch (c) {
+        case '=': if (next == '=') return STR_EQ;  break;
+        case '!': if (next == '=') return STR_NE;  break;
+        case '<': if (next == '=') return STR_LE;  break;
+        case '>': if (next == '=') return STR_GE;  break;
+        case '&': if (next == '&') return STR_AND; *length = 0; return 0;
+        case '|': if (next == '|') return STR_OR;  *length = 0; return 0;
+    }
+    *length = 1;
+    switch (c) {
+        case '+': return STR_PLUS;
+        case '-': return STR_MINUS;
+        case '*': return STR_STAR;
+        case '/': return STR_SLASH;
+        case '%': return STR_PERCENT;
+        case '=': return STR_ASSIGN;
+        case '!': return STR_BANG;
+        case '<': return STR_LT;
+        default:  return STR_GT;
+    }
+}
+
+static uint32_t symbolId(int c) {
+    switch (c) {
+        case '(': return STR_LPAREN;
+        case ')': return STR_RPAREN;
+        case '{': return STR_LBRACE;
+        case '}': return STR_RBRACE;
+        case ';': return STR_SEMICOLON;
+        case '.': return STR_DOTDOT;
+        default:  return STR_COMMA;
+    }
+}
+
+/*
+    "import name" and "import c name" (a function from the C library) are
+    lexed as one TOKEN_IMPORT or TOKEN_IMPORT_FROM_C whose id is the name.
+    Two words in a row occur nowhere else, so an "import" followed by
+    anything but a name on the same line stays an identifier.
+*/
+static size_t wordAfter(Lexer* lexer, size_t k, size_t* word) {
+    size_t start = k;
+    int c;
+    while ((c = peek(lexer, k)) == ' ' || c == '\t') k++;
+    if (k == start || !(charClass[peek(lexer, k)] & CC_ALPHA)) return 0;
+    *word = k;
+    while (charClass[peek(lexer, k)] & (CC_ALPHA | CC_DIGIT)) k++;
+    return k;
+}
+
+static int lexImport(Lexer* lexer, Token* token) {
+    // peek() may move the buffer, so offsets are relative to pos until the end.
+    size_t name, end = wordAfter(lexer, 0, &name);
+    if (!end || keywordId(lexer->buffer + lexer->pos + name, end - name) >= 0) return 0;
+    token->type = TOKEN_IMPORT;
+    if (end - name == 1 && lexer->buffer[lexer->pos + name] == 'c') {
+        size_t cName, cEnd = wordAfter(lexer, end, &cName);
+        if (cEnd && keywordId(lexer->buffer + lexer->pos + cName, cEnd - cName) < 0) {
+            token->type = TOKEN_IMPORT_FROM_C;
+            name = cName;
+            end  = cEnd;
         }
+    }
+    const char* text = lexer->buffer + lexer->pos + name;
+    size_t n = end - name;
+    token->id = lexer->hashOnly ? hashString(text, n) : intern(text, n);
+    lexer->pos += end;
+    return 1;
+}
 
-        if (isspace(*p)) {
-            p++; continue;
+// The name an import token carries is its last word.
+static const char* importName(const char* lexeme, size_t length, size_t* n) {
+    const char* end = lexeme + length;
+    const char* text = end;
+    while (text > lexeme && (charClass[(unsigned char)text[-1]] & (CC_ALPHA | CC_DIGIT))) text--;
+    *n = (size_t)(end - text);
+    return text;
+}
+
+/*
+    Float literals: digits, then a '.' with at least one digit after it
+    and/or an exponent (1.5, 2.0e-3, 1e9).  Called after the integer part;
+    returns 0, having consumed nothing, if there is neither.
+*/
+static int scanFraction(Lexer* lexer) {
+    size_t k = 0;
+    if (peek(lexer, 0) == '.' && (charClass[peek(lexer, 1)] & CC_DIGIT)) {
+        k = 1;
+        while (charClass[peek(lexer, k)] & CC_DIGIT) k++;
+    }
+    int e = peek(lexer, k);
+    if (e == 'e' || e == 'E') {
+        size_t sign = peek(lexer, k + 1) == '+' || peek(lexer, k + 1) == '-';
+        if (charClass[peek(lexer, k + 1 + sign)] & CC_DIGIT) {
+            k += 1 + sign;
+            while (charClass[peek(lexer, k)] & CC_DIGIT) k++;
         }
+    }
+    lexer->pos += k;
+    return k > 0;
+}
 
-        Token token;
+static double parseReal(const char* text, size_t n) {
+    char local[64];
+    char* copy = n < sizeof(local) ? local : (char*)malloc(n + 1);
+    memcpy(copy, text, n);
+    copy[n] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != local) free(copy);
+    return value;
+}
 
-        if (*p == '"') {
-            p++; int len = 0;
-            while (*p && *p != '"' && len < MAX_TOKEN_SIZE - 1)
-                token.value[len++] = *p++;
-            token.value[len] = '\0';
-            token.type = TOKEN_STRING;
-            if (*p == '"') p++;
-            tokens[count++] = token;
+static Token nextPooled(Lexer* lexer);
+
+Token nextToken(Lexer* lexer) {
+    Token token;
+    if (lexer->pool) return nextPooled(lexer);
+
+    for (;;) {
+        if (lexer->end - lexer->pos < LEXER_LOOKAHEAD && !lexer->eof) {
+            lexer->mark = lexer->pos;
+            fill(lexer);
+        }
+        lexer->mark = lexer->pos;
+        int c = peek(lexer, 0);
+        unsigned char cls = charClass[c];
+
+        if (c == '\0') {
+            token.type   = TOKEN_EOF;
+            token.offset = (uint32_t)(lexer->base + lexer->pos);
+            token.length = 0;
+            token.line   = lexer->line;
+            token.id     = STR_EOF;
+            lexer->column = (uint32_t)(token.offset - lexer->lineStart) + 1;
+            return token;
+        }
+
+        if (cls & CC_SPACE) {
+            skipRun(lexer, skipSpaces);
             continue;
         }
 
-        if (isalpha(*p)) {
-            int len = 0;
-            while (isalnum(*p) && len < MAX_TOKEN_SIZE - 1)
-                token.value[len++] = *p++;
-            token.value[len] = '\0';
-            token.type = isKeyword(token.value) ? TOKEN_KEYWORD : TOKEN_IDENTIFIER;
-        } else if (isdigit(*p)) {
-            int len = 0;
-            while (isdigit(*p) && len < MAX_TOKEN_SIZE - 1)
-                token.value[len++] = *p++;
-            token.value[len] = '\0';
-            token.type = TOKEN_NUMBER;
-        } else if (strchr("+-*/=!<>", *p)) {
-            token.value[0] = *p++;
-            token.value[1] = '\0';
+        if (c == '/' && peek(lexer, 1) == '/') {
+            skipRun(lexer, findNewline);
+            continue;
+        }
+
+        token.offset = (uint32_t)(lexer->base + lexer->pos);
+        token.line   = lexer->line;
+        uint32_t column = (uint32_t)(token.offset - lexer->lineStart) + 1;
+
+        if (cls & CC_QUOTE) {
+            lexer->pos++;
+            scanLexeme(lexer, findQuote);
+            countLines(lexer, lexer->mark, lexer->pos);
+            const char* text = lexer->buffer + lexer->mark + 1;
+            size_t n = (size_t)(lexer->buffer + lexer->pos - text);
+            token.id   = lexer->hashOnly ? hashString(text, n) : intern(text, n);
+            token.type = TOKEN_STRING;
+            if (peek(lexer, 0) == '"') lexer->pos++;
+        } else if (cls & CC_ALPHA) {
+            scanLexeme(lexer, skipAlnum);
+            const char* text = lexer->buffer + lexer->mark;
+            size_t n = lexer->pos - lexer->mark;
+            int kw = keywordId(text, n);
+            if (kw >= 0) {
+                token.id   = (uint32_t)kw;
+                token.type = TOKEN_KEYWORD;
+            } else if (n == 6 && memcmp(text, "import", 6) == 0 && lexImport(lexer, &token)) {
+                // the whole "import [c] name"
+            } else {
+                token.id   = lexer->hashOnly ? hashString(text, n) : intern(text, n);
+                token.type = TOKEN_IDENTIFIER;
+            }
+        } else if (cls & CC_DIGIT) {
+            uint64_t value = 0;
+            while (charClass[c = peek(lexer, 0)] & CC_DIGIT) {
+                value = value * 10 + (c - '0');
+                lexer->pos++;
+            }
+            token.number = (int64_t)value;
+            token.type   = TOKEN_NUMBER;
+            if (scanFraction(lexer)) {
+                token.real = parseReal(lexer->buffer + lexer->mark, lexer->pos - lexer->mark);
+                token.type = TOKEN_FLOAT;
+            }
+        } else if (cls & CC_OPER) {
+            int length;
+            token.id = operatorId(c, peek(lexer, 1), &length);
+            if (length == 0) {
+                lexer->pos++;   // lone '&' or '|'
+                continue;
+            }
+            lexer->pos += length;
             token.type = TOKEN_OPERATOR;
-        } else if (strchr("(){};,", *p)) {
-            token.value[0] = *p++;
-            token.value[1] = '\0';
+        } else if (cls & CC_SYMBOL) {
+            if (c == '.' && peek(lexer, 1) != '.') {
+                lexer->pos++;   // lone '.'
+                continue;
+            }
+            token.id   = symbolId(c);
             token.type = TOKEN_SYMBOL;
+            lexer->pos += c == '.' ? 2 : 1;   // '..' is the one two-byte symbol
         } else {
-            p++;
+            lexer->pos++;
             continue;
         }
 
-        tokens[count++] = token;
+        token.length = (uint32_t)(lexer->pos - lexer->mark);
+        lexer->column = column;
+        return token;
     }
+}
 
-    Token eof_token;
-    eof_token.type = TOKEN_EOF;
-    strcpy(eof_token.value, "EOF");
-    tokens[count++] = eof_token;
+Token* lex(const char* input, int* token_count) {
+    Lexer lexer;
+    initLexerString(&lexer, input);
 
+    int count = 0, capacity = 256;
+    Token* tokens = (Token*)malloc(sizeof(Token) * capacity);
+    for (;;) {
+        if (count == capacity) {
+            capacity *= 2;
+            tokens = (Token*)realloc(tokens, sizeof(Token) * capacity);
+        }
+        tokens[count] = nextToken(&lexer);
+        if (tokens[count++].type == TOKEN_EOF) break;
+    }
+
+    freeLexer(&lexer);
     *token_count = count;
     return tokens;
 }
+
+/* ------------------------------------------------------ parallel lexing ---- */
+
+/*
+    Chunks end just after a newline, so the only lexer state that can cross
+    a boundary is "inside a string literal" (comments end at the newline).
+    Workers lex every chunk assuming it starts outside a string (variant 0),
+    which is almost always right.  The parser's thread takes the chunks in
+    order; when the previous chunk ended inside a string, it lexes variant 1
+    (resume after the string's closing quote) itself.  A chunk keeps only
+    the tokens that start inside it; the last one may run past its end.
+
+    Workers hash names and strings but leave interning to the parser's
+    thread, in token order, so every string gets the id the serial lexer
+    would have given it.  Line numbers are chunk-relative until then too.
+*/
+#define LEXER_CHUNK_SIZE   (1 << 20)
+#define LEXER_CHUNKS_AHEAD 4            // per thread, bounds the memory held in tokens
+
+typedef struct {
+    size_t   start, end;
+    Token*   tokens[2];                 // per variant: starts outside / inside a string
+    uint32_t count[2];
+    int      endsInString[2];
+    uint32_t lines;                     // newlines in [start, end)
+    int      ready;                     // variant 0 is lexed (under the pool's lock)
+} LexChunk;
+
+struct LexerPool {
+    const char*     input;
+    size_t          length;
+    LexChunk*       chunks;
+    size_t          chunkCount;
+    size_t          nextChunk;          // next one for a worker
+    size_t          window;             // workers stay this many chunks ahead of 'current'
+    int             stop;
+    pthread_mutex_t lock;
+    pthread_cond_t  lexed;              // a chunk became ready
+    pthread_cond_t  consumed;           // 'current' moved on
+    pthread_t*      threads;
+    int             threadCount;
+
+    // Used by the parser's thread only.
+    size_t          current;            // chunk tokens are taken from
+    uint32_t        next;               // next token in it
+    int             variant;            // the chunk starts inside a string
+    int             waited;             // 'current' is known to be ready
+    uint32_t        lineBase;           // newlines before 'current'
+};
+
+static void lexChunk(const LexerPool* pool, LexChunk* chunk, int variant) {
+    Lexer lexer;
+    initLexerRange(&lexer, pool->input, pool->length, chunk->start);
+    lexer.hashOnly = 1;
+    chunk->tokens[variant] = NULL;
+    chunk->count[variant]  = 0;
+    chunk->endsInString[variant] = 0;
+
+    if (variant) {
+        const char* quote = memchr(pool->input + chunk->start, '"', chunk->end - chunk->start);
+        if (!quote) {
+            chunk->endsInString[variant] = 1;   // the whole chunk is inside the string
+            return;
+        }
+        size_t after = (size_t)(quote - pool->input) + 1;
+        countLines(&lexer, chunk->start, after);
+        lexer.pos = lexer.mark = after;
+    }
+
+    uint32_t count = 0, capacity = 1024;
+    Token* tokens = (Token*)malloc(sizeof(Token) * capacity);
+    for (;;) {
+        Token token = nextToken(&lexer);
+        if (token.type == TOKEN_EOF || token.offset >= chunk->end) break;
+        if (count == capacity) {
+            capacity *= 2;
+            tokens = (Token*)realloc(tokens, sizeof(Token) * capacity);
+        }
+        tokens[count++] = token;
+    }
+    const Token* last = count ? &tokens[count - 1] : NULL;
+    chunk->endsInString[variant] = last && last->type == TOKEN_STRING &&
+                                   last->offset + last->length > chunk->end;
+    chunk->tokens[variant] = tokens;
+    chunk->count[variant]  = count;
+}
+
+static uint32_t countNewlines(const char* p, const char* end) {
+    uint32_t n = 0;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+static void* lexWorker(void* arg) {
+    LexerPool* pool = (LexerPool*)arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->nextChunk < pool->chunkCount &&
+               pool->nextChunk >= pool->current + pool->window) {
+            pthread_cond_wait(&pool->consumed, &pool->lock);
+        }
+        if (pool->stop || pool->nextChunk == pool->chunkCount) break;
+        LexChunk* chunk = &pool->chunks[pool->nextChunk++];
+        pthread_mutex_unlock(&pool->lock);
+
+        chunk->lines = countNewlines(pool->input + chunk->start, pool->input + chunk->end);
+        lexChunk(pool, chunk, 0);
+
+        pthread_mutex_lock(&pool->lock);
+        chunk->ready = 1;
+        pthread_cond_broadcast(&pool->lexed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+void initLexerParallel(Lexer* lexer, const char* input, size_t length, int threads) {
+    // The serial lexer stops at a NUL byte; so does this one.
+    const char* nul = memchr(input, '\0', length);
+    if (nul) length = (size_t)(nul - input);
+    initLexerRange(lexer, input, length, 0);
+    if (threads < 2 || length < LEXER_PARALLEL_MIN) return;
+
+    LexerPool* pool = (LexerPool*)calloc(1, sizeof(LexerPool));
+    pool->input  = input;
+    pool->length = length;
+    size_t capacity = length / LEXER_CHUNK_SIZE + 1;
+    pool->chunks = (LexChunk*)calloc(capacity, sizeof(LexChunk));
+    for (size_t start = 0; start < length; ) {
+        size_t end = start + LEXER_CHUNK_SIZE < length ? start + LEXER_CHUNK_SIZE : length;
+        const char* newline = end < length ? memchr(input + end, '\n', length - end) : NULL;
+        end = newline ? (size_t)(newline - input) + 1 : length;
+        if (pool->chunkCount == capacity) {
+            capacity *= 2;
+            pool->chunks = (LexChunk*)realloc(pool->chunks, sizeof(LexChunk) * capacity);
+        }
+        LexChunk* chunk = &pool->chunks[pool->chunkCount++];
+        memset(chunk, 0, sizeof(*chunk));
+        chunk->start = start;
+        chunk->end   = end;
+        start = end;
+    }
+
+    if ((size_t)threads > pool->chunkCount) threads = (int)pool->chunkCount;
+    pool->window = (size_t)threads * LEXER_CHUNKS_AHEAD;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->lexed, NULL);
+    pthread_cond_init(&pool->consumed, NULL);
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, lexWorker, pool) != 0) break;
+        pool->threadCount++;
+    }
+    if (pool->threadCount == 0) {
+        // No threads to be had: stay serial.
+        freePool(pool);
+        return;
+    }
+    lexer->pool = pool;
+}
+
+static void freePool(LexerPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->consumed);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threadCount; i++) pthread_join(pool->threads[i], NULL);
+
+    for (size_t i = 0; i < pool->chunkCount; i++) {
+        free(pool->chunks[i].tokens[0]);
+        free(pool->chunks[i].tokens[1]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->lexed);
+    pthread_cond_destroy(&pool->consumed);
+    free(pool->threads);
+    free(pool->chunks);
+    free(pool);
+}
+
+static Token nextPooled(Lexer* lexer) {
+    LexerPool* pool = lexer->pool;
+    for (;;) {
+        if (pool->current == pool->chunkCount) {
+            Token token;
+            token.type   = TOKEN_EOF;
+            token.offset = (uint32_t)pool->length;
+            token.length = 0;
+            token.line   = pool->lineBase + 1;
+            token.id     = STR_EOF;
+            return token;
+        }
+
+        LexChunk* chunk = &pool->chunks[pool->current];
+        if (!pool->waited) {
+            pthread_mutex_lock(&pool->lock);
+            while (!chunk->ready) pthread_cond_wait(&pool->lexed, &pool->lock);
+            pthread_mutex_unlock(&pool->lock);
+            pool->waited = 1;
+            // The previous chunk ended inside a string: the speculation was wrong.
+            if (pool->variant) lexChunk(pool, chunk, 1);
+        }
+
+        if (pool->next < chunk->count[pool->variant]) {
+            Token token = chunk->tokens[pool->variant][pool->next++];
+            token.line += pool->lineBase;
+            if (token.type == TOKEN_IDENTIFIER) {
+                token.id = internHashed(pool->input + token.offset, token.length, token.id);
+            } else if (token.type == TOKEN_STRING) {
+                // Without its quotes; the closing one is missing at the end of the input.
+                const char* text = pool->input + token.offset + 1;
+                size_t n = token.length - 1;
+                if (n > 0 && text[n - 1] == '"') n--;
+                token.id = internHashed(text, n, token.id);
+            } else if (token.type == TOKEN_IMPORT || token.type == TOKEN_IMPORT_FROM_C) {
+                size_t n;
+                const char* text = importName(pool->input + token.offset, token.length, &n);
+                token.id = internHashed(text, n, token.id);
+            }
+            return token;
+        }
+
+        // Chunk used up: release it and let the workers move on.
+        pool->lineBase += chunk->lines;
+        pool->variant   = chunk->endsInString[pool->variant];
+        free(chunk->tokens[0]);
+        free(chunk->tokens[1]);
+        chunk->tokens[0] = chunk->tokens[1] = NULL;
+        pool->next   = 0;
+        pool->waited = 0;
+        pthread_mutex_lock(&pool->lock);
+        pool->current++;
+        pthread_cond_broadcast(&pool->consumed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
@@ -3,7 +3,57 @@
 
 #include "token.h"
 #include "error_handling.h"
+#include <stdio.h>
 
+/*
+    Pull-based lexer.  Tokens are produced one at a time from either an
+    in-memory string or a FILE* read through a fixed-size buffer, so memory
+    use does not depend on the size of the source.
+
+    A large source already in memory can instead be lexed by a pool of
+    threads (initLexerParallel): it is cut into chunks at line starts, the
+    chunks are lexed ahead of the parser, and nextToken() hands their tokens
+    out in order, identical to what the serial lexer would produce.
+*/
+typedef struct LexerPool LexerPool;
+
+#define LEXER_PARALLEL_MIN (4u << 20)   // smaller sources are lexed serially
+
+typedef struct {
+    FILE*    file;       // NULL when lexing an in-memory string
+    char*    buffer;
+    size_t   capacity;
+    size_t   mark;       // start of the lexeme being scanned (kept on refill)
+    size_t   pos;        // next byte to scan
+    size_t   end;        // bytes valid in buffer
+    uint64_t base;       // source offset of buffer[0]
+    int      owned;      // buffer is ours to free
+    int      eof;        // no more input to read
+    uint32_t line;       // current source line, from 1
+    uint64_t lineStart;  // source offset of the first byte of that line
+    uint32_t column;     // 1-based column of the last token returned (for error messages)
+    int      hashOnly;   // pool workers: names and strings get their hash in 'id', not an id
+    int64_t  readAt;     // >= 0: the file is read with pread() from here (initLexerRescan)
+    LexerPool* pool;     // set by initLexerParallel
+} Lexer;
+
+void  initLexerString(Lexer* lexer, const char* input);
+void  initLexerFile(Lexer* lexer, FILE* file);
+// 'input' must stay valid until freeLexer(); 'threads' < 2 lexes serially.
+void  initLexerParallel(Lexer* lexer, const char* input, size_t length, int threads);
+/*
+    A second, serial pass over the source of 'lexer' from byte 'offset' on
+    (a token's offset), which leaves 'lexer' where it is: a file is read
+    again with pread().  Line numbers start over at 1.  Returns 0 if the
+    source can't be read twice (a pipe).
+*/
+int   initLexerRescan(Lexer* scan, const Lexer* lexer, uint64_t offset);
+void  freeLexer(Lexer* lexer);
+Token nextToken(Lexer* lexer);
+// Column of 'tok'; when reading a file, it must be the last token nextToken() returned.
+uint32_t lexerColumn(const Lexer* lexer, const Token* tok);
+
+// Lex a whole string at once.  The returned array is malloc'd and ends with TOKEN_EOF.
 Token* lex(const char* input, int* token_count);
 
 #endif // LEXER_H
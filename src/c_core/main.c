@@ -1,78 +1,391 @@
 #include "lexer.h"
 #include "parser.h"
 #include "executor.h"
+#include "jit.h"
+#include "io.h"
+#include "cache.h"
+#include "profile.h"
+#include "debugger.h"
 #include "error_handling.h"
+#include "server.h"
+#include "batch.h"
+#include "interpreter.h"
+#include "task.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-int main(int argc, char *argv[]) {
-    int debug = 0;
-    const char *filename = NULL;
+// Run the system C compiler ($CC, default cc) on a generated .c or .s file.
+static int runCompiler(const char *source, const char *output) {
+    const char *cc = getenv("CC");
+    if (!cc || !*cc) cc = "cc";
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s [--debug] <source_file.spl>\n", argv[0]);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        execlp(cc, cc, "-O2", "-fwrapv", "-o", output, source, "-lm", (char *)NULL);
+        perror(cc);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: %s failed to build %s\n", cc, output);
         return 1;
     }
+    return 0;
+}
 
-    for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], "--debug") == 0) {
-            debug = 1;
-        } else {
-            filename = argv[i];
-        }
+// "prog.spl" -> "prog"
+static char *defaultOutput(const char *filename) {
+    size_t len = strlen(filename);
+    char *out = (char *)malloc(len + 5);
+    strcpy(out, filename);
+    if (len > 4 && strcmp(out + len - 4, ".spl") == 0) {
+        out[len - 4] = '\0';
+    } else {
+        strcat(out, ".out");
     }
+    return out;
+}
 
-    if (!filename) {
-        fprintf(stderr, "Error: No source file specified.\n");
-        return 1;
+// Sources big enough to be worth lexing in parallel are mapped whole.
+static void *mapSource(FILE *file, size_t *size) {
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || (uint64_t)st.st_size < LEXER_PARALLEL_MIN) return NULL;
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map == MAP_FAILED) return NULL;
+    *size = (size_t)st.st_size;
+    return map;
+}
+
+static void runStatement(AST *ast, NodeIndex stmt, Codegen *gen, int debug) {
+    if (debug) {
+        ioFlush();
+        printAST(ast, stmt, 0);
     }
+    if (gen) {
+        emit_statement(gen, ast, stmt);
+    } else {
+        execute_statement(ast, stmt);
+    }
+}
 
+// Command-line settings for running (or translating) one source file.
+typedef struct {
+    int debug;
+    int tree_walk;
+    int optimize;
+    int jit;
+    int jit_stats;
+    int build;
+    int emit;
+    int use_cache;
+    int profile;
+    int lex_threads;
+    int parse_threads;
+    int task_threads;
+    const char *profile_out;
+    ImportPolicy imports;
+    CodegenTarget target;
+    const char *output;
+} RunOptions;
+
+// Lex, parse and run (or translate) 'filename' in the current interpreter; returns the exit status.
+static int runFile(const char *filename, const RunOptions *options) {
     FILE *file = fopen(filename, "r");
     if (!file) {
-        perror("Failed to open file");
+        fprintf(ioErr(), "Failed to open file: %s\n", strerror(errno));
         return 1;
     }
 
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    rewind(file);
+    // build = emit C/asm into a temporary file, then hand it to cc
+    FILE *out = NULL;
+    char *executable = NULL;
+    char tempSource[] = "/tmp/freesplXXXXXX.c";
+    if (options->build) {
+        executable = options->output ? strdup(options->output) : defaultOutput(filename);
+        if (options->target == TARGET_ASM) strcpy(tempSource + strlen(tempSource) - 2, ".s");
+        int fd = mkstemps(tempSource, 2);
+        if (fd < 0 || !(out = fdopen(fd, "w"))) {
+            perror("Failed to create temporary file");
+            return 1;
+        }
+    } else if (options->emit) {
+        out = options->output ? fopen(options->output, "w") : stdout;
+        if (!out) {
+            perror("Failed to open output file");
+            return 1;
+        }
+    }
+
+    set_debug_mode(options->debug);
+    set_tree_walk_mode(options->tree_walk);
+    set_optimize_mode(options->optimize);
+    set_jit_mode(options->jit);
+    set_profile_mode(options->profile);
+    taskSetThreads(options->task_threads);
+
+    Codegen gen;
+    if (out) {
+        codegenBegin(&gen, out, options->target);
+    }
+    if (options->debug) {
+        printf("[AST]\n");
+    }
+
+    // A .splc cache of the same source (and optimizer setting) skips lexing and parsing.
+    uint32_t cacheFlags = options->optimize ? CACHE_OPTIMIZED : 0;
+    CacheReader reader;
+    CacheWriter writer = {0};
+    int cached = 0;
+    if (options->use_cache) {
+        char *cachePath = cachePathFor(filename);
+        cached = cacheOpenReader(&reader, cachePath, file, cacheFlags);
+        // Translating the program leaves nothing to run again: no new cache for it.
+        if (!cached && !out) {
+            cacheOpenWriter(&writer, cachePath, file, cacheFlags);
+        }
+        free(cachePath);
+    }
+
+    ParserError error = {0, 0, ""};
+    int aborted = 0;
+    if (cached) {
+        // Cached statements were optimized before they were stored.
+        set_optimize_mode(0);
+        AST ast;
+        NodeIndex stmt;
+        initAST(&ast);
+        while (cacheNext(&reader, &ast, &stmt)) {
+            runStatement(&ast, stmt, out ? &gen : NULL, options->debug);
+        }
+        freeAST(&ast);
+        cacheCloseReader(&reader);
+    } else {
+        // Statements are lexed, parsed and run one at a time as the file is read.
+        // Each statement's nodes are released from the arena once it has run.
+        // Large sources are lexed ahead of the parser on 'lex_threads' threads,
+        // and their functions parsed on 'parse_threads'.
+        Lexer lexer;
+        AST ast;
+        Parser parser;
+        size_t sourceSize = 0;
+        void *source = options->lex_threads > 1 || options->parse_threads > 1 ? mapSource(file, &sourceSize) : NULL;
+        if (source) {
+            initLexerParallel(&lexer, (const char *)source, sourceSize, options->lex_threads);
+        } else {
+            initLexerFile(&lexer, file);
+        }
+        initAST(&ast);
+        if (source) {
+            initParserParallel(&parser, &lexer, &ast, options->parse_threads);
+        } else {
+            initParser(&parser, &lexer, &ast);
+        }
+
+        // Imports are checked against the whole program before anything runs.
+        // One that was reported keeps the program out of the cache, so the
+        // warning comes back on the next run.
+        int unused = 0;
+        if (parseImports(&parser) > 0) {
+            unused = debuggerCheck(parser.names, (int)parser.nameCount, options->imports);
+            aborted = unused < 0;
+        }
+
+        ASTMark mark = markAST(&ast);
+        NodeIndex stmt;
+        while (!aborted && (stmt = parseNext(&parser, &error)) != AST_NONE) {
+            runStatement(&ast, stmt, out ? &gen : NULL, options->debug);
+            cacheAppend(&writer, &ast, stmt);
+            releaseAST(&ast, mark);
+        }
+        cacheCloseWriter(&writer, !aborted && unused == 0 && strlen(error.message) == 0);
+
+        freeParser(&parser);
+        freeAST(&ast);
+        freeLexer(&lexer);
+        if (source) munmap(source, sourceSize);
+    }
+
+    if (out) {
+        emit_finish(&gen);
+        if (out != stdout) fclose(out);
+    } else {
+        execute_finish();
+    }
+    fclose(file);
+    ioFlush();
+
+    if (options->jit_stats) {
+        jitReport();
+    }
+    if (options->profile && !out) {
+        // "prog.spl" -> "prog.folded"
+        char *folded = NULL;
+        if (!options->profile_out) {
+            char *base = defaultOutput(filename);
+            folded = (char *)malloc(strlen(base) + 8);
+            sprintf(folded, "%s.folded", base);
+            free(base);
+        }
+        profileReport(stderr, options->profile_out ? options->profile_out : folded);
+        free(folded);
+    }
 
-    char *source = malloc(size + 1);
-    if (!source) {
-        perror("Failed to allocate memory");
-        fclose(file);
+    if (aborted) {
+        fprintf(ioErr(), "[FATAL] Unused imports. Execution aborted.\n");
+        if (options->build) unlink(tempSource);
         return 1;
     }
+    if (strlen(error.message) > 0) {
+        reportParserError(&error);
+        fprintf(ioErr(), "[FATAL] Parser failed. Execution aborted.\n");
+        if (options->build) unlink(tempSource);
+        return 1;
+    }
+
+    int status = 0;
+    if (options->build) {
+        status = runCompiler(tempSource, executable);
+        unlink(tempSource);
+        free(executable);
+    }
+    return status;
+}
+
+// runBatch() callback: one script of --jobs, in the job's own interpreter.
+static int runJob(const char *script, void *options) {
+    return runFile(script, (const RunOptions *)options);
+}
+
+int main(int argc, char *argv[]) {
+    RunOptions options = {0};
+    options.optimize = 1;
+    options.use_cache = 1;
+    options.lex_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    options.parse_threads = options.lex_threads;
+    options.imports = IMPORTS_PROMPT;
+    options.target = TARGET_C;
+    const char *filename = NULL;
+    const char *serve_socket = NULL;
+    const char *client_socket = NULL;
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int inline_source = 0;
+    int jobs = 0;
+    const char *scripts[argc];
+    int script_count = 0;
 
-    if (fread(source, 1, size, file) != (size_t)size) {
-        perror("Failed to read file");
-        free(source);
-        fclose(file);
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s [--debug] [--tree-walk] [--no-optimize] [--jit] [--jit-stats] [--no-cache] [--profile [--profile-out file.folded]] [--lex-threads n] [--parse-threads n] [--task-threads n] [--no-prompt | --werror] <source_file.spl>\n", argv[0]);
+        fprintf(stderr, "       %s --emit-c | --emit-asm [-o out] <source_file.spl>\n", argv[0]);
+        fprintf(stderr, "       %s build [--asm] [-o out] <source_file.spl>\n", argv[0]);
+        fprintf(stderr, "       %s --jobs n [--tree-walk] [--no-optimize] [--jit] [--no-cache] [--werror] <source_file.spl>...\n", argv[0]);
+        fprintf(stderr, "       %s --serve socket [--workers n]\n", argv[0]);
+        fprintf(stderr, "       %s --client socket [--tree-walk] [--no-optimize] [--jit] [--no-prompt | --werror] <source_file.spl | -e source>\n", argv[0]);
         return 1;
     }
 
-    source[size] = '\0';
-    fclose(file);
+    int first = 1;
+    if (strcmp(argv[1], "build") == 0) {
+        options.build = 1;
+        first = 2;
+    }
+
+    for (int i = first; i < argc; ++i) {
+        if (strcmp(argv[i], "--debug") == 0) {
+            options.debug = 1;
+        } else if (strcmp(argv[i], "--tree-walk") == 0) {
+            options.tree_walk = 1;
+        } else if (strcmp(argv[i], "--no-optimize") == 0) {
+            options.optimize = 0;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.jit = 1;
+        } else if (strcmp(argv[i], "--jit-stats") == 0) {
+            options.jit = 1;
+            options.jit_stats = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            options.profile = 1;
+        } else if (strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc) {
+            options.profile = 1;
+            options.profile_out = argv[++i];
+        } else if (strcmp(argv[i], "--lex-threads") == 0 && i + 1 < argc) {
+            options.lex_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--parse-threads") == 0 && i + 1 < argc) {
+            options.parse_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--task-threads") == 0 && i + 1 < argc) {
+            options.task_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-prompt") == 0) {
+            options.imports = IMPORTS_WARN;
+        } else if (strcmp(argv[i], "--werror") == 0) {
+            options.imports = IMPORTS_ERROR;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            options.use_cache = 0;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            options.emit = 1;
+            options.target = TARGET_C;
+        } else if (strcmp(argv[i], "--emit-asm") == 0 || (options.build && strcmp(argv[i], "--asm") == 0)) {
+            options.emit = 1;
+            options.target = TARGET_ASM;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            if (jobs < 1) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_socket = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            client_socket = argv[++i];
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            filename = argv[++i];
+            inline_source = 1;
+        } else {
+            filename = argv[i];
+            scripts[script_count++] = argv[i];
+        }
+    }
+
+    // Everything below runs in this interpreter, except --jobs, which gives every script its own.
+    Interpreter *interpreter = interpreterNew();
+    interpreterEnter(interpreter);
 
-    int token_count = 0;
-    Token* tokens = lex(source, &token_count);
+    if (serve_socket) {
+        return serveForever(serve_socket, workers);
+    }
 
-    ASTNode* ast = parse(tokens);
-    if (!ast) {
-        fprintf(stderr, "[FATAL] Parser failed. Execution aborted.\n");
-        free(source);
+    if (!filename) {
+        fprintf(stderr, "Error: No source file specified.\n");
         return 1;
     }
 
-    if (debug) {
-        printf("[AST]\n");
-        printAST(ast, 0);
+    if (inline_source && !client_socket) {
+        fprintf(stderr, "Error: -e only works with --client.\n");
+        return 1;
+    }
+    // The script runs in the server, on our stdin, stdout and stderr.
+    if (client_socket) {
+        ServeRequest request = { filename, inline_source, options.tree_walk, options.optimize, options.jit, options.imports };
+        return serveClient(client_socket, &request);
     }
 
-    set_debug_mode(debug);
-    execute_program(ast);
+    // Scripts of a batch have no stdin to ask on, and their output is collected per script.
+    if (jobs) {
+        if (options.debug || options.emit || options.build || options.profile || options.jit_stats) {
+            fprintf(stderr, "Error: --jobs can't be combined with --debug, --emit-c/--emit-asm, build, --profile or --jit-stats.\n");
+            return 1;
+        }
+        if (options.imports == IMPORTS_PROMPT) options.imports = IMPORTS_WARN;
+        return runBatch(scripts, script_count, jobs, runJob, &options);
+    }
 
-    free(source);
-    return 0;
+    return runFile(filename, &options);
 }
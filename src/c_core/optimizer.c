@@ -0,0 +1,312 @@
+// optimizer.c
+#include "optimizer.h"
+#include "resolver.h"
+#include "token.h"
+#include "value.h"
+#include <limits.h>
+
+/*
+    Everything here rewrites nodes in place: a folded node keeps its index
+    and its token slot, only the token becomes a number (an int or a float).  No nodes are
+    added, so the only arena growth is for blocks that lose or gain
+    statements, which are laid out again through the scratch stack.
+*/
+
+static int isConstant(const AST* ast, const ASTNode* node) {
+    return node && node->nodeType == AST_EXPRESSION && !node->left && !node->right &&
+           isNumberToken(nodeToken(ast, node));
+}
+
+static Value constantValue(const AST* ast, const ASTNode* node) {
+    const Token* tok = nodeToken(ast, node);
+    return tok->type == TOKEN_FLOAT ? valueDouble(tok->real) : valueInt((int32_t)tok->number);
+}
+
+// An int constant equal to n (1.0 is not: x*1.0 turns an int x into a double).
+static int isIntConstant(const AST* ast, const ASTNode* node, int32_t n) {
+    return isConstant(ast, node) && constantValue(ast, node) == valueInt(n);
+}
+
+static int isBinary(const AST* ast, const ASTNode* node) {
+    return node && node->left && node->right && nodeToken(ast, node)->type == TOKEN_OPERATOR;
+}
+
+/*
+    Expressions that are numbers whatever the variables hold, so x*1 may
+    become x: a variable may hold a string, and "ab" * 1 is 0, not "ab".
+    Both tests look at every operand of a long chain, so they keep the
+    ones still to check on a walk stack.
+*/
+static int isNumeric(const AST* ast, NodeIndex root) {
+    ASTWalk walk;
+    walkInit(&walk);
+    walkPush(&walk, root);
+    int numeric = 1;
+    while (numeric && walk.depth) {
+        const ASTNode* node = astNode(ast, walkTop(&walk)->node);
+        walkPop(&walk);
+        if (isConstant(ast, node)) continue;
+        if (!isBinary(ast, node)) {
+            numeric = 0;
+        } else if (nodeToken(ast, node)->id == STR_PLUS) {
+            walkPush(&walk, node->left);
+            walkPush(&walk, node->right);
+        }
+    }
+    walkFree(&walk);
+    return numeric;
+}
+
+// Expressions that are ints whatever the variables hold: x+0 and x*0 may
+// only go away for these, since -0.0 + 0 is 0.0 and 2.5 * 0 is 0.0, not 0.
+static int isIntExpression(const AST* ast, NodeIndex root) {
+    ASTWalk walk;
+    walkInit(&walk);
+    walkPush(&walk, root);
+    int integer = 1;
+    while (integer && walk.depth) {
+        const ASTNode* node = astNode(ast, walkTop(&walk)->node);
+        walkPop(&walk);
+        if (isConstant(ast, node)) {
+            integer = isInt(constantValue(ast, node));
+            continue;
+        }
+        if (!isBinary(ast, node)) {
+            integer = 0;
+            continue;
+        }
+        switch (nodeToken(ast, node)->id) {
+            case STR_PLUS:
+            case STR_MINUS:
+            case STR_STAR:
+            case STR_SLASH:
+            case STR_PERCENT:
+                walkPush(&walk, node->left);
+                walkPush(&walk, node->right);
+                break;
+        }
+        // comparisons, && and || (and unknown operators) give 0 or 1
+    }
+    walkFree(&walk);
+    return integer;
+}
+
+static void makeConstant(AST* ast, ASTNode* node, Value value) {
+    Token* tok = &ast->tokens[node->token];
+    if (isInt(value)) {
+        tok->type   = TOKEN_NUMBER;
+        tok->number = asInt(value);
+    } else {
+        tok->type   = TOKEN_FLOAT;
+        tok->real   = asDouble(value);
+    }
+    node->nodeType = AST_EXPRESSION;
+    node->left  = AST_NONE;
+    node->right = AST_NONE;
+    node->body  = AST_NONE;
+}
+
+// Overwrite 'node' with one of its operands.
+static void replaceWith(AST* ast, ASTNode* node, NodeIndex child) {
+    ASTNode copy = *astNode(ast, child);
+    *node = copy;
+}
+
+// Same results as the interpreter.  Returns 0 if the operation must be left to run time.
+static int foldBinary(uint32_t op, Value left, Value right, Value* out) {
+    // INT_MIN / -1 traps on the machine; leave it to run time like before.
+    if ((op == STR_SLASH || op == STR_PERCENT) && bothInt(left, right) &&
+        asInt(left) == INT_MIN && asInt(right) == -1) {
+        return 0;
+    }
+    *out = valueArith(op, left, right);
+    return 1;
+}
+
+// A binary node whose operands are done.
+static void optimizeBinary(AST* ast, ASTNode* node) {
+    uint32_t op = nodeToken(ast, node)->id;
+    const ASTNode* left  = astNode(ast, node->left);
+    const ASTNode* right = astNode(ast, node->right);
+    Value value;
+
+    if (isConstant(ast, left) && isConstant(ast, right)) {
+        if (foldBinary(op, constantValue(ast, left), constantValue(ast, right), &value)) {
+            makeConstant(ast, node, value);
+        }
+        return;
+    }
+
+    // Short-circuit operators with a deciding left operand never look at the right one.
+    if (isConstant(ast, left)) {
+        int l = valueTruthy(constantValue(ast, left));
+        if ((op == STR_AND && !l) || (op == STR_OR && l)) {
+            makeConstant(ast, node, valueInt(op == STR_OR));
+            return;
+        }
+    }
+
+    // x/0 and x%0 are 0 for any x, and so is 0.0: the divisor only has to be zero.
+    int rightIsZero = isConstant(ast, right) && !valueTruthy(constantValue(ast, right));
+    int rightIs0 = isIntConstant(ast, right, 0);
+    int rightIs1 = isIntConstant(ast, right, 1);
+    int leftIs0  = isIntConstant(ast, left, 0);
+    int leftIs1  = isIntConstant(ast, left, 1);
+
+    switch (op) {
+        case STR_PLUS:
+            if (rightIs0 && isIntExpression(ast, node->left))  replaceWith(ast, node, node->left);
+            else if (leftIs0 && isIntExpression(ast, node->right)) replaceWith(ast, node, node->right);
+            break;
+        case STR_MINUS:
+            if (rightIs0 && isNumeric(ast, node->left))  replaceWith(ast, node, node->left);
+            break;
+        case STR_STAR:
+            if ((rightIs0 && isIntExpression(ast, node->left) && !containsCall(ast, node->left)) ||
+                (leftIs0 && isIntExpression(ast, node->right) && !containsCall(ast, node->right))) {
+                makeConstant(ast, node, valueInt(0));
+            } else if (rightIs1 && isNumeric(ast, node->left)) {
+                replaceWith(ast, node, node->left);
+            } else if (leftIs1 && isNumeric(ast, node->right)) {
+                replaceWith(ast, node, node->right);
+            }
+            break;
+        case STR_SLASH:
+            if (rightIsZero && !containsCall(ast, node->left)) makeConstant(ast, node, valueInt(0));
+            else if (rightIs1 && isNumeric(ast, node->left)) replaceWith(ast, node, node->left);
+            break;
+        case STR_PERCENT:
+            if (rightIsZero && !containsCall(ast, node->left)) makeConstant(ast, node, valueInt(0));
+            else if (rightIs1 && isIntExpression(ast, node->left) && !containsCall(ast, node->left)) {
+                makeConstant(ast, node, valueInt(0));
+            }
+            break;
+    }
+}
+
+// Pruned ifs are spliced into the enclosing block and no-ops dropped from it.
+static int isSpliced(const AST* ast, const ASTNode* node) {
+    return node->nodeType == AST_IF_STATEMENT && isConstant(ast, astNode(ast, node->left));
+}
+
+// A block whose statements are done.
+static BlockIndex optimizeBlock(AST* ast, BlockIndex block) {
+    uint32_t count = blockCount(ast, block);
+    int changed = 0;
+    for (uint32_t i = 0; i < count && !changed; i++) {
+        const ASTNode* node = astNode(ast, blockNodes(ast, block)[i]);
+        changed = isSpliced(ast, node) || isConstant(ast, node);
+    }
+    if (!changed) return block;
+
+    uint32_t mark = ast->scratchCount;
+    for (uint32_t i = 0; i < count; i++) {
+        const ASTNode* node = astNode(ast, blockNodes(ast, block)[i]);
+        if (isConstant(ast, node)) continue;
+        if (isSpliced(ast, node)) {
+            uint32_t n = blockCount(ast, node->body);
+            for (uint32_t j = 0; j < n; j++) {
+                pushStatement(ast, blockNodes(ast, node->body)[j]);
+            }
+            continue;
+        }
+        pushStatement(ast, blockNodes(ast, block)[i]);
+    }
+    return closeBlock(ast, mark);
+}
+
+// Statements with a constant condition, once their blocks are done.
+static void optimizeIf(AST* ast, ASTNode* node) {
+    node->body  = optimizeBlock(ast, node->body);
+    node->right = optimizeBlock(ast, node->right);
+
+    ASTNode* cond = astNode(ast, node->left);
+    if (!isConstant(ast, cond)) return;
+    // Keep only the arm that runs, as "if 1 { ... }" ...
+    if (!valueTruthy(constantValue(ast, cond))) {
+        node->body = node->right;
+        makeConstant(ast, cond, 1);
+    }
+    node->right = AST_NONE;
+    // ... or nothing at all, as a bare constant (a no-op statement).
+    if (!node->body) replaceWith(ast, node, node->left);
+}
+
+static void optimizeWhile(AST* ast, ASTNode* node) {
+    node->body = optimizeBlock(ast, node->body);
+    const ASTNode* cond = astNode(ast, node->left);
+    if (isConstant(ast, cond) && !valueTruthy(constantValue(ast, cond))) {
+        replaceWith(ast, node, node->left);
+    }
+}
+
+// A statement of a block (or the root), as opposed to an operand: 'x = 1' assigns
+// as a statement and compares as an operand.
+// A for's 'i = a' counts as one too, its range does not, and so does a reduce's x = x op e.
+static int isStatement(const AST* ast, NodeIndex parent, NodeIndex index) {
+    if (!parent) return 1;
+    const ASTNode* node = astNode(ast, parent);
+    if (isForLoop(node)) return node->right != index;
+    if (node->nodeType == AST_REDUCE) return 1;
+    return (node->nodeType == AST_IF_STATEMENT || node->nodeType == AST_WHILE_LOOP ||
+            node->nodeType == AST_FUNC_DEF) && node->left != index;
+}
+
+/*
+    One walk over the statement, rewriting on the way up, when everything
+    under a node is done.  Only the parts that ever run are visited:
+    conditions, assigned, printed and returned values, blocks, call
+    arguments, channels and sent values, a for's bounds and step, and the
+    operands of binary operators.
+*/
+void optimizeStatement(AST* ast, NodeIndex stmt) {
+    ASTWalk walk;
+    walkInit(&walk);
+    walkStart(&walk, stmt);
+    int leaving;
+    NodeIndex index;
+    while ((index = walkNext(&walk, ast, &leaving))) {
+        ASTNode* node = astNode(ast, index);
+        // On the way down the node's own frame is still on top of the parent's.
+        uint32_t above = leaving ? walk.depth : walk.depth - 1;
+        NodeIndex parent = above ? walk.frames[above - 1].node : AST_NONE;
+        int statement = isStatement(ast, parent, index);
+        if (!leaving) {
+            if (statement) {
+                switch (node->nodeType) {
+                    case AST_VAR_ASSIGN:
+                        // Only the value runs, the target is a name.
+                        walkSkip(&walk);
+                        walkPush(&walk, node->right);
+                        continue;
+                    case AST_FUNC_DEF:
+                    case AST_PRINT:
+                    case AST_RETURN:
+                    case AST_IF_STATEMENT:
+                    case AST_WHILE_LOOP:
+                    case AST_FOR_LOOP:
+                    case AST_PARALLEL_FOR:
+                    case AST_REDUCE:
+                    case AST_SPAWN:
+                    case AST_SEND:
+                        continue;
+                }
+            }
+            if (!hasEffects(node) && !isBinary(ast, node) && node->nodeType != AST_RANGE) walkSkip(&walk);
+            continue;
+        }
+        switch (node->nodeType) {
+            case AST_FUNC_DEF:     node->body = optimizeBlock(ast, node->body); break;
+            case AST_IF_STATEMENT: optimizeIf(ast, node); break;
+            case AST_WHILE_LOOP:   optimizeWhile(ast, node); break;
+            case AST_FOR_LOOP:
+            case AST_PARALLEL_FOR: node->body = optimizeBlock(ast, node->body); break;
+            default:
+                if (isBinary(ast, node) && !(statement && node->nodeType == AST_VAR_ASSIGN)) {
+                    optimizeBinary(ast, node);
+                }
+                break;
+        }
+    }
+    walkFree(&walk);
+}
@@ -0,0 +1,17 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "parser.h"
+
+/*
+    Load-time rewrites of a parsed statement, done in place in the arena
+    before it is resolved and run:
+      - constant subtrees are folded into number literals
+      - x+0, x-0, x*1, x/1 become x; x*0 becomes 0 when x has no calls
+      - if arms and while loops whose condition is constant are dropped,
+        and the live arm of a constant if is spliced into its block
+    Results are exactly what the tree walker would have computed.
+*/
+void optimizeStatement(AST* ast, NodeIndex stmt);
+
+#endif // OPTIMIZER_H
@@ -1,38 +1,59 @@
 // parser.c
 #include "parser.h"
 #include "token.h"
+#include "io.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 /*
-    ASTNode construction / destruction
+    ASTNode construction.  Nodes live in the parser's AST arena (ast.c);
+    on error nothing is freed here, the caller releases the arena.
 */
 
-ASTNode* createNode(ASTNodeType nodeType, Token token) {
-    ASTNode* node = (ASTNode*)malloc(sizeof(ASTNode));
-    node->nodeType = nodeType;
-    node->token    = token;
-    node->left     = NULL;
-    node->right    = NULL;
-    node->body     = NULL;
-    node->next     = NULL;
-    return node;
+static NodeIndex createNode(Parser* parser, ASTNodeType nodeType, const Token* token) {
+    return newNode(parser->ast, nodeType, token);
+}
+
+static NodeIndex binaryNode(Parser* parser, const Token* opTok, NodeIndex left, NodeIndex right) {
+    NodeIndex bin = createNode(parser, AST_EXPRESSION, opTok);
+    ASTNode* node = astNode(parser->ast, bin);
+    node->left  = left;
+    node->right = right;
+    return bin;
 }
 
-static void freeAST(ASTNode* node) {
-    if (!node) return;
-    freeAST(node->left);
-    freeAST(node->right);
-    freeAST(node->body);
-    freeAST(node->next);
-    free(node);
+// A token of its own for the parts of a rewritten operator, at 'at' in the source.
+static Token madeToken(const Token* at, TokenType type, uint32_t id) {
+    Token tok = *at;
+    tok.type = type;
+    if (type == TOKEN_NUMBER) tok.number = 0;
+    else tok.id = id;
+    return tok;
+}
+
+/*
+    Unary operators become binary ones, so no later pass needs to know
+    them: -x is 0 - x, !x is (x || 0) == 0 (a string is false only when
+    empty), +x is x.
+*/
+static NodeIndex unaryNode(Parser* parser, const Token* opTok, NodeIndex operand) {
+    if (opTok->id == STR_PLUS) return operand;
+    Token zero = madeToken(opTok, TOKEN_NUMBER, 0);
+    if (opTok->id == STR_MINUS) {
+        return binaryNode(parser, opTok, createNode(parser, AST_EXPRESSION, &zero), operand);
+    }
+    Token orTok = madeToken(opTok, TOKEN_OPERATOR, STR_OR);
+    Token eqTok = madeToken(opTok, TOKEN_OPERATOR, STR_EQ);
+    NodeIndex truth = binaryNode(parser, &orTok, operand, createNode(parser, AST_EXPRESSION, &zero));
+    return binaryNode(parser, &eqTok, truth, createNode(parser, AST_EXPRESSION, &zero));
 }
 
-static void reportParserError(ParserError* error) {
+void reportParserError(ParserError* error) {
     if (error && strlen(error->message) > 0) {
-        printf("Parser Error [Line %d, Column %d]: %s\n",
-               error->line, error->column, error->message);
+        fprintf(ioOut(), "Parser Error [Line %d, Column %d]: %s\n",
+                error->line, error->column, error->message);
     }
 }
 
@@ -40,9 +61,9 @@ static void reportParserError(ParserError* error) {
     Non-static forward declarations (match parser.h):
 */
 
-ASTNode* parseExpression(Token** tokens, ParserError* error);
-ASTNode* parseStatement (Token** tokens, ParserError* error);
-ASTNode* parseBlock     (Token** tokens, ParserError* error);
+NodeIndex parseExpression(Parser* parser, ParserError* error);
+NodeIndex parseStatement (Parser* parser, ParserError* error);
+BlockIndex parseBlock    (Parser* parser, ParserError* error);
 
 /*
     Static helpers for expression grammar with full precedence, including assignment at lowest level.
@@ -56,254 +77,652 @@ ASTNode* parseBlock     (Token** tokens, ParserError* error);
       additive        := term { ("+" | "-") term }
       term            := factor { ("*" | "/" | "%") factor }
       factor          := ("+" | "-" | "!") factor
-                       | NUMBER | STRING | IDENTIFIER [ "(" ")" ]
+                       | NUMBER | FLOAT | STRING | IDENTIFIER [ "(" ")" ]
                        | "(" expression ")"
 */
 
-static ASTNode* parseAssignment(Token** tokens, ParserError* error);
-static ASTNode* parseLogicalOr (Token** tokens, ParserError* error);
-static ASTNode* parseLogicalAnd(Token** tokens, ParserError* error);
-static ASTNode* parseEquality  (Token** tokens, ParserError* error);
-static ASTNode* parseRelational(Token** tokens, ParserError* error);
-static ASTNode* parseAdditive  (Token** tokens, ParserError* error);
-static ASTNode* parseTerm      (Token** tokens, ParserError* error);
-static ASTNode* parseFactor    (Token** tokens, ParserError* error);
+static NodeIndex parseAssignment(Parser* parser, ParserError* error);
+static NodeIndex parseLogicalOr (Parser* parser, ParserError* error);
+static NodeIndex parseLogicalAnd(Parser* parser, ParserError* error);
+static NodeIndex parseEquality  (Parser* parser, ParserError* error);
+static NodeIndex parseRelational(Parser* parser, ParserError* error);
+static NodeIndex parseAdditive  (Parser* parser, ParserError* error);
+static NodeIndex parseTerm      (Parser* parser, ParserError* error);
+static NodeIndex parseFactor    (Parser* parser, ParserError* error);
+
+void initParser(Parser* parser, Lexer* lexer, AST* ast) {
+    parser->lexer      = lexer;
+    parser->ast        = ast;
+    parser->tokens     = NULL;
+    parser->tokenBase  = 0;
+    parser->columns    = NULL;
+    parser->next       = 0;
+    parser->tokenCount = 0;
+    parser->functions  = NULL;
+    parser->job        = NULL;
+    parser->names      = NULL;
+    parser->nameCount  = 0;
+    parser->nesting    = 0;
+    parser->parallel   = 0;
+    parser->current    = nextToken(lexer);
+}
+
+static void readAhead(Parser* parser, uint32_t need);
+
+static void advance(Parser* parser) {
+    if (!parser->tokens) {
+        parser->current = nextToken(parser->lexer);
+        return;
+    }
+    if (parser->functions && parser->next - parser->tokenBase == parser->tokenCount) {
+        readAhead(parser, parser->next);
+    }
+    if (parser->next - parser->tokenBase < parser->tokenCount) {
+        parser->current = parser->tokens[parser->next++ - parser->tokenBase];   // the last one is TOKEN_EOF
+    }
+}
+
+// Errors are reported at the current token, the last one the lexer returned.
+static void errorAt(Parser* parser, ParserError* error) {
+    error->line   = (int)parser->current.line;
+    error->column = parser->columns ? (int)parser->columns[parser->next - 1 - parser->tokenBase]
+                                    : (int)lexerColumn(parser->lexer, &parser->current);
+}
+
+static void noteTokenError(FunctionJob* job, const char* format, const Token* tok);
+
+/*
+    An error that names a token.  Its text is in the string table, which a
+    parser worker must not read while the parser's thread interns into it,
+    so there the message is finished by takeFunction().
+*/
+static void tokenError(Parser* parser, ParserError* error, const char* format, const Token* tok) {
+    char buf[32];
+    errorAt(parser, error);
+    if (parser->job) {
+        noteTokenError(parser->job, format, tok);
+        snprintf(error->message, sizeof(error->message), format, "");
+    } else {
+        snprintf(error->message, sizeof(error->message), format, tokenText(tok, buf, sizeof(buf)));
+    }
+}
+
+static int enterNesting(Parser* parser, ParserError* error) {
+    if (++parser->nesting <= PARSER_MAX_NESTING) return 1;
+    errorAt(parser, error);
+    snprintf(error->message, sizeof(error->message),
+             "Nesting deeper than %d levels", PARSER_MAX_NESTING);
+    return 0;
+}
 
 /*
     parse(): top‐level entry.  We call parseBlock until EOF, then report any error.
 */
-ASTNode* parse(Token* tokens) {
+BlockIndex parse(Lexer* lexer, AST* ast) {
+    Parser parser;
     ParserError error = {0, 0, ""};
-    ASTNode* root = parseBlock(&tokens, &error);
+    initParser(&parser, lexer, ast);
+    parseImports(&parser);
+    BlockIndex root = parseBlock(&parser, &error);
+    freeParser(&parser);
     if (strlen(error.message) > 0) {
         reportParserError(&error);
-        freeAST(root);
-        return NULL;
+        return AST_NONE;
     }
     return root;
 }
 
+// Drain the lexer into parser->tokens and parse from there on.
+static void readTokens(Parser* parser) {
+    // A file's lines are gone by the time of an error, so keep the columns too.
+    Lexer* lexer = parser->lexer;
+    uint32_t count = 1, capacity = 1024;
+    Token* tokens = (Token*)malloc(sizeof(Token) * capacity);
+    uint32_t* columns = lexer->file ? (uint32_t*)malloc(sizeof(uint32_t) * capacity) : NULL;
+    tokens[0] = parser->current;
+    if (columns) columns[0] = lexerColumn(lexer, &tokens[0]);
+    while (tokens[count - 1].type != TOKEN_EOF) {
+        if (count == capacity) {
+            capacity *= 2;
+            tokens = (Token*)realloc(tokens, sizeof(Token) * capacity);
+            if (columns) columns = (uint32_t*)realloc(columns, sizeof(uint32_t) * capacity);
+        }
+        tokens[count] = nextToken(lexer);
+        if (columns) columns[count] = lexerColumn(lexer, &tokens[count]);
+        count++;
+    }
+    parser->tokens     = tokens;
+    parser->tokenBase  = 0;
+    parser->columns    = columns;
+    parser->tokenCount = count;
+    parser->next       = 1;
+}
+
+static void addName(Parser* parser, const Token* tok, uint32_t* capacity) {
+    if (parser->nameCount == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        parser->names = (Token*)realloc(parser->names, sizeof(Token) * *capacity);
+    }
+    parser->names[parser->nameCount++] = *tok;
+}
+
+// An identifier's name, unless 'used' has it already (a bitmap by string id).
+static void addUse(Parser* parser, const Token* tok, uint8_t** used, uint32_t* usedSize, uint32_t* capacity) {
+    if (tok->type != TOKEN_IDENTIFIER) return;
+    if (tok->id / 8 >= *usedSize) {
+        uint32_t size = *usedSize;
+        while (tok->id / 8 >= size) size *= 2;
+        *used = (uint8_t*)realloc(*used, size);
+        memset(*used + *usedSize, 0, size - *usedSize);
+        *usedSize = size;
+    }
+    uint8_t bit = (uint8_t)(1u << (tok->id % 8));
+    if ((*used)[tok->id / 8] & bit) return;
+    (*used)[tok->id / 8] |= bit;
+    addName(parser, tok, capacity);
+}
+
+int parseImports(Parser* parser) {
+    int count = 0;
+    uint32_t capacity = 0;
+    while (parser->current.type == TOKEN_IMPORT || parser->current.type == TOKEN_IMPORT_FROM_C) {
+        addName(parser, &parser->current, &capacity);
+        count++;
+        advance(parser);
+        if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+            advance(parser);
+        }
+    }
+    if (count == 0) return 0;
+
+    // Whether an import is used depends on the whole program: lex the rest
+    // once more and keep only the names, not the tokens.
+    uint32_t usedSize = 64;
+    uint8_t* used = (uint8_t*)calloc(usedSize, 1);
+    Lexer scan;
+    if (initLexerRescan(&scan, parser->lexer, parser->current.offset)) {
+        Token tok;
+        while ((tok = nextToken(&scan)).type != TOKEN_EOF) addUse(parser, &tok, &used, &usedSize, &capacity);
+        freeLexer(&scan);
+    } else {
+        // Input that can't be read twice is kept in memory instead.
+        if (!parser->tokens) readTokens(parser);
+        for (uint32_t i = parser->next - 1; i < parser->tokenCount; i++) {
+            addUse(parser, &parser->tokens[i], &used, &usedSize, &capacity);
+        }
+    }
+    free(used);
+    return count;
+}
+
+static int takeFunction(Parser* parser, ParserError* error, NodeIndex* node);
+
+NodeIndex parseNext(Parser* parser, ParserError* error) {
+    if (parser->current.type == TOKEN_EOF) return AST_NONE;
+    NodeIndex function;
+    if (parser->functions) {
+        readAhead(parser, parser->next - 1);
+        if (takeFunction(parser, error, &function)) return function;
+    }
+    if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_RBRACE)) {
+        errorAt(parser, error);
+        snprintf(error->message, sizeof(error->message), "Unexpected '}' at top level");
+        return AST_NONE;
+    }
+    if (tokenIs(&parser->current, TOKEN_KEYWORD, STR_ELSE)) {
+        errorAt(parser, error);
+        snprintf(error->message, sizeof(error->message),
+                 "Unexpected 'else' without matching 'if'");
+        return AST_NONE;
+    }
+    return parseStatement(parser, error);
+}
+
 /*
     parseBlock:
       - Consumes statements until TOKEN_EOF or a '}'.
-      - Attaches 'else' blocks to the previous 'if'.
-      - Returns linked list of statements in this block.
+      - Returns the block's statements, laid out contiguously in the arena.
 */
-ASTNode* parseBlock(Token** tokens, ParserError* error) {
-    ASTNode* head    = NULL;
-    ASTNode* current = NULL;
-    ASTNode* lastIf  = NULL;
-
-    while ((*tokens)->type != TOKEN_EOF &&
-           !((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, "}") == 0)) {
-
-        // Handle 'else' only if it directly follows an unmatched 'if'
-        if ((*tokens)->type == TOKEN_KEYWORD && strcmp((*tokens)->value, "else") == 0) {
-            if (lastIf && lastIf->nodeType == AST_IF_STATEMENT && lastIf->right == NULL) {
-                (*tokens)++;  // consume 'else'
-                if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, "{") == 0) {
-                    (*tokens)++;  // consume '{'
-                    ASTNode* elseBlock = parseBlock(tokens, error);
-                    lastIf->right = elseBlock;
-                    continue;
-                } else {
-                    error->line = error->column = 0;
-                    snprintf(error->message, sizeof(error->message),
-                             "Expected '{' after 'else'");
-                    return NULL;
-                }
-            } else {
-                error->line = error->column = 0;
-                snprintf(error->message, sizeof(error->message),
-                         "Unexpected 'else' without matching 'if'");
-                return NULL;
+BlockIndex parseBlock(Parser* parser, ParserError* error) {
+    uint32_t mark = parser->ast->scratchCount;
+    if (!enterNesting(parser, error)) return AST_NONE;
+
+    while (parser->current.type != TOKEN_EOF &&
+           !tokenIs(&parser->current, TOKEN_SYMBOL, STR_RBRACE)) {
+
+        // 'else' is consumed together with its 'if' in parseStatement
+        if (tokenIs(&parser->current, TOKEN_KEYWORD, STR_ELSE)) {
+            errorAt(parser, error);
+            snprintf(error->message, sizeof(error->message),
+                     "Unexpected 'else' without matching 'if'");
+            parser->ast->scratchCount = mark;
+            parser->nesting--;
+            return AST_NONE;
+        }
+
+        NodeIndex stmt = parseStatement(parser, error);
+        if (!stmt) {
+            if (strlen(error->message) > 0) {
+                parser->ast->scratchCount = mark;
+                parser->nesting--;
+                return AST_NONE;
             }
+            break;  // only stray semicolons were left
         }
+        pushStatement(parser->ast, stmt);
+    }
 
-        ASTNode* stmt = parseStatement(tokens, error);
-        if (!stmt) return NULL;
+    // If we stopped on '}', consume it
+    if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_RBRACE)) {
+        advance(parser);
+    }
+    parser->nesting--;
+    return closeBlock(parser->ast, mark);
+}
 
-        if (!head) head = stmt;
-        else current->next = stmt;
-        current = stmt;
+/*
+    parseBody: a braced block or a single statement (as a one-statement block).
+*/
+static BlockIndex parseBody(Parser* parser, ParserError* error) {
+    if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_LBRACE)) {
+        advance(parser);  // consume '{'
+        return parseBlock(parser, error);
+    }
+    if (!enterNesting(parser, error)) return AST_NONE;
+    NodeIndex stmt = parseStatement(parser, error);
+    parser->nesting--;
+    if (!stmt) return AST_NONE;
+    uint32_t mark = parser->ast->scratchCount;
+    pushStatement(parser->ast, stmt);
+    return closeBlock(parser->ast, mark);
+}
 
-        if (stmt->nodeType == AST_IF_STATEMENT) lastIf = stmt;
-        else lastIf = NULL;
+/*
+    The rest of a for, after 'for': <name> '=' <expr> '..' <expr> [ 'step' <expr> ] and
+    its body, as a node of 'type' with 'tk' for its token.
+*/
+static NodeIndex parseFor(Parser* parser, ParserError* error, const Token* tk, ASTNodeType type) {
+    Token name = parser->current;
+    if (name.type != TOKEN_IDENTIFIER) {
+        errorAt(parser, error);
+        snprintf(error->message, sizeof(error->message),
+                 "Expected a variable name after 'for'");
+        return AST_NONE;
+    }
+    advance(parser);  // consume identifier
+    Token assign = parser->current;
+    if (!tokenIs(&assign, TOKEN_OPERATOR, STR_ASSIGN)) {
+        errorAt(parser, error);
+        snprintf(error->message, sizeof(error->message),
+                 "Expected '=' after the variable of 'for'");
+        return AST_NONE;
     }
+    advance(parser);  // consume '='
+    NodeIndex start = parseExpression(parser, error);
+    if (!start) return AST_NONE;
 
-    // If we stopped on '}', consume it
-    if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, "}") == 0) {
-        (*tokens)++;
+    Token dots = parser->current;
+    if (!tokenIs(&dots, TOKEN_SYMBOL, STR_DOTDOT)) {
+        errorAt(parser, error);
+        snprintf(error->message, sizeof(error->message),
+                 "Expected '..' between the start and the end of 'for'");
+        return AST_NONE;
+    }
+    advance(parser);  // consume '..'
+    NodeIndex end = parseExpression(parser, error);
+    if (!end) return AST_NONE;
+    NodeIndex step = AST_NONE;
+    if (tokenIs(&parser->current, TOKEN_IDENTIFIER, STR_STEP)) {
+        advance(parser);  // consume 'step'
+        step = parseExpression(parser, error);
+        if (!step) return AST_NONE;
     }
-    return head;
+
+    BlockIndex loopBody = parseBody(parser, error);
+    if (!loopBody && strlen(error->message) > 0) return AST_NONE;
+
+    NodeIndex var  = createNode(parser, AST_EXPRESSION, &name);
+    NodeIndex init = createNode(parser, AST_VAR_ASSIGN, &assign);
+    astNode(parser->ast, init)->left  = var;
+    astNode(parser->ast, init)->right = start;
+    NodeIndex range = createNode(parser, AST_RANGE, &dots);
+    astNode(parser->ast, range)->left  = end;
+    astNode(parser->ast, range)->right = step;
+    NodeIndex node = createNode(parser, type, tk);
+    ASTNode* n = astNode(parser->ast, node);
+    n->left  = init;
+    n->right = range;
+    n->body  = loopBody;
+    return node;
 }
 
 /*
     parseStatement:
-      - Skips stray semicolons.
-      - Handles 'func', 'print', 'input', 'return', 'if', 'while'.
+      - Skips stray semicolons (returns AST_NONE without an error if nothing follows them).
+      - Handles 'func', 'print', 'input', 'return', 'if' (with its 'else'), 'while',
+        'for', 'parallel for', 'reduce', 'spawn' and 'send'.
       - Otherwise, parses an expression (includes assignments, calls).
       - Requires a trailing ';' after expressions, print, input, return, or single‐stmt bodies.
 */
-ASTNode* parseStatement(Token** tokens, ParserError* error) {
+NodeIndex parseStatement(Parser* parser, ParserError* error) {
     // Skip multiple semicolons
-    while ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, ";") == 0) {
-        (*tokens)++;
-        if ((*tokens)->type == TOKEN_EOF) return NULL;
+    while (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+        advance(parser);
+        if (parser->current.type == TOKEN_EOF) return AST_NONE;
+        if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_RBRACE)) return AST_NONE;
     }
 
-    Token tk = **tokens;
+    Token tk = parser->current;
+
+    if (tk.type == TOKEN_IMPORT || tk.type == TOKEN_IMPORT_FROM_C) {
+        errorAt(parser, error);
+        snprintf(error->message, sizeof(error->message),
+                 "Imports must come before all other statements");
+        return AST_NONE;
+    }
 
     // KEYWORD STATEMENTS:
     if (tk.type == TOKEN_KEYWORD) {
-        // --- 'func' <name> "(" ")" "{" <block> "}"
-        if (strcmp(tk.value, "func") == 0) {
-            (*tokens)++;  // consume 'func'
-            Token funcName = **tokens;
+        // --- 'func' <name> "(" [ <param> { "," <param> } ] ")" "{" <block> "}"
+        if (tk.id == STR_FUNC) {
+            advance(parser);  // consume 'func'
+            Token funcName = parser->current;
             if (funcName.type != TOKEN_IDENTIFIER) {
-                error->line = error->column = 0;
+                errorAt(parser, error);
                 snprintf(error->message, sizeof(error->message),
                          "Expected function name after 'func'");
-                return NULL;
+                return AST_NONE;
             }
-            (*tokens)++;  // consume identifier
+            advance(parser);  // consume identifier
 
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, "(") == 0) {
-                (*tokens)++;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_LPAREN)) {
+                advance(parser);
             } else {
-                error->line = error->column = 0;
+                errorAt(parser, error);
                 snprintf(error->message, sizeof(error->message),
                          "Expected '(' after function name");
-                return NULL;
+                return AST_NONE;
+            }
+
+            // Parameters are identifier nodes, laid out as a block like statements.
+            uint32_t mark = parser->ast->scratchCount;
+            while (parser->current.type == TOKEN_IDENTIFIER) {
+                for (uint32_t i = mark; i < parser->ast->scratchCount; i++) {
+                    if (nodeToken(parser->ast, astNode(parser->ast, parser->ast->scratch[i]))->id ==
+                        parser->current.id) {
+                        tokenError(parser, error, "Duplicate parameter '%.80s'", &parser->current);
+                        return AST_NONE;
+                    }
+                }
+                pushStatement(parser->ast, createNode(parser, AST_EXPRESSION, &parser->current));
+                advance(parser);  // consume parameter
+                if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_COMMA)) break;
+                advance(parser);  // consume ','
+                if (parser->current.type != TOKEN_IDENTIFIER) {
+                    errorAt(parser, error);
+                    snprintf(error->message, sizeof(error->message),
+                             "Expected parameter name after ','");
+                    return AST_NONE;
+                }
             }
+            BlockIndex params = closeBlock(parser->ast, mark);
 
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, ")") == 0) {
-                (*tokens)++;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_RPAREN)) {
+                advance(parser);
             } else {
-                error->line = error->column = 0;
+                errorAt(parser, error);
                 snprintf(error->message, sizeof(error->message),
-                         "Expected ')' after '(' in function definition");
-                return NULL;
+                         "Expected ')' after parameters in function definition");
+                return AST_NONE;
             }
 
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, "{") == 0) {
-                (*tokens)++;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_LBRACE)) {
+                advance(parser);
             } else {
-                error->line = error->column = 0;
+                errorAt(parser, error);
                 snprintf(error->message, sizeof(error->message),
                          "Expected '{' to start function body");
-                return NULL;
+                return AST_NONE;
             }
 
-            ASTNode* node = createNode(AST_FUNC_DEF, funcName);
-            node->body = parseBlock(tokens, error);
-            if (!node->body && strlen(error->message) > 0) {
-                freeAST(node);
-                return NULL;
-            }
+            // A func inside a parallel for is called like any other: it may return.
+            uint32_t parallel = parser->parallel;
+            parser->parallel = 0;
+            BlockIndex body = parseBlock(parser, error);
+            parser->parallel = parallel;
+            if (!body && strlen(error->message) > 0) return AST_NONE;
+            NodeIndex node = createNode(parser, AST_FUNC_DEF, &funcName);
+            astNode(parser->ast, node)->right = params;
+            astNode(parser->ast, node)->body  = body;
             return node;
         }
 
         // --- 'print' <expr> ';'
-        if (strcmp(tk.value, "print") == 0) {
-            (*tokens)++;  // consume 'print'
-            ASTNode* expr = parseExpression(tokens, error);
-            if (!expr) return NULL;
-            ASTNode* node = createNode(AST_PRINT, tk);
-            node->left = expr;
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, ";") == 0) {
-                (*tokens)++;
+        if (tk.id == STR_PRINT) {
+            advance(parser);  // consume 'print'
+            NodeIndex expr = parseExpression(parser, error);
+            if (!expr) return AST_NONE;
+            NodeIndex node = createNode(parser, AST_PRINT, &tk);
+            astNode(parser->ast, node)->left = expr;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+                advance(parser);
             }
             return node;
         }
 
         // --- 'input' <expr> ';'
-        if (strcmp(tk.value, "input") == 0) {
-            (*tokens)++;  // consume 'input'
-            ASTNode* expr = parseExpression(tokens, error);
-            if (!expr) return NULL;
-            ASTNode* node = createNode(AST_INPUT, tk);
-            node->left = expr;
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, ";") == 0) {
-                (*tokens)++;
+        if (tk.id == STR_INPUT) {
+            advance(parser);  // consume 'input'
+            NodeIndex expr = parseExpression(parser, error);
+            if (!expr) return AST_NONE;
+            NodeIndex node = createNode(parser, AST_INPUT, &tk);
+            astNode(parser->ast, node)->left = expr;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+                advance(parser);
             }
             return node;
         }
 
-        // --- 'return' <expr> ';'
-        if (strcmp(tk.value, "return") == 0) {
-            (*tokens)++;  // consume 'return'
-            ASTNode* expr = parseExpression(tokens, error);
-            if (!expr) return NULL;
-            ASTNode* node = createNode(AST_RETURN, tk);
-            node->left = expr;
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, ";") == 0) {
-                (*tokens)++;
+        // --- 'return' [ <expr> ] ';'
+        if (tk.id == STR_RETURN) {
+            if (parser->parallel) {
+                errorAt(parser, error);
+                snprintf(error->message, sizeof(error->message),
+                         "'return' inside a parallel for");
+                return AST_NONE;
+            }
+            advance(parser);  // consume 'return'
+            NodeIndex expr = AST_NONE;
+            if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON) &&
+                !tokenIs(&parser->current, TOKEN_SYMBOL, STR_RBRACE)) {
+                expr = parseExpression(parser, error);
+                if (!expr) return AST_NONE;
+            }
+            NodeIndex node = createNode(parser, AST_RETURN, &tk);
+            astNode(parser->ast, node)->left = expr;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+                advance(parser);
             }
             return node;
         }
 
-        // --- 'if' <expr> (block | single‐stmt)
-        if (strcmp(tk.value, "if") == 0) {
-            (*tokens)++;  // consume 'if'
-            ASTNode* cond = parseExpression(tokens, error);
-            if (!cond) return NULL;
-
-            ASTNode* thenBody = NULL;
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, "{") == 0) {
-                (*tokens)++;  // consume '{'
-                thenBody = parseBlock(tokens, error);
-                if (!thenBody && strlen(error->message) > 0) {
-                    freeAST(cond);
-                    return NULL;
-                }
-            } else {
-                thenBody = parseStatement(tokens, error);
-                if (!thenBody && strlen(error->message) > 0) {
-                    freeAST(cond);
-                    return NULL;
+        // --- 'if' <expr> (block | single‐stmt) [ 'else' "{" <block> "}" ]
+        if (tk.id == STR_IF) {
+            advance(parser);  // consume 'if'
+            NodeIndex cond = parseExpression(parser, error);
+            if (!cond) return AST_NONE;
+
+            BlockIndex thenBody = parseBody(parser, error);
+            if (!thenBody && strlen(error->message) > 0) return AST_NONE;
+
+            BlockIndex elseBody = AST_NONE;
+            if (tokenIs(&parser->current, TOKEN_KEYWORD, STR_ELSE)) {
+                advance(parser);  // consume 'else'
+                if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_LBRACE)) {
+                    errorAt(parser, error);
+                    snprintf(error->message, sizeof(error->message),
+                             "Expected '{' after 'else'");
+                    return AST_NONE;
                 }
+                advance(parser);  // consume '{'
+                elseBody = parseBlock(parser, error);
+                if (!elseBody && strlen(error->message) > 0) return AST_NONE;
             }
-            ASTNode* node = createNode(AST_IF_STATEMENT, tk);
-            node->left = cond;
-            node->body = thenBody;
+
+            NodeIndex node = createNode(parser, AST_IF_STATEMENT, &tk);
+            ASTNode* n = astNode(parser->ast, node);
+            n->left  = cond;
+            n->body  = thenBody;
+            n->right = elseBody;
             return node;
         }
 
         // --- 'while' <expr> (block | single‐stmt)
-        if (strcmp(tk.value, "while") == 0) {
-            (*tokens)++;  // consume 'while'
-            ASTNode* cond = parseExpression(tokens, error);
-            if (!cond) return NULL;
-
-            ASTNode* loopBody = NULL;
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, "{") == 0) {
-                (*tokens)++;  // consume '{'
-                loopBody = parseBlock(tokens, error);
-                if (!loopBody && strlen(error->message) > 0) {
-                    freeAST(cond);
-                    return NULL;
-                }
-            } else {
-                loopBody = parseStatement(tokens, error);
-                if (!loopBody && strlen(error->message) > 0) {
-                    freeAST(cond);
-                    return NULL;
-                }
+        if (tk.id == STR_WHILE) {
+            advance(parser);  // consume 'while'
+            NodeIndex cond = parseExpression(parser, error);
+            if (!cond) return AST_NONE;
+
+            BlockIndex loopBody = parseBody(parser, error);
+            if (!loopBody && strlen(error->message) > 0) return AST_NONE;
+
+            NodeIndex node = createNode(parser, AST_WHILE_LOOP, &tk);
+            ASTNode* n = astNode(parser->ast, node);
+            n->left = cond;
+            n->body = loopBody;
+            return node;
+        }
+
+        // --- 'for' <name> '=' <expr> '..' <expr> [ 'step' <expr> ] (block | single‐stmt)
+        if (tk.id == STR_FOR) {
+            advance(parser);  // consume 'for'
+            return parseFor(parser, error, &tk, AST_FOR_LOOP);
+        }
+
+        // --- 'parallel' [ 'unordered' ] 'for' ...
+        if (tk.id == STR_PARALLEL) {
+            advance(parser);  // consume 'parallel'
+            if (tokenIs(&parser->current, TOKEN_IDENTIFIER, STR_UNORDERED)) {
+                tk = parser->current;
+                advance(parser);  // consume 'unordered'
+            }
+            if (!tokenIs(&parser->current, TOKEN_KEYWORD, STR_FOR)) {
+                errorAt(parser, error);
+                snprintf(error->message, sizeof(error->message),
+                         "Expected 'for' after 'parallel'");
+                return AST_NONE;
+            }
+            advance(parser);  // consume 'for'
+            parser->parallel++;
+            NodeIndex node = parseFor(parser, error, &tk, AST_PARALLEL_FOR);
+            parser->parallel--;
+            return node;
+        }
+
+        // --- 'reduce' <name> ('+' | '-' | '*') '=' <expr> ';'
+        if (tk.id == STR_REDUCE) {
+            if (!parser->parallel) {
+                errorAt(parser, error);
+                snprintf(error->message, sizeof(error->message),
+                         "'reduce' outside of a parallel for");
+                return AST_NONE;
+            }
+            advance(parser);  // consume 'reduce'
+            Token name = parser->current;
+            if (name.type != TOKEN_IDENTIFIER) {
+                errorAt(parser, error);
+                snprintf(error->message, sizeof(error->message),
+                         "Expected a variable name after 'reduce'");
+                return AST_NONE;
+            }
+            advance(parser);  // consume identifier
+            Token op = parser->current;
+            if (op.type != TOKEN_OPERATOR ||
+                (op.id != STR_PLUS && op.id != STR_MINUS && op.id != STR_STAR)) {
+                errorAt(parser, error);
+                snprintf(error->message, sizeof(error->message),
+                         "Expected '+=', '-=' or '*=' after the variable of 'reduce'");
+                return AST_NONE;
+            }
+            advance(parser);  // consume the operator
+            Token assign = parser->current;
+            if (!tokenIs(&assign, TOKEN_OPERATOR, STR_ASSIGN)) {
+                errorAt(parser, error);
+                snprintf(error->message, sizeof(error->message),
+                         "Expected '+=', '-=' or '*=' after the variable of 'reduce'");
+                return AST_NONE;
+            }
+            advance(parser);  // consume '='
+            NodeIndex value = parseExpression(parser, error);
+            if (!value) return AST_NONE;
+
+            // x op= e is x = x op e; the executor and the VM run it as just that.
+            NodeIndex target = createNode(parser, AST_EXPRESSION, &name);
+            NodeIndex sum = binaryNode(parser, &op, createNode(parser, AST_EXPRESSION, &name), value);
+            NodeIndex store = createNode(parser, AST_VAR_ASSIGN, &assign);
+            astNode(parser->ast, store)->left  = target;
+            astNode(parser->ast, store)->right = sum;
+            NodeIndex node = createNode(parser, AST_REDUCE, &op);
+            astNode(parser->ast, node)->left = store;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+                advance(parser);
+            }
+            return node;
+        }
+
+        // --- 'spawn' <call> ';'
+        if (tk.id == STR_SPAWN) {
+            advance(parser);  // consume 'spawn'
+            NodeIndex call = AST_NONE;
+            if (parser->current.type == TOKEN_IDENTIFIER) {
+                call = parseExpression(parser, error);
+                if (!call) return AST_NONE;
+            }
+            if (!call || astNode(parser->ast, call)->nodeType != AST_CALL) {
+                errorAt(parser, error);
+                snprintf(error->message, sizeof(error->message),
+                         "Expected a function call after 'spawn'");
+                return AST_NONE;
+            }
+            NodeIndex node = createNode(parser, AST_SPAWN, &tk);
+            astNode(parser->ast, node)->left = call;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+                advance(parser);
+            }
+            return node;
+        }
+
+        // --- 'send' <channel> ',' <value> ';'
+        if (tk.id == STR_SEND) {
+            advance(parser);  // consume 'send'
+            NodeIndex channel = parseExpression(parser, error);
+            if (!channel) return AST_NONE;
+            if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_COMMA)) {
+                errorAt(parser, error);
+                snprintf(error->message, sizeof(error->message),
+                         "Expected ',' between the channel and the value in 'send'");
+                return AST_NONE;
+            }
+            advance(parser);  // consume ','
+            NodeIndex value = parseExpression(parser, error);
+            if (!value) return AST_NONE;
+            NodeIndex node = createNode(parser, AST_SEND, &tk);
+            ASTNode* n = astNode(parser->ast, node);
+            n->left  = channel;
+            n->right = value;
+            if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+                advance(parser);
             }
-            ASTNode* node = createNode(AST_WHILE_LOOP, tk);
-            node->left = cond;
-            node->body = loopBody;
             return node;
         }
     }
 
     // Otherwise: parse as expression statement (includes assignments, calls)
-    ASTNode* expr = parseExpression(tokens, error);
-    if (!expr) return NULL;
+    NodeIndex expr = parseExpression(parser, error);
+    if (!expr) return AST_NONE;
 
-    if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, ";") == 0) {
-        (*tokens)++;
+    if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_SEMICOLON)) {
+        advance(parser);
     }
     return expr;
 }
@@ -311,29 +730,30 @@ ASTNode* parseStatement(Token** tokens, ParserError* error) {
 /*
     parseExpression (highest level): parseAssignment
 */
-ASTNode* parseExpression(Token** tokens, ParserError* error) {
-    return parseAssignment(tokens, error);
+NodeIndex parseExpression(Parser* parser, ParserError* error) {
+    if (!enterNesting(parser, error)) return AST_NONE;
+    NodeIndex node = parseAssignment(parser, error);
+    parser->nesting--;
+    return node;
 }
 
 /*
     parseAssignment:
       assignment := logicalOr [ "=" assignment ]
 */
-static ASTNode* parseAssignment(Token** tokens, ParserError* error) {
-    ASTNode* left = parseLogicalOr(tokens, error);
-    if (!left) return NULL;
-
-    if ((*tokens)->type == TOKEN_OPERATOR && strcmp((*tokens)->value, "=") == 0) {
-        Token opTok = **tokens;
-        (*tokens)++;  // consume '='
-        ASTNode* right = parseAssignment(tokens, error);
-        if (!right) {
-            freeAST(left);
-            return NULL;
-        }
-        ASTNode* node = createNode(AST_VAR_ASSIGN, opTok);
-        node->left  = left;
-        node->right = right;
+static NodeIndex parseAssignment(Parser* parser, ParserError* error) {
+    NodeIndex left = parseLogicalOr(parser, error);
+    if (!left) return AST_NONE;
+
+    if (tokenIs(&parser->current, TOKEN_OPERATOR, STR_ASSIGN)) {
+        Token opTok = parser->current;
+        advance(parser);  // consume '='
+        NodeIndex right = parseAssignment(parser, error);
+        if (!right) return AST_NONE;
+        NodeIndex node = createNode(parser, AST_VAR_ASSIGN, &opTok);
+        ASTNode* n = astNode(parser->ast, node);
+        n->left  = left;
+        n->right = right;
         return node;
     }
     return left;
@@ -343,22 +763,16 @@ static ASTNode* parseAssignment(Token** tokens, ParserError* error) {
     parseLogicalOr:
       logicalOr := logicalAnd { "||" logicalAnd }*
 */
-static ASTNode* parseLogicalOr(Token** tokens, ParserError* error) {
-    ASTNode* left = parseLogicalAnd(tokens, error);
-    if (!left) return NULL;
-
-    while ((*tokens)->type == TOKEN_OPERATOR && strcmp((*tokens)->value, "||") == 0) {
-        Token opTok = **tokens;
-        (*tokens)++;
-        ASTNode* right = parseLogicalAnd(tokens, error);
-        if (!right) {
-            freeAST(left);
-            return NULL;
-        }
-        ASTNode* bin = createNode(AST_EXPRESSION, opTok);
-        bin->left  = left;
-        bin->right = right;
-        left = bin;
+static NodeIndex parseLogicalOr(Parser* parser, ParserError* error) {
+    NodeIndex left = parseLogicalAnd(parser, error);
+    if (!left) return AST_NONE;
+
+    while (tokenIs(&parser->current, TOKEN_OPERATOR, STR_OR)) {
+        Token opTok = parser->current;
+        advance(parser);
+        NodeIndex right = parseLogicalAnd(parser, error);
+        if (!right) return AST_NONE;
+        left = binaryNode(parser, &opTok, left, right);
     }
     return left;
 }
@@ -367,22 +781,16 @@ static ASTNode* parseLogicalOr(Token** tokens, ParserError* error) {
     parseLogicalAnd:
       logicalAnd := equality { "&&" equality }*
 */
-static ASTNode* parseLogicalAnd(Token** tokens, ParserError* error) {
-    ASTNode* left = parseEquality(tokens, error);
-    if (!left) return NULL;
-
-    while ((*tokens)->type == TOKEN_OPERATOR && strcmp((*tokens)->value, "&&") == 0) {
-        Token opTok = **tokens;
-        (*tokens)++;
-        ASTNode* right = parseEquality(tokens, error);
-        if (!right) {
-            freeAST(left);
-            return NULL;
-        }
-        ASTNode* bin = createNode(AST_EXPRESSION, opTok);
-        bin->left  = left;
-        bin->right = right;
-        left = bin;
+static NodeIndex parseLogicalAnd(Parser* parser, ParserError* error) {
+    NodeIndex left = parseEquality(parser, error);
+    if (!left) return AST_NONE;
+
+    while (tokenIs(&parser->current, TOKEN_OPERATOR, STR_AND)) {
+        Token opTok = parser->current;
+        advance(parser);
+        NodeIndex right = parseEquality(parser, error);
+        if (!right) return AST_NONE;
+        left = binaryNode(parser, &opTok, left, right);
     }
     return left;
 }
@@ -391,24 +799,18 @@ static ASTNode* parseLogicalAnd(Token** tokens, ParserError* error) {
     parseEquality:
       equality := relational { ("==" | "!=") relational }*
 */
-static ASTNode* parseEquality(Token** tokens, ParserError* error) {
-    ASTNode* left = parseRelational(tokens, error);
-    if (!left) return NULL;
+static NodeIndex parseEquality(Parser* parser, ParserError* error) {
+    NodeIndex left = parseRelational(parser, error);
+    if (!left) return AST_NONE;
 
-    while ((*tokens)->type == TOKEN_OPERATOR &&
-           (strcmp((*tokens)->value, "==") == 0 || strcmp((*tokens)->value, "!=") == 0))
+    while (parser->current.type == TOKEN_OPERATOR &&
+           (parser->current.id == STR_EQ || parser->current.id == STR_NE))
     {
-        Token opTok = **tokens;
-        (*tokens)++;
-        ASTNode* right = parseRelational(tokens, error);
-        if (!right) {
-            freeAST(left);
-            return NULL;
-        }
-        ASTNode* bin = createNode(AST_EXPRESSION, opTok);
-        bin->left  = left;
-        bin->right = right;
-        left = bin;
+        Token opTok = parser->current;
+        advance(parser);
+        NodeIndex right = parseRelational(parser, error);
+        if (!right) return AST_NONE;
+        left = binaryNode(parser, &opTok, left, right);
     }
     return left;
 }
@@ -417,27 +819,21 @@ static ASTNode* parseEquality(Token** tokens, ParserError* error) {
     parseRelational:
       relational := additive { ("<" | "<=" | ">" | ">=") additive }*
 */
-static ASTNode* parseRelational(Token** tokens, ParserError* error) {
-    ASTNode* left = parseAdditive(tokens, error);
-    if (!left) return NULL;
-
-    while ((*tokens)->type == TOKEN_OPERATOR &&
-           (strcmp((*tokens)->value, "<") == 0  ||
-            strcmp((*tokens)->value, "<=") == 0 ||
-            strcmp((*tokens)->value, ">") == 0  ||
-            strcmp((*tokens)->value, ">=") == 0))
+static NodeIndex parseRelational(Parser* parser, ParserError* error) {
+    NodeIndex left = parseAdditive(parser, error);
+    if (!left) return AST_NONE;
+
+    while (parser->current.type == TOKEN_OPERATOR &&
+           (parser->current.id == STR_LT  ||
+            parser->current.id == STR_LE ||
+            parser->current.id == STR_GT  ||
+            parser->current.id == STR_GE))
     {
-        Token opTok = **tokens;
-        (*tokens)++;
-        ASTNode* right = parseAdditive(tokens, error);
-        if (!right) {
-            freeAST(left);
-            return NULL;
-        }
-        ASTNode* bin = createNode(AST_EXPRESSION, opTok);
-        bin->left  = left;
-        bin->right = right;
-        left = bin;
+        Token opTok = parser->current;
+        advance(parser);
+        NodeIndex right = parseAdditive(parser, error);
+        if (!right) return AST_NONE;
+        left = binaryNode(parser, &opTok, left, right);
     }
     return left;
 }
@@ -446,24 +842,18 @@ static ASTNode* parseRelational(Token** tokens, ParserError* error) {
     parseAdditive:
       additive := term { ("+" | "-") term }*
 */
-static ASTNode* parseAdditive(Token** tokens, ParserError* error) {
-    ASTNode* left = parseTerm(tokens, error);
-    if (!left) return NULL;
+static NodeIndex parseAdditive(Parser* parser, ParserError* error) {
+    NodeIndex left = parseTerm(parser, error);
+    if (!left) return AST_NONE;
 
-    while ((*tokens)->type == TOKEN_OPERATOR &&
-           (strcmp((*tokens)->value, "+") == 0 || strcmp((*tokens)->value, "-") == 0))
+    while (parser->current.type == TOKEN_OPERATOR &&
+           (parser->current.id == STR_PLUS || parser->current.id == STR_MINUS))
     {
-        Token opTok = **tokens;
-        (*tokens)++;
-        ASTNode* right = parseTerm(tokens, error);
-        if (!right) {
-            freeAST(left);
-            return NULL;
-        }
-        ASTNode* bin = createNode(AST_EXPRESSION, opTok);
-        bin->left  = left;
-        bin->right = right;
-        left = bin;
+        Token opTok = parser->current;
+        advance(parser);
+        NodeIndex right = parseTerm(parser, error);
+        if (!right) return AST_NONE;
+        left = binaryNode(parser, &opTok, left, right);
     }
     return left;
 }
@@ -472,26 +862,20 @@ static ASTNode* parseAdditive(Token** tokens, ParserError* error) {
     parseTerm:
       term := factor { ("*" | "/" | "%") factor }*
 */
-static ASTNode* parseTerm(Token** tokens, ParserError* error) {
-    ASTNode* left = parseFactor(tokens, error);
-    if (!left) return NULL;
-
-    while ((*tokens)->type == TOKEN_OPERATOR &&
-           (strcmp((*tokens)->value, "*") == 0 ||
-            strcmp((*tokens)->value, "/") == 0 ||
-            strcmp((*tokens)->value, "%") == 0))
+static NodeIndex parseTerm(Parser* parser, ParserError* error) {
+    NodeIndex left = parseFactor(parser, error);
+    if (!left) return AST_NONE;
+
+    while (parser->current.type == TOKEN_OPERATOR &&
+           (parser->current.id == STR_STAR ||
+            parser->current.id == STR_SLASH ||
+            parser->current.id == STR_PERCENT))
     {
-        Token opTok = **tokens;
-        (*tokens)++;
-        ASTNode* right = parseFactor(tokens, error);
-        if (!right) {
-            freeAST(left);
-            return NULL;
-        }
-        ASTNode* bin = createNode(AST_EXPRESSION, opTok);
-        bin->left  = left;
-        bin->right = right;
-        left = bin;
+        Token opTok = parser->current;
+        advance(parser);
+        NodeIndex right = parseFactor(parser, error);
+        if (!right) return AST_NONE;
+        left = binaryNode(parser, &opTok, left, right);
     }
     return left;
 }
@@ -499,92 +883,454 @@ static ASTNode* parseTerm(Token** tokens, ParserError* error) {
 /*
     parseFactor:
       factor := ("+" | "-" | "!") factor
-               | NUMBER | STRING
-               | IDENTIFIER [ "(" ")" ]
+               | "recv" factor
+               | "chan" "(" [ expression ] ")"
+               | NUMBER | FLOAT | STRING
+               | IDENTIFIER [ "(" [ expression { "," expression } ] ")" ]
                | "(" expression ")"
 */
-static ASTNode* parseFactor(Token** tokens, ParserError* error) {
-    Token tk = **tokens;
+static NodeIndex parseFactor(Parser* parser, ParserError* error) {
+    Token tk = parser->current;
 
     // Unary +, -, !
     if (tk.type == TOKEN_OPERATOR &&
-        (strcmp(tk.value, "+") == 0 || strcmp(tk.value, "-") == 0 || strcmp(tk.value, "!") == 0))
+        (tk.id == STR_PLUS || tk.id == STR_MINUS || tk.id == STR_BANG))
     {
         Token opTok = tk;
-        (*tokens)++;
-        ASTNode* operand = parseFactor(tokens, error);
-        if (!operand) return NULL;
-        ASTNode* unaryNode = createNode(AST_EXPRESSION, opTok);
-        unaryNode->left = operand;
-        return unaryNode;
-    }
-
-    // NUMBER or STRING literal
-    if (tk.type == TOKEN_NUMBER || tk.type == TOKEN_STRING) {
-        ASTNode* litNode = createNode(AST_EXPRESSION, tk);
-        (*tokens)++;
+        advance(parser);
+        if (!enterNesting(parser, error)) return AST_NONE;
+        NodeIndex operand = parseFactor(parser, error);
+        parser->nesting--;
+        if (!operand) return AST_NONE;
+        return unaryNode(parser, &opTok, operand);
+    }
+
+    // recv <factor>: the next value from a channel
+    if (tk.type == TOKEN_KEYWORD && tk.id == STR_RECV) {
+        advance(parser);
+        if (!enterNesting(parser, error)) return AST_NONE;
+        NodeIndex channel = parseFactor(parser, error);
+        parser->nesting--;
+        if (!channel) return AST_NONE;
+        NodeIndex node = createNode(parser, AST_RECV, &tk);
+        astNode(parser->ast, node)->left = channel;
+        return node;
+    }
+
+    // chan "(" [ <capacity> ] ")": a new channel
+    if (tk.type == TOKEN_KEYWORD && tk.id == STR_CHAN) {
+        advance(parser);
+        if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_LPAREN)) {
+            errorAt(parser, error);
+            snprintf(error->message, sizeof(error->message), "Expected '(' after 'chan'");
+            return AST_NONE;
+        }
+        advance(parser);  // consume "("
+        NodeIndex capacity = AST_NONE;
+        if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_RPAREN)) {
+            capacity = parseExpression(parser, error);
+            if (!capacity) return AST_NONE;
+        }
+        if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_RPAREN)) {
+            errorAt(parser, error);
+            snprintf(error->message, sizeof(error->message), "Expected ')' after the capacity of 'chan'");
+            return AST_NONE;
+        }
+        advance(parser);  // consume ")"
+        NodeIndex node = createNode(parser, AST_CHAN, &tk);
+        astNode(parser->ast, node)->left = capacity;
+        return node;
+    }
+
+    // NUMBER, FLOAT or STRING literal
+    if (isNumberToken(&tk) || tk.type == TOKEN_STRING) {
+        NodeIndex litNode = createNode(parser, AST_EXPRESSION, &tk);
+        advance(parser);
         return litNode;
     }
 
     // IDENTIFIER or keyword "loop" used as call: treat both as identifier
-    if (tk.type == TOKEN_IDENTIFIER || (tk.type == TOKEN_KEYWORD && strcmp(tk.value, "loop") == 0)) {
+    if (tk.type == TOKEN_IDENTIFIER || (tk.type == TOKEN_KEYWORD && tk.id == STR_LOOP)) {
         Token idTok = tk;
-        (*tokens)++;  // consume IDENT (or "loop")
-
-        // If next is "(" and then ")", that’s a call with no args:
-        if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, "(") == 0) {
-            (*tokens)++;  // consume "("
-            if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, ")") == 0) {
-                (*tokens)++;  // consume ")"
-                ASTNode* callNode = createNode(AST_EXPRESSION, idTok);
-                return callNode;
-            } else {
-                error->line = error->column = 0;
+        advance(parser);  // consume IDENT (or "loop")
+
+        // "(" [ <expr> { "," <expr> } ] ")" makes it a call; the arguments are its body.
+        if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_LPAREN)) {
+            advance(parser);  // consume "("
+            uint32_t mark = parser->ast->scratchCount;
+            if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_RPAREN)) {
+                for (;;) {
+                    NodeIndex arg = parseExpression(parser, error);
+                    if (!arg) return AST_NONE;
+                    pushStatement(parser->ast, arg);
+                    if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_COMMA)) break;
+                    advance(parser);  // consume ","
+                }
+            }
+            if (!tokenIs(&parser->current, TOKEN_SYMBOL, STR_RPAREN)) {
+                errorAt(parser, error);
                 snprintf(error->message, sizeof(error->message),
-                         "Expected ')' after '(' in function call");
-                return NULL;
+                         "Expected ')' after arguments in function call");
+                return AST_NONE;
             }
+            advance(parser);  // consume ")"
+            BlockIndex args = closeBlock(parser->ast, mark);
+            NodeIndex call = createNode(parser, AST_CALL, &idTok);
+            astNode(parser->ast, call)->body = args;
+            return call;
         }
 
         // Otherwise, simple identifier node
-        ASTNode* idNode = createNode(AST_EXPRESSION, idTok);
-        return idNode;
+        return createNode(parser, AST_EXPRESSION, &idTok);
     }
 
     // Parenthesized expression
-    if (tk.type == TOKEN_SYMBOL && strcmp(tk.value, "(") == 0) {
-        (*tokens)++;  // consume '('
-        ASTNode* inner = parseExpression(tokens, error);
-        if (!inner) return NULL;
+    if (tk.type == TOKEN_SYMBOL && tk.id == STR_LPAREN) {
+        advance(parser);  // consume '('
+        NodeIndex inner = parseExpression(parser, error);
+        if (!inner) return AST_NONE;
 
-        if ((*tokens)->type == TOKEN_SYMBOL && strcmp((*tokens)->value, ")") == 0) {
-            (*tokens)++;  // consume ')'
+        if (tokenIs(&parser->current, TOKEN_SYMBOL, STR_RPAREN)) {
+            advance(parser);  // consume ')'
             return inner;
         } else {
-            error->line = error->column = 0;
+            errorAt(parser, error);
             snprintf(error->message, sizeof(error->message),
                      "Expected ')' after expression");
-            freeAST(inner);
-            return NULL;
+            return AST_NONE;
         }
     }
 
     // If none matched, it’s an invalid factor
-    error->line = error->column = 0;
-    snprintf(error->message, sizeof(error->message),
-             "Invalid expression starting with '%s'", tk.value);
+    tokenError(parser, error, "Invalid expression starting with '%.80s'", &tk);
+    return AST_NONE;
+}
+
+/*
+    Parallel parsing of top-level functions.  As tokens are read into the
+    parser's window, a scan finds every 'func' at brace depth 0 and the '}'
+    that closes it, and copies those tokens out as a job; workers parse the
+    jobs with the code above, each into an arena of its own.  parseNext()
+    only uses a result when it reaches the function's first token at the
+    top level, so whatever the scan got wrong (a func as the body of a
+    brace-less if, unbalanced braces) is parsed serially as before.  A
+    worker's error is the one the serial parser would report at the same
+    token, and it only surfaces when parseNext() gets there, so the first
+    error in source order is the one reported.
+
+    The window only keeps tokens from the parser's current one (or the
+    start of a func still being scanned) on, and is read ahead of the
+    parser until PARSE_TOKENS_AHEAD tokens or a full ring of jobs are
+    waiting, so memory depends on the largest function, not the source.
+*/
+#define PARSE_JOBS_AHEAD   64           // per thread, bounds the arenas waiting to be taken
+#define PARSE_TOKENS_AHEAD (1u << 20)   // read ahead of the parser to find funcs in
+
+struct FunctionJob {
+    uint32_t    first, last;    // 'func' .. the '}' closing its body
+    Token*      tokens;         // first .. last + 1, then an EOF
+    AST         ast;
+    NodeIndex   root;
+    ParserError error;
+    const char* format;         // error's message, when it names 'quoted'
+    Token       quoted;
+    int         done;           // under the pool's lock
+    int         serial;         // the parse did not end where the scan said
+};
+
+struct FunctionPool {
+    FunctionJob*    jobs;       // a ring: job n is jobs[n % window]
+    uint32_t        jobCount;   // found so far
+    uint32_t        nextJob;    // next one for a worker
+    uint32_t        taken;      // jobs before this one were used or dropped by parseNext
+    uint32_t        window;
+    int             stop;
+    int             scanned;    // the whole input has been read, no more jobs will come
+    pthread_mutex_t lock;
+    pthread_cond_t  parsed;     // a job is done
+    pthread_cond_t  moved;      // a job was found, or the scan is over
+    pthread_t*      threads;
+    int             threadCount;
+    Parser          source;     // the main parser, for the lexer the workers report columns from
+    Interpreter*    interpreter; // the workers run in it, but leave its string table alone
+
+    // The scan, on the parser's thread; tokens are numbered from the start of the input.
+    uint32_t        capacity;   // of the parser's window
+    uint32_t        depth;
+    uint32_t        first, last;
+    int             open;       // a top-level func started at 'first'
+    int             closed;     // and its body ended at 'last'; the job is made at the next token
+};
+
+static void noteTokenError(FunctionJob* job, const char* format, const Token* tok) {
+    job->format = format;
+    job->quoted = *tok;
+}
+
+static FunctionJob* poolJob(const FunctionPool* pool, uint32_t n) {
+    return &pool->jobs[n % pool->window];
+}
+
+static void parseJob(const FunctionPool* pool, FunctionJob* job) {
+    Parser parser = pool->source;
+    parser.ast        = &job->ast;
+    parser.functions  = NULL;
+    parser.job        = job;
+    parser.names      = NULL;
+    parser.nesting    = 0;
+    parser.parallel   = 0;
+    parser.tokens     = job->tokens;
+    parser.tokenBase  = job->first;
+    parser.tokenCount = job->last - job->first + 3;
+    parser.columns    = NULL;
+    parser.next       = job->first;
+    advance(&parser);
+    initAST(&job->ast);
+    memset(&job->error, 0, sizeof(job->error));
+    job->format = NULL;
+    job->root = parseStatement(&parser, &job->error);
+    // The serial parser would be looking at the token after the closing '}'.
+    if (strlen(job->error.message) == 0 && parser.next != job->last + 2) job->serial = 1;
+}
+
+static void* parseWorker(void* arg) {
+    FunctionPool* pool = (FunctionPool*)arg;
+    interpreterEnter(pool->interpreter);
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && !pool->scanned && pool->nextJob == pool->jobCount) {
+            pthread_cond_wait(&pool->moved, &pool->lock);
+        }
+        if (pool->stop || pool->nextJob == pool->jobCount) break;
+        FunctionJob* job = poolJob(pool, pool->nextJob++);
+        pthread_mutex_unlock(&pool->lock);
+
+        parseJob(pool, job);
+
+        pthread_mutex_lock(&pool->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&pool->parsed);
+    }
+    pthread_mutex_unlock(&pool->lock);
     return NULL;
 }
 
+// Done with job 'taken': make sure no worker still has it, then free it for the next one.
+static void releaseJob(FunctionPool* pool) {
+    FunctionJob* job = poolJob(pool, pool->taken);
+    pthread_mutex_lock(&pool->lock);
+    if (pool->nextJob <= pool->taken) {
+        pool->nextJob = pool->taken + 1;    // no worker started it, and now none will
+    } else {
+        while (!job->done) pthread_cond_wait(&pool->parsed, &pool->lock);
+    }
+    pool->taken++;
+    pthread_mutex_unlock(&pool->lock);
+    freeAST(&job->ast);
+    free(job->tokens);
+    job->tokens = NULL;
+}
+
+static int takeFunction(Parser* parser, ParserError* error, NodeIndex* node) {
+    FunctionPool* pool = parser->functions;
+    uint32_t at = parser->next - 1;         // number of the current token
+    while (pool->taken < pool->jobCount && poolJob(pool, pool->taken)->first < at) releaseJob(pool);
+    if (pool->taken == pool->jobCount || poolJob(pool, pool->taken)->first != at) return 0;
+
+    FunctionJob* job = poolJob(pool, pool->taken);
+    pthread_mutex_lock(&pool->lock);
+    while (!job->done) pthread_cond_wait(&pool->parsed, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    int used = !job->serial;
+    if (used && strlen(job->error.message) > 0) {
+        *error = job->error;
+        *node  = AST_NONE;
+        if (job->format) {
+            char buf[32];
+            snprintf(error->message, sizeof(error->message), job->format,
+                     tokenText(&job->quoted, buf, sizeof(buf)));
+        }
+    } else if (used) {
+        *node = appendAST(parser->ast, &job->ast, job->root);
+        parser->next    = job->last + 2;
+        parser->current = parser->tokens[job->last + 1 - parser->tokenBase];
+    }
+    releaseJob(pool);
+    return used;
+}
+
+// The func that ended at pool->last, now that the token after it is in the window too.
+static void addJob(Parser* parser) {
+    FunctionPool* pool = parser->functions;
+    // One the parser is already on is parsed serially, and so is one with no room in the ring.
+    if (pool->first < parser->next || pool->jobCount == pool->taken + pool->window) return;
+
+    FunctionJob* job = poolJob(pool, pool->jobCount);
+    memset(job, 0, sizeof(*job));
+    job->first = pool->first;
+    job->last  = pool->last;
+    uint32_t count = job->last + 2 - job->first;
+    job->tokens = (Token*)malloc(sizeof(Token) * (count + 1));
+    memcpy(job->tokens, &parser->tokens[job->first - parser->tokenBase], sizeof(Token) * count);
+    Token* eof = &job->tokens[count];
+    *eof = job->tokens[count - 1];
+    eof->type   = TOKEN_EOF;
+    eof->length = 0;
+    eof->id     = STR_EOF;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->jobCount++;
+    pthread_cond_broadcast(&pool->moved);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Token number 'i', just added to the window.
+static void scanToken(Parser* parser, uint32_t i) {
+    FunctionPool* pool = parser->functions;
+    const Token* tok = &parser->tokens[i - parser->tokenBase];
+    if (pool->closed) {
+        pool->closed = 0;
+        addJob(parser);
+    }
+    if (tokenIs(tok, TOKEN_SYMBOL, STR_LBRACE)) {
+        pool->depth++;
+    } else if (tokenIs(tok, TOKEN_SYMBOL, STR_RBRACE) && pool->depth > 0) {
+        if (--pool->depth == 0 && pool->open) {
+            pool->last   = i;
+            pool->open   = 0;
+            pool->closed = 1;
+        }
+    } else if (pool->depth == 0 && tokenIs(tok, TOKEN_KEYWORD, STR_FUNC)) {
+        pool->first = i;
+        pool->open  = 1;
+    }
+    if (tok->type == TOKEN_EOF) {
+        pthread_mutex_lock(&pool->lock);
+        pool->scanned = 1;
+        pthread_cond_broadcast(&pool->moved);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Room for one more token: drop what nobody needs any more, or grow.
+static void makeRoom(Parser* parser) {
+    FunctionPool* pool = parser->functions;
+    uint32_t keep = parser->next - 1;
+    if ((pool->open || pool->closed) && pool->first < keep) keep = pool->first;
+    uint32_t drop = keep - parser->tokenBase;
+    if (drop > 0 && drop >= parser->tokenCount / 2) {
+        memmove(parser->tokens, parser->tokens + drop, sizeof(Token) * (parser->tokenCount - drop));
+        parser->tokenBase  += drop;
+        parser->tokenCount -= drop;
+    } else {
+        pool->capacity *= 2;
+        parser->tokens = (Token*)realloc(parser->tokens, sizeof(Token) * pool->capacity);
+    }
+}
+
+// Reads tokens into the window until it has token 'need', then on ahead while the workers could use more.
+static void readAhead(Parser* parser, uint32_t need) {
+    FunctionPool* pool = parser->functions;
+    while (!pool->scanned) {
+        uint32_t end = parser->tokenBase + parser->tokenCount;
+        if (end > need && (pool->jobCount == pool->taken + pool->window ||
+                           end - parser->next >= PARSE_TOKENS_AHEAD)) break;
+        if (parser->tokenCount == pool->capacity) makeRoom(parser);
+        parser->tokens[parser->tokenCount++] = nextToken(parser->lexer);
+        scanToken(parser, end);
+    }
+}
+
+void initParserParallel(Parser* parser, Lexer* lexer, AST* ast, int threads) {
+    initParser(parser, lexer, ast);
+    if (threads < 2) return;
+
+    FunctionPool* pool = (FunctionPool*)calloc(1, sizeof(FunctionPool));
+    pool->window = (uint32_t)threads * PARSE_JOBS_AHEAD;
+    pool->jobs = (FunctionJob*)calloc(pool->window, sizeof(FunctionJob));
+    pool->source = *parser;
+    pool->interpreter = INTERPRETER;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->parsed, NULL);
+    pthread_cond_init(&pool->moved, NULL);
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, parseWorker, pool) != 0) break;
+        pool->threadCount++;
+    }
+    // Without workers every job would wait forever; parse serially from the lexer.
+    if (pool->threadCount == 0) {
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->parsed);
+        pthread_cond_destroy(&pool->moved);
+        free(pool->threads);
+        free(pool->jobs);
+        free(pool);
+        return;
+    }
+
+    // The window starts with the token initParser() read.
+    pool->capacity = 1024;
+    parser->tokens = (Token*)malloc(sizeof(Token) * pool->capacity);
+    parser->tokens[0]  = parser->current;
+    parser->tokenBase  = 0;
+    parser->tokenCount = 1;
+    parser->next       = 1;
+    parser->functions  = pool;
+    scanToken(parser, 0);
+}
+
+void freeParser(Parser* parser) {
+    FunctionPool* pool = parser->functions;
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->moved);
+        pthread_mutex_unlock(&pool->lock);
+        for (int i = 0; i < pool->threadCount; i++) pthread_join(pool->threads[i], NULL);
+        for (uint32_t i = pool->taken; i < pool->jobCount; i++) {
+            freeAST(&poolJob(pool, i)->ast);
+            free(poolJob(pool, i)->tokens);
+        }
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->parsed);
+        pthread_cond_destroy(&pool->moved);
+        free(pool->threads);
+        free(pool->jobs);
+        free(pool);
+    }
+    free(parser->tokens);
+    free(parser->columns);
+    free(parser->names);
+    parser->functions = NULL;
+    parser->tokens    = NULL;
+    parser->columns   = NULL;
+    parser->names     = NULL;
+}
+
 /*
-    printAST: unchanged from your original
+    printAST: one node per line, indented by depth, children under it
 */
-void printAST(ASTNode* node, int depth) {
-    if (!node) return;
-    for (int i = 0; i < depth; ++i) printf("  ");
-    printf("%s\n", node->token.value);
-    printAST(node->left, depth + 1);
-    printAST(node->right, depth + 1);
-    printAST(node->body, depth + 1);
-    printAST(node->next, depth);
+void printAST(const AST* ast, NodeIndex index, int depth) {
+    ASTWalk walk;
+    walkInit(&walk);
+    walkStart(&walk, index);
+    int leaving;
+    NodeIndex i;
+    char buf[32];
+    while ((i = walkNext(&walk, ast, &leaving))) {
+        if (leaving) continue;
+        for (uint32_t d = 1; d < walk.depth + (uint32_t)depth; ++d) printf("  ");
+        printf("%s\n", tokenText(nodeToken(ast, astNode(ast, i)), buf, sizeof(buf)));
+    }
+    walkFree(&walk);
+}
+
+void printBlock(const AST* ast, BlockIndex block, int depth) {
+    uint32_t count = blockCount(ast, block);
+    const NodeIndex* stmts = blockNodes(ast, block);
+    for (uint32_t i = 0; i < count; i++) {
+        printAST(ast, stmts[i], depth);
+    }
 }
@@ -2,29 +2,8 @@
 #define PARSER_H
 
 #include "token.h"
-
-typedef enum {
-    AST_UNKNOWN,
-    AST_VAR_ASSIGN,
-    AST_FUNC_DEF,
-    AST_RETURN,
-    AST_WHILE_LOOP,
-    AST_IF_STATEMENT,
-    AST_EXPRESSION,
-    AST_PRINT,
-    AST_INPUT,
-    AST_LOOP,     // <-- added
-    AST_BREAK,     // <-- added
-} ASTNodeType;
-
-typedef struct ASTNode {
-    ASTNodeType nodeType;
-    Token       token;   // stores the “main” token for this node (operator, keyword, etc.)
-    struct ASTNode* left;
-    struct ASTNode* right;
-    struct ASTNode* body;   // for blocks (func, if, while)
-    struct ASTNode* next;   // next statement in the same block
-} ASTNode;
+#include "lexer.h"
+#include "ast.h"
 
 typedef struct {
     int line;
@@ -32,15 +11,76 @@ typedef struct {
     char message[128];
 } ParserError;
 
-// Entry point: parse a top‐level block and return the head of a statement list
-ASTNode* parse(Token* tokens);
+typedef struct FunctionPool FunctionPool;
+typedef struct FunctionJob  FunctionJob;
+
+/*
+    The parser is recursive descent, so every open parenthesis, unary
+    operand and statement body costs C stack.  Deeper nesting than this
+    is a parse error instead of a crash; later passes walk the tree
+    without recursion and take any depth.
+*/
+#define PARSER_MAX_NESTING 4096
+
+// The parser pulls tokens from a lexer with one token of lookahead.
+// Nodes are allocated in 'ast'.
+typedef struct {
+    Lexer* lexer;
+    AST*   ast;
+    Token  current;
+    Token*        tokens;      // when parsing from an array instead of 'lexer': tokens[0] is
+    uint32_t      tokenBase;   // token number 'tokenBase' of the input
+    uint32_t*     columns;     // their columns, when the lexer can no longer tell
+    uint32_t      next, tokenCount;     // next: number of the token after 'current'
+    FunctionPool* functions;   // top-level funcs being parsed on other threads
+    FunctionJob*  job;         // on a worker: the func being parsed, see tokenError()
+    Token*        names;       // set by parseImports()
+    uint32_t      nameCount;
+    uint32_t      nesting;     // open parentheses, operands and bodies
+    uint32_t      parallel;    // open parallel for bodies, outside funcs: no 'return' there
+} Parser;
+
+void initParser(Parser* parser, Lexer* lexer, AST* ast);
+/*
+    Same, but top-level function definitions are parsed ahead on 'threads'
+    threads, each into its own arena, and copied into 'ast' when parseNext()
+    gets to them.  Tokens are read into a window that holds what has not
+    been parsed yet and a bounded stretch ahead, where the funcs are found,
+    so memory does not grow with the source.  The workers look back into
+    the source for error columns, so it must be in memory
+    (initLexerString/initLexerParallel).
+*/
+void initParserParallel(Parser* parser, Lexer* lexer, AST* ast, int threads);
+void freeParser(Parser* parser);
+
+/*
+    The "import name;" lines at the top of the file; imports are not
+    statements and make no nodes.  Once there is one, a second lexer pass
+    over the rest of the input collects parser->names for debuggerCheck():
+    the imports, then one identifier token for every name used after them.
+    Returns how many imports there were.
+*/
+int parseImports(Parser* parser);
+
+// Entry point: parse a top‐level block and return its statement list
+BlockIndex parse(Lexer* lexer, AST* ast);
+
+/*
+    Streaming entry point: parse the next top-level statement only, so it
+    can run before the rest of the input has been read.  Returns AST_NONE at
+    end of input or on error (error->message is non-empty then).
+*/
+NodeIndex parseNext(Parser* parser, ParserError* error);
+
+void reportParserError(ParserError* error);
 
-// Utility to print an AST (unchanged from before)
-void printAST(ASTNode* node, int depth);
+// Utility to print an AST
+void printAST(const AST* ast, NodeIndex node, int depth);
+void printBlock(const AST* ast, BlockIndex block, int depth);
 
 // (These are now implemented in parser.c — you don’t need to call them from outside)
-ASTNode* parseBlock(Token** tokens, ParserError* error);
-ASTNode* parseStatement(Token** tokens, ParserError* error);
-ASTNode* parseExpression(Token** tokens, ParserError* error);
+BlockIndex parseBlock(Parser* parser, ParserError* error);
+NodeIndex  parseStatement(Parser* parser, ParserError* error);
+NodeIndex  parseExpression(Parser* parser, ParserError* error);
 
 #endif // PARSER_H
\ No newline at end of file
@@ -0,0 +1,389 @@
+// profile.c
+#include "profile.h"
+#include "token.h"
+#include "interpreter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#endif
+
+#define PROFILE_TOP 20      // rows in the statement and line tables
+
+typedef struct {
+    uint32_t offset;        // source offset of the statement's token: the site's identity
+    uint32_t line;
+    uint32_t function;      // name id, or PROFILE_TOP_LEVEL
+    int      definition;    // the func itself: its count is the number of calls
+    char     label[40];
+    uint64_t count;
+    uint64_t selfTicks;     // excluding nested statements
+    uint64_t totalTicks;    // including them; recursive entries count once
+    uint32_t active;        // entries not left yet
+    uint32_t context;       // of the outermost of them
+} Site;
+
+// A node of the calling-context tree: one site reached through one chain of parents.
+typedef struct {
+    uint32_t site;
+    uint32_t parent;        // context index; 0 is the root
+    uint64_t selfTicks;
+} Context;
+
+typedef struct {
+    uint32_t context;
+    uint64_t start;
+    uint64_t children;      // time spent in nested statements
+    uint64_t overhead;      // time spent in the profiler itself, left out of everything
+} Frame;
+
+struct ProfileState {
+    Site*     sites;
+    uint32_t  siteCount, siteCapacity;
+    uint32_t* siteTable;            // open addressing on offset, site + 1 (0 = empty)
+    uint32_t  siteTableSize;
+
+    Context*  contexts;
+    uint32_t  contextCount, contextCapacity;
+    uint32_t* contextTable;         // open addressing on (parent, site), context + 1
+    uint32_t  contextTableSize;
+
+    Frame*    stack;
+    uint32_t  depth, stackCapacity;
+
+    uint64_t  startTicks, startNs;
+    double    ticksPerNs;
+};
+
+#define PROFILE (INTERPRETER->profile)
+
+ProfileState* profileStateNew(void) {
+    ProfileState* state = (ProfileState*)calloc(1, sizeof(ProfileState));
+    state->ticksPerNs = 1.0;
+    return state;
+}
+
+void profileStateFree(ProfileState* state) {
+    if (!state) return;
+    free(state->sites);
+    free(state->siteTable);
+    free(state->contexts);
+    free(state->contextTable);
+    free(state->stack);
+    free(state);
+}
+
+static uint64_t nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+    Times are kept in ticks of now().  On x86-64 that is the time-stamp
+    counter, several times cheaper to read than the clock, which matters
+    when every statement reads it twice; ticks are converted to time at
+    report time against the clock read when profiling started.
+*/
+#if defined(__x86_64__) && defined(__GNUC__)
+static inline uint64_t now(void) {
+    return __rdtsc();
+}
+#else
+static inline uint64_t now(void) {
+    return nanoseconds();
+}
+#endif
+
+static inline uint32_t hash32(uint64_t key) {
+    key *= 0x9E3779B97F4A7C15ull;
+    return (uint32_t)(key >> 32);
+}
+
+/* -------------------------------------------------------------- sites ---- */
+
+static uint32_t* findSite(uint32_t offset) {
+    ProfileState* state = PROFILE;
+    uint32_t mask = state->siteTableSize - 1;
+    uint32_t i = hash32(offset) & mask;
+    while (state->siteTable[i] && state->sites[state->siteTable[i] - 1].offset != offset) i = (i + 1) & mask;
+    return &state->siteTable[i];
+}
+
+static void growSiteTable(void) {
+    ProfileState* state = PROFILE;
+    free(state->siteTable);
+    state->siteTableSize = state->siteTableSize ? state->siteTableSize * 2 : 256;
+    state->siteTable = (uint32_t*)calloc(state->siteTableSize, sizeof(uint32_t));
+    for (uint32_t s = 0; s < state->siteCount; s++) *findSite(state->sites[s].offset) = s + 1;
+}
+
+static void describe(const AST* ast, const ASTNode* node, char* label, size_t size) {
+    char buf[32];
+    const Token* tok = nodeToken(ast, node);
+    const ASTNode* target = astNode(ast, node->left);
+    if (node->nodeType == AST_FUNC_DEF) {
+        snprintf(label, size, "%s()", stringOf(tok->id));
+    } else if (node->nodeType == AST_VAR_ASSIGN && target) {
+        snprintf(label, size, "%.30s =", tokenText(nodeToken(ast, target), buf, sizeof(buf)));
+    } else if (node->nodeType == AST_REDUCE) {
+        const ASTNode* name = astNode(ast, target->left);
+        snprintf(label, size, "reduce %.30s %s=", tokenText(nodeToken(ast, name), buf, sizeof(buf)),
+                 stringOf(tok->id));
+    } else {
+        snprintf(label, size, "%.30s", tokenText(tok, buf, sizeof(buf)));
+    }
+}
+
+uint32_t profileSite(const AST* ast, NodeIndex stmt, uint32_t function) {
+    ProfileState* state = PROFILE;
+    const ASTNode* node = astNode(ast, stmt);
+    uint32_t offset = nodeToken(ast, node)->offset;
+    if ((state->siteCount + 1) * 2 > state->siteTableSize) growSiteTable();
+    uint32_t* slot = findSite(offset);
+    if (*slot) return *slot - 1;
+
+    if (state->siteCount == state->siteCapacity) {
+        state->siteCapacity = state->siteCapacity ? state->siteCapacity * 2 : 64;
+        state->sites = (Site*)realloc(state->sites, sizeof(Site) * state->siteCapacity);
+    }
+    Site* site = &state->sites[state->siteCount];
+    memset(site, 0, sizeof(*site));
+    site->offset   = offset;
+    site->line     = nodeLine(ast, node);
+    site->function = function;
+    site->definition = node->nodeType == AST_FUNC_DEF;
+    describe(ast, node, site->label, sizeof(site->label));
+    *slot = ++state->siteCount;
+    return state->siteCount - 1;
+}
+
+/* ----------------------------------------------------------- contexts ---- */
+
+static uint32_t* findContext(uint32_t parent, uint32_t site) {
+    ProfileState* state = PROFILE;
+    uint32_t mask = state->contextTableSize - 1;
+    uint32_t i = hash32((uint64_t)parent << 32 | site) & mask;
+    while (state->contextTable[i]) {
+        const Context* c = &state->contexts[state->contextTable[i] - 1];
+        if (c->parent == parent && c->site == site) break;
+        i = (i + 1) & mask;
+    }
+    return &state->contextTable[i];
+}
+
+static uint32_t contextFor(uint32_t parent, uint32_t site) {
+    ProfileState* state = PROFILE;
+    if (state->contextCount == 0) {
+        // Context 0 is the root every top-level statement hangs off.
+        state->contextCapacity = 256;
+        state->contexts = (Context*)malloc(sizeof(Context) * state->contextCapacity);
+        state->contexts[0] = (Context){ PROFILE_TOP_LEVEL, 0, 0 };
+        state->contextCount = 1;
+    }
+    if ((state->contextCount + 1) * 2 > state->contextTableSize) {
+        free(state->contextTable);
+        state->contextTableSize = state->contextTableSize ? state->contextTableSize * 2 : 512;
+        state->contextTable = (uint32_t*)calloc(state->contextTableSize, sizeof(uint32_t));
+        for (uint32_t c = 1; c < state->contextCount; c++) {
+            *findContext(state->contexts[c].parent, state->contexts[c].site) = c + 1;
+        }
+    }
+    uint32_t* slot = findContext(parent, site);
+    if (*slot) return *slot - 1;
+
+    if (state->contextCount == state->contextCapacity) {
+        state->contextCapacity *= 2;
+        state->contexts = (Context*)realloc(state->contexts, sizeof(Context) * state->contextCapacity);
+    }
+    state->contexts[state->contextCount] = (Context){ site, parent, 0 };
+    *slot = ++state->contextCount;
+    return state->contextCount - 1;
+}
+
+/* ------------------------------------------------------------ running ---- */
+
+/*
+    The profiler's own work (from entering it to reading the clock, and from
+    reading the clock to returning) is measured and subtracted from the
+    enclosing statements, or a loop would look expensive just because its
+    body is being profiled.
+*/
+void profileEnter(uint32_t site) {
+    ProfileState* state = PROFILE;
+    if (!state->startNs) {
+        state->startNs = nanoseconds();
+        state->startTicks = now();
+    }
+    uint64_t begin = now();
+    if (state->depth == state->stackCapacity) {
+        state->stackCapacity = state->stackCapacity ? state->stackCapacity * 2 : 64;
+        state->stack = (Frame*)realloc(state->stack, sizeof(Frame) * state->stackCapacity);
+    }
+    uint32_t parent = state->depth ? state->stack[state->depth - 1].context : 0;
+    Frame* frame = &state->stack[state->depth++];
+    // Recursion folds onto the outermost entry of the site, so a call chain
+    // n deep adds no contexts past the first round and the output stays small.
+    if (state->sites[site].active++ == 0) state->sites[site].context = contextFor(parent, site);
+    frame->context  = state->sites[site].context;
+    frame->children = 0;
+    frame->overhead = 0;
+    frame->start = now();
+    if (state->depth > 1) state->stack[state->depth - 2].overhead += frame->start - begin;
+}
+
+void profileLeave(void) {
+    ProfileState* state = PROFILE;
+    uint64_t end = now();
+    Frame* frame = &state->stack[--state->depth];
+    uint64_t elapsed = end - frame->start - frame->overhead;
+    Context* context = &state->contexts[frame->context];
+    Site* site = &state->sites[context->site];
+
+    site->count++;
+    site->selfTicks    += elapsed - frame->children;
+    context->selfTicks += elapsed - frame->children;
+    if (--site->active == 0) site->totalTicks += elapsed;
+    if (state->depth) {
+        Frame* parent = &state->stack[state->depth - 1];
+        parent->children += elapsed;
+        parent->overhead += frame->overhead + (now() - end);
+    }
+}
+
+/* ---------------------------------------------------------- reporting ---- */
+
+typedef struct {
+    uint32_t key;           // line, or function name id
+    uint64_t count;
+    uint64_t selfTicks, totalTicks;
+} Row;
+
+static int bySelfTime(const void* a, const void* b) {
+    uint64_t x = ((const Row*)a)->selfTicks, y = ((const Row*)b)->selfTicks;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static const char* functionName(uint32_t function) {
+    return function == PROFILE_TOP_LEVEL ? "<top level>" : stringOf(function);
+}
+
+static double ms(uint64_t ticks) {
+    ProfileState* state = PROFILE;
+    return ticks / state->ticksPerNs / 1e6;
+}
+
+static double percent(uint64_t ticks, uint64_t total) {
+    return total ? 100.0 * ticks / total : 0.0;
+}
+
+static void writeFolded(const char* path) {
+    ProfileState* state = PROFILE;
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return;
+    }
+    uint32_t* chain = NULL;
+    uint32_t capacity = 0;
+    for (uint32_t c = 1; c < state->contextCount; c++) {
+        if (!state->contexts[c].selfTicks) continue;
+        uint32_t depth = 0;
+        for (uint32_t at = c; at; at = state->contexts[at].parent) {
+            if (depth == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                chain = (uint32_t*)realloc(chain, sizeof(uint32_t) * capacity);
+            }
+            chain[depth++] = at;
+        }
+        while (depth--) {
+            const Site* site = &state->sites[state->contexts[chain[depth]].site];
+            fprintf(out, "%s line %u%s", site->label, site->line, depth ? ";" : "");
+        }
+        fprintf(out, " %llu\n", (unsigned long long)(state->contexts[c].selfTicks / state->ticksPerNs));
+    }
+    free(chain);
+    fclose(out);
+}
+
+void profileReport(FILE* out, const char* foldedPath) {
+    ProfileState* state = PROFILE;
+    if (state->startNs) {
+        uint64_t ticks = now() - state->startTicks, ns = nanoseconds() - state->startNs;
+        if (ticks && ns) state->ticksPerNs = (double)ticks / ns;
+    }
+    uint64_t total = 0;
+    uint32_t maxLine = 0;
+    for (uint32_t s = 0; s < state->siteCount; s++) {
+        total += state->sites[s].selfTicks;
+        if (state->sites[s].line > maxLine) maxLine = state->sites[s].line;
+    }
+    fprintf(out, "\n[PROFILE] %u statements, %.3f ms\n", state->siteCount, ms(total));
+
+    // Statements: the site index rides along in 'key'.
+    Row* rows = (Row*)calloc(state->siteCount + maxLine + 2, sizeof(Row));
+    for (uint32_t s = 0; s < state->siteCount; s++) {
+        rows[s] = (Row){ s, state->sites[s].count, state->sites[s].selfTicks, state->sites[s].totalTicks };
+    }
+    qsort(rows, state->siteCount, sizeof(Row), bySelfTime);
+    fprintf(out, "\n%10s %7s %10s %12s %6s  %-14s %s\n",
+            "self ms", "self %", "total ms", "count", "line", "function", "statement");
+    for (uint32_t i = 0; i < state->siteCount && i < PROFILE_TOP; i++) {
+        const Site* site = &state->sites[rows[i].key];
+        fprintf(out, "%10.3f %6.1f%% %10.3f %12llu %6u  %-14s %s\n",
+                ms(site->selfTicks), percent(site->selfTicks, total), ms(site->totalTicks),
+                (unsigned long long)site->count, site->line,
+                functionName(site->function), site->label);
+    }
+
+    // Lines: every statement starting on the line.
+    Row* lines = rows + state->siteCount;
+    uint32_t lineCount = 0;
+    memset(lines, 0, sizeof(Row) * (maxLine + 1));
+    for (uint32_t s = 0; s < state->siteCount; s++) {
+        Row* row = &lines[state->sites[s].line];
+        row->key        = state->sites[s].line;
+        row->count     += state->sites[s].count;
+        row->selfTicks += state->sites[s].selfTicks;
+    }
+    for (uint32_t line = 0; line <= maxLine; line++) {
+        if (lines[line].count) lines[lineCount++] = lines[line];
+    }
+    qsort(lines, lineCount, sizeof(Row), bySelfTime);
+    fprintf(out, "\n%10s %7s %12s %6s\n", "self ms", "self %", "count", "line");
+    for (uint32_t i = 0; i < lineCount && i < PROFILE_TOP; i++) {
+        fprintf(out, "%10.3f %6.1f%% %12llu %6u\n", ms(lines[i].selfTicks),
+                percent(lines[i].selfTicks, total), (unsigned long long)lines[i].count, lines[i].key);
+    }
+
+    // Functions: self time of their statements; calls and total time from the definition.
+    Row* functions = rows;
+    uint32_t functionCount = 0;
+    for (uint32_t s = 0; s < state->siteCount; s++) {
+        const Site* site = &state->sites[s];
+        uint32_t f = 0;
+        while (f < functionCount && functions[f].key != site->function) f++;
+        if (f == functionCount) functions[functionCount++] = (Row){ site->function, 0, 0, 0 };
+        functions[f].selfTicks += site->selfTicks;
+        if (site->function == PROFILE_TOP_LEVEL) {
+            functions[f].totalTicks += site->totalTicks;
+        } else if (site->definition) {
+            functions[f].count      += site->count;
+            functions[f].totalTicks += site->totalTicks;
+        }
+    }
+    qsort(functions, functionCount, sizeof(Row), bySelfTime);
+    fprintf(out, "\n%10s %7s %10s %12s  %s\n", "self ms", "self %", "total ms", "calls", "function");
+    for (uint32_t i = 0; i < functionCount; i++) {
+        fprintf(out, "%10.3f %6.1f%% %10.3f %12llu  %s\n", ms(functions[i].selfTicks),
+                percent(functions[i].selfTicks, total), ms(functions[i].totalTicks),
+                (unsigned long long)functions[i].count, functionName(functions[i].key));
+    }
+    free(rows);
+
+    if (foldedPath) {
+        writeFolded(foldedPath);
+        fprintf(out, "\nfolded stacks written to %s\n", foldedPath);
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "ast.h"
+#include "interpreter.h"
+#include <stdio.h>
+
+/*
+    Statement profiler (--profile).  Every statement that runs is a site,
+    named by the source offset of its token, so a site outlives the arena
+    the statement was parsed into.  The VM brackets each profiled statement
+    with OP_ENTER/OP_LEAVE (the compiler only emits them with --profile, so
+    a normal run pays nothing); the tree walker calls profileEnter/Leave
+    itself.  Time is wall-clock and kept both per site and per calling
+    context (the chain of statements that led to it) for the folded stacks.
+*/
+
+#define PROFILE_TOP_LEVEL UINT32_MAX   // 'function' of statements outside any func
+
+// The sites and timings of one interpreter (interpreter.h).
+ProfileState* profileStateNew(void);
+void          profileStateFree(ProfileState* state);
+
+// Site of statement 'stmt', registered on first use.  'function' is the
+// name id of the enclosing func (its own name for a func definition).
+uint32_t profileSite(const AST* ast, NodeIndex stmt, uint32_t function);
+void     profileEnter(uint32_t site);
+void     profileLeave(void);
+
+// Hot statements, lines and functions to 'out'; folded stacks (one
+// "frame;frame;... nanoseconds" line per context) to 'foldedPath'.
+void     profileReport(FILE* out, const char* foldedPath);
+
+#endif // PROFILE_H
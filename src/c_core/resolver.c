@@ -0,0 +1,156 @@
+// resolver.c
+#include "resolver.h"
+#include "token.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    One scope per function body: an open-addressing hash table from the
+    identifier's interned name id to its slot.  At run time a variable access
+    is just frame[slot].
+*/
+
+static unsigned hashId(uint32_t id) {
+    return id * 2654435761u;
+}
+
+static void scopeInit(Scope* scope, int capacity) {
+    scope->capacity = capacity;
+    scope->count    = 0;
+    scope->ids      = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    scope->slots    = (int*)malloc(sizeof(int) * capacity);
+    scope->names    = NULL;
+    scope->nameCapacity = 0;
+}
+
+static void scopeFree(Scope* scope) {
+    free(scope->ids);
+    free(scope->slots);
+    free(scope->names);
+}
+
+static void scopeName(Scope* scope, int slot, uint32_t id) {
+    if (slot >= scope->nameCapacity) {
+        while (slot >= scope->nameCapacity) scope->nameCapacity *= 2;
+        scope->names = (uint32_t*)realloc(scope->names, sizeof(uint32_t) * scope->nameCapacity);
+    }
+    scope->names[slot] = id;
+}
+
+static void scopeGrow(Scope* scope) {
+    Scope old = *scope;
+    scopeInit(scope, old.capacity * 2);
+    scope->names        = old.names;
+    scope->nameCapacity = old.nameCapacity;
+    old.names = NULL;
+    for (int i = 0; i < old.capacity; i++) {
+        if (!old.ids[i]) continue;
+        unsigned j = hashId(old.ids[i] - 1) & (scope->capacity - 1);
+        while (scope->ids[j]) j = (j + 1) & (scope->capacity - 1);
+        scope->ids[j]   = old.ids[i];
+        scope->slots[j] = old.slots[i];
+    }
+    scope->count = old.count;
+    scopeFree(&old);
+}
+
+static int scopeSlot(Scope* scope, uint32_t id) {
+    unsigned mask = scope->capacity - 1;
+    unsigned i = hashId(id) & mask;
+    while (scope->ids[i]) {
+        if (scope->ids[i] == id + 1) return scope->slots[i];
+        i = (i + 1) & mask;
+    }
+    if ((scope->count + 1) * 2 > scope->capacity) {
+        scopeGrow(scope);
+        return scopeSlot(scope, id);
+    }
+    scope->ids[i]   = id + 1;
+    scope->slots[i] = scope->count;
+    if (scope->names) scopeName(scope, scope->count, id);
+    return scope->count++;
+}
+
+// Slots no name refers to: a for loop's counter, end and step.
+static int scopeHidden(Scope* scope, int count) {
+    int first = scope->count;
+    scope->count += count;
+    return first;
+}
+
+int isVariableNode(const AST* ast, const ASTNode* node) {
+    return node && node->nodeType == AST_EXPRESSION &&
+           nodeToken(ast, node)->type == TOKEN_IDENTIFIER;
+}
+
+/*
+    One walk over the statement.  A func opens a scope of its own on the way
+    down and closes it on the way up; parameters come before the body in a
+    walk, so they take slots 0 .. n-1.
+*/
+static void resolveTree(AST* ast, NodeIndex root, Scope* globals, Scope* functions) {
+    Scope  small[4];
+    Scope* scopes = small;
+    int    depth = 0, capacity = 4;
+
+    ASTWalk walk;
+    walkInit(&walk);
+    walkStart(&walk, root);
+    int leaving;
+    NodeIndex index;
+    while ((index = walkNext(&walk, ast, &leaving))) {
+        ASTNode* node = astNode(ast, index);
+        if (node->nodeType == AST_FUNC_DEF) {
+            if (leaving) {
+                node->slot = scopes[--depth].count;
+                scopeFree(&scopes[depth]);
+                continue;
+            }
+            if (depth == capacity) {
+                capacity *= 2;
+                if (scopes == small) {
+                    scopes = (Scope*)malloc(sizeof(Scope) * capacity);
+                    memcpy(scopes, small, sizeof(small));
+                } else {
+                    scopes = (Scope*)realloc(scopes, sizeof(Scope) * capacity);
+                }
+            }
+            scopeInit(&scopes[depth++], 16);
+            continue;
+        }
+        if (leaving) continue;
+
+        Scope* scope = depth ? &scopes[depth - 1] : globals;
+        if (isVariableNode(ast, node)) {
+            node->slot = scopeSlot(scope, nodeToken(ast, node)->id);
+        }
+        if (node->nodeType == AST_CALL) {
+            // Bound by index now, so a call never looks its function up by name.
+            node->slot = scopeSlot(functions, nodeToken(ast, node)->id);
+        }
+        if (isForLoop(node)) {
+            node->slot = scopeHidden(scope, 3);
+        }
+    }
+    walkFree(&walk);
+    if (scopes != small) free(scopes);
+}
+
+void initScope(Scope* scope) {
+    scopeInit(scope, 16);
+    scope->nameCapacity = 16;
+    scope->names = (uint32_t*)malloc(sizeof(uint32_t) * scope->nameCapacity);
+}
+
+void freeScope(Scope* scope) {
+    scopeFree(scope);
+}
+
+int resolveStatement(AST* ast, NodeIndex stmt, Scope* globals, Scope* functions) {
+    resolveTree(ast, stmt, globals, functions);
+    return globals->count;
+}
+
+int resolveFunctionName(Scope* functions, uint32_t name) {
+    return scopeSlot(functions, name);
+}
@@ -0,0 +1,40 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "parser.h"
+
+typedef struct {
+    uint32_t* ids;      // name id + 1, 0 = empty
+    int*      slots;
+    int       capacity;
+    int       count;
+    uint32_t* names;    // name id of every named slot, by slot (scopes from initScope())
+    int       nameCapacity;
+} Scope;
+
+/*
+    Assigns every variable a numeric frame slot so the executor can read and
+    write it with an array index instead of a name lookup.
+      - identifiers get node->slot = index into their function's frame;
+        a function's parameters come first, in order
+      - AST_FUNC_DEF nodes get node->slot = number of slots in their frame
+      - AST_CALL nodes get node->slot = index of the called name in
+        'functions', so the call is bound once, whether or not the
+        function has been defined yet
+      - AST_FOR_LOOP and AST_PARALLEL_FOR nodes get node->slot = the
+        first of three slots of their own, named by no variable, for the loop's counter, end and
+        step
+    Top-level statements are resolved one at a time (they may be streamed);
+    'globals' and 'functions' persist across calls so they share one frame
+    and one function table.  Returns the top-level frame size so far.
+*/
+void initScope(Scope* scope);
+void freeScope(Scope* scope);
+int  resolveStatement(AST* ast, NodeIndex stmt, Scope* globals, Scope* functions);
+// Index of function 'name' in 'functions', given on first use.
+int  resolveFunctionName(Scope* functions, uint32_t name);
+
+// True for an identifier used as a variable (read or assignment target).
+int isVariableNode(const AST* ast, const ASTNode* node);
+
+#endif // RESOLVER_H
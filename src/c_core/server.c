@@ -0,0 +1,843 @@
+// server.c
+#define _GNU_SOURCE     // struct ucred
+#include "server.h"
+#include "executor.h"
+#include "optimizer.h"
+#include "interpreter.h"
+#include "io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define REQUEST_MAX_TEXT (1u << 30)   // script path or inline source
+
+// What a client sends, with its stdin, stdout and stderr attached; the
+// script (path or source) follows.  The reply is the int32_t exit status.
+typedef struct {
+    char     magic[4];          // "SPLR"
+    uint32_t flags;             // WIRE_* below
+    uint32_t imports;           // ImportPolicy
+    uint32_t scriptLength;
+} WireRequest;
+
+#define WIRE_INLINE    1u
+#define WIRE_TREE_WALK 2u
+#define WIRE_OPTIMIZE  4u
+#define WIRE_JIT       8u
+
+/* ----------------------------------------------------------- programs ---- */
+
+// One top-level statement with its own copy of the arena it was parsed into.
+typedef struct {
+    AST       view;
+    NodeIndex root;
+} ProgramStatement;
+
+/*
+    A parsed program, ready to run.  The statements are stored the way a
+    .splc cache stores them (optimized, arena by arena), only in memory.  A
+    cached program is parsed in an interpreter of its own, which is freed
+    right after; its strings are kept here and interned again, in the same
+    order, by every interpreter that runs it, where they get the same ids
+    (loadStrings()).  Runs only read a program, so any number of workers
+    can run it at once.
+*/
+typedef struct Program {
+    char*             path;         // NULL for inline source
+    struct timespec   mtime;
+    off_t             size;
+    int               optimized;
+    char*             source;
+    ProgramStatement* statements;
+    uint32_t          count, capacity;
+    uint32_t          nodeCount;    // of all the statements
+    Token*            tokens;       // its imports and the names it uses, for debuggerCheck()
+    uint32_t          tokenCount;
+    ParserError       error;        // set if parsing stopped early
+    char*             strings;      // the strings it interned, one after another
+    uint32_t*         stringEnds;   // where each of them ends in 'strings'
+    uint32_t          firstString, stringCount;
+    int               refs;         // the cache's and one per run, under PROGRAMS_LOCK
+    int               ready;        // parsed, or 'openError' set
+    int               openError;
+    struct Program*   next;
+} Program;
+
+static Program*        PROGRAMS = NULL;
+static pthread_mutex_t PROGRAMS_LOCK   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  PROGRAMS_PARSED = PTHREAD_COND_INITIALIZER;
+
+static void keepStatement(Program* program, const AST* ast, NodeIndex root) {
+    if (program->count == program->capacity) {
+        program->capacity = program->capacity ? program->capacity * 2 : 16;
+        program->statements = (ProgramStatement*)realloc(program->statements,
+                                                         sizeof(ProgramStatement) * program->capacity);
+    }
+    ProgramStatement* s = &program->statements[program->count++];
+    memset(&s->view, 0, sizeof(s->view));
+    s->view.nodes  = (ASTNode*)malloc(sizeof(ASTNode) * ast->nodeCount);
+    s->view.tokens = (Token*)malloc(sizeof(Token) * (ast->tokenCount ? ast->tokenCount : 1));
+    s->view.lists  = (NodeIndex*)malloc(sizeof(NodeIndex) * (ast->listCount ? ast->listCount : 1));
+    memcpy(s->view.nodes, ast->nodes, sizeof(ASTNode) * ast->nodeCount);
+    memcpy(s->view.tokens, ast->tokens, sizeof(Token) * ast->tokenCount);
+    memcpy(s->view.lists, ast->lists, sizeof(NodeIndex) * ast->listCount);
+    s->view.nodeCount  = s->view.nodeCapacity  = ast->nodeCount;
+    s->view.tokenCount = s->view.tokenCapacity = ast->tokenCount;
+    s->view.listCount  = s->view.listCapacity  = ast->listCount;
+    s->root = root;
+    program->nodeCount += ast->nodeCount;
+}
+
+// Parses all of program->source in the current interpreter, as main.c would while running it.
+static void parseProgram(Program* program) {
+    Lexer lexer;
+    AST ast;
+    Parser parser;
+    initLexerString(&lexer, program->source);
+    initAST(&ast);
+    initParser(&parser, &lexer, &ast);
+    memset(&program->error, 0, sizeof(program->error));
+
+    if (parseImports(&parser) > 0) {
+        program->tokenCount = parser.nameCount;
+        program->tokens = (Token*)malloc(sizeof(Token) * parser.nameCount);
+        memcpy(program->tokens, parser.names, sizeof(Token) * parser.nameCount);
+    }
+
+    ASTMark mark = markAST(&ast);
+    NodeIndex stmt;
+    while ((stmt = parseNext(&parser, &program->error)) != AST_NONE) {
+        if (program->optimized) optimizeStatement(&ast, stmt);
+        keepStatement(program, &ast, stmt);
+        releaseAST(&ast, mark);
+    }
+
+    freeParser(&parser);
+    freeAST(&ast);
+    freeLexer(&lexer);
+}
+
+// Copies out the strings interned since program->firstString.
+static void keepStrings(Program* program) {
+    uint32_t count = stringCount();
+    size_t size = 0;
+    for (uint32_t id = program->firstString; id < count; id++) size += stringLength(id);
+    program->stringCount = count - program->firstString;
+    program->strings = (char*)malloc(size ? size : 1);
+    program->stringEnds = (uint32_t*)malloc(sizeof(uint32_t) * (program->stringCount ? program->stringCount : 1));
+    size = 0;
+    for (uint32_t i = 0; i < program->stringCount; i++) {
+        uint32_t id = program->firstString + i;
+        memcpy(program->strings + size, stringOf(id), stringLength(id));
+        size += stringLength(id);
+        program->stringEnds[i] = (uint32_t)size;
+    }
+}
+
+// Interns the program's strings in the current interpreter; 0 if they do not get their ids.
+static int loadStrings(const Program* program) {
+    if (stringCount() != program->firstString) return 0;
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < program->stringCount; i++) {
+        uint32_t end = program->stringEnds[i];
+        if (intern(program->strings + start, end - start) != program->firstString + i) return 0;
+        start = end;
+    }
+    return 1;
+}
+
+// A cached program is parsed in a fresh interpreter, which only its strings outlive.
+static void parseCached(Program* program) {
+    Interpreter* previous = INTERPRETER;
+    Interpreter* interpreter = interpreterNew();
+    interpreterEnter(interpreter);
+    program->firstString = stringCount();
+    parseProgram(program);
+    keepStrings(program);
+    interpreterFree(interpreter);
+    interpreterEnter(previous);
+}
+
+static void freeProgram(Program* program) {
+    for (uint32_t i = 0; i < program->count; i++) {
+        freeAST(&program->statements[i].view);
+    }
+    free(program->statements);
+    free(program->tokens);
+    free(program->strings);
+    free(program->stringEnds);
+    free(program->source);
+    free(program->path);
+    free(program);
+}
+
+// Under PROGRAMS_LOCK.
+static void dropProgram(Program* program) {
+    if (--program->refs == 0) freeProgram(program);
+}
+
+static void unlinkProgram(Program* program) {
+    for (Program** link = &PROGRAMS; *link; link = &(*link)->next) {
+        if (*link != program) continue;
+        *link = program->next;
+        dropProgram(program);
+        return;
+    }
+}
+
+static void releaseProgram(Program* program) {
+    pthread_mutex_lock(&PROGRAMS_LOCK);
+    dropProgram(program);
+    pthread_mutex_unlock(&PROGRAMS_LOCK);
+}
+
+// Reads the file into program->source; 0 with errno set if it cannot be read.
+static int readProgram(Program* program, struct stat* st) {
+    int fd = open(program->path, O_RDONLY);
+    if (fd < 0) return 0;
+    // The times of what is actually read; a change while reading shows next time.
+    if (fstat(fd, st) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return 0;
+    }
+    char* source = (char*)malloc((size_t)st->st_size + 1);
+    size_t length = 0;
+    ssize_t got;
+    while (length < (size_t)st->st_size &&
+           (got = read(fd, source + length, (size_t)st->st_size - length)) > 0) {
+        length += (size_t)got;
+    }
+    close(fd);
+    source[length] = '\0';
+    program->source = source;
+    return 1;
+}
+
+/*
+    The parsed program at 'path', parsed again if the file changed since it
+    was cached, with a reference the caller gives back with
+    releaseProgram().  NULL with errno set if it cannot be read.  Workers
+    that ask for a program while another one parses it wait for that one;
+    runs still under way keep an old version until they are done.
+*/
+static Program* acquireProgram(const char* path, int optimized) {
+    struct stat st;
+    if (stat(path, &st) != 0) return NULL;
+
+    pthread_mutex_lock(&PROGRAMS_LOCK);
+    for (Program* program = PROGRAMS; program; program = program->next) {
+        if (program->optimized != optimized || strcmp(program->path, path) != 0) continue;
+        if (program->size == st.st_size &&
+            program->mtime.tv_sec == st.st_mtim.tv_sec &&
+            program->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            program->refs++;
+            while (!program->ready) pthread_cond_wait(&PROGRAMS_PARSED, &PROGRAMS_LOCK);
+            int error = program->openError;
+            if (error) dropProgram(program);
+            pthread_mutex_unlock(&PROGRAMS_LOCK);
+            if (!error) return program;
+            errno = error;
+            return NULL;
+        }
+        unlinkProgram(program);
+        break;
+    }
+    Program* program = (Program*)calloc(1, sizeof(Program));
+    program->path = strdup(path);
+    program->mtime = st.st_mtim;
+    program->size = st.st_size;
+    program->optimized = optimized;
+    program->refs = 2;
+    program->next = PROGRAMS;
+    PROGRAMS = program;
+    pthread_mutex_unlock(&PROGRAMS_LOCK);
+
+    // Parsed outside the lock, so that other programs need not wait for this one.
+    int error = 0;
+    if (readProgram(program, &st)) {
+        parseCached(program);
+    } else {
+        error = errno;
+    }
+
+    pthread_mutex_lock(&PROGRAMS_LOCK);
+    program->ready = 1;
+    if (error) {
+        program->openError = error;
+        unlinkProgram(program);
+        dropProgram(program);
+    } else {
+        program->mtime = st.st_mtim;
+        program->size = st.st_size;
+    }
+    pthread_cond_broadcast(&PROGRAMS_PARSED);
+    pthread_mutex_unlock(&PROGRAMS_LOCK);
+    if (!error) return program;
+    errno = error;
+    return NULL;
+}
+
+/*
+    Runs a parsed program in the current interpreter, like main.c does a
+    cached one.  Resolving writes frame slots into the nodes (resolver.h),
+    so the run gets its own copy of them; tokens and lists are only read.
+*/
+static int runProgram(const Program* program, const WireRequest* request) {
+    set_tree_walk_mode((request->flags & WIRE_TREE_WALK) != 0);
+    set_jit_mode((request->flags & WIRE_JIT) != 0);
+    // Statements were optimized when they were parsed.
+    set_optimize_mode(0);
+
+    int aborted = 0;
+    if (program->tokens) {
+        aborted = debuggerCheck(program->tokens, (int)program->tokenCount, (ImportPolicy)request->imports) < 0;
+    }
+    AST* views = (AST*)malloc(sizeof(AST) * (program->count ? program->count : 1));
+    ASTNode* nodes = (ASTNode*)malloc(sizeof(ASTNode) * (program->nodeCount ? program->nodeCount : 1));
+    ASTNode* next = nodes;
+    for (uint32_t i = 0; !aborted && !interpreterCancelled() && i < program->count; i++) {
+        const ProgramStatement* s = &program->statements[i];
+        views[i] = s->view;
+        views[i].nodes = next;
+        memcpy(next, s->view.nodes, sizeof(ASTNode) * s->view.nodeCount);
+        next += s->view.nodeCount;
+        execute_statement(&views[i], s->root);
+    }
+    execute_finish();
+    ioFlush();
+    free(nodes);
+    free(views);
+
+    if (aborted) {
+        fprintf(ioErr(), "[FATAL] Unused imports. Execution aborted.\n");
+        return 1;
+    }
+    if (interpreterCancelled()) {
+        fprintf(ioErr(), "[FATAL] Cancelled: the client went away or the server is stopping.\n");
+        return 1;
+    }
+    if (strlen(program->error.message) > 0) {
+        reportParserError((ParserError*)&program->error);
+        fprintf(ioErr(), "[FATAL] Parser failed. Execution aborted.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------- wiring ---- */
+
+static int readAll(int fd, void* data, size_t size) {
+    char* p = (char*)data;
+    while (size) {
+        ssize_t got = read(fd, p, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 0;
+        p += got;
+        size -= (size_t)got;
+    }
+    return 1;
+}
+
+static int writeAll(int fd, const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size) {
+        ssize_t put = write(fd, p, size);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return 0;
+        p += put;
+        size -= (size_t)put;
+    }
+    return 1;
+}
+
+#define MAX_PASSED_FDS 4
+
+typedef union {
+    struct cmsghdr header;
+    char           space[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+} FdControl;
+
+// 'size' bytes of 'data' with 'count' descriptors attached.
+static int sendWithFds(int socket, const void* data, size_t size, const int* fds, int count) {
+    FdControl control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { (void*)data, size };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    ssize_t put;
+    do {
+        put = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (put < 0 && errno == EINTR);
+    if (put <= 0) return 0;
+    return writeAll(socket, (const char*)data + put, size - (size_t)put);
+}
+
+// The other end of sendWithFds(); exactly 'count' descriptors or nothing.
+static int receiveWithFds(int socket, void* data, size_t size, int* fds, int count) {
+    FdControl control;
+    struct iovec iov = { data, size };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+
+    ssize_t got;
+    do {
+        got = recvmsg(socket, &message, 0);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) return 0;
+
+    // Anything but one message of exactly 'count' descriptors is refused,
+    // and every descriptor that did come along is closed.
+    int accepted = 0;
+    int valid = !(message.msg_flags & MSG_CTRUNC);
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        if (!accepted && valid && cmsg->cmsg_len == CMSG_LEN(sizeof(int) * count)) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+            accepted = 1;
+            continue;
+        }
+        valid = 0;
+        for (int i = 0; i < received; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+            close(fd);
+        }
+    }
+    if (accepted && valid &&
+        readAll(socket, (char*)data + got, size - (size_t)got)) {
+        return 1;
+    }
+    if (accepted) {
+        for (int i = 0; i < count; i++) close(fds[i]);
+    }
+    return 0;
+}
+
+static char* receiveText(int socket, uint32_t length) {
+    char* text = (char*)malloc((size_t)length + 1);
+    if (!readAll(socket, text, length)) {
+        free(text);
+        return NULL;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+/* ------------------------------------------------------------ workers ---- */
+
+// Runs a request in the current interpreter; returns its exit status.
+static int runRequest(const WireRequest* request, const Program* program, const char* script, int openError) {
+    if (request->flags & WIRE_INLINE) {
+        // Inline source is not cached: it is parsed right in the interpreter it runs in.
+        Program* parsed = (Program*)calloc(1, sizeof(Program));
+        parsed->optimized = (request->flags & WIRE_OPTIMIZE) != 0;
+        parsed->source = strdup(script);
+        parseProgram(parsed);
+        int status = runProgram(parsed, request);
+        freeProgram(parsed);
+        return status;
+    }
+    if (!program) {
+        fprintf(ioErr(), "Failed to open file: %s\n", strerror(openError));
+        return 1;
+    }
+    if (!loadStrings(program)) {
+        fprintf(ioErr(), "[FATAL] %s: strings out of order. Execution aborted.\n", program->path);
+        return 1;
+    }
+    return runProgram(program, request);
+}
+
+static void startRun(int worker, int connection, Interpreter* interpreter);
+static void endRun(int worker);
+
+/*
+    Reads the request on 'connection', runs it on a fresh interpreter and
+    sends the client its exit status.  A client sends everything at once;
+    one that does not holds up this worker, for at most the timeout, and
+    nobody else.  The run itself is cancelled if the client hangs up or the
+    server stops (startRun()).
+*/
+static void serveConnection(int worker, int connection) {
+    struct timeval timeout = { 5, 0 };
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    WireRequest request;
+    int fds[3];
+    if (!receiveWithFds(connection, &request, sizeof(request), fds, 3)) return;
+    char* script = NULL;
+    if (memcmp(request.magic, "SPLR", 4) != 0 || request.scriptLength > REQUEST_MAX_TEXT ||
+        !(script = receiveText(connection, request.scriptLength))) {
+        for (int i = 0; i < 3; i++) close(fds[i]);
+        return;
+    }
+
+    Program* program = NULL;
+    int openError = 0;
+    if (!(request.flags & WIRE_INLINE) &&
+        !(program = acquireProgram(script, (request.flags & WIRE_OPTIMIZE) != 0))) {
+        openError = errno;
+    }
+
+    // The program reads the client's stdin and writes its stdout and stderr itself.
+    FILE* out = fdopen(fds[1], "w");
+    FILE* err = fdopen(fds[2], "w");
+    int32_t status = 1;
+    if (out && err) {
+        setvbuf(err, NULL, _IONBF, 0);
+        Interpreter* interpreter = interpreterNew();
+        interpreterEnter(interpreter);
+        ioRedirect(out, err, fds[0]);
+        startRun(worker, connection, interpreter);
+        status = runRequest(&request, program, script, openError);
+        ioFlush();
+        endRun(worker);
+        interpreterFree(interpreter);
+    }
+    if (out) fclose(out); else close(fds[1]);
+    if (err) fclose(err); else close(fds[2]);
+    close(fds[0]);
+    if (program) releaseProgram(program);
+    free(script);
+    writeAll(connection, &status, sizeof(status));
+}
+
+/*
+    A worker's run, for the accept loop to cancel (interpreter.h): the loop
+    polls the connection, and a client that hangs up (POLLHUP) has nobody
+    left to run for.  'serial' tells one run on a worker from the next, so
+    that a descriptor number the loop polled after its run was over cancels
+    nothing.
+*/
+typedef struct {
+    int          connection;    // -1 between runs
+    Interpreter* interpreter;
+    unsigned     serial;
+    int          cancelled;     // no need to poll it any more
+} Run;
+
+/*
+    Connections the accept loop has taken that no worker has yet: at most
+    one per worker, so that any more wait in the listen queue.  Also the
+    runs under way, one slot per worker.
+*/
+typedef struct {
+    int*            connections;    // a ring of 'capacity'
+    int             capacity, first, count;
+    int             closing;        // the server is stopping: no more will come
+    Run*            runs;           // 'capacity' of them
+    pthread_mutex_t lock;
+    pthread_cond_t  ready;
+} ConnectionQueue;
+
+static ConnectionQueue QUEUE = { NULL, 0, 0, 0, 0, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static int WAKE[2] = { -1, -1 };        // written by the signal handlers and the workers, polled by the loop
+static volatile sig_atomic_t STOPPING = 0;
+
+static void wakeLoop(void) {
+    if (write(WAKE[1], "", 1) < 0) {
+        // The pipe is full: the loop will wake up anyway.
+    }
+}
+
+static void onSignal(int signal) {
+    (void)signal;
+    int saved = errno;
+    STOPPING = 1;
+    wakeLoop();
+    errno = saved;
+}
+
+static void handle(int signal, void (*handler)(int)) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(signal, &action, NULL);
+}
+
+// Once the server is stopping, a run is cancelled as soon as it starts.
+static void startRun(int worker, int connection, Interpreter* interpreter) {
+    pthread_mutex_lock(&QUEUE.lock);
+    Run* run = &QUEUE.runs[worker];
+    run->connection = connection;
+    run->interpreter = interpreter;
+    run->serial++;
+    run->cancelled = QUEUE.closing;
+    if (run->cancelled) interpreterCancel(interpreter);
+    pthread_mutex_unlock(&QUEUE.lock);
+    // The loop polls the connections it knew of when it went to sleep.
+    wakeLoop();
+}
+
+static void endRun(int worker) {
+    pthread_mutex_lock(&QUEUE.lock);
+    QUEUE.runs[worker].connection = -1;
+    QUEUE.runs[worker].interpreter = NULL;
+    pthread_mutex_unlock(&QUEUE.lock);
+}
+
+// Under QUEUE.lock.
+static void cancelRun(Run* run) {
+    run->cancelled = 1;
+    if (run->interpreter) interpreterCancel(run->interpreter);
+}
+
+static void* serveWorker(void* arg) {
+    int worker = (int)(intptr_t)arg;
+    pthread_mutex_lock(&QUEUE.lock);
+    for (;;) {
+        while (QUEUE.count == 0 && !QUEUE.closing) pthread_cond_wait(&QUEUE.ready, &QUEUE.lock);
+        if (QUEUE.count == 0) break;
+        int connection = QUEUE.connections[QUEUE.first];
+        QUEUE.first = (QUEUE.first + 1) % QUEUE.capacity;
+        // The loop stops listening while the queue is full.
+        if (QUEUE.count-- == QUEUE.capacity) wakeLoop();
+        pthread_mutex_unlock(&QUEUE.lock);
+
+        serveConnection(worker, connection);
+        close(connection);
+
+        pthread_mutex_lock(&QUEUE.lock);
+    }
+    pthread_mutex_unlock(&QUEUE.lock);
+    return NULL;
+}
+
+// Programs run as the server's user, so nobody else gets to send them.
+static int trustedPeer(int connection) {
+    struct ucred peer;
+    socklen_t size = sizeof(peer);
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &size) != 0) return 0;
+    if (peer.uid == getuid()) return 1;
+    fprintf(stderr, "[SERVE] refused a connection from uid %u\n", (unsigned)peer.uid);
+    return 0;
+}
+
+/* ------------------------------------------------------------- server ---- */
+
+int serveForever(const char* socketPath, int workerCount) {
+    if (workerCount < 1) workerCount = 1;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", socketPath);
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+    unlink(socketPath);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 128) != 0) {
+        perror(socketPath);
+        close(listener);
+        return 1;
+    }
+
+    if (pipe(WAKE) != 0) {
+        perror("pipe");
+        close(listener);
+        unlink(socketPath);
+        return 1;
+    }
+    fcntl(WAKE[0], F_SETFL, O_NONBLOCK);
+    fcntl(WAKE[1], F_SETFL, O_NONBLOCK);
+    handle(SIGINT, onSignal);
+    handle(SIGTERM, onSignal);
+    // A client that hung up must not take the server with it.
+    handle(SIGPIPE, SIG_IGN);
+
+    QUEUE.connections = (int*)malloc(sizeof(int) * workerCount);
+    QUEUE.runs = (Run*)calloc(workerCount, sizeof(Run));
+    for (int i = 0; i < workerCount; i++) QUEUE.runs[i].connection = -1;
+    QUEUE.capacity = workerCount;
+    // The wake pipe, the listener and the connections of the runs under way.
+    struct pollfd* polls = (struct pollfd*)malloc(sizeof(struct pollfd) * (workerCount + 2));
+    int* polled = (int*)malloc(sizeof(int) * workerCount);              // their workers
+    unsigned* serials = (unsigned*)malloc(sizeof(unsigned) * workerCount);
+    // SIGINT and SIGTERM are for the loop below: the workers start with them blocked.
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    pthread_t* pool = (pthread_t*)malloc(sizeof(pthread_t) * workerCount);
+    int started = 0;
+    while (started < workerCount &&
+           pthread_create(&pool[started], NULL, serveWorker, (void*)(intptr_t)started) == 0) {
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (started == 0) {
+        fprintf(stderr, "Error: could not start a worker thread\n");
+        STOPPING = 1;
+    } else {
+        fprintf(stderr, "[SERVE] %s, %d workers\n", socketPath, started);
+    }
+
+    // The loop accepts, and cancels the runs whose client hung up; reading,
+    // parsing and running a request is a worker's.
+    while (!STOPPING) {
+        pthread_mutex_lock(&QUEUE.lock);
+        int listening = QUEUE.count < QUEUE.capacity;
+        int count = 2;
+        for (int i = 0; i < QUEUE.capacity; i++) {
+            const Run* run = &QUEUE.runs[i];
+            if (run->connection < 0 || run->cancelled) continue;
+            polled[count - 2] = i;
+            serials[count - 2] = run->serial;
+            polls[count].fd = run->connection;
+            polls[count].events = 0;        // POLLHUP comes anyway
+            polls[count].revents = 0;
+            count++;
+        }
+        pthread_mutex_unlock(&QUEUE.lock);
+        polls[0].fd = WAKE[0];
+        polls[0].events = POLLIN;
+        polls[0].revents = 0;
+        // Not listening leaves the listener out of the poll, not the runs.
+        polls[1].fd = listening ? listener : -1;
+        polls[1].events = POLLIN;
+        polls[1].revents = 0;
+        int ready = poll(polls, count, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        char drain[64];
+        while (read(WAKE[0], drain, sizeof(drain)) > 0) {}
+
+        pthread_mutex_lock(&QUEUE.lock);
+        for (int i = 2; i < count; i++) {
+            Run* run = &QUEUE.runs[polled[i - 2]];
+            if ((polls[i].revents & (POLLHUP | POLLERR)) && run->serial == serials[i - 2] &&
+                run->connection >= 0 && !run->cancelled) {
+                cancelRun(run);
+            }
+        }
+        pthread_mutex_unlock(&QUEUE.lock);
+        if (!(polls[1].revents & POLLIN)) continue;
+
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) continue;
+        if (!trustedPeer(connection)) {
+            close(connection);
+            continue;
+        }
+        pthread_mutex_lock(&QUEUE.lock);
+        QUEUE.connections[(QUEUE.first + QUEUE.count++) % QUEUE.capacity] = connection;
+        pthread_cond_signal(&QUEUE.ready);
+        pthread_mutex_unlock(&QUEUE.lock);
+    }
+
+    // Runs under way are cancelled, and so are the requests already accepted,
+    // as soon as they start: their clients get a status, and the workers can be joined.
+    close(listener);
+    unlink(socketPath);
+    pthread_mutex_lock(&QUEUE.lock);
+    QUEUE.closing = 1;
+    for (int i = 0; i < QUEUE.capacity; i++) {
+        if (QUEUE.runs[i].connection >= 0) cancelRun(&QUEUE.runs[i]);
+    }
+    pthread_cond_broadcast(&QUEUE.ready);
+    pthread_mutex_unlock(&QUEUE.lock);
+    for (int i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    free(pool);
+    free(polls);
+    free(polled);
+    free(serials);
+    free(QUEUE.connections);
+    free(QUEUE.runs);
+    close(WAKE[0]);
+    close(WAKE[1]);
+    return started ? 0 : 1;
+}
+
+/* ------------------------------------------------------------- client ---- */
+
+int serveClient(const char* socketPath, const ServeRequest* request) {
+    // The server has its own working directory: scripts go by absolute path.
+    char* script;
+    if (request->inlineSource) {
+        script = strdup(request->script);
+    } else if (!(script = realpath(request->script, NULL))) {
+        perror("Failed to open file");
+        return 1;
+    }
+
+    WireRequest wire;
+    memset(&wire, 0, sizeof(wire));
+    memcpy(wire.magic, "SPLR", 4);
+    wire.flags = (request->inlineSource ? WIRE_INLINE : 0) |
+                 (request->treeWalk ? WIRE_TREE_WALK : 0) |
+                 (request->optimize ? WIRE_OPTIMIZE : 0) |
+                 (request->jit ? WIRE_JIT : 0);
+    wire.imports = (uint32_t)request->imports;
+    wire.scriptLength = (uint32_t)strlen(script);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    int connection = -1;
+    int status = 1;
+    int32_t code;
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    if (strlen(socketPath) >= sizeof(address.sun_path) || strlen(script) > REQUEST_MAX_TEXT) {
+        fprintf(stderr, "Error: request too large for %s\n", socketPath);
+        goto done;
+    }
+    strcpy(address.sun_path, socketPath);
+    connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error: no server at %s: %s\n", socketPath, strerror(errno));
+        goto done;
+    }
+    if (!sendWithFds(connection, &wire, sizeof(wire), fds, 3) ||
+        !writeAll(connection, script, wire.scriptLength)) {
+        fprintf(stderr, "Error: could not send the request to %s\n", socketPath);
+        goto done;
+    }
+    if (!readAll(connection, &code, sizeof(code))) {
+        fprintf(stderr, "Error: %s closed the connection\n", socketPath);
+        goto done;
+    }
+    status = code;
+
+done:
+    if (connection >= 0) close(connection);
+    free(script);
+    return status;
+}
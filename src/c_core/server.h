@@ -0,0 +1,46 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "debugger.h"
+
+/*
+    Resident interpreter (--serve) and its front end (--client).
+
+    The server listens on a Unix domain socket and keeps every script it
+    has been asked to run parsed and optimized in memory, keyed by path,
+    modification time and size, so a request for an unchanged script skips
+    reading, lexing and parsing altogether.  It only takes connections from
+    its own user (SO_PEERCRED) and hands them to a pool of 'workers'
+    threads; the accept loop does nothing else, so a slow client holds up
+    one worker and no one else.  A worker reads the request, finds or
+    parses the program and runs it in the server's process on a fresh
+    interpreter (interpreter.h), which it frees afterwards: nothing a run
+    does leaks into the next one.  At most 'workers' requests run at once;
+    further connections wait in the listen queue.
+
+    The client passes its stdin, stdout and stderr along with the request
+    (SCM_RIGHTS), so the program reads and writes them directly: output
+    streams to wherever the client's goes, input can be a terminal, and
+    nothing is copied through the server.  The socket then carries back the
+    exit status.  While a request runs, the accept loop polls its
+    connection: a client that goes away has its run cancelled
+    (interpreter.h), and stopping the server cancels all of them, so a
+    script that never ends holds a worker only as long as its client
+    waits.  A cancelled run exits with status 1.
+*/
+
+typedef struct {
+    const char*  script;        // path of the program, or its text with 'inlineSource'
+    int          inlineSource;  // -e: run 'script' itself (parsed for this run, not cached)
+    int          treeWalk;
+    int          optimize;
+    int          jit;
+    ImportPolicy imports;
+} ServeRequest;
+
+// Serves until SIGINT or SIGTERM; returns the process exit status.
+int serveForever(const char* socketPath, int workers);
+// Runs 'request' on the server at 'socketPath'; returns the program's exit status.
+int serveClient(const char* socketPath, const ServeRequest* request);
+
+#endif // SERVER_H
@@ -0,0 +1,593 @@
+// task.c
+#include "task.h"
+#include "vm.h"
+#include "io.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define CHANNEL_BLOCK  1024     // channels per block of the handle table
+#define CHANNEL_BLOCKS 4096     // blocks, so handles go up to 4M
+
+/*
+    A worker's runnable tasks.  The worker pushes and pops at the newest
+    end, thieves take the oldest; a small lock per deque is enough, as a
+    task runs far longer than it takes to hand it over.
+*/
+typedef struct {
+    pthread_mutex_t lock;
+    Task**          tasks;      // a ring of 'capacity'
+    size_t          first, count, capacity;
+} Deque;
+
+typedef struct {
+    TaskState* state;
+    pthread_t  thread;
+    Deque      deque;
+    unsigned   seed;            // where the next steal starts
+} Worker;
+
+struct Channel {
+    pthread_mutex_t lock;
+    Value*          buffer;     // a ring of 'size' values, grown up to 'capacity'
+    uint32_t        capacity, size, first, count;
+    Waiter*         senders;    // waiting, oldest first
+    Waiter*         lastSender;
+    Waiter*         receivers;
+    Waiter*         lastReceiver;
+};
+
+/*
+    'lock' guards the counts, the list of live tasks and the sleeping
+    workers.  'active' counts the tasks that are queued or running: when it
+    drops to 0 while some are still live, they all wait on channels and
+    only the main program could wake them.  'blocked' counts the workers
+    whose task waits with its thread (a parallel for's chunk run inline):
+    still active, but stuck until a task or the main program wakes them.
+    'epoch' moves on with every task made runnable, so a worker that found
+    nothing can tell whether it may go to sleep.
+*/
+struct TaskState {
+    pthread_mutex_t lock;
+    pthread_cond_t  work;           // a task was made runnable
+    pthread_cond_t  wake;           // for the main program: woken, a task is done, or none active
+    Interpreter*    interpreter;
+    int             threads;        // to start; < 1: one per core
+    Worker*         workers;
+    int             workerCount;
+    int             started;        // threads running, to join
+    Deque           injected;       // spawned by the main program
+    unsigned        epoch;
+    int             sleeping;
+    int             stop;
+    int             live;
+    int             active;
+    Task*           tasks;          // the live ones
+    int             mainWaiting;
+    int             blocked;
+
+    Channel**       channels[CHANNEL_BLOCKS];
+    int32_t         channelCount;
+    int             warned;         // about a value that is not a channel
+};
+
+// The chunks of a parallel for that are not done yet.
+typedef struct TaskGroup {
+    int remaining;
+} TaskGroup;
+
+#define TASKS (INTERPRETER->tasks)
+
+static _Thread_local Worker* WORKER = NULL;
+
+/* ---- deques ---- */
+
+static void dequeInit(Deque* deque) {
+    memset(deque, 0, sizeof(Deque));
+    pthread_mutex_init(&deque->lock, NULL);
+}
+
+static void dequeFree(Deque* deque) {
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->tasks);
+}
+
+static void dequePush(Deque* deque, Task* task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        Task** tasks = (Task**)malloc(sizeof(Task*) * capacity);
+        for (size_t i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->first + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->first = 0;
+        deque->capacity = capacity;
+    }
+    deque->tasks[(deque->first + deque->count++) % deque->capacity] = task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// The newest task, for the worker that owns the deque.
+static Task* dequePop(Deque* deque) {
+    pthread_mutex_lock(&deque->lock);
+    Task* task = NULL;
+    if (deque->count) task = deque->tasks[(deque->first + --deque->count) % deque->capacity];
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+// The oldest task, for everybody else.
+static Task* dequeSteal(Deque* deque) {
+    pthread_mutex_lock(&deque->lock);
+    Task* task = NULL;
+    if (deque->count) {
+        task = deque->tasks[deque->first];
+        deque->first = (deque->first + 1) % deque->capacity;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/* ---- scheduling ---- */
+
+// Queues 'task' where it will run soonest; under the state's lock.
+static void makeRunnable(TaskState* state, Task* task) {
+    state->active++;
+    Worker* worker = WORKER;
+    dequePush(worker && worker->state == state ? &worker->deque : &state->injected, task);
+    __atomic_add_fetch(&state->epoch, 1, __ATOMIC_RELEASE);
+    if (state->sleeping) pthread_cond_signal(&state->work);
+}
+
+// Waiter.wake of a parked task: it goes back on a deque.
+static void taskReady(Waiter* waiter) {
+    TaskState* state = (TaskState*)waiter->owner;
+    Task* task = (Task*)((char*)waiter - offsetof(Task, wait));
+    pthread_mutex_lock(&state->lock);
+    makeRunnable(state, task);
+    pthread_mutex_unlock(&state->lock);
+}
+
+// Own tasks first, then the main program's, then another worker's.
+static Task* findTask(TaskState* state, Worker* worker) {
+    Task* task = dequePop(&worker->deque);
+    if (!task) task = dequeSteal(&state->injected);
+    for (int i = 0; !task && i < state->workerCount; i++) {
+        Worker* victim = &state->workers[(worker->seed + i) % state->workerCount];
+        if (victim != worker) task = dequeSteal(&victim->deque);
+    }
+    worker->seed = worker->seed * 1103515245u + 12345u;
+    return task;
+}
+
+// Whoever waits on 'wake' has something to look at; under the state's lock.
+static int worthWaking(const TaskState* state) {
+    return state->active <= state->blocked || state->live == 0;
+}
+
+/*
+    After a task ran until it finished ('done') or parked.  A finished
+    chunk of a parallel for leaves its group and stays with taskRunAll(),
+    which frees it.
+*/
+static void taskStopped(TaskState* state, Task* task, int done) {
+    pthread_mutex_lock(&state->lock);
+    TaskGroup* group = done ? task->group : NULL;
+    if (group) {
+        task->group = NULL;
+        group->remaining--;
+    } else if (done) {
+        if (task->prev) task->prev->next = task->next;
+        else state->tasks = task->next;
+        if (task->next) task->next->prev = task->prev;
+        __atomic_store_n(&state->live, state->live - 1, __ATOMIC_RELEASE);
+    }
+    state->active--;
+    if ((state->mainWaiting || state->blocked) && (group || worthWaking(state))) {
+        pthread_cond_broadcast(&state->wake);
+    }
+    pthread_mutex_unlock(&state->lock);
+    if (done && !group) vm_task_free(task);
+}
+
+static void* workerMain(void* arg) {
+    Worker* worker = (Worker*)arg;
+    TaskState* state = worker->state;
+    interpreterEnter(state->interpreter);
+    WORKER = worker;
+    for (;;) {
+        unsigned epoch = __atomic_load_n(&state->epoch, __ATOMIC_ACQUIRE);
+        Task* task = findTask(state, worker);
+        if (task) {
+            taskStopped(state, task, vm_resume(task));
+            continue;
+        }
+        // Nothing anywhere: sleep until something is queued after the search started.
+        pthread_mutex_lock(&state->lock);
+        while (!state->stop && __atomic_load_n(&state->epoch, __ATOMIC_ACQUIRE) == epoch) {
+            state->sleeping++;
+            pthread_cond_wait(&state->work, &state->lock);
+            state->sleeping--;
+        }
+        int stop = state->stop;
+        pthread_mutex_unlock(&state->lock);
+        if (stop) break;
+    }
+    WORKER = NULL;
+    interpreterEnter(NULL);
+    return NULL;
+}
+
+// Under the state's lock.
+static void startWorkers(TaskState* state) {
+    int threads = state->threads > 0 ? state->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    state->interpreter = INTERPRETER;
+    state->workers = (Worker*)calloc(threads, sizeof(Worker));
+    for (int i = 0; i < threads; i++) {
+        Worker* worker = &state->workers[i];
+        worker->state = state;
+        worker->seed  = (unsigned)i;
+        dequeInit(&worker->deque);
+    }
+    // Workers look at each other's deques, so they all exist before the first one runs;
+    // the deque of a thread that could not be started stays empty.
+    state->workerCount = threads;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&state->workers[i].thread, NULL, workerMain, &state->workers[i]) != 0) break;
+        state->started++;
+    }
+    if (state->started == 0) {
+        ioFlush();
+        fprintf(ioErr(), "[FATAL] Could not start a thread to run tasks on\n");
+        exit(1);
+    }
+}
+
+TaskState* taskStateNew(void) {
+    TaskState* state = (TaskState*)calloc(1, sizeof(TaskState));
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->work, NULL);
+    pthread_cond_init(&state->wake, NULL);
+    dequeInit(&state->injected);
+    return state;
+}
+
+void taskStateFree(TaskState* state) {
+    if (!state) return;
+    taskJoin();
+    if (state->workers) {
+        pthread_mutex_lock(&state->lock);
+        state->stop = 1;
+        pthread_cond_broadcast(&state->work);
+        pthread_mutex_unlock(&state->lock);
+        for (int i = 0; i < state->started; i++) pthread_join(state->workers[i].thread, NULL);
+        for (int i = 0; i < state->workerCount; i++) dequeFree(&state->workers[i].deque);
+        free(state->workers);
+    }
+    for (int32_t id = 1; id <= state->channelCount; id++) {
+        Channel* channel = state->channels[id / CHANNEL_BLOCK][id % CHANNEL_BLOCK];
+        for (uint32_t i = 0; i < channel->count; i++) {
+            valueRelease(channel->buffer[(channel->first + i) % channel->size]);
+        }
+        pthread_mutex_destroy(&channel->lock);
+        free(channel->buffer);
+        free(channel);
+    }
+    for (int i = 0; i < CHANNEL_BLOCKS && state->channels[i]; i++) free(state->channels[i]);
+    dequeFree(&state->injected);
+    pthread_cond_destroy(&state->wake);
+    pthread_cond_destroy(&state->work);
+    pthread_mutex_destroy(&state->lock);
+    free(state);
+}
+
+void taskSetThreads(int threads) {
+    if (!TASKS->workers) TASKS->threads = threads;
+}
+
+void taskSpawn(Task* task) {
+    TaskState* state = TASKS;
+    task->wait.wake  = taskReady;
+    task->wait.owner = state;
+    pthread_mutex_lock(&state->lock);
+    if (!state->workers) startWorkers(state);
+    task->prev = NULL;
+    task->next = state->tasks;
+    if (state->tasks) state->tasks->prev = task;
+    state->tasks = task;
+    __atomic_store_n(&state->live, state->live + 1, __ATOMIC_RELEASE);
+    makeRunnable(state, task);
+    pthread_mutex_unlock(&state->lock);
+}
+
+int tasksLive(void) {
+    return __atomic_load_n(&TASKS->live, __ATOMIC_ACQUIRE) != 0;
+}
+
+// The main program starts to wait; workers blocked on it may now give up.  Under the lock.
+static void mainWaits(TaskState* state) {
+    state->mainWaiting = 1;
+    if (state->blocked) pthread_cond_broadcast(&state->wake);
+}
+
+void taskJoin(void) {
+    TaskState* state = TASKS;
+    if (!tasksLive()) return;
+    pthread_mutex_lock(&state->lock);
+    mainWaits(state);
+    while (state->live > 0 && state->active > 0) pthread_cond_wait(&state->wake, &state->lock);
+    state->mainWaiting = 0;
+    // What is left waits on channels that nothing will ever use again.
+    Task* stuck = state->tasks;
+    int count = state->live;
+    state->tasks = NULL;
+    __atomic_store_n(&state->live, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&state->lock);
+    if (!stuck) return;
+
+    taskWarnDropped(count);
+    while (stuck) {
+        Task* task = stuck;
+        stuck = task->next;
+        if (channelCancel(&task->wait)) valueRelease(task->wait.value);
+        vm_task_free(task);
+    }
+}
+
+/*
+    The chunks of a parallel for go to the workers in runs, chunk k to
+    worker k * workers / count, each run queued so that its worker starts
+    with its first chunk; stealing evens out whatever the split did not.
+*/
+void taskRunAll(Task** tasks, int count) {
+    TaskState* state = TASKS;
+    TaskGroup group = { count };
+    pthread_mutex_lock(&state->lock);
+    if (!state->workers) startWorkers(state);
+    for (int i = count - 1; i >= 0; i--) {
+        Task* task = tasks[i];
+        task->wait.wake  = taskReady;
+        task->wait.owner = state;
+        task->group      = &group;
+        state->active++;
+        dequePush(&state->workers[(int)((int64_t)i * state->started / count)].deque, task);
+    }
+    __atomic_add_fetch(&state->epoch, 1, __ATOMIC_RELEASE);
+    if (state->sleeping) pthread_cond_broadcast(&state->work);
+    mainWaits(state);
+    while (group.remaining > 0 && state->active > 0) pthread_cond_wait(&state->wake, &state->lock);
+    state->mainWaiting = 0;
+    pthread_mutex_unlock(&state->lock);
+    if (group.remaining == 0) return;
+
+    // Nothing runs, so nothing can wake the chunks still parked meanwhile.
+    taskWarnDropped(group.remaining);
+    for (int i = 0; i < count; i++) {
+        Task* task = tasks[i];
+        if (!task->group) continue;
+        if (channelCancel(&task->wait)) valueRelease(task->wait.value);
+        task->group = NULL;
+    }
+}
+
+// Waiter.wake of a thread that blocks.
+static void wakeThread(Waiter* waiter) {
+    TaskState* state = (TaskState*)waiter->owner;
+    pthread_mutex_lock(&state->lock);
+    waiter->ready = 1;
+    pthread_cond_broadcast(&state->wake);
+    pthread_mutex_unlock(&state->lock);
+}
+
+void taskThreadWaiter(Waiter* waiter) {
+    memset(waiter, 0, sizeof(Waiter));
+    waiter->wake  = wakeThread;
+    waiter->owner = TASKS;
+}
+
+/*
+    A worker's task is still active while its thread waits here, so only
+    the main program can tell that nothing will come: the worker gives up
+    once the main program waits too and every active task is blocked.
+*/
+int taskWaitThread(Waiter* waiter) {
+    TaskState* state = TASKS;
+    int worker = WORKER && WORKER->state == state;
+    pthread_mutex_lock(&state->lock);
+    if (worker) {
+        state->blocked++;
+        if (state->mainWaiting && worthWaking(state)) pthread_cond_broadcast(&state->wake);
+        while (!waiter->ready && !(state->mainWaiting && state->active <= state->blocked)) {
+            pthread_cond_wait(&state->wake, &state->lock);
+        }
+        state->blocked--;
+    } else {
+        mainWaits(state);
+        while (!waiter->ready && state->active > 0) pthread_cond_wait(&state->wake, &state->lock);
+        state->mainWaiting = 0;
+    }
+    int ready = waiter->ready;
+    waiter->ready = 0;
+    pthread_mutex_unlock(&state->lock);
+    if (ready) return 1;
+
+    // No task runs, so nothing can take the waiter off the channel meanwhile.
+    taskGiveUp(waiter);
+    return 0;
+}
+
+void taskGiveUp(Waiter* waiter) {
+    int sender = channelCancel(waiter);
+    if (sender) valueRelease(waiter->value);
+    waiter->value = valueInt(0);
+    // Tasks of a cancelled run (interpreter.h) just stopped: no deadlock to speak of.
+    if (interpreterCancelled()) return;
+    ioFlush();
+    fprintf(ioErr(), "[WARNING] Deadlock: no task is left to %s, %s\n",
+            sender ? "receive this send" : "send to this recv", sender ? "the value is dropped" : "it gives 0");
+}
+
+void taskWarnDropped(int count) {
+    if (interpreterCancelled()) return;
+    ioFlush();
+    fprintf(ioErr(), "[WARNING] Deadlock: %d task%s waiting on channels forever, dropped\n",
+            count, count == 1 ? "" : "s");
+}
+
+/* ---- channels ---- */
+
+Value channelNew(Value capacity) {
+    TaskState* state = TASKS;
+    double wanted = isString(capacity) ? 0.0 : toDouble(capacity);
+    uint32_t size = wanted >= INT32_MAX ? INT32_MAX : wanted > 0 ? (uint32_t)wanted : 0;
+
+    pthread_mutex_lock(&state->lock);
+    int32_t id = state->channelCount + 1;
+    if (id >= CHANNEL_BLOCK * CHANNEL_BLOCKS) {
+        pthread_mutex_unlock(&state->lock);
+        ioLock();
+        ioFlush();
+        fprintf(ioErr(), "[WARNING] Too many channels (limit %d), chan gives 0\n", CHANNEL_BLOCK * CHANNEL_BLOCKS - 1);
+        ioUnlock();
+        return valueInt(0);
+    }
+    Channel** block = state->channels[id / CHANNEL_BLOCK];
+    if (!block) block = state->channels[id / CHANNEL_BLOCK] = (Channel**)calloc(CHANNEL_BLOCK, sizeof(Channel*));
+    Channel* channel = (Channel*)calloc(1, sizeof(Channel));
+    pthread_mutex_init(&channel->lock, NULL);
+    channel->capacity = size;
+    block[id % CHANNEL_BLOCK] = channel;
+    __atomic_store_n(&state->channelCount, id, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&state->lock);
+    return valueInt(id);
+}
+
+Channel* channelFind(Value handle) {
+    TaskState* state = TASKS;
+    if (isInt(handle) && asInt(handle) > 0 &&
+        asInt(handle) <= __atomic_load_n(&state->channelCount, __ATOMIC_ACQUIRE)) {
+        int32_t id = asInt(handle);
+        return state->channels[id / CHANNEL_BLOCK][id % CHANNEL_BLOCK];
+    }
+    if (!__atomic_exchange_n(&state->warned, 1, __ATOMIC_RELAXED)) {
+        char text[32];
+        valueFormat(handle, text, sizeof(text));
+        ioLock();
+        ioFlush();
+        fprintf(ioErr(), "[WARNING] %s is not a channel: send to it does nothing and recv gives 0\n", text);
+        ioUnlock();
+    }
+    return NULL;
+}
+
+// Appends 'waiter' to a list (oldest first).
+static void enqueue(Waiter** first, Waiter** last, Waiter* waiter) {
+    waiter->next = NULL;
+    if (*last) (*last)->next = waiter;
+    else *first = waiter;
+    *last = waiter;
+}
+
+static Waiter* dequeue(Waiter** first, Waiter** last) {
+    Waiter* waiter = *first;
+    if (waiter) {
+        *first = waiter->next;
+        if (!*first) *last = NULL;
+    }
+    return waiter;
+}
+
+// Room for one more buffered value; under the channel's lock.
+static int reserveBuffer(Channel* channel) {
+    if (channel->count < channel->size) return 1;
+    if (channel->size == channel->capacity) return 0;
+    uint32_t size = channel->size ? channel->size * 2 : 16;
+    if (size > channel->capacity || size < channel->size) size = channel->capacity;
+    Value* buffer = (Value*)malloc(sizeof(Value) * size);
+    for (uint32_t i = 0; i < channel->count; i++) {
+        buffer[i] = channel->buffer[(channel->first + i) % channel->size];
+    }
+    free(channel->buffer);
+    channel->buffer = buffer;
+    channel->first  = 0;
+    channel->size   = size;
+    return 1;
+}
+
+int channelSend(Channel* channel, Value value, Waiter* waiter) {
+    pthread_mutex_lock(&channel->lock);
+    Waiter* receiver = dequeue(&channel->receivers, &channel->lastReceiver);
+    if (receiver) {
+        pthread_mutex_unlock(&channel->lock);
+        receiver->value = value;
+        receiver->wake(receiver);
+        return 1;
+    }
+    if (reserveBuffer(channel)) {
+        channel->buffer[(channel->first + channel->count++) % channel->size] = value;
+        pthread_mutex_unlock(&channel->lock);
+        return 1;
+    }
+    waiter->value   = value;
+    waiter->channel = channel;
+    enqueue(&channel->senders, &channel->lastSender, waiter);
+    pthread_mutex_unlock(&channel->lock);
+    return 0;
+}
+
+int channelRecv(Channel* channel, Value* value, Waiter* waiter) {
+    pthread_mutex_lock(&channel->lock);
+    if (channel->count) {
+        *value = channel->buffer[channel->first];
+        channel->first = (channel->first + 1) % channel->size;
+        channel->count--;
+        // The oldest waiting sender's value takes the freed place.
+        Waiter* sender = dequeue(&channel->senders, &channel->lastSender);
+        if (sender) channel->buffer[(channel->first + channel->count++) % channel->size] = sender->value;
+        pthread_mutex_unlock(&channel->lock);
+        if (sender) sender->wake(sender);
+        return 1;
+    }
+    Waiter* sender = dequeue(&channel->senders, &channel->lastSender);
+    if (sender) {
+        pthread_mutex_unlock(&channel->lock);
+        *value = sender->value;
+        sender->wake(sender);
+        return 1;
+    }
+    waiter->channel = channel;
+    enqueue(&channel->receivers, &channel->lastReceiver, waiter);
+    pthread_mutex_unlock(&channel->lock);
+    return 0;
+}
+
+// Takes 'waiter' out of a list; returns 0 if it is not there.
+static int removeWaiter(Waiter** first, Waiter** last, Waiter* waiter) {
+    Waiter* previous = NULL;
+    for (Waiter* at = *first; at; previous = at, at = at->next) {
+        if (at != waiter) continue;
+        if (previous) previous->next = at->next;
+        else *first = at->next;
+        if (*last == at) *last = previous;
+        return 1;
+    }
+    return 0;
+}
+
+int channelCancel(Waiter* waiter) {
+    Channel* channel = waiter->channel;
+    if (!channel) return 0;
+    pthread_mutex_lock(&channel->lock);
+    int sender = removeWaiter(&channel->senders, &channel->lastSender, waiter);
+    if (!sender) removeWaiter(&channel->receivers, &channel->lastReceiver, waiter);
+    pthread_mutex_unlock(&channel->lock);
+    waiter->channel = NULL;
+    return sender;
+}
@@ -0,0 +1,130 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "compiler.h"
+#include "interpreter.h"
+#include <stddef.h>
+
+/*
+    Tasks and channels: spawn f(...) runs a call as a task of its own, and
+    tasks pass values over bounded channels (chan(n), send c, v and recv c).
+
+    A task is a green thread.  Its frames are the VM's, kept in registers
+    and a return stack of its own (vm.c), so a task that has to wait is
+    only its saved pc and stacks: it is parked on the channel, and the
+    thread goes on with another task.  The tasks of an interpreter run on
+    one worker thread per core (--task-threads), and so do the chunks of a
+    parallel for (vm.c).  Every worker has a deque
+    of runnable tasks: it takes its own newest task first and, when it has
+    none, steals the oldest one of another worker, so related tasks stay
+    on one thread while there is work for all of them.  The main program is
+    not a task; when it has to wait for a channel it blocks its thread.
+
+    A channel is an int, the handle of a queue of up to 'capacity' values
+    (chan() or chan(0): none, every send waits for its recv).  Channels
+    last as long as the interpreter.  A value moves to the other task as a
+    copy of its own (text.h), so no object is ever shared between threads.
+
+    Waiting for a task nobody will ever wake is a deadlock: the main
+    program's send or recv gives up with a warning (recv gives 0), and the
+    tasks still waiting when they are joined are dropped, again with a
+    warning.  The tree-walking interpreter runs tasks in turns on its own
+    thread (executor.c), with the same channels.
+*/
+
+typedef struct Channel Channel;
+typedef struct Waiter  Waiter;
+
+/*
+    A send or recv that has to wait.  The channel takes the value from a
+    waiting sender, or stores the value for a waiting receiver, and then
+    calls wake() on the thread that finished the operation, outside the
+    channel's lock.
+*/
+struct Waiter {
+    Waiter*  next;
+    Channel* channel;           // the one it waits on
+    Value    value;             // being sent, or received once woken
+    void   (*wake)(Waiter* waiter);
+    void*    owner;             // for wake()
+    int      ready;             // woken, for a thread that blocks on it
+};
+
+/*
+    A spawned call on the VM: its registers and return stack, and where it
+    stopped.  vm.c runs it; the scheduler only queues it.
+*/
+typedef struct Task {
+    Value*            stack;
+    size_t            stackSize;
+    struct CallFrame* calls;
+    size_t            callCapacity;
+    Function*         functions;
+    Chunk*            chunk;
+    const Instr*      pc;
+    size_t            base, depth, high;
+    int               result;       // register a woken recv stores into, -1 after a send
+    Waiter            wait;
+    struct Task*      prev;         // the interpreter's live tasks
+    struct Task*      next;
+    struct TaskGroup* group;        // a chunk of a parallel for, until it is done
+    struct IoCapture* output;       // where its prints go meanwhile (io.h), or NULL
+} Task;
+
+// The interpreter's workers, tasks and channels (interpreter.h).  Workers are
+// started by the first spawn.
+TaskState* taskStateNew(void);
+void       taskStateFree(TaskState* state);
+// Workers the next start uses; less than 1 means one per core.
+void       taskSetThreads(int threads);
+
+// Makes 'task' runnable for the first time.
+void       taskSpawn(Task* task);
+// Some task is still running or waiting.
+int        tasksLive(void);
+/*
+    Waits until every task is done.  Tasks that can never be woken again
+    are dropped with a warning.  Only the main program joins.
+*/
+void       taskJoin(void);
+/*
+    Runs 'tasks', the chunks of a parallel for, on the workers and waits
+    until all of them are done; they are not freed.  Chunks left waiting
+    on channels that nothing can use any more are taken off them with a
+    warning.  Only the main program runs chunks this way; a task runs
+    them one after the other on its own thread.
+*/
+void       taskRunAll(Task** tasks, int count);
+/*
+    The main program, or a task running the chunks of a parallel for, waits
+    for 'waiter', queued on a channel, blocking its thread.  Returns 0
+    (and takes the waiter off the channel) when no task is left that could
+    finish the operation; for a worker, once the main program waits too.
+*/
+int        taskWaitThread(Waiter* waiter);
+// A waiter for a thread that blocks, for taskWaitThread().
+void       taskThreadWaiter(Waiter* waiter);
+/*
+    For a thread that waits with no task left to wake it: takes
+    'waiter' off its channel, drops a send's value, makes a recv's 0 and
+    warns.  taskWarnDropped() is the warning for tasks dropped at a join.
+*/
+void       taskGiveUp(Waiter* waiter);
+void       taskWarnDropped(int count);
+
+/*
+    Channels.  channelNew() makes one and returns its handle.
+    channelFind() is the channel a handle names; NULL (after a warning, the
+    first time) for anything else.  channelSend() takes an owned value
+    and channelRecv() gives one; both return 1 when they are done and 0
+    when 'waiter' was queued, to be woken once they are.  channelCancel()
+    takes a queued waiter back; it returns 1 if it was a sender, whose
+    value is the caller's again.
+*/
+Value      channelNew(Value capacity);
+Channel*   channelFind(Value handle);
+int        channelSend(Channel* channel, Value value, Waiter* waiter);
+int        channelRecv(Channel* channel, Value* value, Waiter* waiter);
+int        channelCancel(Waiter* waiter);
+
+#endif // TASK_H
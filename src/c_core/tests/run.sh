@@ -0,0 +1,86 @@
+#!/bin/sh
+# make test: runs every program on every engine and diffs stdout against tests/<name>.out.
+# A "// skip: c asm" line in a program leaves those engines out (--emit-c/--emit-asm lack
+# tasks, --emit-asm lacks floats and strings). Every run has to exit with status 0.
+
+FREESPL=${FREESPL:-./freespl}
+ENGINES="vm tree-walk no-optimize jit cache bad-cache c asm jobs tasks server"
+PROGRAMS="tests/*.spl example.spl full_test.spl"
+
+tmp=$(mktemp -d /tmp/freespl-test.XXXXXX) || exit 1
+server=
+cleanup() {
+    [ -n "$server" ] && kill "$server" 2>/dev/null
+    rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+"$FREESPL" --serve "$tmp/sock" --workers 2 2>"$tmp/server.err" &
+server=$!
+tries=0
+while [ ! -S "$tmp/sock" ] && [ $tries -lt 100 ]; do
+    sleep 0.05
+    tries=$((tries + 1))
+done
+
+# run <engine> <program>: its stdout goes to stdout, returns the exit status.
+run() {
+    case $1 in
+        vm)          "$FREESPL" --no-cache "$2" ;;
+        tree-walk)   "$FREESPL" --no-cache --tree-walk "$2" ;;
+        no-optimize) "$FREESPL" --no-cache --no-optimize "$2" ;;
+        jit)         "$FREESPL" --no-cache --jit "$2" ;;
+        jobs)        "$FREESPL" --no-cache --jobs 2 "$2" ;;
+        tasks)       "$FREESPL" --no-cache --task-threads 1 "$2" && "$FREESPL" --no-cache --task-threads 4 "$2" >/dev/null ;;
+        server)      "$FREESPL" --client "$tmp/sock" "$2" ;;
+        cache)
+            # the first run writes the .splc, the second one maps it
+            rm -rf "$tmp/cache" && mkdir "$tmp/cache" &&
+            FREESPL_CACHE_DIR="$tmp/cache" "$FREESPL" "$2" >/dev/null &&
+            FREESPL_CACHE_DIR="$tmp/cache" "$FREESPL" "$2" ;;
+        bad-cache)
+            # a damaged .splc is a miss: the source is parsed again
+            rm -rf "$tmp/cache" && mkdir "$tmp/cache" &&
+            FREESPL_CACHE_DIR="$tmp/cache" "$FREESPL" "$2" >/dev/null &&
+            for splc in "$tmp"/cache/*; do
+                size=$(wc -c <"$splc")
+                printf '\245\132' | dd of="$splc" bs=1 seek=$((size / 2)) conv=notrunc 2>/dev/null
+            done &&
+            FREESPL_CACHE_DIR="$tmp/cache" "$FREESPL" "$2" ;;
+        c)   "$FREESPL" build -o "$tmp/prog" "$2" >/dev/null && "$tmp/prog" ;;
+        asm) "$FREESPL" build --asm -o "$tmp/prog" "$2" >/dev/null && "$tmp/prog" ;;
+    esac
+}
+
+passed=0
+failed=0
+for program in $PROGRAMS; do
+    name=$(basename "$program" .spl)
+    expected="tests/$name.out"
+    if [ ! -f "$expected" ]; then
+        echo "MISSING $expected"
+        failed=$((failed + 1))
+        continue
+    fi
+    skip=$(sed -n 's|^// skip: *||p' "$program" | head -n 1)
+    for engine in $ENGINES; do
+        case " $skip " in *" $engine "*) continue ;; esac
+        run "$engine" "$program" </dev/null >"$tmp/out" 2>"$tmp/err"
+        status=$?
+        if [ $status -ne 0 ]; then
+            echo "FAIL $name [$engine]: exit status $status"
+            sed 's/^/    /' "$tmp/err"
+            failed=$((failed + 1))
+        elif ! diff -u "$expected" "$tmp/out" >"$tmp/diff"; then
+            echo "FAIL $name [$engine]: output differs"
+            sed 's/^/    /' "$tmp/diff"
+            failed=$((failed + 1))
+        else
+            passed=$((passed + 1))
+        fi
+    done
+done
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
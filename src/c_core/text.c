@@ -0,0 +1,253 @@
+// text.c
+#include "text.h"
+#include "token.h"
+#include "interpreter.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INLINE_TAG ((1ull << 48) | (1ull << 47))
+
+struct TextState {
+    Value*   literals;              // by string id, 0 = not made yet
+    uint32_t literalCount;
+};
+
+static inline int isInlineText(Value v) { return (v >> 47) == 3; }
+static inline Text* asText(Value v)     { return (Text*)asObject(v); }
+
+static Value objectValue(const Text* text) {
+    return (1ull << 48) | (uint64_t)(uintptr_t)text;
+}
+
+// Bytes at positions 0..4 of the payload, the length above them.
+static Value inlineText(const char* bytes, uint32_t length) {
+    Value v = INLINE_TAG | ((uint64_t)length << 40);
+    for (uint32_t i = 0; i < length; i++) v |= (uint64_t)(unsigned char)bytes[i] << (8 * i);
+    return v;
+}
+
+static void inlineBytes(Value v, char* out) {
+    uint32_t length = (uint32_t)(v >> 40) & 7;
+    for (uint32_t i = 0; i < length; i++) out[i] = (char)(v >> (8 * i));
+    out[length] = '\0';
+}
+
+static Text* newText(TextKind kind, uint32_t length, size_t extra) {
+    Text* text = (Text*)malloc(sizeof(Text) + extra);
+    text->header.refs = 1;
+    text->header.kind = kind;
+    text->length = length;
+    text->left = text->right = 0;
+    text->chars = text->data;
+    return text;
+}
+
+uint32_t textLength(Value v) {
+    if (isInlineText(v)) return (uint32_t)(v >> 40) & 7;
+    return asText(v)->length;
+}
+
+Value textFromBytes(const char* bytes, uint32_t length) {
+    if (length <= TEXT_INLINE_MAX) return inlineText(bytes, length);
+    Text* text = newText(TEXT_FLAT, length, length + 1);
+    memcpy(text->data, bytes, length);
+    text->data[length] = '\0';
+    return objectValue(text);
+}
+
+TextState* textStateNew(void) {
+    return (TextState*)calloc(1, sizeof(TextState));
+}
+
+void textStateFree(TextState* state) {
+    if (!state) return;
+    for (uint32_t id = 0; id < state->literalCount; id++) {
+        if (isObject(state->literals[id])) objectFree(asObject(state->literals[id]));
+    }
+    free(state->literals);
+    free(state);
+}
+
+Value textLiteral(uint32_t id) {
+    TextState* state = INTERPRETER->text;
+    if (id >= state->literalCount) {
+        uint32_t count = state->literalCount ? state->literalCount : 64;
+        while (count <= id) count *= 2;
+        state->literals = (Value*)realloc(state->literals, sizeof(Value) * count);
+        memset(state->literals + state->literalCount, 0, sizeof(Value) * (count - state->literalCount));
+        state->literalCount = count;
+    }
+    if (!state->literals[id]) {
+        uint32_t length = stringLength(id);
+        if (length <= TEXT_INLINE_MAX) {
+            state->literals[id] = inlineText(stringOf(id), length);
+        } else {
+            // The table keeps it for good; the text is never copied.
+            Text* text = newText(TEXT_LITERAL, length, 0);
+            text->chars = stringOf(id);
+            state->literals[id] = objectValue(text);
+        }
+    }
+    return state->literals[id];
+}
+
+/*
+    Freeing a rope releases its halves, which may be ropes in turn: those
+    whose count drops to 0 go on a list (linked through 'next', which a
+    rope does not use) instead of the C stack, however deep the rope is.
+*/
+void objectFree(Object* object) {
+    Text* pending = (Text*)object;
+    if (pending->header.kind != TEXT_ROPE) {
+        if (pending->header.kind == TEXT_FLATTENED) free((char*)pending->chars);
+        free(pending);
+        return;
+    }
+    pending->next = NULL;
+    while (pending) {
+        Text* text = pending;
+        pending = text->next;
+        if (text->header.kind == TEXT_ROPE) {
+            Value halves[2] = { text->left, text->right };
+            for (int i = 0; i < 2; i++) {
+                if (!isObject(halves[i])) continue;
+                Text* half = asText(halves[i]);
+                if (half->header.kind == TEXT_LITERAL || --half->header.refs != 0) continue;
+                if (half->header.kind == TEXT_ROPE) {
+                    half->next = pending;
+                    pending = half;
+                } else {
+                    objectFree(&half->header);
+                }
+            }
+        }
+        free(text);
+    }
+}
+
+// Copy the bytes of a rope into 'out', left to right, with an explicit stack.
+static void flattenInto(Value root, char* out) {
+    Value small[64];
+    Value* stack = small;
+    size_t capacity = 64, depth = 0;
+    stack[depth++] = root;
+    while (depth) {
+        Value v = stack[--depth];
+        if (isInlineText(v)) {
+            uint32_t length = textLength(v);
+            for (uint32_t i = 0; i < length; i++) *out++ = (char)(v >> (8 * i));
+            continue;
+        }
+        const Text* text = asText(v);
+        if (text->header.kind != TEXT_ROPE) {
+            memcpy(out, text->chars, text->length);
+            out += text->length;
+            continue;
+        }
+        if (depth + 2 > capacity) {
+            capacity *= 2;
+            if (stack == small) {
+                stack = (Value*)malloc(sizeof(Value) * capacity);
+                memcpy(stack, small, sizeof(small));
+            } else {
+                stack = (Value*)realloc(stack, sizeof(Value) * capacity);
+            }
+        }
+        stack[depth++] = text->right;
+        stack[depth++] = text->left;
+    }
+    if (stack != small) free(stack);
+}
+
+const char* textChars(Value v, char buf[TEXT_INLINE_MAX + 1]) {
+    if (isInlineText(v)) {
+        inlineBytes(v, buf);
+        return buf;
+    }
+    Text* text = asText(v);
+    if (text->header.kind == TEXT_ROPE) {
+        char* chars = (char*)malloc(text->length + 1);
+        flattenInto(v, chars);
+        chars[text->length] = '\0';
+
+        // Same text, one piece: the halves are not needed any more.
+        Value left = text->left, right = text->right;
+        text->header.kind = TEXT_FLATTENED;
+        text->chars = chars;
+        text->left = text->right = 0;
+        valueRelease(left);
+        valueRelease(right);
+    }
+    return text->chars;
+}
+
+Value textCopy(Value v) {
+    if (!isObject(v) || asText(v)->header.kind == TEXT_LITERAL) return v;
+    char buf[TEXT_INLINE_MAX + 1];
+    return textFromBytes(textChars(v, buf), textLength(v));
+}
+
+int textCompare(Value a, Value b) {
+    if (a == b) return 0;
+    char bufA[TEXT_INLINE_MAX + 1], bufB[TEXT_INLINE_MAX + 1];
+    uint32_t la = textLength(a), lb = textLength(b);
+    int order = memcmp(textChars(a, bufA), textChars(b, bufB), la < lb ? la : lb);
+    if (order) return order;
+    return la < lb ? -1 : la > lb;
+}
+
+// A number as print writes it, as a new string.
+static Value numberText(Value v) {
+    char buf[32];
+    int length = valueFormat(v, buf, sizeof(buf));
+    return textFromBytes(buf, (uint32_t)length);
+}
+
+static Value concat(Value a, Value b) {
+    uint32_t la = textLength(a), lb = textLength(b);
+    if (la == 0) { valueRetain(b); return b; }
+    if (lb == 0) { valueRetain(a); return a; }
+
+    uint32_t length = la + lb;
+    if (length <= TEXT_FLAT_MAX) {
+        char bytes[TEXT_FLAT_MAX];
+        char bufA[TEXT_INLINE_MAX + 1], bufB[TEXT_INLINE_MAX + 1];
+        memcpy(bytes, textChars(a, bufA), la);
+        memcpy(bytes + la, textChars(b, bufB), lb);
+        return textFromBytes(bytes, length);
+    }
+    Text* rope = newText(TEXT_ROPE, length, 0);
+    rope->chars = NULL;
+    rope->left  = a;
+    rope->right = b;
+    valueRetain(a);
+    valueRetain(b);
+    return objectValue(rope);
+}
+
+Value textArith(uint32_t op, Value a, Value b) {
+    if (op == STR_PLUS) {
+        Value left  = isString(a) ? a : numberText(a);
+        Value right = isString(b) ? b : numberText(b);
+        Value result = concat(left, right);
+        if (left != a) valueRelease(left);
+        if (right != b) valueRelease(right);
+        return result;
+    }
+    if (op == STR_AND) return valueInt(valueTruthy(a) && valueTruthy(b));
+    if (op == STR_OR)  return valueInt(valueTruthy(a) || valueTruthy(b));
+
+    if (isString(a) && isString(b)) {
+        int order = textCompare(a, b);
+        switch (op) {
+            case STR_ASSIGN:
+            case STR_EQ: return valueInt(order == 0);
+            case STR_NE: return valueInt(order != 0);
+            case STR_LT: return valueInt(order < 0);
+            case STR_LE: return valueInt(order <= 0);
+            case STR_GT: return valueInt(order > 0);
+            case STR_GE: return valueInt(order >= 0);
+        }
+    }
+    return valueArith(op, isString(a) ? valueInt(0) : a, isString(b) ? valueInt(0) : b);
+}
@@ -0,0 +1,70 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include "value.h"
+#include "interpreter.h"
+
+/*
+    String values.  Up to TEXT_INLINE_MAX bytes live in the value itself
+    (value.h), so short temporaries never allocate.  Longer strings are
+    immutable, reference-counted objects of one of these kinds:
+
+        TEXT_FLAT       the bytes follow the header, one allocation
+        TEXT_LITERAL    a string literal: the bytes are the interned text,
+                        and it is never counted (value.h)
+        TEXT_ROPE       left + right, made by concatenation without copying
+        TEXT_FLATTENED  a rope that was needed in one piece; it keeps the
+                        copied bytes and has let go of its halves
+
+    Building a string in a loop (s = s + x) adds one rope node per step, so
+    it stays O(1) per concatenation.  A rope is flattened the first time it
+    is printed or compared, and only once.  Ropes may be as deep as they
+    are long; every walk over them is iterative.
+*/
+#define TEXT_INLINE_MAX 5
+#define TEXT_FLAT_MAX   32      // shorter concatenations are copied, not roped
+
+typedef enum {
+    TEXT_FLAT,
+    TEXT_LITERAL = OBJECT_IMMORTAL,
+    TEXT_ROPE,
+    TEXT_FLATTENED
+} TextKind;
+
+typedef struct Text {
+    Object   header;
+    uint32_t length;
+    Value    left, right;       // TEXT_ROPE
+    union {
+        const char*  chars;     // every other kind
+        struct Text* next;      // a rope on objectFree()'s list
+    };
+    char     data[];            // TEXT_FLAT
+} Text;
+
+// The interpreter's literals (interpreter.h); freeing releases them.
+TextState*  textStateNew(void);
+void        textStateFree(TextState* state);
+
+// The string literal with interned id 'id'; made once, the result is borrowed.
+Value       textLiteral(uint32_t id);
+// A new string holding a copy of 'length' bytes.
+Value       textFromBytes(const char* bytes, uint32_t length);
+// 'v' for another task (task.h): a string comes back as a new one that shares
+// no object with it, anything else (literals too) as it is.  Owned by the caller.
+Value       textCopy(Value v);
+// The bytes of a string (flattening a rope), 'buf' holds an inline one.
+// Valid while the value is alive.
+const char* textChars(Value v, char buf[TEXT_INLINE_MAX + 1]);
+// memcmp order, then the shorter first.
+int         textCompare(Value a, Value b);
+
+/*
+    valueArith() with at least one string operand: + concatenates (a number
+    is formatted as print shows it), comparisons between two strings compare
+    their bytes, && and || test for "", and everywhere else a string counts
+    as 0, as string literals always have.
+*/
+Value       textArith(uint32_t op, Value a, Value b);
+
+#endif // TEXT_H
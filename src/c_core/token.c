@@ -1 +1,172 @@
-// empty for now bcuz yes
\ No newline at end of file
+// token.c
+#include "token.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRING_BLOCK_SIZE (64 * 1024)
+
+static const char* predefined[STR_PREDEFINED_COUNT] = {
+    "if", "else", "while", "for", "return", "int", "float", "void",
+    "func", "print", "input", "break", "loop",
+    "spawn", "chan", "send", "recv", "parallel", "reduce",
+    "+", "-", "*", "/", "%", "=", "!",
+    "<", ">", "==", "!=", "<=", ">=", "&&", "||",
+    "(", ")", "{", "}", ";", ",", "..",
+    "EOF", "main", "step", "unordered"
+};
+
+typedef struct {
+    const char* text;
+    uint32_t    length;
+    uint32_t    hash;
+} StringEntry;
+
+typedef struct StringBlock {
+    struct StringBlock* prev;
+    size_t used;
+    size_t size;
+    char   data[];
+} StringBlock;
+
+/*
+    Text lives in large append-only blocks, entries in one array indexed by
+    id, and lookup goes through an open-addressing table of ids.  Each
+    interpreter has its own table (interpreter.h).
+*/
+struct StringTable {
+    StringEntry* entries;
+    uint32_t     entryCount;
+    uint32_t     entryCapacity;
+    uint32_t*    buckets;           // id + 1, 0 = empty
+    uint32_t     bucketCapacity;
+    StringBlock* block;
+};
+
+#define TABLE (INTERPRETER->strings)
+
+uint32_t hashString(const char* s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static char* storeText(StringTable* table, const char* text, size_t length) {
+    StringBlock* block = table->block;
+    if (!block || block->used + length + 1 > block->size) {
+        size_t size = length + 1 > STRING_BLOCK_SIZE ? length + 1 : STRING_BLOCK_SIZE;
+        block = (StringBlock*)malloc(sizeof(StringBlock) + size);
+        block->prev = table->block;
+        block->used = 0;
+        block->size = size;
+        table->block = block;
+    }
+    char* dst = block->data + block->used;
+    memcpy(dst, text, length);
+    dst[length] = '\0';
+    block->used += length + 1;
+    return dst;
+}
+
+static void rehash(StringTable* table, uint32_t capacity) {
+    free(table->buckets);
+    table->bucketCapacity = capacity;
+    table->buckets = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    for (uint32_t id = 0; id < table->entryCount; id++) {
+        uint32_t i = table->entries[id].hash & (capacity - 1);
+        while (table->buckets[i]) i = (i + 1) & (capacity - 1);
+        table->buckets[i] = id + 1;
+    }
+}
+
+static uint32_t internInto(StringTable* table, const char* text, size_t length, uint32_t hash) {
+    uint32_t mask = table->bucketCapacity - 1;
+    uint32_t i = hash & mask;
+    while (table->buckets[i]) {
+        StringEntry* e = &table->entries[table->buckets[i] - 1];
+        if (e->hash == hash && e->length == length && memcmp(e->text, text, length) == 0) {
+            return table->buckets[i] - 1;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (table->entryCount == table->entryCapacity) {
+        table->entryCapacity = table->entryCapacity ? table->entryCapacity * 2 : 256;
+        table->entries = (StringEntry*)realloc(table->entries, sizeof(StringEntry) * table->entryCapacity);
+    }
+    uint32_t id = table->entryCount++;
+    table->entries[id].text   = storeText(table, text, length);
+    table->entries[id].length = (uint32_t)length;
+    table->entries[id].hash   = hash;
+
+    if (table->entryCount * 2 > table->bucketCapacity) {
+        rehash(table, table->bucketCapacity * 2);
+    } else {
+        table->buckets[i] = id + 1;
+    }
+    return id;
+}
+
+StringTable* stringTableNew(void) {
+    StringTable* table = (StringTable*)calloc(1, sizeof(StringTable));
+    rehash(table, 256);
+    for (int i = 0; i < STR_PREDEFINED_COUNT; i++) {
+        size_t n = strlen(predefined[i]);
+        internInto(table, predefined[i], n, hashString(predefined[i], n));
+    }
+    return table;
+}
+
+void stringTableFree(StringTable* table) {
+    if (!table) return;
+    while (table->block) {
+        StringBlock* prev = table->block->prev;
+        free(table->block);
+        table->block = prev;
+    }
+    free(table->entries);
+    free(table->buckets);
+    free(table);
+}
+
+uint32_t internHashed(const char* text, size_t length, uint32_t hash) {
+    return internInto(TABLE, text, length, hash);
+}
+
+uint32_t intern(const char* text, size_t length) {
+    return internInto(TABLE, text, length, hashString(text, length));
+}
+
+const char* predefinedText(uint32_t id) {
+    return id < STR_PREDEFINED_COUNT ? predefined[id] : "";
+}
+
+const char* stringOf(uint32_t id) {
+    const StringTable* table = TABLE;
+    return id < table->entryCount ? table->entries[id].text : "";
+}
+
+uint32_t stringLength(uint32_t id) {
+    const StringTable* table = TABLE;
+    return id < table->entryCount ? table->entries[id].length : 0;
+}
+
+uint32_t stringCount(void) {
+    return TABLE->entryCount;
+}
+
+const char* tokenText(const Token* tok, char* buf, size_t size) {
+    if (tok->type == TOKEN_NUMBER) {
+        snprintf(buf, size, "%lld", (long long)tok->number);
+        return buf;
+    }
+    if (tok->type == TOKEN_FLOAT) {
+        snprintf(buf, size, "%g", tok->real);
+        return buf;
+    }
+    return stringOf(tok->id);
+}
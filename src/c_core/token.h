@@ -1,10 +1,15 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include "interpreter.h"
+#include <stddef.h>
+#include <stdint.h>
+
 typedef enum {
     TOKEN_KEYWORD,
     TOKEN_IDENTIFIER,
     TOKEN_NUMBER,
+    TOKEN_FLOAT,
     TOKEN_OPERATOR,
     TOKEN_SYMBOL,
     TOKEN_STRING,
@@ -13,9 +18,72 @@ typedef enum {
     TOKEN_EOF
 } TokenType;
 
+/*
+    Tokens do not own their text.  They point back into the source buffer
+    (offset/length) and carry the decoded payload: the binary value of a
+    number or float literal, or the string-table id of everything else.
+*/
 typedef struct {
     TokenType type;
-    char value[100];
+    uint32_t  offset;   // byte offset of the lexeme in the source
+    uint32_t  length;   // lexeme length in bytes
+    uint32_t  line;     // 1-based source line the lexeme starts on
+    union {
+        int64_t  number;  // TOKEN_NUMBER
+        double   real;    // TOKEN_FLOAT
+        uint32_t id;      // interned text of keywords, names, strings, operators
+    };
 } Token;
 
+/*
+    String table.  Every distinct string is stored once and named by a
+    32-bit id.  The strings below are interned first, in this order, so the
+    lexer, parser and executor can compare against constant ids.  The
+    table is the current interpreter's (interpreter.h).
+*/
+typedef enum {
+    // keywords
+    STR_IF, STR_ELSE, STR_WHILE, STR_FOR, STR_RETURN, STR_INT, STR_FLOAT, STR_VOID,
+    STR_FUNC, STR_PRINT, STR_INPUT, STR_BREAK, STR_LOOP,
+    STR_SPAWN, STR_CHAN, STR_SEND, STR_RECV, STR_PARALLEL, STR_REDUCE,
+    // operators
+    STR_PLUS, STR_MINUS, STR_STAR, STR_SLASH, STR_PERCENT, STR_ASSIGN, STR_BANG,
+    STR_LT, STR_GT, STR_EQ, STR_NE, STR_LE, STR_GE, STR_AND, STR_OR,
+    // symbols
+    STR_LPAREN, STR_RPAREN, STR_LBRACE, STR_RBRACE, STR_SEMICOLON, STR_COMMA, STR_DOTDOT,
+    // other well-known names; 'step' is only a word of its own inside a for,
+    // 'unordered' right after 'parallel'
+    STR_EOF, STR_MAIN, STR_STEP, STR_UNORDERED,
+    STR_PREDEFINED_COUNT
+} PredefinedString;
+
+#define STR_FIRST_KEYWORD STR_IF
+#define STR_LAST_KEYWORD  STR_REDUCE
+
+StringTable* stringTableNew(void);
+void        stringTableFree(StringTable* table);
+
+uint32_t    intern(const char* text, size_t length);
+const char* stringOf(uint32_t id);
+uint32_t    stringLength(uint32_t id);
+uint32_t    stringCount(void);    // ids run from 0 to stringCount() - 1, in interning order
+
+// The table's hash, and intern() with the hash already computed: the parallel
+// lexer hashes on its worker threads and interns in token order (lexer.c).
+uint32_t    hashString(const char* text, size_t length);
+uint32_t    internHashed(const char* text, size_t length, uint32_t hash);
+// Text of a predefined string; never changes, so it is safe from any thread.
+const char* predefinedText(uint32_t id);
+
+static inline int tokenIs(const Token* tok, TokenType type, uint32_t id) {
+    return tok->type == type && tok->id == id;
+}
+
+static inline int isNumberToken(const Token* tok) {
+    return tok->type == TOKEN_NUMBER || tok->type == TOKEN_FLOAT;
+}
+
+// Text of a token for messages and dumps; numbers are formatted into 'buf'.
+const char* tokenText(const Token* tok, char* buf, size_t size);
+
 #endif
@@ -0,0 +1,124 @@
+// value.c
+#include "value.h"
+#include "text.h"
+#include "token.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+
+static Value intArith(uint32_t op, int32_t left, int32_t right) {
+    // Wrap like the machine does instead of relying on signed overflow (undefined in C).
+    uint32_t l = (uint32_t)left, r = (uint32_t)right;
+    switch (op) {
+        case STR_PLUS:    return valueInt((int32_t)(l + r));
+        case STR_MINUS:   return valueInt((int32_t)(l - r));
+        case STR_STAR:    return valueInt((int32_t)(l * r));
+        // INT_MIN / -1 traps in idiv: x / -1 is negation (wrapping too), x % -1 is 0.
+        case STR_SLASH:   return valueInt(right == 0 ? 0 : right == -1 ? (int32_t)(0u - l) : left / right);
+        case STR_PERCENT: return valueInt(right != 0 && right != -1 ? left % right : 0);
+        case STR_ASSIGN:
+        case STR_EQ:      return valueInt(left == right);
+        case STR_NE:      return valueInt(left != right);
+        case STR_LT:      return valueInt(left < right);
+        case STR_LE:      return valueInt(left <= right);
+        case STR_GT:      return valueInt(left > right);
+        case STR_GE:      return valueInt(left >= right);
+        case STR_AND:     return valueInt(left && right);
+        case STR_OR:      return valueInt(left || right);
+    }
+    return valueInt(0);
+}
+
+Value valueArith(uint32_t op, Value a, Value b) {
+    if (bothInt(a, b)) return intArith(op, asInt(a), asInt(b));
+    if (isString(a) || isString(b)) return textArith(op, a, b);
+
+    double x = toDouble(a), y = toDouble(b);
+    switch (op) {
+        case STR_PLUS:    return valueDouble(x + y);
+        case STR_MINUS:   return valueDouble(x - y);
+        case STR_STAR:    return valueDouble(x * y);
+        case STR_SLASH:   return y != 0.0 ? valueDouble(x / y) : valueInt(0);
+        case STR_PERCENT: return y != 0.0 ? valueDouble(fmod(x, y)) : valueInt(0);
+        case STR_ASSIGN:
+        case STR_EQ:      return valueInt(x == y);
+        case STR_NE:      return valueInt(x != y);
+        case STR_LT:      return valueInt(x < y);
+        case STR_LE:      return valueInt(x <= y);
+        case STR_GT:      return valueInt(x > y);
+        case STR_GE:      return valueInt(x >= y);
+        case STR_AND:     return valueInt(valueTruthy(a) && valueTruthy(b));
+        case STR_OR:      return valueInt(valueTruthy(a) || valueTruthy(b));
+    }
+    return valueInt(0);
+}
+
+int valueFormat(Value v, char* buf, size_t size) {
+    if (isInt(v)) return snprintf(buf, size, "%d", asInt(v));
+    if (isString(v)) {
+        char small[TEXT_INLINE_MAX + 1];
+        return snprintf(buf, size, "%.*s", (int)textLength(v), textChars(v, small));
+    }
+
+    // The shortest of %.15g and %.17g that reads back as the same double.
+    double d = asDouble(v);
+    if (isnan(d)) return snprintf(buf, size, "nan");
+    if (isinf(d)) return snprintf(buf, size, d < 0 ? "-inf" : "inf");
+    int n = snprintf(buf, size, "%.15g", d);
+    if (strtod(buf, NULL) != d) n = snprintf(buf, size, "%.17g", d);
+    if (!strpbrk(buf, ".e") && (size_t)n + 2 < size) {
+        buf[n++] = '.';
+        buf[n++] = '0';
+        buf[n] = '\0';
+    }
+    return n;
+}
+
+static int32_t loopInt(Value v) {
+    if (isInt(v)) return asInt(v);
+    if (isString(v)) return 0;
+    double d = asDouble(v);
+    if (d != d) return 0;
+    if (d <= INT_MIN) return INT_MIN;
+    if (d >= INT_MAX) return INT_MAX;
+    return (int32_t)d;
+}
+
+int forStart(Value* loop) {
+    for (int i = 0; i < 3; i++) {
+        Value v = loop[i];
+        loop[i] = valueInt(loopInt(v));
+        valueRelease(v);
+    }
+    int32_t counter = asInt(loop[0]), end = asInt(loop[1]), step = asInt(loop[2]);
+    return step > 0 ? counter < end : step < 0 && counter > end;
+}
+
+static int64_t loopTrips(const Value* loop) {
+    int64_t counter = asInt(loop[0]), end = asInt(loop[1]), step = asInt(loop[2]);
+    if (step > 0) return counter < end ? (end - counter + step - 1) / step : 0;
+    if (step < 0) return counter > end ? (counter - end - step - 1) / -step : 0;
+    return 0;
+}
+
+int parallelChunks(const Value* loop) {
+    int64_t trips = loopTrips(loop);
+    return trips < PARALLEL_CHUNKS ? (int)trips : PARALLEL_CHUNKS;
+}
+
+void parallelChunk(const Value* loop, int k, int count, Value* chunk) {
+    int64_t trips = loopTrips(loop), step = asInt(loop[2]);
+    int64_t first = trips * k / count, next = trips * (k + 1) / count;
+    chunk[0] = valueInt((int32_t)(asInt(loop[0]) + first * step));
+    chunk[1] = k == count - 1 ? loop[1] : valueInt((int32_t)(asInt(loop[0]) + next * step));
+    chunk[2] = loop[2];
+}
+
+Value reduceStart(uint32_t op) {
+    return valueInt(op == STR_STAR);
+}
+
+uint32_t reduceCombine(uint32_t op) {
+    return op == STR_STAR ? STR_STAR : STR_PLUS;
+}
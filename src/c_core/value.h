@@ -0,0 +1,148 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+    Runtime values, NaN-boxed into one 64-bit word.  Doubles are stored
+    with 2^49 added to their bits, which moves them clear of the bottom of
+    the range (only NaNs with a payload could land there, and every NaN is
+    made canonical first).  That leaves:
+
+        0000 0000 xxxx xxxx   int: the language's 32-bit wrapping integers
+                              (the JIT and --emit-asm work on them in 32-bit
+                              registers, so the width is part of the language)
+        0001 0xxx xxxx xxxx   string object (47-bit pointer, see text.h)
+        0001 8lxx xxxx xxxx   string of up to 5 bytes, stored in the value
+        0002 ... FFFF         double, bits + 2^49
+
+    Integers have a tag of all zeroes, so zeroed memory is a frame of 0s,
+    and int op int is the machine operation on the low halves when both
+    high halves are 0.  Everything else goes through valueArith().
+
+    Objects are reference counted.  Whoever stores a value (a frame slot, a
+    VM register) owns one reference: copies valueRetain(), overwritten and
+    dropped values valueRelease().  Nothing else needs to care, ints and
+    doubles pass both tests in one compare.  Objects of kind
+    OBJECT_IMMORTAL (string literals) are not counted at all: tasks on
+    other threads load the same literals (task.h), and they live as long
+    as the interpreter anyway.  Every other object belongs to one task.
+*/
+typedef uint64_t Value;
+
+#define VALUE_DOUBLE_OFFSET (1ull << 49)
+#define VALUE_CANONICAL_NAN 0x7FF8000000000000ull
+
+static inline Value   valueInt(int32_t i)   { return (uint32_t)i; }
+static inline int     isInt(Value v)        { return (v >> 32) == 0; }
+static inline int     isDouble(Value v)     { return v >= VALUE_DOUBLE_OFFSET; }
+static inline int32_t asInt(Value v)        { return (int32_t)(uint32_t)v; }
+
+static inline int     isString(Value v)     { return (v >> 48) == 1; }
+static inline int     isObject(Value v)     { return (v >> 47) == 2; }
+
+// Both operands are ints: the fast path everywhere.
+static inline int     bothInt(Value a, Value b) { return ((a | b) >> 32) == 0; }
+
+static inline Value valueDouble(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    if (d != d) bits = VALUE_CANONICAL_NAN;
+    return bits + VALUE_DOUBLE_OFFSET;
+}
+
+static inline double asDouble(Value v) {
+    uint64_t bits = v - VALUE_DOUBLE_OFFSET;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static inline double toDouble(Value v) {
+    return isInt(v) ? (double)asInt(v) : asDouble(v);
+}
+
+// Every object starts with this header.
+typedef struct {
+    uint32_t refs;
+    uint32_t kind;
+} Object;
+
+#define OBJECT_IMMORTAL 1       // kind of an object that is never counted (TEXT_LITERAL)
+
+static inline Object* asObject(Value v) { return (Object*)(uintptr_t)(v & 0x7FFFFFFFFFFFull); }
+
+void     objectFree(Object* object);    // the last reference is gone (text.c)
+uint32_t textLength(Value v);           // of a string (text.c)
+
+static inline void valueRetain(Value v) {
+    if (isObject(v) && asObject(v)->kind != OBJECT_IMMORTAL) asObject(v)->refs++;
+}
+
+static inline void valueRelease(Value v) {
+    if (!isObject(v)) return;
+    Object* object = asObject(v);
+    if (object->kind != OBJECT_IMMORTAL && --object->refs == 0) objectFree(object);
+}
+
+// Conditions, && and ||: 0, 0.0, -0.0 and "" are false.
+static inline int valueTruthy(Value v) {
+    if (isInt(v)) return v != 0;
+    if (isString(v)) return textLength(v) != 0;
+    return asDouble(v) != 0.0;
+}
+
+/*
+    Binary operator 'op' (STR_PLUS .. STR_OR) on any two values, with the
+    same results as the int fast paths: ints wrap, x / 0 and x % 0 are 0,
+    an int meeting a double is converted, comparisons, && and || give the
+    int 0 or 1, unknown operators 0.  Strings are handled by textArith().
+    The operands are borrowed, the result is owned by the caller.
+*/
+Value valueArith(uint32_t op, Value a, Value b);
+
+// Text of a value as print shows it; doubles always show a '.' or an
+// exponent ("2.0", "0.1", "1e+100").  Strings are cut to fit.  Returns
+// the length.
+int   valueFormat(Value v, char* buf, size_t size);
+
+/*
+    A counted for loop keeps its counter, end and step in three slots in a
+    row (frame slots or VM registers).  forStart() turns the evaluated
+    start, end and step into ints in place (doubles are cut toward 0 and
+    to the int range, strings are 0); forNext() moves the counter on.
+    Both return whether the body runs (again): the counter goes from the
+    start towards the end, which it never reaches, and a step of 0 runs
+    nothing.  The sum is taken in 64 bits, so an end near the int range's
+    limits does not wrap around into an endless loop.
+*/
+int   forStart(Value* loop);
+
+static inline int forNext(Value* loop) {
+    int32_t step = asInt(loop[2]);
+    int64_t next = (int64_t)asInt(loop[0]) + step;
+    if (step > 0 ? next >= asInt(loop[1]) : next <= asInt(loop[1])) return 0;
+    loop[0] = valueInt((int32_t)next);
+    return 1;
+}
+
+/*
+    A parallel for (after forStart()) is cut into parallelChunks() pieces
+    of as near the same number of trips as can be, at most PARALLEL_CHUNKS
+    whatever the number of workers, so a run splits the same way on any
+    machine.  parallelChunk() gives piece k of 'count' as a loop of its own:
+    its counter, end and step, ready for forNext().
+*/
+#define PARALLEL_CHUNKS 64
+
+int   parallelChunks(const Value* loop);
+void  parallelChunk(const Value* loop, int k, int count, Value* chunk);
+
+// A reduction (ast.h) starts every chunk from reduceStart(op), and the
+// chunks' results are folded into the variable with reduceCombine(op):
+// x -= e sums the e's of a chunk below 0 and adds that.  Meant for numbers.
+Value    reduceStart(uint32_t op);
+uint32_t reduceCombine(uint32_t op);
+
+#endif // VALUE_H
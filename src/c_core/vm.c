@@ -0,0 +1,558 @@
+// vm.c
+#include "vm.h"
+#include "token.h"
+#include "jit.h"
+#include "io.h"
+#include "profile.h"
+#include "text.h"
+#include "task.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Register VM dispatch loop.  With GCC/Clang we thread the code through a
+    table of label addresses (computed goto) so every handler ends in its own
+    indirect branch; other compilers get a plain switch.
+*/
+
+#if defined(__GNUC__)
+#define USE_COMPUTED_GOTO 1
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+
+/*
+    With the JIT on, every backward jump (the end of a while loop) counts how
+    often it was taken; the loop it closes is compiled on the JIT_THRESHOLD-th
+    time and from then on runs natively until it exits.  Counts and code are
+    kept with the chunk, so a function's loops are compiled once, not once
+    per call.
+*/
+static JitCode* hotLoop(Chunk* chunk, int at, int target, int statement) {
+    if (!chunk->hits) {
+        chunk->hits  = (uint32_t*)calloc(chunk->count, sizeof(uint32_t));
+        chunk->loops = (JitCode**)calloc(chunk->count, sizeof(JitCode*));
+    }
+    if (chunk->loops[at]) return chunk->loops[at];
+    if (chunk->hits[at] == UINT32_MAX || ++chunk->hits[at] < JIT_THRESHOLD) return NULL;
+
+    chunk->loops[at] = jitCompileLoop(chunk, target, at, statement);
+    if (!chunk->loops[at]) chunk->hits[at] = UINT32_MAX;
+    return chunk->loops[at];
+}
+
+/*
+    All frames live on one stack of registers.  A call moves the register
+    window up to where the caller put the arguments, so they are the
+    callee's first registers without a copy, and pushes a return record;
+    a call costs a few stores, and recursion is only bounded by memory.
+    Every register up to the high-water mark owns its value (a dead frame's
+    values are released when the registers are reused or the statement
+    ends), so the stack needs no clearing when a function returns.
+
+    The main program's stacks are kept from statement to statement; every
+    spawned task has stacks of its own (task.h).
+*/
+typedef struct CallFrame {
+    Chunk*       chunk;
+    const Instr* pc;
+    size_t       base;
+} CallFrame;
+
+struct VmState {
+    Task main;
+    int  statement;             // statements run so far, for --jit-stats
+};
+
+VmState* vm_new(void) {
+    return (VmState*)calloc(1, sizeof(VmState));
+}
+
+static void freeStacks(Task* task) {
+    for (size_t i = 0; i < task->stackSize; i++) valueRelease(task->stack[i]);
+    free(task->stack);
+    free(task->calls);
+}
+
+void vm_free(VmState* vm) {
+    if (!vm) return;
+    freeStacks(&vm->main);
+    free(vm);
+}
+
+void vm_task_free(Task* task) {
+    freeStacks(task);
+    free(task);
+}
+
+// Room for registers 0 .. size-1; the stack may move.
+static void reserveStack(Task* task, size_t size) {
+    if (size <= task->stackSize) return;
+    size_t grown = task->stackSize ? task->stackSize : 1024;
+    while (grown < size) grown *= 2;
+    Value* stack = (Value*)realloc(task->stack, sizeof(Value) * grown);
+    if (!stack) {
+        ioFlush();
+        fprintf(ioErr(), "[FATAL] Out of memory for the call stack (%zu frames deep)\n", size);
+        exit(1);
+    }
+    memset(stack + task->stackSize, 0, sizeof(Value) * (grown - task->stackSize));
+    task->stack = stack;
+    task->stackSize = grown;
+}
+
+static void pushCall(Task* task, size_t depth, Chunk* chunk, const Instr* pc, size_t base) {
+    if (depth == task->callCapacity) {
+        task->callCapacity = task->callCapacity ? task->callCapacity * 2 : 256;
+        task->calls = (CallFrame*)realloc(task->calls, sizeof(CallFrame) * task->callCapacity);
+        if (!task->calls) {
+            ioFlush();
+            fprintf(ioErr(), "[FATAL] Out of memory for the call stack (%zu calls deep)\n", depth);
+            exit(1);
+        }
+    }
+    task->calls[depth].chunk = chunk;
+    task->calls[depth].pc    = pc;
+    task->calls[depth].base  = base;
+}
+
+/*
+    spawn f(args): a task whose first frame is the call, with copies of
+    the arguments (text.h) so the caller's strings stay its own.  Its
+    stack starts small, as most tasks are; it grows like any other.
+*/
+static Task* newTask(Chunk* callee, Function* functions, const Value* args, int nargs) {
+    Task* task = (Task*)calloc(1, sizeof(Task));
+    task->stackSize = callee->nregs > 64 ? (size_t)callee->nregs : 64;
+    task->stack     = (Value*)calloc(task->stackSize, sizeof(Value));
+    int first = nargs < callee->params ? nargs : callee->params;
+    for (int i = 0; i < first; i++) task->stack[i] = textCopy(args[i]);
+    task->functions = functions;
+    task->chunk     = callee;
+    task->pc        = callee->code;
+    task->high      = callee->nregs;
+    task->result    = -1;
+    return task;
+}
+
+/*
+    Arithmetic and comparisons: when both operands are ints (high halves
+    0), the 32-bit result zero-extended is already the boxed int.  Anything
+    else, doubles included, goes through valueArith().  The operator ids
+    line up with OP_ADD .. OP_GE.
+*/
+static const uint32_t ARITH_OPERATOR[] = {
+    STR_PLUS, STR_MINUS, STR_STAR, STR_SLASH, STR_PERCENT,
+    STR_EQ, STR_NE, STR_LT, STR_LE, STR_GT, STR_GE
+};
+
+#define ARITH(op, expr)                                                            \
+    do {                                                                           \
+        Value x_ = R[in->b], y_ = R[in->c];                                        \
+        if (bothInt(x_, y_)) {                                                     \
+            int32_t x = asInt(x_), y = asInt(y_);                                  \
+            SET(in->a, valueInt(expr));                                            \
+        } else {                                                                   \
+            SET(in->a, valueArith(ARITH_OPERATOR[(op) - OP_ADD], x_, y_));         \
+        }                                                                          \
+    } while (0)
+
+// Registers own their values (value.h): a write releases what it replaces.
+#define SET(r, value)                                                              \
+    do {                                                                           \
+        Value old_ = R[r];                                                         \
+        R[r] = (value);                                                            \
+        valueRelease(old_);                                                        \
+    } while (0)
+
+/*
+    A callee's variables start at 0, except the parameters it was passed;
+    arguments beyond its parameters are dropped with the rest.
+*/
+#define ENTER_FRAME(callee, nargs)                                                 \
+    do {                                                                           \
+        int first_ = (nargs) < (callee)->params ? (nargs) : (callee)->params;      \
+        for (int i_ = first_; i_ < (callee)->frame; i_++) SET(i_, valueInt(0));     \
+        size_t top_ = base + (callee)->nregs;                                      \
+        if (top_ > task->high) task->high = top_;                                  \
+        chunk = (callee);                                                          \
+        pc = chunk->code;                                                          \
+    } while (0)
+
+/*
+    While tasks run, output, input and warnings go through the interpreter's
+    IO under its lock (io.h); a program that never spawns does not pay for it.
+*/
+#define IO(call)                                                                   \
+    do {                                                                           \
+        if (shared) ioLock();                                                      \
+        call;                                                                      \
+        if (shared) ioUnlock();                                                    \
+    } while (0)
+
+/*
+    Where a task stops to wait, so that whichever thread wakes it can go on.
+    Out of line: stored in the loop, the frame's fields get packed into
+    vector registers that every dispatch then has to shuffle.
+*/
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void saveTask(Task* task, Chunk* chunk, const Instr* pc, size_t base, size_t depth, int result) {
+    task->chunk  = chunk;
+    task->pc     = pc;
+    task->base   = base;
+    task->depth  = depth;
+    task->result = result;
+}
+
+#define SAVE(reg) saveTask(task, chunk, pc, base, depth, (reg))
+
+/*
+    A cancelled run (interpreter.h) stops at its next backward jump or call
+    as if it had reached OP_HALT: the main program's statement ends, and a
+    task is done.  Whatever its frames held is released with its stacks.
+    A for loop's jump back only looks at the flag when its counter moves
+    into another block of 2^16: its body has no jumps back or calls of its
+    own, or they would look, so that is still soon enough, and a counted
+    loop of a few instructions does not pay a load on every trip.
+*/
+#define CANCELLED() interpreterCancelled()
+
+static inline int forLooks(const Value* loop) {
+    uint32_t counter = (uint32_t)asInt(loop[0]);
+    return ((counter ^ (counter - (uint32_t)asInt(loop[2]))) >> 16) != 0;
+}
+
+/*
+    How execute() runs a task.  The main program (RUN_MAIN) runs one
+    statement, until OP_HALT, and blocks its thread when a channel makes it
+    wait; a spawned task or a chunk of a parallel for on a worker
+    (RUN_TASK) runs until its first frame returns or its chunk is done (1)
+    or it is parked on a channel (0), and must not be touched after that
+    by this thread, as a send or recv on another one may already have woken
+    it.  A chunk a task runs itself (RUN_INLINE) blocks its thread instead.
+*/
+enum { RUN_MAIN, RUN_TASK, RUN_INLINE };
+
+static int execute(Task* task, int jit, int mode);
+
+/*
+    parallel for: the chunks (value.h) each get a task with a copy of the
+    frame, their part of the range and every reduced variable at its
+    starting value, and start right after OP_PARFOR.  The main program
+    hands them to the workers and waits; a task, already on one, runs them
+    in turn.  Then their prints are written out in chunk order, unless the
+    loop is unordered, and the reductions folded into the frame in the
+    same order, so the result does not depend on which chunk ran where.
+*/
+static void parallelFor(Task* task, Chunk* chunk, const Instr* in, Value* R, int mode, int shared) {
+    const ParallelLoop* loop = &chunk->parallels[in->b];
+    int count = parallelChunks(R + in->a);
+    Task** tasks = (Task**)malloc(sizeof(Task*) * count);
+    IoCapture* captures = loop->unordered ? NULL : (IoCapture*)calloc(count, sizeof(IoCapture));
+    for (int k = 0; k < count; k++) {
+        Task* t = (Task*)calloc(1, sizeof(Task));
+        t->stackSize = chunk->nregs > 64 ? (size_t)chunk->nregs : 64;
+        t->stack     = (Value*)calloc(t->stackSize, sizeof(Value));
+        for (int i = 0; i < chunk->nregs; i++) t->stack[i] = textCopy(R[i]);
+        parallelChunk(R + in->a, k, count, t->stack + in->a);
+        for (int r = 0; r < loop->reductionCount; r++) {
+            Value* slot = &t->stack[loop->reductions[r].slot];
+            valueRelease(*slot);
+            *slot = reduceStart(loop->reductions[r].op);
+        }
+        t->functions = task->functions;
+        t->chunk     = chunk;
+        t->pc        = in + 1;
+        t->high      = chunk->nregs;
+        t->result    = -1;
+        t->output    = captures ? &captures[k] : NULL;
+        tasks[k] = t;
+    }
+
+    if (mode == RUN_MAIN) {
+        taskRunAll(tasks, count);
+    } else {
+        for (int k = 0; k < count; k++) {
+            IoCapture* outer = tasks[k]->output ? ioCapture(tasks[k]->output) : NULL;
+            execute(tasks[k], 0, RUN_INLINE);
+            if (tasks[k]->output) ioCapture(outer);
+        }
+    }
+
+    if (captures) {
+        IO(for (int k = 0; k < count; k++) ioCaptureWrite(&captures[k]));
+        free(captures);
+    }
+    for (int r = 0; r < loop->reductionCount; r++) {
+        int reg = loop->reductions[r].slot;
+        uint32_t op = reduceCombine(loop->reductions[r].op);
+        for (int k = 0; k < count; k++) {
+            Value sum = valueArith(op, R[reg], tasks[k]->stack[reg]);
+            SET(reg, sum);
+        }
+    }
+    for (int k = 0; k < count; k++) vm_task_free(tasks[k]);
+    free(tasks);
+}
+
+/*
+    Runs 'task' from where it stopped, as 'mode' says.
+*/
+static int execute(Task* task, int jit, int mode) {
+    Chunk* chunk = task->chunk;
+    const Instr* pc = task->pc;
+    size_t base = task->base, depth = task->depth;
+    Value* R = task->stack + base;
+    const Instr* in;
+    int result;     // register returned from by OP_RET or a failed OP_TAILCALL
+    int shared = mode != RUN_MAIN || tasksLive();
+    if (shared) jit = 0;
+    if (task->result >= 0) {
+        SET(task->result, task->wait.value);
+        task->result = -1;
+    }
+
+#if USE_COMPUTED_GOTO
+    static void* dispatchTable[OP_COUNT] = {
+        &&op_HALT, &&op_LOADI, &&op_LOADK, &&op_MOV, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV, &&op_MOD,
+        &&op_EQ, &&op_NE, &&op_LT, &&op_LE, &&op_GT, &&op_GE, &&op_TEST,
+        &&op_JMP, &&op_JMPF, &&op_JMPT, &&op_PRINT, &&op_PRINTS,
+        &&op_INPUT, &&op_PROMPT, &&op_PROMPTS, &&op_ENTER, &&op_LEAVE,
+        &&op_CALL, &&op_TAILCALL, &&op_RET, &&op_SPAWN, &&op_CHAN, &&op_SEND, &&op_RECV,
+        &&op_FORPREP, &&op_FORLOOP, &&op_PARFOR, &&op_PARNEXT
+    };
+#define CASE(name) op_##name:
+#define DISPATCH() do { in = pc++; goto *dispatchTable[in->op]; } while (0)
+    DISPATCH();
+#else
+#define CASE(name) case OP_##name:
+#define DISPATCH() break
+    for (;;) {
+        in = pc++;
+        switch (in->op) {
+#endif
+
+    CASE(LOADI)  SET(in->a, valueInt(in->sx)); DISPATCH();
+    CASE(LOADK)  valueRetain(chunk->constants[in->sx]); SET(in->a, chunk->constants[in->sx]); DISPATCH();
+    CASE(MOV)    valueRetain(R[in->b]); SET(in->a, R[in->b]); DISPATCH();
+    CASE(ADD)    ARITH(OP_ADD, (int32_t)((uint32_t)x + (uint32_t)y)); DISPATCH();
+    CASE(SUB)    ARITH(OP_SUB, (int32_t)((uint32_t)x - (uint32_t)y)); DISPATCH();
+    CASE(MUL)    ARITH(OP_MUL, (int32_t)((uint32_t)x * (uint32_t)y)); DISPATCH();
+    CASE(DIV)    ARITH(OP_DIV, y == 0 ? 0 : y == -1 ? (int32_t)(0u - (uint32_t)x) : x / y); DISPATCH();
+    CASE(MOD)    ARITH(OP_MOD, y != 0 && y != -1 ? x % y : 0); DISPATCH();
+    CASE(EQ)     ARITH(OP_EQ, x == y); DISPATCH();
+    CASE(NE)     ARITH(OP_NE, x != y); DISPATCH();
+    CASE(LT)     ARITH(OP_LT, x < y); DISPATCH();
+    CASE(LE)     ARITH(OP_LE, x <= y); DISPATCH();
+    CASE(GT)     ARITH(OP_GT, x > y); DISPATCH();
+    CASE(GE)     ARITH(OP_GE, x >= y); DISPATCH();
+    CASE(TEST)   SET(in->a, valueInt(valueTruthy(R[in->b]))); DISPATCH();
+    CASE(JMP)
+        if (in->sx < 0) {
+            if (CANCELLED()) goto done;
+            if (jit) {
+                int at = (int)(in - chunk->code);
+                JitCode* loop = hotLoop(chunk, at, at + 1 + in->sx, INTERPRETER->vm->statement);
+                if (loop) {
+                    pc = chunk->code + jitRun(loop, R);
+                    DISPATCH();
+                }
+            }
+        }
+        pc += in->sx; DISPATCH();
+    CASE(JMPF)   if (!valueTruthy(R[in->a])) pc += in->sx; DISPATCH();
+    CASE(JMPT)   if (valueTruthy(R[in->a])) pc += in->sx; DISPATCH();
+    CASE(PRINT)  IO(ioPrintValue(R[in->a])); DISPATCH();
+    CASE(PRINTS) IO(ioPrintString(stringOf(in->sx), stringLength(in->sx))); DISPATCH();
+    CASE(INPUT) {
+        int number;
+        IO(number = ioReadInt());
+        SET(in->a, valueInt(number));
+        DISPATCH();
+    }
+    CASE(PROMPT) IO(ioWriteValue(R[in->a])); DISPATCH();
+    CASE(PROMPTS) IO(ioWrite(stringOf(in->sx), stringLength(in->sx))); DISPATCH();
+    CASE(ENTER)  if (mode == RUN_MAIN) profileEnter((uint32_t)in->sx); DISPATCH();
+    CASE(LEAVE)  if (mode == RUN_MAIN) profileLeave(); DISPATCH();
+    CASE(CALL) {
+        if (CANCELLED()) goto done;
+        Chunk* callee = task->functions[in->b].chunk;
+        if (!callee) {
+            IO(functionUndefined(&task->functions[in->b]));
+            SET(in->a, valueInt(0));
+            DISPATCH();
+        }
+        pushCall(task, depth++, chunk, pc, base);
+        base += in->a;
+        reserveStack(task, base + callee->nregs);
+        R = task->stack + base;
+        ENTER_FRAME(callee, in->c);
+        DISPATCH();
+    }
+    CASE(TAILCALL) {
+        if (CANCELLED()) goto done;
+        Chunk* callee = task->functions[in->b].chunk;
+        if (!callee) {
+            IO(functionUndefined(&task->functions[in->b]));
+            SET(in->a, valueInt(0));
+            result = in->a;
+            goto ret;
+        }
+        // The arguments move down over this frame's parameters.
+        for (int i = 0; i < in->c && in->a != 0; i++) {
+            Value arg = R[in->a + i];
+            R[in->a + i] = 0;
+            SET(i, arg);
+        }
+        reserveStack(task, base + callee->nregs);
+        R = task->stack + base;
+        ENTER_FRAME(callee, in->c);
+        DISPATCH();
+    }
+    CASE(RET)
+        result = in->a;
+    ret: {
+        // A task's first frame returning is the task done; nobody takes the result.
+        if (depth == 0) return 1;
+        // The result goes to the frame's first register: the caller's R[a] of OP_CALL.
+        if (result != 0) {
+            Value value = R[result];
+            R[result] = 0;
+            SET(0, value);
+        }
+        CallFrame* frame = &task->calls[--depth];
+        chunk = frame->chunk;
+        pc    = frame->pc;
+        base  = frame->base;
+        R     = task->stack + base;
+        DISPATCH();
+    }
+    CASE(SPAWN) {
+        Chunk* callee = task->functions[in->b].chunk;
+        if (!callee) {
+            IO(functionUndefined(&task->functions[in->b]));
+            DISPATCH();
+        }
+        taskSpawn(newTask(callee, task->functions, R + in->a, in->c));
+        // From here on other threads run code too.
+        shared = 1;
+        jit    = 0;
+        DISPATCH();
+    }
+    CASE(CHAN) {
+        Value handle = channelNew(R[in->b]);
+        SET(in->a, handle);
+        DISPATCH();
+    }
+    CASE(SEND) {
+        Channel* channel = channelFind(R[in->a]);
+        if (!channel) DISPATCH();
+        if (mode != RUN_TASK) taskThreadWaiter(&task->wait);
+        else SAVE(-1);
+        if (!channelSend(channel, textCopy(R[in->b]), &task->wait)) {
+            if (mode == RUN_TASK) return 0;
+            taskWaitThread(&task->wait);
+        }
+        DISPATCH();
+    }
+    CASE(RECV) {
+        Channel* channel = channelFind(R[in->b]);
+        Value value = valueInt(0);
+        if (channel) {
+            if (mode != RUN_TASK) taskThreadWaiter(&task->wait);
+            else SAVE(in->a);
+            if (!channelRecv(channel, &value, &task->wait)) {
+                if (mode == RUN_TASK) return 0;
+                if (taskWaitThread(&task->wait)) value = task->wait.value;
+            }
+        }
+        SET(in->a, value);
+        DISPATCH();
+    }
+    CASE(FORPREP) if (!forStart(R + in->a)) pc += in->sx; DISPATCH();
+    CASE(FORLOOP)
+        if (forNext(R + in->a)) {
+            if (forLooks(R + in->a) && CANCELLED()) goto done;
+            if (jit) {
+                int at = (int)(in - chunk->code);
+                JitCode* loop = hotLoop(chunk, at, at + 1 + in->sx, INTERPRETER->vm->statement);
+                if (loop) {
+                    pc = chunk->code + jitRun(loop, R);
+                    DISPATCH();
+                }
+            }
+            pc += in->sx;
+        }
+        DISPATCH();
+    CASE(PARFOR)
+        if (forStart(R + in->a)) parallelFor(task, chunk, in, R, mode, shared);
+        pc = chunk->code + chunk->parallels[in->b].next;
+        // A chunk may have spawned.
+        if (tasksLive()) {
+            shared = 1;
+            jit    = 0;
+        }
+        DISPATCH();
+    CASE(PARNEXT)
+        if (forNext(R + in->a) && !(forLooks(R + in->a) && CANCELLED())) {
+            pc += in->sx;
+            DISPATCH();
+        }
+        goto done;
+    CASE(HALT)   goto done;
+
+#if !USE_COMPUTED_GOTO
+        default: goto done;
+        }
+    }
+#endif
+
+done:
+    return 1;
+#undef CASE
+#undef DISPATCH
+}
+
+int vm_resume(Task* task) {
+    IoCapture* outer = ioCapture(task->output);
+    int done = execute(task, 0, RUN_TASK);
+    ioCapture(outer);
+    return done;
+}
+
+void vm_run(Chunk* chunk, Value* globals, int nglobals, Function* functions, int jit) {
+    VmState* vm = INTERPRETER->vm;
+    Task* task = &vm->main;
+    reserveStack(task, chunk->nregs);
+    if (nglobals) memcpy(task->stack, globals, sizeof(Value) * nglobals);
+    task->functions = functions;
+    task->chunk     = chunk;
+    task->pc        = chunk->code;
+    task->base      = 0;
+    task->depth     = 0;
+    task->high      = chunk->nregs;
+    task->result    = -1;
+    vm->statement++;
+
+    execute(task, jit, RUN_MAIN);
+
+    // The globals' references go back with them; temporaries and dead frames are dropped.
+    if (nglobals) {
+        memcpy(globals, task->stack, sizeof(Value) * nglobals);
+        memset(task->stack, 0, sizeof(Value) * nglobals);
+    }
+    for (size_t i = nglobals; i < task->high; i++) {
+        valueRelease(task->stack[i]);
+        task->stack[i] = 0;
+    }
+}
+#undef ARITH
+#undef SET
+#undef ENTER_FRAME
+#undef IO
+#undef SAVE
+#undef CANCELLED
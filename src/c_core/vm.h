@@ -0,0 +1,25 @@
+#ifndef VM_H
+#define VM_H
+
+#include "compiler.h"
+#include "interpreter.h"
+#include "task.h"
+
+/*
+    Run a compiled chunk to completion.  The top-level frame occupies the
+    first 'nglobals' registers and is copied back to 'globals' when the
+    chunk halts.  Calls look their chunk up in 'functions' by index.  With
+    'jit' set, hot loops are compiled to native code (see jit.h).
+*/
+void vm_run(Chunk* chunk, Value* globals, int nglobals, Function* functions, int jit);
+
+// Runs a spawned task until it is done (1) or waits on a channel (0; see
+// task.h).  A task that is done is the caller's to free.
+int  vm_resume(Task* task);
+void vm_task_free(Task* task);
+
+// An interpreter's register and call stacks (interpreter.h).
+VmState* vm_new(void);
+void     vm_free(VmState* vm);
+
+#endif // VM_H